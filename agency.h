@@ -46,6 +46,10 @@ const gtfs_file_spec_t agency_file_spec = {
     &(gtfs_field_spec_t) {"agency_fare_url", TYPE_STRING, 255, false }
   },
 
+  /* The fields identifying each object: its agency ID */
+  1,
+  (unsigned int [1]) { 0 },
+
   /* SQL statements */
 
   /* Create the corresponding table in the database */
@@ -66,6 +70,10 @@ const gtfs_file_spec_t agency_file_spec = {
   (const char *[]) {
     NULL
   },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  false,
 };
 
 #endif
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+# Builds gtfs2db and its benchmark tools, checks its CSV tokenizers
+# against libcsv, generates synthetic GTFS bundles of increasing size
+# and benchmarks gtfs2db on each, printing the results one phase per
+# line as JSON objects. Name the sizes to run ("small", "medium" and
+# "large") as arguments; all three are run by default. Arguments to
+# pass to gtfs2db may be given in GTFS2DB_ARGS.
+#
+# Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+#
+# This file is part of gtfs2db.
+#
+# gtfs2db is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# gtfs2db is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+set -e
+
+./build.sh
+gcc -std=c99 -O2 gen_gtfs.c `pkg-config --cflags --libs glib-2.0` -lzip -o gen_gtfs
+gcc -std=c99 -O2 bench_gtfs2db.c gtfs_bundle.c gtfs_csv.c `pkg-config --cflags --libs glib-2.0` -lcsv -lzip -lz -o bench_gtfs2db
+gcc -std=c99 -O2 check_gtfs_csv.c gtfs_csv.c `pkg-config --cflags --libs glib-2.0` -lcsv -o check_gtfs_csv
+
+# Timings of a tokenizer that parses differently from libcsv mean
+# nothing, so stop here if any does
+./check_gtfs_csv >&2
+
+if [ $# -eq 0 ]; then
+    set -- small medium large
+fi
+
+for size in "$@"; do
+    case $size in
+        small)  feed_args="--routes 50 --trips-per-route 20 --stops-per-trip 20 --stops 500" ;;
+        medium) feed_args="--routes 200 --trips-per-route 50 --stops-per-trip 30 --stops 2000" ;;
+        large)  feed_args="--routes 500 --trips-per-route 100 --stops-per-trip 40 --stops 10000" ;;
+        *)      echo "Unknown size \"$size\"" >&2; exit 1 ;;
+    esac
+
+    ./gen_gtfs $feed_args bench-$size.zip > /dev/null
+    ./bench_gtfs2db --label $size --loader-args "$GTFS2DB_ARGS" \
+        --database bench-$size.sqlite bench-$size.zip
+done
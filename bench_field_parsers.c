@@ -0,0 +1,217 @@
+/* A micro-benchmark comparing the throughput of the field-value
+   parsers in field_parsers.h with the library functions gtfs2db used
+   previously. Build with
+
+     gcc -std=c99 -O2 bench_field_parsers.c `pkg-config --cflags --libs glib-2.0` -o bench_field_parsers
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Include the definition of "strptime" and "strtok_r" */
+#define _XOPEN_SOURCE 500
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "field_parsers.h"
+
+#define NUM_VALUES 4096
+#define VALUE_SIZE 32
+#define ITERATIONS 500
+
+/* The sample values for each type, each followed by a NUL character as
+   the CSV parser provides them */
+static char values[NUM_VALUES][VALUE_SIZE];
+static size_t value_lengths[NUM_VALUES];
+
+/* Accumulates parsed values so the compiler cannot discard them */
+static volatile double sink;
+
+typedef void (*parse_function_t)(void);
+
+/* Fills the sample values with random values of the given type: 't'
+   for times, 'd' for dates, 'i' for integers or 'f' for doubles */
+static void generate_values(char type) {
+  for(unsigned int index = 0; index < NUM_VALUES; index++) {
+    switch(type) {
+    case 't':
+      snprintf(values[index], VALUE_SIZE, "%d:%02d:%02d",
+               g_random_int_range(4, 28),
+               g_random_int_range(0, 60),
+               g_random_int_range(0, 60));
+      break;
+
+    case 'd':
+      snprintf(values[index], VALUE_SIZE, "%04d%02d%02d",
+               g_random_int_range(2010, 2030),
+               g_random_int_range(1, 13),
+               g_random_int_range(1, 29));
+      break;
+
+    case 'i':
+      snprintf(values[index], VALUE_SIZE, "%d",
+               g_random_int_range(0, 100000));
+      break;
+
+    case 'f':
+      snprintf(values[index], VALUE_SIZE, "%.6f",
+               g_random_double_range(-180.0, 180.0));
+      break;
+    }
+
+    value_lengths[index] = strlen(values[index]);
+  }
+}
+
+/* Parsers using the library functions gtfs2db used previously */
+static void parse_times_legacy(void) {
+  char buffer[VALUE_SIZE];
+
+  for(unsigned int index = 0; index < NUM_VALUES; index++) {
+    char *hours, *minutes, *seconds, *saveptr;
+
+    /* strtok_r modifies its input, so work on a copy */
+    memcpy(buffer, values[index], value_lengths[index] + 1);
+    hours = strtok_r(buffer, ":", &saveptr);
+    minutes = strtok_r(NULL, ":", &saveptr);
+    seconds = strtok_r(NULL, ":", &saveptr);
+    sink += atoi(hours) * 3600 + atoi(minutes) * 60 + atoi(seconds);
+  }
+}
+
+static void parse_dates_legacy(void) {
+  char iso8601_date_str[24];
+  struct tm date_value;
+
+  for(unsigned int index = 0; index < NUM_VALUES; index++) {
+    strptime(values[index], "%Y%m%d", &date_value);
+    sink += strftime(iso8601_date_str,
+                     sizeof(iso8601_date_str),
+                     "%F",
+                     &date_value);
+  }
+}
+
+static void parse_integers_legacy(void) {
+  for(unsigned int index = 0; index < NUM_VALUES; index++) {
+    sink += atoi(values[index]);
+  }
+}
+
+static void parse_doubles_legacy(void) {
+  for(unsigned int index = 0; index < NUM_VALUES; index++) {
+    sink += atof(values[index]);
+  }
+}
+
+/* Parsers using the functions in field_parsers.h */
+static void parse_times(void) {
+  int time_value;
+
+  for(unsigned int index = 0; index < NUM_VALUES; index++) {
+    if(parse_time(values[index], value_lengths[index], &time_value)) {
+      sink += time_value;
+    }
+  }
+}
+
+static void parse_dates(void) {
+  char date_value[11];
+
+  for(unsigned int index = 0; index < NUM_VALUES; index++) {
+    if(parse_date(values[index], value_lengths[index], date_value)) {
+      sink += date_value[9];
+    }
+  }
+}
+
+static void parse_integers(void) {
+  int integer_value;
+
+  for(unsigned int index = 0; index < NUM_VALUES; index++) {
+    if(parse_integer(values[index], value_lengths[index], &integer_value)) {
+      sink += integer_value;
+    }
+  }
+}
+
+static void parse_doubles(void) {
+  double double_value;
+
+  for(unsigned int index = 0; index < NUM_VALUES; index++) {
+    if(parse_double(values[index], value_lengths[index], &double_value)) {
+      sink += double_value;
+    }
+  }
+}
+
+/* Runs "parse_function" repeatedly over the sample values and returns
+   its throughput in values per second */
+static double measure_throughput(parse_function_t parse_function) {
+  GTimer *timer;
+  double elapsed;
+
+  /* Warm the caches first */
+  parse_function();
+
+  timer = g_timer_new();
+  for(unsigned int iteration = 0; iteration < ITERATIONS; iteration++) {
+    parse_function();
+  }
+  elapsed = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
+
+  return (double)NUM_VALUES * ITERATIONS / elapsed;
+}
+
+int main(void) {
+  static const struct {
+    char type;
+    const char *name;
+    parse_function_t legacy_function;
+    parse_function_t function;
+  } benchmarks[] = {
+    { 't', "time",    parse_times_legacy,    parse_times },
+    { 'd', "date",    parse_dates_legacy,    parse_dates },
+    { 'i', "integer", parse_integers_legacy, parse_integers },
+    { 'f', "double",  parse_doubles_legacy,  parse_doubles }
+  };
+
+  printf("%-8s %16s %16s %8s\n",
+         "Type", "Legacy (val/s)", "Parser (val/s)", "Speedup");
+
+  for(unsigned int index = 0;
+      index < sizeof(benchmarks) / sizeof(benchmarks[0]);
+      index++) {
+    double legacy_throughput, throughput;
+
+    generate_values(benchmarks[index].type);
+    legacy_throughput = measure_throughput(benchmarks[index].legacy_function);
+    throughput = measure_throughput(benchmarks[index].function);
+
+    printf("%-8s %16.0f %16.0f %7.1fx\n",
+           benchmarks[index].name,
+           legacy_throughput,
+           throughput,
+           throughput / legacy_throughput);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,606 @@
+/* A benchmark that measures gtfs2db's throughput, phase by phase, on
+   a GTFS bundle such as one made by gen_gtfs. Each file in the bundle
+   is inflated, tokenized and converted in turn here, timing each
+   phase separately, before gtfs2db itself is run on the bundle.
+   Inflation is timed both through gtfs_bundle.c, as gtfs2db reads
+   the bundle, and through libzip in small buffers, as it used to;
+   tokenization is timed with libcsv and with each tokenizer in
+   gtfs_csv.c the processor supports. The time it spent inserting each
+   file's records and creating each index is then read from the
+   statistics it writes with "--stats-json".
+
+   Results are printed one phase per line, each as a JSON object, for
+   collection by scripts. Build with
+
+     gcc -std=c99 -O2 bench_gtfs2db.c gtfs_bundle.c gtfs_csv.c `pkg-config --cflags --libs glib-2.0` -lcsv -lzip -lz -o bench_gtfs2db
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <assert.h>
+#include <csv.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <zip.h>
+
+#include "field_parsers.h"
+#include "gtfs_bundle.h"
+#include "gtfs_csv.h"
+#include "gtfs_file.h"
+
+#include "agency.h"
+#include "calendar.h"
+#include "calendar_dates.h"
+#include "routes.h"
+#include "shapes.h"
+#include "stops.h"
+#include "stop_times.h"
+#include "trips.h"
+
+#define MAX_COLUMNS 32
+
+/* The size, in bytes, of the buffer gtfs2db used to read each file
+   through libzip before reading bundles through gtfs_bundle.c */
+#define LIBZIP_BUFFER_SIZE 20 * 1024
+
+/* The files measured, in the order gtfs2db loads them */
+static const gtfs_file_spec_t *gtfs_file_specs[] = {
+  &agency_file_spec,
+  &calendar_file_spec,
+  &calendar_dates_file_spec,
+  &routes_file_spec,
+  &stops_file_spec,
+  &shapes_file_spec,
+  &trips_file_spec,
+  &stop_times_file_spec,
+  NULL
+};
+
+/* The measurements taken for a single file */
+typedef struct {
+  const gtfs_file_spec_t *gtfs_file_spec;
+  bool present;
+
+  /* The file's contents once inflated, and the number of records it
+     contains */
+  char *data;
+  size_t size;
+  unsigned long records;
+
+  /* The time taken by each phase, in seconds */
+  double inflate_time;
+  double libzip_inflate_time;
+  double tokenize_time;
+  double tokenizer_times[GTFS_CSV_AVX2 + 1];
+  double convert_time;
+  double insert_time;
+} bench_file_t;
+
+/* The state of the CSV parser's callbacks as a file is converted */
+typedef struct {
+  const gtfs_file_spec_t *gtfs_file_spec;
+  bool header_parsed;
+  unsigned int fields_parsed;
+  unsigned long records;
+  int field_for_column[MAX_COLUMNS];
+  gtfs_field_value_t record_values[MAX_COLUMNS];
+  char strings[MAX_COLUMNS][1024 + 1];
+} bench_convert_state_t;
+
+static gchar *loader_path = "./gtfs2db";
+static gchar *db_path = "bench.sqlite";
+static gchar *label = "";
+static gchar *loader_args = "";
+static gint buffer_size = DEFAULT_READ_BUFFER_SIZE / 1024;
+
+/* Accumulates converted values so the compiler cannot discard them */
+static volatile double sink;
+
+/* Prints the result of one phase as a JSON object */
+static void print_phase(const char *phase,
+                        const char *name,
+                        unsigned long records,
+                        size_t bytes,
+                        double seconds) {
+  printf("{\"label\": \"%s\", \"phase\": \"%s\", \"name\": \"%s\", "
+         "\"records\": %lu, \"bytes\": %lu, \"seconds\": %.6f",
+         label,
+         phase,
+         name,
+         records,
+         (unsigned long)bytes,
+         seconds);
+  if(seconds > 0 && records > 0) {
+    printf(", \"records_per_second\": %.0f, \"bytes_per_second\": %.0f",
+           records / seconds,
+           bytes / seconds);
+  }
+  puts("}");
+}
+
+/* Reads a file from the bundle into memory for the phases that
+   follow, then times reading it again as gtfs2db does, parsing it in
+   place where it is mapped into memory (so both this and the libzip
+   path that follows read a bundle already in the page cache) */
+static bool inflate_file(gtfs_bundle_t *gtfs_bundle, bench_file_t *file) {
+  gtfs_member_t *gtfs_member;
+  GTimer *timer;
+  const char *block;
+  char *errmsg;
+  ssize_t bytes_read = 0;
+  size_t offset = 0;
+  guint64 size;
+
+  gtfs_bundle_locate(gtfs_bundle, file->gtfs_file_spec->filename, &size);
+  file->size = size;
+  file->data = g_malloc(file->size + 1);
+
+  if((gtfs_member = gtfs_member_open(gtfs_bundle,
+                                     file->gtfs_file_spec->filename,
+                                     &errmsg)) == NULL) {
+    fprintf(stderr,
+            "inflate_file: "
+            "Error opening bundle file \"%s\": %s\n",
+            file->gtfs_file_spec->filename,
+            errmsg);
+    g_free(errmsg);
+    return false;
+  }
+  while(offset < file->size &&
+        (bytes_read = gtfs_member_read(gtfs_member,
+                                       file->data + offset,
+                                       file->size - offset)) > 0) {
+    offset += bytes_read;
+  }
+  gtfs_member_close(gtfs_member);
+  if(offset != file->size) {
+    return false;
+  }
+
+  gtfs_member = gtfs_member_open(gtfs_bundle,
+                                 file->gtfs_file_spec->filename,
+                                 &errmsg);
+  timer = g_timer_new();
+  while((bytes_read = gtfs_member_next_block(gtfs_member, &block)) > 0) {
+    sink += block[bytes_read - 1];
+  }
+  file->inflate_time = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
+  gtfs_member_close(gtfs_member);
+
+  return bytes_read == 0;
+}
+
+/* Times reading a file from a ZIP bundle through libzip, in the small
+   buffers gtfs2db used before */
+static bool inflate_file_libzip(struct zip *gtfs_zip, bench_file_t *file) {
+  struct zip_file *gtfs_zip_member;
+  GTimer *timer;
+  char buf[LIBZIP_BUFFER_SIZE];
+  zip_int64_t bytes_read;
+  size_t offset = 0;
+
+  if((gtfs_zip_member = zip_fopen(gtfs_zip,
+                                  file->gtfs_file_spec->filename,
+                                  0)) == NULL) {
+    fprintf(stderr,
+            "inflate_file_libzip: "
+            "Error opening ZIP member \"%s\": %s\n",
+            file->gtfs_file_spec->filename,
+            zip_strerror(gtfs_zip));
+    return false;
+  }
+
+  timer = g_timer_new();
+  while((bytes_read = zip_fread(gtfs_zip_member, buf, sizeof(buf))) > 0) {
+    sink += buf[bytes_read - 1];
+    offset += bytes_read;
+  }
+  file->libzip_inflate_time = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
+
+  zip_fclose(gtfs_zip_member);
+
+  return offset == file->size;
+}
+
+/* Callbacks that only count the records tokenized */
+static void count_field(void *val, size_t len, void *data) {
+}
+
+static void count_record(int c, void *data) {
+  (*(unsigned long *)data)++;
+}
+
+/* Callbacks that convert each field as gtfs2db does, for fields in
+   the file's specification, without writing anything */
+static void convert_field(void *val, size_t len, void *data) {
+  bench_convert_state_t *state = data;
+  const gtfs_field_spec_t *field_spec;
+  gtfs_field_value_t *field_value;
+  unsigned int field_number;
+  int column = state->fields_parsed++;
+
+  if(column >= MAX_COLUMNS) {
+    return;
+  }
+
+  if(!state->header_parsed) {
+    /* Map this column to the field of the same name */
+    state->field_for_column[column] = -1;
+    for(field_number = 0;
+        field_number < state->gtfs_file_spec->num_fields;
+        field_number++) {
+      if(strcmp(state->gtfs_file_spec->field_specs[field_number]->name,
+                val) == 0) {
+        state->field_for_column[column] = field_number;
+      }
+    }
+    return;
+  }
+
+  if(state->field_for_column[column] == -1 || len == 0) {
+    return;
+  }
+  field_number = state->field_for_column[column];
+  field_spec = state->gtfs_file_spec->field_specs[field_number];
+  field_value = &state->record_values[field_number];
+
+  switch(field_spec->type) {
+  case TYPE_BOOLEAN:
+    field_value->boolean_value = (*(char *)val == '1');
+    break;
+
+  case TYPE_INTEGER:
+    parse_integer(val, len, &field_value->integer_value);
+    break;
+
+  case TYPE_DOUBLE:
+    parse_double(val, len, &field_value->double_value);
+    break;
+
+  case TYPE_STRING:
+    /* Copy the string, truncated, as it would be into the arena */
+    len = MIN(len, MIN(field_spec->length, 1024));
+    memcpy(state->strings[field_number], val, len);
+    state->strings[field_number][len] = '\0';
+    field_value->string_value = state->strings[field_number];
+    break;
+
+  case TYPE_DATE:
+    parse_date(val, len, field_value->date_value);
+    break;
+
+  case TYPE_TIME:
+    parse_time(val, len, &field_value->time_value);
+    break;
+  }
+}
+
+static void convert_record(int c, void *data) {
+  bench_convert_state_t *state = data;
+
+  if(state->header_parsed) {
+    sink += state->record_values[0].integer_value;
+    state->records++;
+  }
+  state->header_parsed = true;
+  state->fields_parsed = 0;
+}
+
+/* Times the tokenization of a file's contents by each tokenizer in
+   gtfs_csv.c the processor supports */
+static void tokenize_file(bench_file_t *file) {
+  gtfs_csv_parser_t csv;
+  GTimer *timer = g_timer_new();
+  unsigned long records;
+
+  for(gtfs_csv_tokenizer_t tokenizer = GTFS_CSV_SCALAR;
+      tokenizer <= GTFS_CSV_AVX2;
+      tokenizer++) {
+    if(gtfs_csv_init(&csv, tokenizer)) {
+      records = 0;
+      g_timer_start(timer);
+      gtfs_csv_parse(&csv, file->data, file->size, count_field, count_record,
+                     &records);
+      gtfs_csv_fini(&csv, count_field, count_record, &records);
+      file->tokenizer_times[tokenizer] = g_timer_elapsed(timer, NULL);
+      gtfs_csv_free(&csv);
+    }
+  }
+
+  g_timer_destroy(timer);
+}
+
+/* Times the tokenization of a file's contents alone, then its
+   tokenization and conversion together */
+static void parse_file(bench_file_t *file) {
+  struct csv_parser csv;
+  bench_convert_state_t *state;
+  GTimer *timer;
+  unsigned long records = 0;
+
+  assert(csv_init(&csv, CSV_STRICT | CSV_APPEND_NULL) == 0);
+  timer = g_timer_new();
+
+  csv_parse(&csv, file->data, file->size, count_field, count_record,
+            &records);
+  csv_fini(&csv, count_field, count_record, &records);
+  file->tokenize_time = g_timer_elapsed(timer, NULL);
+
+  /* Don't count the header */
+  file->records = records > 0? records - 1: 0;
+
+  state = g_new0(bench_convert_state_t, 1);
+  state->gtfs_file_spec = file->gtfs_file_spec;
+  g_timer_start(timer);
+  csv_parse(&csv, file->data, file->size, convert_field, convert_record,
+            state);
+  csv_fini(&csv, convert_field, convert_record, state);
+  file->convert_time = MAX(g_timer_elapsed(timer, NULL) -
+                           file->tokenize_time,
+                           0);
+  g_free(state);
+
+  g_timer_destroy(timer);
+  csv_free(&csv);
+}
+
+/* Runs gtfs2db on the bundle, returning the lines of the statistics
+   it wrote or NULL if it failed */
+static gchar **run_loader(const char *gtfs_path) {
+  gchar **result = NULL;
+  gchar **argv, *command_line, *stats_path, *stats;
+  GError *error = NULL;
+  gint exit_status;
+
+  remove(db_path);
+  stats_path = g_strconcat(db_path, ".json", NULL);
+  command_line = g_strdup_printf("%s --stats-json %s %s %s %s",
+                                 loader_path,
+                                 stats_path,
+                                 loader_args,
+                                 gtfs_path,
+                                 db_path);
+  if(!g_shell_parse_argv(command_line, NULL, &argv, &error)) {
+    fprintf(stderr, "run_loader: Error: %s\n", error->message);
+    g_error_free(error);
+    g_free(command_line);
+    g_free(stats_path);
+    return NULL;
+  }
+  g_free(command_line);
+
+  if(!g_spawn_sync(NULL,
+                   argv,
+                   NULL,
+                   G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+                   NULL,
+                   NULL,
+                   NULL,
+                   NULL,
+                   &exit_status,
+                   &error)) {
+    fprintf(stderr, "run_loader: Error: %s\n", error->message);
+    g_error_free(error);
+  }
+  else if(!WIFEXITED(exit_status) || WEXITSTATUS(exit_status) != 0) {
+    fprintf(stderr, "run_loader: Error: gtfs2db failed\n");
+  }
+  else if(!g_file_get_contents(stats_path, &stats, NULL, &error)) {
+    fprintf(stderr, "run_loader: Error: %s\n", error->message);
+    g_error_free(error);
+  }
+  else {
+    /* gtfs2db writes the statistics for each file and index on a line
+       of its own */
+    result = g_strsplit(stats, "\n", 0);
+    g_free(stats);
+  }
+
+  g_strfreev(argv);
+  g_free(stats_path);
+  return result;
+}
+
+/* Records the time gtfs2db reported spending writing each file's
+   records to the database */
+static void record_insert_times(gchar **lines, bench_file_t *files) {
+  char name[256];
+  double seconds;
+  const char *write_seconds;
+
+  for(gchar **line = lines; *line; line++) {
+    if(sscanf(*line, " {\"file\": \"%255[^\"]\"", name) == 1 &&
+       (write_seconds = strstr(*line, "\"write_seconds\": ")) &&
+       sscanf(write_seconds, "\"write_seconds\": %lf", &seconds) == 1) {
+      for(bench_file_t *file = files; file->gtfs_file_spec; file++) {
+        if(strcmp(file->gtfs_file_spec->filename, name) == 0) {
+          file->insert_time = seconds;
+        }
+      }
+    }
+  }
+}
+
+/* Prints the time gtfs2db reported taking to create each index once
+   the files were loaded, and to load the bundle as a whole */
+static void print_loader_phases(gchar **lines, const char *gtfs_path) {
+  char name[256];
+  double seconds;
+
+  for(gchar **line = lines; *line; line++) {
+    if(sscanf(*line,
+              " {\"name\": \"%255[^\"]\", \"seconds\": %lf",
+              name,
+              &seconds) == 2) {
+      print_phase("index", name, 0, 0, seconds);
+    }
+    else if(sscanf(*line, " \"seconds\": %lf", &seconds) == 1) {
+      print_phase("total", gtfs_path, 0, 0, seconds);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  static const GOptionEntry option_entries[] = {
+    { "loader", 'l', 0, G_OPTION_ARG_STRING, &loader_path,
+      "Run the gtfs2db at PATH", "PATH" },
+    { "loader-args", 'a', 0, G_OPTION_ARG_STRING, &loader_args,
+      "Pass ARGS to gtfs2db", "ARGS" },
+    { "database", 'd', 0, G_OPTION_ARG_STRING, &db_path,
+      "Load into the database at PATH, replacing it", "PATH" },
+    { "label", 'n', 0, G_OPTION_ARG_STRING, &label,
+      "Label each result with NAME", "NAME" },
+    { "buffer-size", 'b', 0, G_OPTION_ARG_INT, &buffer_size,
+      "Read compressed files through buffers of N kilobytes", "N" },
+    { NULL }
+  };
+
+  int result = EXIT_FAILURE;
+  GOptionContext *option_context;
+  GError *option_error = NULL;
+  bench_file_t files[G_N_ELEMENTS(gtfs_file_specs)];
+  bench_file_t *file;
+  gchar **lines;
+  gtfs_bundle_t *gtfs_bundle;
+  struct zip *gtfs_zip = NULL;
+  char *errmsg;
+  bool success = true;
+
+  option_context = g_option_context_new("gtfs-file");
+  g_option_context_add_main_entries(option_context, option_entries, NULL);
+  if(!g_option_context_parse(option_context, &argc, &argv, &option_error)) {
+    fprintf(stderr, "Error: %s\n", option_error->message);
+    g_error_free(option_error);
+    argc = 0;
+  }
+  g_option_context_free(option_context);
+
+  if(argc != 2 || buffer_size < 1) {
+    puts("Usage: bench_gtfs2db [--loader PATH] [--loader-args ARGS] "
+         "[--database PATH] [--label NAME] [--buffer-size N] gtfs-file");
+    return result;
+  }
+
+  gtfs_bundle = gtfs_bundle_open(argv[1],
+                                 true,
+                                 (size_t)buffer_size * 1024,
+                                 0,
+                                 &errmsg);
+  if(gtfs_bundle == NULL) {
+    fprintf(stderr, "Error opening bundle: %s\n", errmsg);
+    g_free(errmsg);
+    return result;
+  }
+
+  /* An extracted bundle has no libzip path to compare against */
+  if(!g_file_test(argv[1], G_FILE_TEST_IS_DIR)) {
+    gtfs_zip = zip_open(argv[1], 0, NULL);
+  }
+
+  /* Measure the phases we can run in isolation on each file */
+  memset(files, 0, sizeof(files));
+  for(unsigned int index = 0; gtfs_file_specs[index]; index++) {
+    file = &files[index];
+    file->gtfs_file_spec = gtfs_file_specs[index];
+    file->present = gtfs_bundle_locate(gtfs_bundle,
+                                       file->gtfs_file_spec->filename,
+                                       NULL);
+    if(file->present) {
+      if(inflate_file(gtfs_bundle, file) &&
+         (gtfs_zip == NULL || inflate_file_libzip(gtfs_zip, file))) {
+        parse_file(file);
+        tokenize_file(file);
+      }
+      else {
+        success = false;
+      }
+      g_free(file->data);
+      file->data = NULL;
+    }
+  }
+  if(gtfs_zip) {
+    assert(zip_close(gtfs_zip) == 0);
+  }
+  gtfs_bundle_close(gtfs_bundle);
+
+  /* Then run gtfs2db, and find out how long it spent inserting each
+     file's records */
+  if(success && (lines = run_loader(argv[1]))) {
+    record_insert_times(lines, files);
+    for(file = files; file->gtfs_file_spec; file++) {
+      if(file->present) {
+        const char *filename = file->gtfs_file_spec->filename;
+
+        print_phase("inflate",
+                    filename,
+                    file->records,
+                    file->size,
+                    file->inflate_time);
+        if(file->libzip_inflate_time > 0) {
+          print_phase("inflate_libzip",
+                      filename,
+                      file->records,
+                      file->size,
+                      file->libzip_inflate_time);
+        }
+        print_phase("tokenize",
+                    filename,
+                    file->records,
+                    file->size,
+                    file->tokenize_time);
+        for(gtfs_csv_tokenizer_t tokenizer = GTFS_CSV_SCALAR;
+            tokenizer <= GTFS_CSV_AVX2;
+            tokenizer++) {
+          if(file->tokenizer_times[tokenizer] > 0) {
+            char phase[32];
+
+            snprintf(phase,
+                     sizeof(phase),
+                     "tokenize_%s",
+                     gtfs_csv_tokenizer_name(tokenizer));
+            print_phase(phase,
+                        filename,
+                        file->records,
+                        file->size,
+                        file->tokenizer_times[tokenizer]);
+          }
+        }
+        print_phase("convert",
+                    filename,
+                    file->records,
+                    file->size,
+                    file->convert_time);
+        print_phase("insert",
+                    filename,
+                    file->records,
+                    file->size,
+                    file->insert_time);
+      }
+    }
+    print_loader_phases(lines, argv[1]);
+    g_strfreev(lines);
+    result = EXIT_SUCCESS;
+  }
+
+  return result;
+}
@@ -0,0 +1,425 @@
+/* A benchmark comparing nearest-stop and radius queries answered from
+   the spatial index over a database's stops with the same queries
+   answered by scanning the whole "stops" table, checking the two give
+   the same stops. Build with
+
+     gcc -std=c99 -O2 bench_stop_index.c gtfs_stop_index.c `pkg-config --cflags --libs glib-2.0` -lsqlite3 -lm -o bench_stop_index
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <glib.h>
+#include <math.h>
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtfs_stop_index.h"
+
+/* The area over which synthetic stops are generated: a box about 110
+   km square, holding towns around which the stops cluster, each a few
+   kilometres across */
+#define REGION_MIN_LAT 45.0
+#define REGION_MAX_LAT 46.0
+#define REGION_MIN_LON -74.2
+#define REGION_MAX_LON -72.8
+#define NUM_TOWNS 40
+#define TOWN_SPREAD 0.03
+
+/* The greatest distance, in degrees, between a query's point and the
+   stop it is placed near */
+#define QUERY_JITTER 0.005
+
+/* A kind of query: the "k" nearest stops or, if "k" is zero, the stops
+   within "radius" metres */
+typedef struct {
+  const char *name;
+  unsigned int k;
+  double radius;
+} benchmark_t;
+
+/* The stops a query found */
+typedef struct {
+  unsigned int num_matches;
+  gtfs_stop_match_t *matches;
+} query_result_t;
+
+static gint num_stops = 50000;
+static gint num_queries = 200;
+
+/* ---------------------------------------------------------------- */
+
+/* Orders stops nearest first, then by row ID, as the index does */
+static gint compare_matches(gconstpointer a, gconstpointer b) {
+  const gtfs_stop_match_t *match_a = a, *match_b = b;
+
+  if(match_a->distance != match_b->distance) {
+    return (match_a->distance > match_b->distance) -
+      (match_a->distance < match_b->distance);
+  }
+
+  return (match_a->stop > match_b->stop) - (match_a->stop < match_b->stop);
+}
+
+/* Returns a normally distributed random number */
+static double random_normal(double mean, double deviation) {
+  double u = 1.0 - g_random_double(), v = g_random_double();
+
+  return mean + deviation * sqrt(-2 * log(u)) * cos(2 * G_PI * v);
+}
+
+/* Fills a new "stops" table with "num_stops" stops clustered around
+   towns in the region. Returns FALSE on failure */
+static bool generate_stops(sqlite3 *db) {
+  bool result = true;
+  double town_lats[NUM_TOWNS], town_lons[NUM_TOWNS];
+  sqlite3_stmt *insert_stmt;
+  unsigned int town;
+
+  for(town = 0; town < NUM_TOWNS; town++) {
+    town_lats[town] = g_random_double_range(REGION_MIN_LAT, REGION_MAX_LAT);
+    town_lons[town] = g_random_double_range(REGION_MIN_LON, REGION_MAX_LON);
+  }
+
+  if(sqlite3_exec(db,
+                  "CREATE TABLE stops (lat DOUBLE, lon DOUBLE); "
+                  "BEGIN",
+                  NULL,
+                  NULL,
+                  NULL) != SQLITE_OK ||
+     sqlite3_prepare_v2(db,
+                        "INSERT INTO stops VALUES (?, ?)",
+                        -1,
+                        &insert_stmt,
+                        NULL) != SQLITE_OK) {
+    return false;
+  }
+  for(int stop = 0; stop < num_stops && result; stop++) {
+    town = g_random_int_range(0, NUM_TOWNS);
+    sqlite3_bind_double(insert_stmt, 1,
+                        random_normal(town_lats[town], TOWN_SPREAD));
+    sqlite3_bind_double(insert_stmt, 2,
+                        random_normal(town_lons[town], TOWN_SPREAD));
+    result = sqlite3_step(insert_stmt) == SQLITE_DONE;
+    sqlite3_reset(insert_stmt);
+  }
+  sqlite3_finalize(insert_stmt);
+
+  return result &&
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) == SQLITE_OK;
+}
+
+/* Places each query's point near a stop chosen at random. Returns
+   FALSE on failure */
+static bool generate_query_points(sqlite3 *db, double *lats, double *lons) {
+  GArray *stop_lats, *stop_lons;
+  sqlite3_stmt *select_stmt;
+  double lat, lon;
+  unsigned int stop;
+
+  if(sqlite3_prepare_v2(db,
+                        "SELECT lat, lon FROM stops "
+                        "WHERE lat IS NOT NULL AND lon IS NOT NULL",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    return false;
+  }
+
+  stop_lats = g_array_new(FALSE, FALSE, sizeof(double));
+  stop_lons = g_array_new(FALSE, FALSE, sizeof(double));
+  while(sqlite3_step(select_stmt) == SQLITE_ROW) {
+    lat = sqlite3_column_double(select_stmt, 0);
+    lon = sqlite3_column_double(select_stmt, 1);
+    g_array_append_val(stop_lats, lat);
+    g_array_append_val(stop_lons, lon);
+  }
+  sqlite3_finalize(select_stmt);
+
+  for(int query = 0; query < num_queries; query++) {
+    if(stop_lats->len > 0) {
+      stop = g_random_int_range(0, stop_lats->len);
+      lat = g_array_index(stop_lats, double, stop) +
+        g_random_double_range(-QUERY_JITTER, QUERY_JITTER);
+      lats[query] = CLAMP(lat, -90.0, 90.0);
+      lons[query] = g_array_index(stop_lons, double, stop) +
+        g_random_double_range(-QUERY_JITTER, QUERY_JITTER);
+    }
+    else {
+      lats[query] = lons[query] = 0;
+    }
+  }
+
+  g_array_free(stop_lats, TRUE);
+  g_array_free(stop_lons, TRUE);
+
+  return true;
+}
+
+/* Answers a query by reading every stop in the "stops" table */
+static void scan_query(sqlite3_stmt *select_stmt,
+                       const benchmark_t *benchmark,
+                       double lat,
+                       double lon,
+                       query_result_t *result) {
+  GArray *found;
+  gtfs_stop_match_t match;
+  unsigned int index;
+
+  found = g_array_new(FALSE, FALSE, sizeof(gtfs_stop_match_t));
+  while(sqlite3_step(select_stmt) == SQLITE_ROW) {
+    match.stop = sqlite3_column_int64(select_stmt, 0);
+    match.lat = sqlite3_column_double(select_stmt, 1);
+    match.lon = sqlite3_column_double(select_stmt, 2);
+    match.distance = gtfs_stop_distance(lat, lon, match.lat, match.lon);
+
+    if(benchmark->k == 0) {
+      if(match.distance <= benchmark->radius) {
+        g_array_append_val(found, match);
+      }
+    }
+    else if(found->len < benchmark->k ||
+            compare_matches(&match,
+                            &g_array_index(found,
+                                           gtfs_stop_match_t,
+                                           found->len - 1)) < 0) {
+      /* Keep the "k" nearest stops seen so far in order, inserting
+         this one in its place */
+      for(index = found->len;
+          index > 0 &&
+            compare_matches(&match,
+                            &g_array_index(found,
+                                           gtfs_stop_match_t,
+                                           index - 1)) < 0;
+          index--);
+      g_array_insert_val(found, index, match);
+      if(found->len > benchmark->k) {
+        g_array_set_size(found, benchmark->k);
+      }
+    }
+  }
+  sqlite3_reset(select_stmt);
+
+  if(benchmark->k == 0) {
+    g_array_sort(found, compare_matches);
+  }
+
+  result->num_matches = found->len;
+  result->matches = (gtfs_stop_match_t *)g_array_free(found, FALSE);
+}
+
+/* Answers a query from the spatial index */
+static void index_query(gtfs_stop_index_t *stop_index,
+                        const benchmark_t *benchmark,
+                        double lat,
+                        double lon,
+                        query_result_t *result) {
+  if(benchmark->k == 0) {
+    result->num_matches = gtfs_stop_index_within(stop_index,
+                                                 lat,
+                                                 lon,
+                                                 benchmark->radius,
+                                                 &result->matches);
+  }
+  else {
+    result->matches = g_new(gtfs_stop_match_t, benchmark->k);
+    result->num_matches = gtfs_stop_index_nearest(stop_index,
+                                                  lat,
+                                                  lon,
+                                                  benchmark->k,
+                                                  result->matches);
+  }
+}
+
+/* Returns TRUE if two queries found the same stops in the same
+   order */
+static bool same_results(const query_result_t *a, const query_result_t *b) {
+  bool result = a->num_matches == b->num_matches;
+
+  for(unsigned int index = 0; index < a->num_matches && result; index++) {
+    result = a->matches[index].stop == b->matches[index].stop;
+  }
+
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  static const GOptionEntry option_entries[] = {
+    { "stops", 'n', 0, G_OPTION_ARG_INT, &num_stops,
+      "Generate N stops when no database is given", "N" },
+    { "queries", 'q', 0, G_OPTION_ARG_INT, &num_queries,
+      "Run N queries of each kind", "N" },
+    { NULL }
+  };
+  static const benchmark_t benchmarks[] = {
+    { "nearest 1",   1,  0 },
+    { "nearest 10",  10, 0 },
+    { "within 400m", 0,  400 },
+    { "within 1km",  0,  1000 }
+  };
+
+  int result = EXIT_FAILURE;
+  GOptionContext *option_context;
+  GError *option_error = NULL;
+  sqlite3 *db;
+  sqlite3_stmt *select_stmt;
+  gtfs_stop_index_t *stop_index;
+  query_result_t *scan_results, *index_results;
+  double *lats, *lons;
+  double scan_seconds, index_seconds, mean_matches;
+  unsigned int num_indexed, num_mismatches = 0;
+  char *errmsg;
+  GTimer *timer;
+
+  option_context = g_option_context_new("[db-file]");
+  g_option_context_add_main_entries(option_context, option_entries, NULL);
+  if(!g_option_context_parse(option_context, &argc, &argv, &option_error)) {
+    fprintf(stderr, "Error: %s\n", option_error->message);
+    g_error_free(option_error);
+    argc = 0;
+  }
+  g_option_context_free(option_context);
+
+  if(argc < 1 || argc > 2 || num_stops < 0 || num_queries < 1) {
+    puts("Usage: bench_stop_index [--stops N] [--queries N] [db-file]");
+    return result;
+  }
+
+  /* Use the stops in the database given, building the index over them
+     if the database has none, or else generate stops in a database of
+     our own */
+  if(sqlite3_open_v2(argc == 2? argv[1]: ":memory:",
+                     &db,
+                     SQLITE_OPEN_READWRITE |
+                     (argc == 2? 0: SQLITE_OPEN_CREATE),
+                     NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error opening database: %s\n", sqlite3_errmsg(db));
+    sqlite3_close(db);
+    return result;
+  }
+  if(argc == 1 && !generate_stops(db)) {
+    fprintf(stderr, "Error generating stops: %s\n", sqlite3_errmsg(db));
+    sqlite3_close(db);
+    return result;
+  }
+
+  timer = g_timer_new();
+  if((stop_index = gtfs_stop_index_open(db, &errmsg)) == NULL) {
+    g_free(errmsg);
+    if(!gtfs_stop_index_build(db, &num_indexed, &errmsg) ||
+       (stop_index = gtfs_stop_index_open(db, &errmsg)) == NULL) {
+      fprintf(stderr, "Error indexing stops: %s\n", errmsg);
+      g_free(errmsg);
+      g_timer_destroy(timer);
+      sqlite3_close(db);
+      return result;
+    }
+    printf("Indexed %u stops in %.3f seconds\n",
+           num_indexed,
+           g_timer_elapsed(timer, NULL));
+  }
+
+  lats = g_new(double, num_queries);
+  lons = g_new(double, num_queries);
+  if(sqlite3_prepare_v2(db,
+                        "SELECT rowid, lat, lon FROM stops "
+                        "WHERE lat IS NOT NULL AND lon IS NOT NULL",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK ||
+     !generate_query_points(db, lats, lons)) {
+    fprintf(stderr, "Error reading stops: %s\n", sqlite3_errmsg(db));
+    g_free(lats);
+    g_free(lons);
+    sqlite3_finalize(select_stmt);
+    gtfs_stop_index_close(stop_index);
+    g_timer_destroy(timer);
+    sqlite3_close(db);
+    return result;
+  }
+  scan_results = g_new(query_result_t, num_queries);
+  index_results = g_new(query_result_t, num_queries);
+
+  printf("%-12s %12s %12s %8s %10s\n",
+         "Query", "Scan (q/s)", "Index (q/s)", "Speedup", "Stops/q");
+
+  for(unsigned int index = 0;
+      index < sizeof(benchmarks) / sizeof(benchmarks[0]);
+      index++) {
+    const benchmark_t *benchmark = &benchmarks[index];
+
+    g_timer_start(timer);
+    for(int query = 0; query < num_queries; query++) {
+      scan_query(select_stmt,
+                 benchmark,
+                 lats[query],
+                 lons[query],
+                 &scan_results[query]);
+    }
+    scan_seconds = g_timer_elapsed(timer, NULL);
+
+    g_timer_start(timer);
+    for(int query = 0; query < num_queries; query++) {
+      index_query(stop_index,
+                  benchmark,
+                  lats[query],
+                  lons[query],
+                  &index_results[query]);
+    }
+    index_seconds = g_timer_elapsed(timer, NULL);
+
+    mean_matches = 0;
+    for(int query = 0; query < num_queries; query++) {
+      if(!same_results(&scan_results[query], &index_results[query])) {
+        num_mismatches++;
+      }
+      mean_matches += scan_results[query].num_matches;
+      g_free(scan_results[query].matches);
+      g_free(index_results[query].matches);
+    }
+    mean_matches /= num_queries;
+
+    printf("%-12s %12.0f %12.0f %7.1fx %10.1f\n",
+           benchmark->name,
+           num_queries / scan_seconds,
+           num_queries / index_seconds,
+           scan_seconds / index_seconds,
+           mean_matches);
+  }
+
+  if(num_mismatches == 0) {
+    result = EXIT_SUCCESS;
+  }
+  else {
+    fprintf(stderr,
+            "Error: %u queries found different stops through the index\n",
+            num_mismatches);
+  }
+
+  g_free(scan_results);
+  g_free(index_results);
+  g_free(lats);
+  g_free(lons);
+  sqlite3_finalize(select_stmt);
+  gtfs_stop_index_close(stop_index);
+  g_timer_destroy(timer);
+  sqlite3_close(db);
+
+  return result;
+}
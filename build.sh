@@ -20,4 +20,4 @@
 # You should have received a copy of the GNU General Public License
 # along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
 
-gcc -std=c99 -O2 main.c -L/usr/local/lib `pkg-config --cflags --libs glib-2.0` -lcsv -lsqlite3 -lzip -o gtfs2db
+gcc -std=c99 -O2 main.c gtfs_arrow.c gtfs_bundle.c gtfs_csv.c gtfs_departures.c gtfs_frequencies.c gtfs_raptor.c gtfs_service_days.c gtfs_shapes.c gtfs_sort.c gtfs_sqlite.c gtfs_stop_index.c gtfs_transfers.c -L/usr/local/lib `pkg-config --cflags --libs glib-2.0 gthread-2.0` -lcsv -lsqlite3 -lzip -lz -lm -o gtfs2db
@@ -37,7 +37,8 @@ const gtfs_file_spec_t calendar_file_spec = {
   /* Field definitions */
   10,
   (gtfs_field_spec_t *[10]) {
-    &(gtfs_field_spec_t) {"service_id", TYPE_STRING,  255, true },
+    &(gtfs_field_spec_t) {"service_id", TYPE_STRING,  255, true,
+                          ID_SPACE_SERVICE },
     &(gtfs_field_spec_t) {"monday",     TYPE_BOOLEAN,   0, true },
     &(gtfs_field_spec_t) {"tuesday",    TYPE_BOOLEAN,   0, true },
     &(gtfs_field_spec_t) {"wednesday",  TYPE_BOOLEAN,   0, true },
@@ -49,6 +50,10 @@ const gtfs_file_spec_t calendar_file_spec = {
     &(gtfs_field_spec_t) {"end_date",   TYPE_DATE,      0, true }
   },
 
+  /* The fields identifying each object: its service ID */
+  1,
+  (unsigned int [1]) { 0 },
+
   /* SQL statements */
 
   /* Create the corresponding table in the database */
@@ -73,6 +78,10 @@ const gtfs_file_spec_t calendar_file_spec = {
   (const char *[]) {
     NULL
   },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  false,
 };
 
 #endif
@@ -37,11 +37,16 @@ const gtfs_file_spec_t calendar_dates_file_spec = {
   /* Field definitions */
   3,
   (gtfs_field_spec_t *[3]) {
-    &(gtfs_field_spec_t) {"service_id",     TYPE_STRING, 255, true },
+    &(gtfs_field_spec_t) {"service_id",     TYPE_STRING, 255, true,
+                          ID_SPACE_SERVICE },
     &(gtfs_field_spec_t) {"date",           TYPE_DATE,     0, true },
     &(gtfs_field_spec_t) {"exception_type", TYPE_INTEGER,  0, true }
   },
 
+  /* The fields identifying each object: its service ID and date */
+  2,
+  (unsigned int [2]) { 0, 1 },
+
   /* SQL statements */
 
   /* Create the corresponding table in the database */
@@ -59,6 +64,10 @@ const gtfs_file_spec_t calendar_dates_file_spec = {
   (const char *[]) {
     NULL
   },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  true,
 };
 
 #endif
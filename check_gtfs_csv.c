@@ -0,0 +1,452 @@
+/* A check that each of the tokenizers in gtfs_csv.c produces exactly
+   the fields, records and errors libcsv does with the options gtfs2db
+   uses. Random inputs, some built from well-formed records (mutated
+   at times) and some a jumble of delimiters, quotes, newlines and
+   whitespace, are parsed whole by libcsv and then, split into pieces
+   at random points and passed one piece per call, by each tokenizer
+   the processor supports. The fields and record ends each passes to
+   its callbacks, the offset of any parse error and the result of
+   ending the parse must match; the first input on which a tokenizer
+   differs is printed along with the points at which it was split.
+   Build with
+
+     gcc -std=c99 -O2 check_gtfs_csv.c gtfs_csv.c `pkg-config --cflags --libs glib-2.0` -lcsv -o check_gtfs_csv
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <csv.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtfs_csv.h"
+
+/* The greatest number of points at which an input is split */
+#define MAX_SPLITS 8
+
+/* The characters jumbled inputs are made of, weighted toward those the
+   parsers treat specially; the NUL character is among them */
+static const char jumble_chars[] = "ab ,,,\"\"\"\r\n\n\t\0";
+#define NUM_JUMBLE_CHARS (sizeof(jumble_chars) - 1)
+
+/* The outcome of parsing an input: the fields and record ends passed
+   to the callbacks, in order, and either the offset and description
+   of the parse error or the value returned on ending the parse */
+typedef struct {
+  GString *events;
+  bool failed;
+  size_t error_offset;
+  const char *error;
+  int fini_result;
+} parse_result_t;
+
+static gint num_inputs = 100000;
+static gint seed = 0;
+
+/* ---------------------------------------------------------------- */
+
+/* Logs a field passed to the callback, noting if it was not
+   NUL-terminated as CSV_APPEND_NULL requires */
+static void field_parsed(void *s, size_t len, void *data) {
+  GString *events = data;
+
+  g_string_append_printf(events, "F%zu:", len);
+  g_string_append_len(events, s, len);
+  if(((char *)s)[len] != '\0') {
+    g_string_append(events, "(not NUL-terminated)");
+  }
+  g_string_append_c(events, ';');
+}
+
+/* Logs the end of a record, with the character that ended it */
+static void record_parsed(int c, void *data) {
+  GString *events = data;
+
+  g_string_append_printf(events, "R%d;", c);
+}
+
+/* Appends a random run of spaces and tabs, usually empty */
+static void append_whitespace(GString *input) {
+  if(g_random_int_range(0, 4) == 0) {
+    for(int count = g_random_int_range(1, 3); count > 0; count--) {
+      g_string_append_c(input, g_random_boolean()? ' ': '\t');
+    }
+  }
+}
+
+/* Appends a field that is empty, unquoted or quoted (with delimiters,
+   newlines and escaped quotes within it), now and then long enough to
+   span several blocks */
+static void append_field(GString *input) {
+  static const char unquoted_chars[] = "abcxyz019.: \t";
+  static const char quoted_chars[] = "abc ,\r\n\t\"";
+  int len = g_random_int_range(0, 4) == 0?
+    g_random_int_range(60, 400):
+    g_random_int_range(0, 12);
+  char c;
+
+  append_whitespace(input);
+  switch(g_random_int_range(0, 3)) {
+  case 0:
+    break;
+
+  case 1:
+    for(int index = 0; index < len; index++) {
+      c = unquoted_chars[g_random_int_range(0, sizeof(unquoted_chars) - 1)];
+      g_string_append_c(input, c);
+    }
+    break;
+
+  case 2:
+    g_string_append_c(input, '"');
+    for(int index = 0; index < len; index++) {
+      c = quoted_chars[g_random_int_range(0, sizeof(quoted_chars) - 1)];
+      g_string_append_c(input, c);
+      if(c == '"') {
+        g_string_append_c(input, c);
+      }
+    }
+    g_string_append_c(input, '"');
+    break;
+  }
+  append_whitespace(input);
+}
+
+/* Fills "input" with well-formed records ended by LF, CRLF or CR,
+   with blank lines among them and, at times, the last unterminated */
+static void generate_records(GString *input) {
+  static const char *terminators[] = {
+    "\n", "\r\n", "\r", "\n\n", " \r\n"
+  };
+  const char *terminator;
+  int num_records = g_random_int_range(0, 20);
+
+  for(int record = 0; record < num_records; record++) {
+    for(int field = g_random_int_range(1, 8); field > 0; field--) {
+      append_field(input);
+      if(field > 1) {
+        g_string_append_c(input, ',');
+      }
+    }
+
+    if(record < num_records - 1 || g_random_int_range(0, 3) > 0) {
+      terminator =
+        terminators[g_random_int_range(0, G_N_ELEMENTS(terminators))];
+      g_string_append(input, terminator);
+    }
+  }
+}
+
+/* Fills "input" with a jumble of characters */
+static void generate_jumble(GString *input) {
+  for(int len = g_random_int_range(0, 200); len > 0; len--) {
+    g_string_append_c(input,
+                      jumble_chars[g_random_int_range(0, NUM_JUMBLE_CHARS)]);
+  }
+}
+
+/* Fills "input" with a random input */
+static void generate_input(GString *input) {
+  g_string_truncate(input, 0);
+
+  if(g_random_int_range(0, 4) == 0) {
+    generate_jumble(input);
+  }
+  else {
+    generate_records(input);
+
+    /* Now and then, damage a well-formed input in a few places */
+    if(input->len > 0 && g_random_int_range(0, 3) == 0) {
+      for(int count = g_random_int_range(1, 4); count > 0; count--) {
+        input->str[g_random_int_range(0, input->len)] =
+          jumble_chars[g_random_int_range(0, NUM_JUMBLE_CHARS)];
+      }
+    }
+  }
+}
+
+/* Chooses the points, in ascending order, at which to split an input
+   of "len" bytes, returning their number; pieces may be empty */
+static unsigned int generate_splits(size_t len, size_t *splits) {
+  unsigned int num_splits = g_random_int_range(0, MAX_SPLITS + 1);
+  unsigned int position;
+  size_t split;
+
+  for(unsigned int index = 0; index < num_splits; index++) {
+    split = g_random_int_range(0, len + 1);
+
+    /* Keep the points sorted as they are added */
+    position = index;
+    while(position > 0 && splits[position - 1] > split) {
+      splits[position] = splits[position - 1];
+      position--;
+    }
+    splits[position] = split;
+  }
+
+  return num_splits;
+}
+
+/* Parses an input whole with libcsv */
+static void parse_with_libcsv(const GString *input, parse_result_t *result) {
+  struct csv_parser parser;
+  size_t parsed;
+
+  csv_init(&parser, CSV_STRICT | CSV_APPEND_NULL);
+
+  g_string_truncate(result->events, 0);
+  result->failed = false;
+  parsed = csv_parse(&parser,
+                     input->str,
+                     input->len,
+                     field_parsed,
+                     record_parsed,
+                     result->events);
+  if(parsed < input->len) {
+    result->failed = true;
+    result->error_offset = parsed;
+    result->error = csv_strerror(csv_error(&parser));
+  }
+  else {
+    result->fini_result = csv_fini(&parser,
+                                   field_parsed,
+                                   record_parsed,
+                                   result->events);
+  }
+
+  csv_free(&parser);
+}
+
+/* Parses an input with a tokenizer, a piece at a time. Each piece is
+   copied on its own so a tokenizer reading past the end of one can be
+   caught by a memory checker such as Valgrind. Returns FALSE if the
+   tokenizer cannot be used */
+static bool parse_with_tokenizer(gtfs_csv_tokenizer_t tokenizer,
+                                 const GString *input,
+                                 const size_t *splits,
+                                 unsigned int num_splits,
+                                 parse_result_t *result) {
+  gtfs_csv_parser_t csv;
+  size_t start = 0, end, parsed;
+  char *piece;
+
+  if(!gtfs_csv_init(&csv, tokenizer)) {
+    return false;
+  }
+
+  g_string_truncate(result->events, 0);
+  result->failed = false;
+  for(unsigned int index = 0; index <= num_splits; index++) {
+    end = index < num_splits? splits[index]: input->len;
+    piece = g_malloc(end - start + 1);
+    memcpy(piece, input->str + start, end - start);
+
+    parsed = gtfs_csv_parse(&csv,
+                            piece,
+                            end - start,
+                            field_parsed,
+                            record_parsed,
+                            result->events);
+    g_free(piece);
+    if(parsed < end - start) {
+      result->failed = true;
+      result->error_offset = start + parsed;
+      result->error = gtfs_csv_strerror(&csv);
+      break;
+    }
+
+    start = end;
+  }
+  if(!result->failed) {
+    result->fini_result = gtfs_csv_fini(&csv,
+                                        field_parsed,
+                                        record_parsed,
+                                        result->events);
+  }
+
+  gtfs_csv_free(&csv);
+
+  return true;
+}
+
+/* Returns TRUE if two parses had the same outcome */
+static bool same_results(const parse_result_t *a, const parse_result_t *b) {
+  if(!g_string_equal(a->events, b->events) || a->failed != b->failed) {
+    return false;
+  }
+
+  return a->failed?
+    a->error_offset == b->error_offset && strcmp(a->error, b->error) == 0:
+    a->fini_result == b->fini_result;
+}
+
+/* Prints data with control characters, quotes and backslashes
+   escaped */
+static void print_escaped(const char *data, size_t len) {
+  unsigned char c;
+
+  putchar('"');
+  for(size_t index = 0; index < len; index++) {
+    c = data[index];
+    if(c == '"' || c == '\\') {
+      printf("\\%c", c);
+    }
+    else if(c == '\r') {
+      fputs("\\r", stdout);
+    }
+    else if(c == '\n') {
+      fputs("\\n", stdout);
+    }
+    else if(c == '\t') {
+      fputs("\\t", stdout);
+    }
+    else if(c < ' ' || c >= 0x7f) {
+      printf("\\%03o", c);
+    }
+    else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+/* Prints the outcome of a parse */
+static void print_result(const char *name, const parse_result_t *result) {
+  printf("  %-8s ", name);
+  print_escaped(result->events->str, result->events->len);
+  if(result->failed) {
+    printf("\n           error at offset %zu: %s\n",
+           result->error_offset,
+           result->error);
+  }
+  else {
+    printf("\n           ended with %d\n", result->fini_result);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  static const GOptionEntry option_entries[] = {
+    { "inputs", 'n', 0, G_OPTION_ARG_INT, &num_inputs,
+      "Check N random inputs", "N" },
+    { "seed", 's', 0, G_OPTION_ARG_INT, &seed,
+      "Seed the random-number generator with S rather than a random "
+      "value", "S" },
+    { NULL }
+  };
+
+  int result = EXIT_FAILURE;
+  GOptionContext *option_context;
+  GError *option_error = NULL;
+  GString *input;
+  parse_result_t expected, actual;
+  size_t splits[MAX_SPLITS];
+  unsigned int num_splits;
+  bool supported[GTFS_CSV_AVX2 + 1] = { false };
+  bool matched = true;
+  int input_number;
+
+  option_context = g_option_context_new(NULL);
+  g_option_context_add_main_entries(option_context, option_entries, NULL);
+  if(!g_option_context_parse(option_context, &argc, &argv, &option_error)) {
+    fprintf(stderr, "Error: %s\n", option_error->message);
+    g_error_free(option_error);
+    argc = 0;
+  }
+  g_option_context_free(option_context);
+
+  if(argc != 1 || num_inputs < 1) {
+    puts("Usage: check_gtfs_csv [--inputs N] [--seed S]");
+    return result;
+  }
+
+  if(seed == 0) {
+    seed = g_random_int_range(1, G_MAXINT);
+  }
+  g_random_set_seed(seed);
+
+  for(gtfs_csv_tokenizer_t tokenizer = GTFS_CSV_SCALAR;
+      tokenizer <= GTFS_CSV_AVX2;
+      tokenizer++) {
+    supported[tokenizer] = gtfs_csv_tokenizer_supported(tokenizer);
+    if(!supported[tokenizer]) {
+      printf("Skipping the \"%s\" tokenizer, which this processor does not "
+             "support\n",
+             gtfs_csv_tokenizer_name(tokenizer));
+    }
+  }
+
+  input = g_string_new(NULL);
+  expected.events = g_string_new(NULL);
+  actual.events = g_string_new(NULL);
+
+  for(input_number = 0; input_number < num_inputs && matched; input_number++) {
+    generate_input(input);
+    parse_with_libcsv(input, &expected);
+
+    for(gtfs_csv_tokenizer_t tokenizer = GTFS_CSV_SCALAR;
+        tokenizer <= GTFS_CSV_AVX2 && matched;
+        tokenizer++) {
+      if(!supported[tokenizer]) {
+        continue;
+      }
+
+      num_splits = generate_splits(input->len, splits);
+      if(!parse_with_tokenizer(tokenizer,
+                               input,
+                               splits,
+                               num_splits,
+                               &actual)) {
+        fprintf(stderr,
+                "Error: Unable to initialize the \"%s\" tokenizer\n",
+                gtfs_csv_tokenizer_name(tokenizer));
+        matched = false;
+      }
+      else if(!same_results(&expected, &actual)) {
+        printf("The \"%s\" tokenizer differs from libcsv on input %d "
+               "(seed %d):\n  input    ",
+               gtfs_csv_tokenizer_name(tokenizer),
+               input_number + 1,
+               seed);
+        print_escaped(input->str, input->len);
+        printf("\n  split at");
+        for(unsigned int index = 0; index < num_splits; index++) {
+          printf(" %zu", splits[index]);
+        }
+        putchar('\n');
+        print_result("libcsv", &expected);
+        print_result(gtfs_csv_tokenizer_name(tokenizer), &actual);
+        matched = false;
+      }
+    }
+  }
+
+  if(matched) {
+    printf("Checked %d inputs (seed %d): each tokenizer matches libcsv\n",
+           num_inputs,
+           seed);
+    result = EXIT_SUCCESS;
+  }
+
+  g_string_free(input, TRUE);
+  g_string_free(expected.events, TRUE);
+  g_string_free(actual.events, TRUE);
+
+  return result;
+}
@@ -0,0 +1,107 @@
+/* Specifies the departures table, which is not loaded from a file
+   within a GTFS bundle but derived from the stop times, trips and
+   service calendars once these are loaded: each record is a departure
+   from a stop on a given service day, with the route and headsign a
+   departure board shows, so the next departures from a stop on a date
+   are read with a single range scan of the table's primary key.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __DEPARTURES_H__
+#define __DEPARTURES_H__
+
+#include "gtfs_file.h"
+
+/* The numbers of the table's fields, by which each departure is built
+   up */
+enum {
+  DEPARTURE_STOP_ID,
+  DEPARTURE_DATE,
+  DEPARTURE_TIME,
+  DEPARTURE_TRIP_ID,
+  DEPARTURE_STOP_SEQUENCE,
+  DEPARTURE_ROUTE_ID,
+  DEPARTURE_HEADSIGN
+};
+
+const gtfs_file_spec_t departures_file_spec = {
+  /* The name of this GTFS object, both singular and plural forms */
+  { "departure", "departures" },
+
+  /* The filename within the GTFS bundle to load from---none, as the
+     table is derived from others */
+  NULL,
+
+  /* Whether the file is required to be present in a GTFS bundle or
+     not */
+  false,
+
+  /* Field definitions */
+  7,
+  (gtfs_field_spec_t *[7]) {
+    &(gtfs_field_spec_t) {"stop_id",        TYPE_STRING, 255, true,
+                          ID_SPACE_STOP },
+    &(gtfs_field_spec_t) {"date",           TYPE_DATE,     0, true },
+    &(gtfs_field_spec_t) {"departure_time", TYPE_TIME,     8, true },
+    &(gtfs_field_spec_t) {"trip_id",        TYPE_STRING, 255, true,
+                          ID_SPACE_TRIP },
+    &(gtfs_field_spec_t) {"stop_sequence",  TYPE_INTEGER,  0, true },
+    &(gtfs_field_spec_t) {"route_id",       TYPE_STRING, 255, true,
+                          ID_SPACE_ROUTE },
+    &(gtfs_field_spec_t) {"headsign",       TYPE_STRING, 255, false }
+  },
+
+  /* The fields identifying each object: its stop ID, service day,
+     departure time, trip ID and stop sequence, in the order a
+     departure board lists them */
+  5,
+  (unsigned int [5]) { 0, 1, 2, 3, 4 },
+
+  /* SQL statements */
+
+  /* Create the corresponding table in the database, always clustered
+     on the fields identifying each object */
+  "CREATE TABLE departures("
+    "stop_id VARCHAR(255) NOT NULL, "
+    "date DATE NOT NULL, "
+    "departure_time INTEGER NOT NULL, "
+    "trip_id VARCHAR(255) NOT NULL, "
+    "stop_sequence INTEGER NOT NULL, "
+    "route_id VARCHAR(255) NOT NULL, "
+    "headsign VARCHAR(255), "
+    "PRIMARY KEY (stop_id, date, departure_time, trip_id, stop_sequence)) "
+    "WITHOUT ROWID;",
+
+  /* Insert a new record into the database */
+  "INSERT INTO departures(stop_id, date, departure_time, trip_id, "
+    "stop_sequence, route_id, headsign) "
+    "VALUES (?, ?, ?, ?, ?, ?, ?);",
+
+  /* Define indices on the table for quick lookups---none beyond its
+     primary key */
+  (const char *[]) {
+    NULL
+  },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered---it is regardless, by its own
+     CREATE statement */
+  false,
+};
+
+#endif
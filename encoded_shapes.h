@@ -0,0 +1,101 @@
+/* Specifies the shapes table, which the SQLite sink fills from the
+   file "shapes.txt" within a GTFS bundle: rather than a row for each
+   point, each shape has a single row holding the number of its points,
+   the box bounding them and the points themselves, in order, encoded
+   as a polyline (see gtfs_shapes.h), along with the distance travelled
+   to each point when the file gives one for every point.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __ENCODED_SHAPES_H__
+#define __ENCODED_SHAPES_H__
+
+#include "gtfs_file.h"
+
+/* The numbers of the table's fields, by which each shape is built
+   up */
+enum {
+  ENCODED_SHAPE_ID,
+  ENCODED_SHAPE_NUM_POINTS,
+  ENCODED_SHAPE_MIN_LAT,
+  ENCODED_SHAPE_MIN_LON,
+  ENCODED_SHAPE_MAX_LAT,
+  ENCODED_SHAPE_MAX_LON,
+  ENCODED_SHAPE_POINTS,
+  ENCODED_SHAPE_DISTANCES
+};
+
+const gtfs_file_spec_t encoded_shapes_file_spec = {
+  /* The name of this GTFS object, both singular and plural forms */
+  { "shape", "shapes" },
+
+  /* The filename within the GTFS bundle to load from---none, as the
+     table is filled from the points in "shapes.txt" */
+  NULL,
+
+  /* Whether the file is required to be present in a GTFS bundle or
+     not */
+  false,
+
+  /* Field definitions */
+  8,
+  (gtfs_field_spec_t *[8]) {
+    &(gtfs_field_spec_t) {"id",         TYPE_STRING,  255, true },
+    &(gtfs_field_spec_t) {"num_points", TYPE_INTEGER,   0, true },
+    &(gtfs_field_spec_t) {"min_lat",    TYPE_DOUBLE,    0, true },
+    &(gtfs_field_spec_t) {"min_lon",    TYPE_DOUBLE,    0, true },
+    &(gtfs_field_spec_t) {"max_lat",    TYPE_DOUBLE,    0, true },
+    &(gtfs_field_spec_t) {"max_lon",    TYPE_DOUBLE,    0, true },
+    &(gtfs_field_spec_t) {"points",     TYPE_STRING,    0, true },
+    &(gtfs_field_spec_t) {"distances",  TYPE_STRING,    0, false }
+  },
+
+  /* The fields identifying each object: its ID */
+  1,
+  (unsigned int [1]) { 0 },
+
+  /* SQL statements */
+
+  /* Create the corresponding table in the database */
+  "CREATE TABLE shapes("
+    "id VARCHAR(255) PRIMARY KEY, "
+    "num_points INTEGER NOT NULL, "
+    "min_lat DECIMAL(8,6) NOT NULL, "
+    "min_lon DECIMAL(9,6) NOT NULL, "
+    "max_lat DECIMAL(8,6) NOT NULL, "
+    "max_lon DECIMAL(9,6) NOT NULL, "
+    "points TEXT NOT NULL, "
+    "distances TEXT);",
+
+  /* Insert a new record into the database */
+  "INSERT INTO shapes(id, num_points, min_lat, min_lon, max_lat, "
+    "max_lon, points, distances) "
+    "VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
+
+  /* Define indices on the table for quick lookups---none beyond its
+     primary key */
+  (const char *[]) {
+    NULL
+  },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  false,
+};
+
+#endif
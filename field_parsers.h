@@ -0,0 +1,197 @@
+/* Parsers for the fixed formats used by field values in GTFS files.
+   Each takes a string of "len" bytes, followed by a NUL character as
+   appended by the CSV parser, and returns TRUE and stores the parsed
+   value if the string is valid or FALSE otherwise.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __FIELD_PARSERS_H__
+#define __FIELD_PARSERS_H__
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Evaluates to TRUE if the character "c" is a decimal digit */
+#define IS_DIGIT(c) ((unsigned char)((c) - '0') <= 9)
+
+/* Powers of ten that are exactly representable as doubles */
+static const double exact_powers_of_ten[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+  1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+  1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Parses a time in "H:MM:SS" or "HH:MM:SS" format as a number of
+   seconds since midnight. Hours may exceed 23 (and run to three
+   digits) for trips that continue past midnight of their service
+   day */
+static inline bool parse_time(const char *str, size_t len, int *value) {
+  const char *minutes;
+  int hours;
+
+  /* The hours field takes whatever precedes ":MM:SS" */
+  if(len < 7 || len > 9) {
+    return false;
+  }
+  minutes = str + len - 5;
+  if(minutes[-1] != ':' || minutes[2] != ':' ||
+     !IS_DIGIT(minutes[0]) || !IS_DIGIT(minutes[1]) ||
+     !IS_DIGIT(minutes[3]) || !IS_DIGIT(minutes[4]) ||
+     minutes[0] > '5' || minutes[3] > '5') {
+    return false;
+  }
+
+  hours = 0;
+  while(str < minutes - 1) {
+    if(!IS_DIGIT(*str)) {
+      return false;
+    }
+    hours = hours * 10 + (*str++ - '0');
+  }
+
+  *value = hours * 3600 +
+    ((minutes[0] - '0') * 10 + (minutes[1] - '0')) * 60 +
+    ((minutes[3] - '0') * 10 + (minutes[4] - '0'));
+  return true;
+}
+
+/* Parses a date in "YYYYMMDD" format, storing it in ISO 8601
+   ("YYYY-MM-DD") format */
+static inline bool parse_date(const char *str, size_t len, char *value) {
+  unsigned int month, day;
+
+  if(len != 8) {
+    return false;
+  }
+  for(unsigned int index = 0; index < 8; index++) {
+    if(!IS_DIGIT(str[index])) {
+      return false;
+    }
+  }
+
+  month = (str[4] - '0') * 10 + (str[5] - '0');
+  day = (str[6] - '0') * 10 + (str[7] - '0');
+  if(month < 1 || month > 12 || day < 1 || day > 31) {
+    return false;
+  }
+
+  value[0] = str[0];
+  value[1] = str[1];
+  value[2] = str[2];
+  value[3] = str[3];
+  value[4] = '-';
+  value[5] = str[4];
+  value[6] = str[5];
+  value[7] = '-';
+  value[8] = str[6];
+  value[9] = str[7];
+  value[10] = '\0';
+  return true;
+}
+
+/* Parses a decimal integer, with an optional sign, that fits in an
+   int */
+static inline bool parse_integer(const char *str, size_t len, int *value) {
+  const char *end = str + len;
+  bool negative = false;
+  long long result = 0;
+
+  if(str < end && (*str == '-' || *str == '+')) {
+    negative = (*str++ == '-');
+  }
+  if(str == end || end - str > 10) {
+    return false;
+  }
+
+  while(str < end) {
+    if(!IS_DIGIT(*str)) {
+      return false;
+    }
+    result = result * 10 + (*str++ - '0');
+  }
+
+  if(negative) {
+    result = -result;
+  }
+  if(result < INT_MIN || result > INT_MAX) {
+    return false;
+  }
+
+  *value = (int)result;
+  return true;
+}
+
+/* Parses a decimal number such as a latitude or longitude. Numbers
+   with at most 15 significant digits and no exponent, which covers
+   all the coordinates and distances found in practice, are converted
+   directly with a single (correctly rounded) division; anything else
+   is left to strtod, so the result is always identical to strtod's */
+static inline bool parse_double(const char *str, size_t len, double *value) {
+  const char *p = str, *end = str + len;
+  bool negative = false, digit_seen = false;
+  uint64_t mantissa = 0;
+  unsigned int digits = 0, fraction_digits = 0;
+  char *strtod_end;
+
+  if(p < end && (*p == '-' || *p == '+')) {
+    negative = (*p++ == '-');
+  }
+
+  while(p < end && IS_DIGIT(*p)) {
+    mantissa = mantissa * 10 + (*p++ - '0');
+    digits += (mantissa != 0);
+    digit_seen = true;
+    if(digits > 15) {
+      goto use_strtod;
+    }
+  }
+  if(p < end && *p == '.') {
+    p++;
+    while(p < end && IS_DIGIT(*p)) {
+      mantissa = mantissa * 10 + (*p++ - '0');
+      digits += (mantissa != 0);
+      digit_seen = true;
+      if(digits > 15 || ++fraction_digits > 22) {
+        goto use_strtod;
+      }
+    }
+  }
+
+  if(p != end) {
+    /* An exponent or some other syntax we don't handle here */
+    goto use_strtod;
+  }
+  if(!digit_seen) {
+    return false;
+  }
+
+  *value = (double)mantissa / exact_powers_of_ten[fraction_digits];
+  if(negative) {
+    *value = -*value;
+  }
+  return true;
+
+use_strtod:
+  *value = strtod(str, &strtod_end);
+  return len > 0 && strtod_end == end;
+}
+
+#endif
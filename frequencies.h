@@ -0,0 +1,82 @@
+/* Specifies how the file "frequencies.txt" within a GTFS bundle is to
+   be parsed and loaded into the database. Each record gives the
+   headway at which a trip runs over a period of the day, the trip's
+   own stop times serving as a template for each of its runs.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __FREQUENCIES_H__
+#define __FREQUENCIES_H__
+
+#include "gtfs_file.h"
+
+const gtfs_file_spec_t frequencies_file_spec = {
+  /* The name of this GTFS object, both singular and plural forms */
+  { "frequency", "frequencies" },
+
+  /* The filename within the GTFS bundle to load from */
+  "frequencies.txt",
+
+  /* Whether the file is required to be present in a GTFS bundle or
+     not */
+  false,
+
+  /* Field definitions */
+  5,
+  (gtfs_field_spec_t *[5]) {
+    &(gtfs_field_spec_t) {"trip_id",      TYPE_STRING, 255, true,
+                          ID_SPACE_TRIP },
+    &(gtfs_field_spec_t) {"start_time",   TYPE_TIME,     8, true },
+    &(gtfs_field_spec_t) {"end_time",     TYPE_TIME,     8, true },
+    &(gtfs_field_spec_t) {"headway_secs", TYPE_INTEGER,  0, true },
+    &(gtfs_field_spec_t) {"exact_times",  TYPE_INTEGER,  0, false }
+  },
+
+  /* The fields identifying each object: its trip ID and start time */
+  2,
+  (unsigned int [2]) { 0, 1 },
+
+  /* SQL statements */
+
+  /* Create the corresponding table in the database */
+  "CREATE TABLE frequencies("
+    "trip_id VARCHAR(255) NOT NULL REFERENCES trips(id), "
+    "start_time INTEGER NOT NULL, "
+    "end_time INTEGER NOT NULL, "
+    "headway_secs INTEGER NOT NULL, "
+    "exact_times TINYINT);",
+
+  /* Insert a new record into the database */
+  "INSERT INTO frequencies(trip_id, start_time, end_time, "
+    "headway_secs, exact_times) "
+    "VALUES (?, ?, ?, ?, ?);",
+
+  /* Define indices on the table for quick lookups */
+  (const char *[]) {
+    /* Allow fast look-ups by trip ID, in order of start time */
+    "CREATE INDEX frequencies_trip_id_index "
+      "ON frequencies(trip_id, start_time);",
+    NULL
+  },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  false,
+};
+
+#endif
@@ -0,0 +1,399 @@
+/* Generates a synthetic GTFS bundle of configurable size for
+   benchmarking gtfs2db, so its performance can be measured without
+   shipping real feeds around. The same options and seed always
+   produce the same bundle. Build with
+
+     gcc -std=c99 -O2 gen_gtfs.c `pkg-config --cflags --libs glib-2.0` -lzip -o gen_gtfs
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <errno.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zip.h>
+
+/* The first day of service in the generated feed and the number of
+   days it covers */
+#define SERVICE_START_YEAR 2012
+#define SERVICE_DAYS 365
+
+/* The area over which stops are scattered, in degrees */
+#define STOPS_LAT -36.85
+#define STOPS_LON 174.76
+#define STOPS_SPREAD 0.25
+
+/* The times between which trips start, in seconds since midnight, and
+   the range of times taken to travel between stops */
+#define FIRST_TRIP_START (5 * 3600)
+#define LAST_TRIP_START (23 * 3600)
+#define MIN_STOP_INTERVAL 60
+#define MAX_STOP_INTERVAL 180
+
+/* The size of the generated feed */
+static gint num_routes = 100;
+static gint trips_per_route = 100;
+static gint stops_per_trip = 20;
+static gint num_stops = 1000;
+static gint num_services = 4;
+static gdouble calendar_density = 0.7;
+static gint exceptions_per_service = 5;
+static gint seed = 1;
+
+/* Appends a date, given as a number of days since the start of
+   service, in "YYYYMMDD" format */
+static void append_date(GString *str, unsigned int day) {
+  GDate *date;
+
+  date = g_date_new_dmy(1, G_DATE_JANUARY, SERVICE_START_YEAR);
+  g_date_add_days(date, day);
+  g_string_append_printf(str,
+                         "%04d%02d%02d",
+                         g_date_get_year(date),
+                         g_date_get_month(date),
+                         g_date_get_day(date));
+  g_date_free(date);
+}
+
+/* Appends a time, given in seconds since midnight, in "H:MM:SS"
+   format; hours run past 23 for trips that continue past midnight */
+static void append_time(GString *str, int time_value) {
+  g_string_append_printf(str,
+                         "%d:%02d:%02d",
+                         time_value / 3600,
+                         (time_value / 60) % 60,
+                         time_value % 60);
+}
+
+/* Generates a single agency operating every route */
+static GString *generate_agencies(GRand *rand) {
+  GString *str;
+
+  str = g_string_new("agency_id,agency_name,agency_url,agency_timezone,"
+                     "agency_lang,agency_phone\n");
+  g_string_append(str,
+                  "A0,Synthetic Transit,http://example.com/,"
+                  "Pacific/Auckland,en,555-0100\n");
+
+  return str;
+}
+
+/* Generates stops scattered at random over the area served */
+static GString *generate_stops(GRand *rand) {
+  GString *str;
+
+  str = g_string_new("stop_id,stop_code,stop_name,stop_lat,stop_lon\n");
+  for(int stop = 0; stop < num_stops; stop++) {
+    g_string_append_printf(str,
+                           "S%d,%d,\"Stop \"\"%d\"\"\",%.6f,%.6f\n",
+                           stop,
+                           stop,
+                           stop,
+                           STOPS_LAT + g_rand_double_range(rand,
+                                                           -STOPS_SPREAD,
+                                                           STOPS_SPREAD),
+                           STOPS_LON + g_rand_double_range(rand,
+                                                           -STOPS_SPREAD,
+                                                           STOPS_SPREAD));
+  }
+
+  return str;
+}
+
+/* Generates service schedules that run on each day of the week with a
+   probability given by the calendar density, plus at least one day */
+static GString *generate_calendars(GRand *rand) {
+  GString *str;
+  bool runs[7], any_day;
+
+  str = g_string_new("service_id,monday,tuesday,wednesday,thursday,"
+                     "friday,saturday,sunday,start_date,end_date\n");
+  for(int service = 0; service < num_services; service++) {
+    any_day = false;
+    for(int day = 0; day < 7; day++) {
+      runs[day] = g_rand_double(rand) < calendar_density;
+      any_day = any_day || runs[day];
+    }
+    if(!any_day) {
+      runs[service % 7] = true;
+    }
+
+    g_string_append_printf(str, "C%d", service);
+    for(int day = 0; day < 7; day++) {
+      g_string_append(str, runs[day]? ",1": ",0");
+    }
+    g_string_append_c(str, ',');
+    append_date(str, 0);
+    g_string_append_c(str, ',');
+    append_date(str, SERVICE_DAYS - 1);
+    g_string_append_c(str, '\n');
+  }
+
+  return str;
+}
+
+/* Generates service exceptions spread evenly through the year, each on
+   a distinct day */
+static GString *generate_calendar_dates(GRand *rand) {
+  GString *str;
+  int interval;
+
+  str = g_string_new("service_id,date,exception_type\n");
+  if(exceptions_per_service > 0) {
+    interval = MAX(SERVICE_DAYS / exceptions_per_service, 1);
+    for(int service = 0; service < num_services; service++) {
+      for(int exception = 0;
+          exception < exceptions_per_service &&
+            exception * interval < SERVICE_DAYS;
+          exception++) {
+        g_string_append_printf(str, "C%d,", service);
+        append_date(str,
+                    exception * interval +
+                    g_rand_int_range(rand, 0, interval));
+        g_string_append_printf(str, ",%d\n", g_rand_int_range(rand, 1, 3));
+      }
+    }
+  }
+
+  return str;
+}
+
+/* Generates the routes, all of them bus routes */
+static GString *generate_routes(GRand *rand) {
+  GString *str;
+
+  str = g_string_new("route_id,agency_id,route_short_name,"
+                     "route_long_name,route_type,route_color\n");
+  for(int route = 0; route < num_routes; route++) {
+    g_string_append_printf(str,
+                           "R%d,A0,%d,Route %d Crosstown,3,%06X\n",
+                           route,
+                           route,
+                           route,
+                           (route * 2654435761u) & 0xffffff);
+  }
+
+  return str;
+}
+
+/* Generates the trips on each route, assigning services in turn and
+   alternating between directions; trip IDs are numbered so they sort
+   in the order trips are generated */
+static GString *generate_trips(GRand *rand) {
+  GString *str;
+
+  str = g_string_new("route_id,service_id,trip_id,trip_headsign,"
+                     "direction_id,block_id\n");
+  for(int route = 0; route < num_routes; route++) {
+    for(int trip = 0; trip < trips_per_route; trip++) {
+      g_string_append_printf(str,
+                             "R%d,C%d,T%08d,Route %d %s,%d,B%d_%d\n",
+                             route,
+                             trip % num_services,
+                             route * trips_per_route + trip,
+                             route,
+                             trip % 2? "Inbound": "Outbound",
+                             trip % 2,
+                             route,
+                             trip / 8);
+    }
+  }
+
+  return str;
+}
+
+/* Generates the stop times of every trip in order of trip ID and stop
+   sequence, as real feeds usually are. Each route visits a fixed,
+   randomly chosen sequence of stops, and its trips start at even
+   intervals through the day */
+static GString *generate_stop_times(GRand *rand) {
+  GString *str;
+  int *route_stops, *intervals;
+  int trip_start, time_value;
+  double distance;
+
+  route_stops = g_new(int, stops_per_trip);
+  intervals = g_new(int, stops_per_trip);
+
+  str = g_string_new("trip_id,arrival_time,departure_time,stop_id,"
+                     "stop_sequence,stop_headsign,shape_dist_traveled\n");
+  for(int route = 0; route < num_routes; route++) {
+    for(int stop = 0; stop < stops_per_trip; stop++) {
+      route_stops[stop] = g_rand_int_range(rand, 0, num_stops);
+      intervals[stop] = g_rand_int_range(rand,
+                                         MIN_STOP_INTERVAL,
+                                         MAX_STOP_INTERVAL + 1);
+    }
+
+    for(int trip = 0; trip < trips_per_route; trip++) {
+      trip_start = FIRST_TRIP_START +
+        (LAST_TRIP_START - FIRST_TRIP_START) / trips_per_route * trip;
+      time_value = trip_start;
+      distance = 0;
+
+      for(int stop = 0; stop < stops_per_trip; stop++) {
+        if(stop > 0) {
+          time_value += intervals[stop];
+          distance += intervals[stop] / 180.0;
+        }
+
+        g_string_append_printf(str,
+                               "T%08d,",
+                               route * trips_per_route + trip);
+        append_time(str, time_value);
+        g_string_append_c(str, ',');
+        append_time(str, time_value);
+        g_string_append_printf(str,
+                               ",S%d,%d,,%.2f\n",
+                               route_stops[stop],
+                               stop + 1,
+                               distance);
+      }
+    }
+  }
+
+  g_free(intervals);
+  g_free(route_stops);
+
+  return str;
+}
+
+int main(int argc, char *argv[]) {
+  static const GOptionEntry option_entries[] = {
+    { "routes", 'r', 0, G_OPTION_ARG_INT, &num_routes,
+      "Generate N routes", "N" },
+    { "trips-per-route", 't', 0, G_OPTION_ARG_INT, &trips_per_route,
+      "Generate N trips on each route", "N" },
+    { "stops-per-trip", 'p', 0, G_OPTION_ARG_INT, &stops_per_trip,
+      "Make each trip visit N stops", "N" },
+    { "stops", 's', 0, G_OPTION_ARG_INT, &num_stops,
+      "Generate N stops", "N" },
+    { "services", 'c', 0, G_OPTION_ARG_INT, &num_services,
+      "Generate N service schedules", "N" },
+    { "calendar-density", 'd', 0, G_OPTION_ARG_DOUBLE, &calendar_density,
+      "Run each service on a day of the week with probability P", "P" },
+    { "exceptions", 'e', 0, G_OPTION_ARG_INT, &exceptions_per_service,
+      "Generate N service exceptions per service", "N" },
+    { "seed", 0, 0, G_OPTION_ARG_INT, &seed,
+      "Seed the random-number generator with N", "N" },
+    { NULL }
+  };
+  static const struct {
+    const char *filename;
+    GString *(*generate)(GRand *rand);
+  } files[] = {
+    { "agency.txt",         generate_agencies },
+    { "stops.txt",          generate_stops },
+    { "calendar.txt",       generate_calendars },
+    { "calendar_dates.txt", generate_calendar_dates },
+    { "routes.txt",         generate_routes },
+    { "trips.txt",          generate_trips },
+    { "stop_times.txt",     generate_stop_times }
+  };
+
+  int result = EXIT_FAILURE;
+  GOptionContext *option_context;
+  GError *option_error = NULL;
+  GString *contents[G_N_ELEMENTS(files)];
+  GRand *rand;
+  struct zip *gtfs_zip;
+  struct zip_source *source;
+  int zip_error;
+  char zip_error_str[256];
+  unsigned int index;
+
+  option_context = g_option_context_new("gtfs-file");
+  g_option_context_add_main_entries(option_context, option_entries, NULL);
+  if(!g_option_context_parse(option_context, &argc, &argv, &option_error)) {
+    fprintf(stderr, "Error: %s\n", option_error->message);
+    g_error_free(option_error);
+    argc = 0;
+  }
+  else if(num_routes < 1 || trips_per_route < 1 || stops_per_trip < 1 ||
+          num_stops < 1 || num_services < 1 || exceptions_per_service < 0) {
+    fprintf(stderr, "Error: Every count must be at least 1\n");
+    argc = 0;
+  }
+  g_option_context_free(option_context);
+
+  if(argc != 2) {
+    puts("Usage: gen_gtfs [--routes N] [--trips-per-route N] "
+         "[--stops-per-trip N] [--stops N] [--services N] "
+         "[--calendar-density P] [--exceptions N] [--seed N] gtfs-file");
+    return result;
+  }
+
+  /* Generate each file in memory, then write them all to the bundle */
+  rand = g_rand_new_with_seed(seed);
+  for(index = 0; index < G_N_ELEMENTS(files); index++) {
+    contents[index] = files[index].generate(rand);
+  }
+  g_rand_free(rand);
+
+  gtfs_zip = zip_open(argv[1], ZIP_CREATE | ZIP_TRUNCATE, &zip_error);
+  if(gtfs_zip) {
+    result = EXIT_SUCCESS;
+    for(index = 0; index < G_N_ELEMENTS(files); index++) {
+      source = zip_source_buffer(gtfs_zip,
+                                 contents[index]->str,
+                                 contents[index]->len,
+                                 0);
+      if(source == NULL ||
+         zip_add(gtfs_zip, files[index].filename, source) < 0) {
+        fprintf(stderr,
+                "Error adding \"%s\" to bundle: %s\n",
+                files[index].filename,
+                zip_strerror(gtfs_zip));
+        if(source) {
+          zip_source_free(source);
+        }
+        result = EXIT_FAILURE;
+      }
+    }
+
+    if(zip_close(gtfs_zip) != 0) {
+      fprintf(stderr,
+              "Error writing bundle: %s\n",
+              zip_strerror(gtfs_zip));
+      result = EXIT_FAILURE;
+    }
+  }
+  else {
+    zip_error_to_str(zip_error_str,
+                     sizeof(zip_error_str),
+                     zip_error,
+                     errno);
+    fprintf(stderr, "Error creating bundle: %s\n", zip_error_str);
+  }
+
+  if(result == EXIT_SUCCESS) {
+    printf("%d routes, %d trips, %d stop times, %d stops, %d services\n",
+           num_routes,
+           num_routes * trips_per_route,
+           num_routes * trips_per_route * stops_per_trip,
+           num_stops,
+           num_services);
+  }
+
+  for(index = 0; index < G_N_ELEMENTS(files); index++) {
+    g_string_free(contents[index], TRUE);
+  }
+
+  return result;
+}
@@ -0,0 +1,1006 @@
+/* Writing the records of a GTFS file to a columnar file in the Apache
+   Arrow IPC file format.
+
+   An Arrow file is a sequence of messages, each a block of metadata
+   encoded as a FlatBuffer followed by a body holding the message's
+   data buffers, between a leading magic number and a trailing footer
+   that locates every message. The metadata are built here with a
+   minimal FlatBuffer builder rather than through the Arrow or
+   FlatBuffers libraries.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <assert.h>
+#include <errno.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gtfs_arrow.h"
+#include "gtfs_service_days.h"
+
+/* Arrow data are stored little-endian, and we write them as they are
+   held in memory */
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Arrow files can only be written on little-endian machines"
+#endif
+
+/* The magic number at the start and end of an Arrow file, padded to
+   eight bytes at the start */
+#define ARROW_MAGIC "ARROW1"
+#define ARROW_MAGIC_SIZE 6
+#define ARROW_MAGIC_PADDED_SIZE 8
+
+/* The marker preceding each message's metadata, and the alignment of
+   metadata and data buffers within the file */
+#define ARROW_CONTINUATION 0xffffffff
+#define ARROW_ALIGNMENT 8
+
+/* Values from Arrow's Schema.fbs and Message.fbs: the metadata
+   version, the types of message header and of field, and the
+   parameters of those types */
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_DICTIONARY_BATCH 2
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_BOOL 6
+#define ARROW_TYPE_DATE 8
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_DATE_UNIT_DAY 0
+
+/* The most fields in any FlatBuffer table we build */
+#define FB_MAX_FIELDS 8
+
+/* The most data buffers a column needs: its validity bitmap and,
+   for strings, its offsets and their data */
+#define MAX_COLUMN_BUFFERS 3
+
+/* ---------------------------------------------------------------- */
+
+/* A FlatBuffer under construction. FlatBuffers are built back to
+   front, children before their parents, so the buffer is filled from
+   its end and each object is identified by its distance from the end
+   of the buffer (its "position") */
+typedef struct {
+  uint8_t *data;
+  size_t capacity, size;
+
+  /* The position of the start of the table being built and of each
+     of its fields (zero for fields not set) */
+  size_t table_start;
+  size_t field_positions[FB_MAX_FIELDS];
+} fb_builder_t;
+
+/* A growable buffer holding the data of a column */
+typedef struct {
+  uint8_t *data;
+  size_t size, capacity;
+} arrow_buffer_t;
+
+/* The location of a message within the file, as recorded in its
+   footer (Arrow's Block struct) */
+typedef struct {
+  int64_t offset;
+  int32_t metadata_length;
+  int32_t padding;
+  int64_t body_length;
+} arrow_block_t;
+
+/* The length and null count of a column in a record batch (Arrow's
+   FieldNode struct) and the location of a data buffer within a
+   message's body (its Buffer struct) */
+typedef struct {
+  int64_t length;
+  int64_t null_count;
+} arrow_field_node_t;
+
+typedef struct {
+  int64_t offset;
+  int64_t length;
+} arrow_buffer_spec_t;
+
+/* A column of the file, into which the values of a field are
+   gathered until the next record batch is written */
+typedef struct {
+  const gtfs_field_spec_t *field_spec;
+  char *name;
+
+  /* The column's validity bitmap, its values (a bitmap of booleans,
+     an array of 32-bit integers, doubles or dictionary indices, or the
+     offsets of its strings) and the data of its strings, for the
+     records in the batch being gathered, and the number of those
+     records missing a value */
+  arrow_buffer_t validity;
+  arrow_buffer_t values;
+  arrow_buffer_t data;
+  unsigned long null_count;
+
+  /* For a dictionary-encoded column, a mapping from each distinct
+     string to its index in the dictionary (plus one), the size of the
+     dictionary, whether any of it has been written yet and the
+     strings added since it was last written (as offsets and their
+     data); NULL for other columns */
+  GHashTable *dictionary;
+  unsigned int dictionary_size;
+  bool dictionary_written;
+  unsigned int dictionary_pending;
+  arrow_buffer_t dictionary_offsets;
+  arrow_buffer_t dictionary_data;
+} arrow_column_t;
+
+struct gtfs_arrow_writer {
+  char *path;
+  FILE *file;
+
+  /* The number of bytes written so far, and the value of "errno" once
+     a write has failed (or zero) */
+  uint64_t offset;
+  int error;
+
+  /* The file's columns and the number of records gathered in them
+     since the last record batch was written */
+  unsigned int num_columns;
+  arrow_column_t *columns;
+  unsigned int num_records;
+
+  /* The builder of each message's metadata, and the locations of the
+     dictionary and record batches written, for the footer */
+  fb_builder_t builder;
+  GArray *dictionary_blocks;
+  GArray *record_batch_blocks;
+
+  /* The body of the message being written: its data buffers (NULL
+     for those left empty), where each is placed within the body and,
+     for a record batch, the length and null count of each column */
+  unsigned int num_body_buffers;
+  const arrow_buffer_t **body_buffers;
+  arrow_buffer_spec_t *buffer_specs;
+  arrow_field_node_t *field_nodes;
+};
+
+/* ---------------------------------------------------------------- */
+
+/* Makes room for "size" more bytes at the front of a FlatBuffer */
+static void fb_reserve(fb_builder_t *builder, size_t size) {
+  uint8_t *data;
+  size_t capacity;
+
+  if(builder->capacity - builder->size < size) {
+    capacity = MAX(builder->capacity * 2, builder->size + size);
+    data = g_malloc(capacity);
+    if(builder->size > 0) {
+      memcpy(data + capacity - builder->size,
+             builder->data + builder->capacity - builder->size,
+             builder->size);
+    }
+    g_free(builder->data);
+    builder->data = data;
+    builder->capacity = capacity;
+  }
+}
+
+/* Adds "size" bytes to the front of a FlatBuffer, copied from "data"
+   or, if it is NULL, zeroed */
+static void fb_push(fb_builder_t *builder, const void *data, size_t size) {
+  uint8_t *front;
+
+  if(size == 0) {
+    return;
+  }
+
+  fb_reserve(builder, size);
+  builder->size += size;
+  front = builder->data + builder->capacity - builder->size;
+  if(data) {
+    memcpy(front, data, size);
+  }
+  else {
+    memset(front, 0, size);
+  }
+}
+
+/* Pads a FlatBuffer so that an object of "size" bytes added next
+   starts at a multiple of "alignment" (a power of two) from its end;
+   as the finished buffer's size is a multiple of the greatest
+   alignment, this aligns the object from the buffer's start too */
+static void fb_align(fb_builder_t *builder, size_t alignment, size_t size) {
+  fb_push(builder, NULL, -(builder->size + size) & (alignment - 1));
+}
+
+/* Empties a FlatBuffer to build another */
+static void fb_reset(fb_builder_t *builder) {
+  builder->size = 0;
+}
+
+/* Returns the start of a FlatBuffer's data */
+static const uint8_t *fb_data(const fb_builder_t *builder) {
+  return builder->data + builder->capacity - builder->size;
+}
+
+/* Starts a table, whose fields are then added before it is ended */
+static void fb_start_table(fb_builder_t *builder) {
+  builder->table_start = builder->size;
+  memset(builder->field_positions, 0, sizeof(builder->field_positions));
+}
+
+/* Adds a scalar field to the table being built */
+static void fb_add_scalar(fb_builder_t *builder,
+                          unsigned int field,
+                          const void *value,
+                          size_t size) {
+  fb_align(builder, size, 0);
+  fb_push(builder, value, size);
+  builder->field_positions[field] = builder->size;
+}
+
+static void fb_add_bool(fb_builder_t *builder,
+                        unsigned int field,
+                        bool value) {
+  uint8_t scalar = value;
+
+  fb_add_scalar(builder, field, &scalar, sizeof(scalar));
+}
+
+static void fb_add_uint8(fb_builder_t *builder,
+                         unsigned int field,
+                         uint8_t value) {
+  fb_add_scalar(builder, field, &value, sizeof(value));
+}
+
+static void fb_add_int16(fb_builder_t *builder,
+                         unsigned int field,
+                         int16_t value) {
+  fb_add_scalar(builder, field, &value, sizeof(value));
+}
+
+static void fb_add_int32(fb_builder_t *builder,
+                         unsigned int field,
+                         int32_t value) {
+  fb_add_scalar(builder, field, &value, sizeof(value));
+}
+
+static void fb_add_int64(fb_builder_t *builder,
+                         unsigned int field,
+                         int64_t value) {
+  fb_add_scalar(builder, field, &value, sizeof(value));
+}
+
+/* Adds a field referring to an object (a table, string or vector)
+   already built, given its position */
+static void fb_add_offset(fb_builder_t *builder,
+                          unsigned int field,
+                          size_t position) {
+  uint32_t offset;
+
+  /* An offset is relative to the field holding it */
+  fb_align(builder, sizeof(offset), 0);
+  offset = builder->size + sizeof(offset) - position;
+  fb_add_scalar(builder, field, &offset, sizeof(offset));
+}
+
+/* Ends the table being built, preceding it with its vtable (the
+   offsets of its fields from its start); returns its position */
+static size_t fb_end_table(fb_builder_t *builder) {
+  uint16_t vtable[2 + FB_MAX_FIELDS];
+  unsigned int num_fields = 0;
+  int32_t vtable_offset;
+  size_t table;
+
+  /* The table starts with the offset of its vtable, filled in once
+     the vtable is built */
+  fb_align(builder, sizeof(vtable_offset), 0);
+  fb_push(builder, NULL, sizeof(vtable_offset));
+  table = builder->size;
+
+  for(unsigned int field = 0; field < FB_MAX_FIELDS; field++) {
+    if(builder->field_positions[field]) {
+      vtable[2 + field] = table - builder->field_positions[field];
+      num_fields = field + 1;
+    }
+    else {
+      vtable[2 + field] = 0;
+    }
+  }
+  vtable[0] = (2 + num_fields) * sizeof(vtable[0]);
+  vtable[1] = table - builder->table_start;
+  fb_push(builder, vtable, vtable[0]);
+
+  /* The vtable lies before the table, at the offset subtracted from
+     the table's start to find it */
+  vtable_offset = builder->size - table;
+  memcpy(builder->data + builder->capacity - table,
+         &vtable_offset,
+         sizeof(vtable_offset));
+
+  return table;
+}
+
+/* Adds a string; returns its position */
+static size_t fb_create_string(fb_builder_t *builder, const char *str) {
+  uint32_t length = strlen(str);
+
+  /* The string is preceded by its length and followed by a NUL */
+  fb_align(builder, sizeof(length), length + 1);
+  fb_push(builder, NULL, 1);
+  fb_push(builder, str, length);
+  fb_push(builder, &length, sizeof(length));
+
+  return builder->size;
+}
+
+/* Adds a vector of "count" structs of "size" bytes, each aligned to
+   eight bytes; returns its position */
+static size_t fb_create_struct_vector(fb_builder_t *builder,
+                                      const void *structs,
+                                      unsigned int count,
+                                      size_t size) {
+  uint32_t length = count;
+
+  fb_align(builder, sizeof(int64_t), count * size);
+  fb_push(builder, structs, count * size);
+  fb_push(builder, &length, sizeof(length));
+
+  return builder->size;
+}
+
+/* Adds a vector of references to the objects at the given positions;
+   returns its position */
+static size_t fb_create_offset_vector(fb_builder_t *builder,
+                                      const size_t *positions,
+                                      unsigned int count) {
+  uint32_t length = count, offset;
+
+  fb_align(builder, sizeof(offset), count * sizeof(offset));
+  for(unsigned int index = count; index > 0; index--) {
+    offset = builder->size + sizeof(offset) - positions[index - 1];
+    fb_push(builder, &offset, sizeof(offset));
+  }
+  fb_push(builder, &length, sizeof(length));
+
+  return builder->size;
+}
+
+/* Finishes a FlatBuffer with the offset of its root table, padding it
+   to a multiple of the alignment Arrow requires */
+static void fb_finish(fb_builder_t *builder, size_t root) {
+  uint32_t offset;
+
+  fb_align(builder, ARROW_ALIGNMENT, sizeof(offset));
+  offset = builder->size + sizeof(offset) - root;
+  fb_push(builder, &offset, sizeof(offset));
+}
+
+/* ---------------------------------------------------------------- */
+
+/* Appends "size" bytes to a column's buffer */
+static void buffer_append(arrow_buffer_t *buffer,
+                          const void *data,
+                          size_t size) {
+  if(buffer->capacity - buffer->size < size) {
+    buffer->capacity = MAX(buffer->capacity * 2, buffer->size + size);
+    buffer->data = g_realloc(buffer->data, buffer->capacity);
+  }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+}
+
+static void buffer_append_int32(arrow_buffer_t *buffer, int32_t value) {
+  buffer_append(buffer, &value, sizeof(value));
+}
+
+static void buffer_append_double(arrow_buffer_t *buffer, double value) {
+  buffer_append(buffer, &value, sizeof(value));
+}
+
+/* Sets the bit for a record in a bitmap, to which records are added
+   in order */
+static void buffer_append_bit(arrow_buffer_t *buffer,
+                              unsigned int record,
+                              bool value) {
+  static const uint8_t zero = 0;
+
+  if(record % 8 == 0) {
+    buffer_append(buffer, &zero, sizeof(zero));
+  }
+  if(value) {
+    buffer->data[record / 8] |= 1 << (record % 8);
+  }
+}
+
+/* Returns the index of a string in a column's dictionary, adding it
+   if it is not there already */
+static int32_t dictionary_index(arrow_column_t *column, const char *str) {
+  gpointer value;
+  size_t length;
+
+  value = g_hash_table_lookup(column->dictionary, str);
+  if(value == NULL) {
+    length = strlen(str);
+    value = GUINT_TO_POINTER(++column->dictionary_size);
+    g_hash_table_insert(column->dictionary, g_strndup(str, length), value);
+
+    buffer_append(&column->dictionary_data, str, length);
+    buffer_append_int32(&column->dictionary_offsets,
+                        column->dictionary_data.size);
+    column->dictionary_pending++;
+  }
+
+  return GPOINTER_TO_UINT(value) - 1;
+}
+
+/* Empties a column's buffers once its values have been written */
+static void reset_column(arrow_column_t *column) {
+  column->validity.size = 0;
+  column->values.size = 0;
+  column->data.size = 0;
+  column->null_count = 0;
+
+  /* The offsets of a column's strings start from zero */
+  if(column->field_spec->type == TYPE_STRING && !column->dictionary) {
+    buffer_append_int32(&column->values, 0);
+  }
+}
+
+/* ---------------------------------------------------------------- */
+
+/* Writes bytes to the file, unless a write has already failed */
+static void write_bytes(gtfs_arrow_writer_t *writer,
+                        const void *data,
+                        size_t size) {
+  if(!writer->error && fwrite(data, 1, size, writer->file) != size) {
+    writer->error = errno;
+    fprintf(stderr,
+            "write_bytes: "
+            "Error writing \"%s\": %s\n",
+            writer->path,
+            g_strerror(writer->error));
+  }
+  writer->offset += size;
+}
+
+/* Pads the file to the alignment Arrow requires */
+static void write_padding(gtfs_arrow_writer_t *writer) {
+  static const uint8_t zeros[ARROW_ALIGNMENT];
+
+  write_bytes(writer, zeros, -writer->offset & (ARROW_ALIGNMENT - 1));
+}
+
+/* Adds a data buffer to the body of the message being written; NULL
+   adds an empty buffer */
+static void add_body_buffer(gtfs_arrow_writer_t *writer,
+                            const arrow_buffer_t *buffer) {
+  writer->body_buffers[writer->num_body_buffers++] = buffer;
+}
+
+/* Places each data buffer within the body of the message being
+   written; returns the length of the body */
+static int64_t lay_out_body(gtfs_arrow_writer_t *writer) {
+  int64_t offset = 0, length;
+
+  for(unsigned int index = 0; index < writer->num_body_buffers; index++) {
+    length = writer->body_buffers[index]?
+      writer->body_buffers[index]->size: 0;
+    writer->buffer_specs[index].offset = offset;
+    writer->buffer_specs[index].length = length;
+    offset += (length + ARROW_ALIGNMENT - 1) & -ARROW_ALIGNMENT;
+  }
+
+  return offset;
+}
+
+/* Writes a message whose metadata are held, finished, by the writer's
+   builder, followed by its body, recording its location in
+   "block" */
+static void write_message(gtfs_arrow_writer_t *writer, arrow_block_t *block) {
+  const arrow_buffer_t *buffer;
+  uint32_t prefix[2];
+
+  /* The metadata are preceded by a continuation marker and their
+     length */
+  prefix[0] = ARROW_CONTINUATION;
+  prefix[1] = writer->builder.size;
+
+  block->offset = writer->offset;
+  block->metadata_length = sizeof(prefix) + writer->builder.size;
+  block->padding = 0;
+  write_bytes(writer, prefix, sizeof(prefix));
+  write_bytes(writer, fb_data(&writer->builder), writer->builder.size);
+
+  for(unsigned int index = 0; index < writer->num_body_buffers; index++) {
+    if((buffer = writer->body_buffers[index]) && buffer->size > 0) {
+      write_bytes(writer, buffer->data, buffer->size);
+      write_padding(writer);
+    }
+  }
+  block->body_length =
+    writer->offset - block->offset - block->metadata_length;
+}
+
+/* Builds a Message table wrapping a message header */
+static size_t build_message(fb_builder_t *builder,
+                            uint8_t header_type,
+                            size_t header,
+                            int64_t body_length) {
+  fb_start_table(builder);
+  fb_add_int64(builder, 3, body_length);
+  fb_add_offset(builder, 2, header);
+  fb_add_int16(builder, 0, ARROW_METADATA_V5);
+  fb_add_uint8(builder, 1, header_type);
+  return fb_end_table(builder);
+}
+
+/* Builds an Int type table for 32-bit signed integers */
+static size_t build_int32_type(fb_builder_t *builder) {
+  fb_start_table(builder);
+  fb_add_int32(builder, 0, 32);
+  fb_add_bool(builder, 1, true);
+  return fb_end_table(builder);
+}
+
+/* Builds the type table of a column's values, storing the number of
+   its type in "type_type" */
+static size_t build_column_type(fb_builder_t *builder,
+                                const arrow_column_t *column,
+                                uint8_t *type_type) {
+  switch(column->field_spec->type) {
+  case TYPE_BOOLEAN:
+    *type_type = ARROW_TYPE_BOOL;
+    fb_start_table(builder);
+    return fb_end_table(builder);
+
+  case TYPE_INTEGER:
+  case TYPE_TIME:
+    *type_type = ARROW_TYPE_INT;
+    return build_int32_type(builder);
+
+  case TYPE_DOUBLE:
+    *type_type = ARROW_TYPE_FLOATING_POINT;
+    fb_start_table(builder);
+    fb_add_int16(builder, 0, ARROW_PRECISION_DOUBLE);
+    return fb_end_table(builder);
+
+  case TYPE_STRING:
+    *type_type = ARROW_TYPE_UTF8;
+    fb_start_table(builder);
+    return fb_end_table(builder);
+
+  case TYPE_DATE:
+    *type_type = ARROW_TYPE_DATE;
+    fb_start_table(builder);
+    fb_add_int16(builder, 0, ARROW_DATE_UNIT_DAY);
+    return fb_end_table(builder);
+
+  default:
+    /* Unrecognized field type; this should never be reached */
+    assert(false);
+    return 0;
+  }
+}
+
+/* Builds the Schema table describing the file's columns, which both
+   its first message and its footer hold */
+static size_t build_schema(gtfs_arrow_writer_t *writer) {
+  fb_builder_t *builder = &writer->builder;
+  const arrow_column_t *column;
+  size_t *fields, name, type, index_type, dictionary, children, schema;
+  uint8_t type_type;
+
+  fields = g_new(size_t, writer->num_columns);
+  for(unsigned int field_number = 0;
+      field_number < writer->num_columns;
+      field_number++) {
+    column = &writer->columns[field_number];
+
+    name = fb_create_string(builder, column->name);
+    type = build_column_type(builder, column, &type_type);
+
+    /* A dictionary-encoded column's values are indices into the
+       dictionary identified by its field number */
+    dictionary = 0;
+    if(column->dictionary) {
+      index_type = build_int32_type(builder);
+      fb_start_table(builder);
+      fb_add_int64(builder, 0, field_number);
+      fb_add_offset(builder, 1, index_type);
+      fb_add_bool(builder, 2, false);
+      dictionary = fb_end_table(builder);
+    }
+    children = fb_create_offset_vector(builder, NULL, 0);
+
+    fb_start_table(builder);
+    fb_add_offset(builder, 0, name);
+    fb_add_bool(builder, 1, true);
+    fb_add_uint8(builder, 2, type_type);
+    fb_add_offset(builder, 3, type);
+    if(dictionary) {
+      fb_add_offset(builder, 4, dictionary);
+    }
+    fb_add_offset(builder, 5, children);
+    fields[field_number] = fb_end_table(builder);
+  }
+
+  schema = fb_create_offset_vector(builder, fields, writer->num_columns);
+  g_free(fields);
+
+  fb_start_table(builder);
+  fb_add_offset(builder, 1, schema);
+  return fb_end_table(builder);
+}
+
+/* Builds a RecordBatch table describing the body of the message being
+   written, which holds "length" records in "num_nodes" columns */
+static size_t build_record_batch(gtfs_arrow_writer_t *writer,
+                                 int64_t length,
+                                 unsigned int num_nodes) {
+  fb_builder_t *builder = &writer->builder;
+  size_t nodes, buffers;
+
+  nodes = fb_create_struct_vector(builder,
+                                  writer->field_nodes,
+                                  num_nodes,
+                                  sizeof(arrow_field_node_t));
+  buffers = fb_create_struct_vector(builder,
+                                    writer->buffer_specs,
+                                    writer->num_body_buffers,
+                                    sizeof(arrow_buffer_spec_t));
+
+  fb_start_table(builder);
+  fb_add_int64(builder, 0, length);
+  fb_add_offset(builder, 1, nodes);
+  fb_add_offset(builder, 2, buffers);
+  return fb_end_table(builder);
+}
+
+/* Writes the strings added to a column's dictionary since it was last
+   written, as a delta to what was written before */
+static void write_dictionary_batch(gtfs_arrow_writer_t *writer,
+                                   unsigned int field_number) {
+  fb_builder_t *builder = &writer->builder;
+  arrow_column_t *column = &writer->columns[field_number];
+  arrow_block_t block;
+  int64_t body_length;
+  size_t record_batch, dictionary_batch;
+
+  writer->num_body_buffers = 0;
+  add_body_buffer(writer, NULL);
+  add_body_buffer(writer, &column->dictionary_offsets);
+  add_body_buffer(writer, &column->dictionary_data);
+  body_length = lay_out_body(writer);
+  writer->field_nodes[0].length = column->dictionary_pending;
+  writer->field_nodes[0].null_count = 0;
+
+  fb_reset(builder);
+  record_batch = build_record_batch(writer, column->dictionary_pending, 1);
+  fb_start_table(builder);
+  fb_add_int64(builder, 0, field_number);
+  fb_add_offset(builder, 1, record_batch);
+  fb_add_bool(builder, 2, column->dictionary_written);
+  dictionary_batch = fb_end_table(builder);
+  fb_finish(builder, build_message(builder,
+                                   ARROW_HEADER_DICTIONARY_BATCH,
+                                   dictionary_batch,
+                                   body_length));
+
+  write_message(writer, &block);
+  g_array_append_val(writer->dictionary_blocks, block);
+
+  column->dictionary_written = true;
+  column->dictionary_pending = 0;
+  column->dictionary_offsets.size = 0;
+  column->dictionary_data.size = 0;
+  buffer_append_int32(&column->dictionary_offsets, 0);
+}
+
+/* Writes the records gathered in the file's columns as a record
+   batch, preceded by any additions to their dictionaries */
+static void write_record_batch(gtfs_arrow_writer_t *writer) {
+  fb_builder_t *builder = &writer->builder;
+  arrow_column_t *column;
+  arrow_block_t block;
+  int64_t body_length;
+
+  for(unsigned int field_number = 0;
+      field_number < writer->num_columns;
+      field_number++) {
+    column = &writer->columns[field_number];
+    if(column->dictionary &&
+       (!column->dictionary_written || column->dictionary_pending > 0)) {
+      write_dictionary_batch(writer, field_number);
+    }
+  }
+
+  /* Each column has a validity bitmap, left empty if no value is
+     missing, followed by its values and, for strings not
+     dictionary-encoded, their data */
+  writer->num_body_buffers = 0;
+  for(unsigned int field_number = 0;
+      field_number < writer->num_columns;
+      field_number++) {
+    column = &writer->columns[field_number];
+    writer->field_nodes[field_number].length = writer->num_records;
+    writer->field_nodes[field_number].null_count = column->null_count;
+
+    add_body_buffer(writer, column->null_count > 0? &column->validity: NULL);
+    add_body_buffer(writer, &column->values);
+    if(column->field_spec->type == TYPE_STRING && !column->dictionary) {
+      add_body_buffer(writer, &column->data);
+    }
+  }
+  body_length = lay_out_body(writer);
+
+  fb_reset(builder);
+  fb_finish(builder, build_message(builder,
+                                   ARROW_HEADER_RECORD_BATCH,
+                                   build_record_batch(writer,
+                                                      writer->num_records,
+                                                      writer->num_columns),
+                                   body_length));
+
+  write_message(writer, &block);
+  g_array_append_val(writer->record_batch_blocks, block);
+
+  for(unsigned int field_number = 0;
+      field_number < writer->num_columns;
+      field_number++) {
+    reset_column(&writer->columns[field_number]);
+  }
+  writer->num_records = 0;
+}
+
+/* Frees a writer and everything it holds, closing its file if it is
+   still open */
+static void free_writer(gtfs_arrow_writer_t *writer) {
+  arrow_column_t *column;
+
+  if(writer->file) {
+    fclose(writer->file);
+  }
+
+  for(unsigned int field_number = 0;
+      field_number < writer->num_columns;
+      field_number++) {
+    column = &writer->columns[field_number];
+    g_free(column->name);
+    g_free(column->validity.data);
+    g_free(column->values.data);
+    g_free(column->data.data);
+    if(column->dictionary) {
+      g_hash_table_destroy(column->dictionary);
+    }
+    g_free(column->dictionary_offsets.data);
+    g_free(column->dictionary_data.data);
+  }
+  g_free(writer->columns);
+
+  g_free(writer->builder.data);
+  g_array_free(writer->dictionary_blocks, TRUE);
+  g_array_free(writer->record_batch_blocks, TRUE);
+  g_free(writer->body_buffers);
+  g_free(writer->buffer_specs);
+  g_free(writer->field_nodes);
+  g_free(writer->path);
+  g_free(writer);
+}
+
+/* ---------------------------------------------------------------- */
+
+gtfs_arrow_writer_t *gtfs_arrow_writer_open(const char *path,
+                                            const gtfs_file_spec_t
+                                            *gtfs_file_spec,
+                                            char **column_names,
+                                            char **errmsg) {
+  gtfs_arrow_writer_t *writer;
+  arrow_column_t *column;
+  arrow_block_t block;
+
+  writer = g_new0(gtfs_arrow_writer_t, 1);
+  writer->path = g_strdup(path);
+  writer->num_columns = gtfs_file_spec->num_fields;
+  writer->columns = g_new0(arrow_column_t, writer->num_columns);
+  writer->dictionary_blocks = g_array_new(FALSE, FALSE, sizeof(block));
+  writer->record_batch_blocks = g_array_new(FALSE, FALSE, sizeof(block));
+  writer->body_buffers = g_new(const arrow_buffer_t *,
+                               writer->num_columns * MAX_COLUMN_BUFFERS);
+  writer->buffer_specs = g_new(arrow_buffer_spec_t,
+                               writer->num_columns * MAX_COLUMN_BUFFERS);
+  writer->field_nodes = g_new(arrow_field_node_t, writer->num_columns);
+
+  for(unsigned int field_number = 0;
+      field_number < writer->num_columns;
+      field_number++) {
+    column = &writer->columns[field_number];
+    column->field_spec = gtfs_file_spec->field_specs[field_number];
+    column->name = g_strdup(column_names[field_number]);
+
+    /* Dictionary-encode every string column except one that alone
+       identifies each record, whose values are all distinct */
+    if(column->field_spec->type == TYPE_STRING &&
+       !(gtfs_file_spec->num_key_fields == 1 &&
+         gtfs_file_spec->key_fields[0] == field_number)) {
+      column->dictionary = g_hash_table_new_full(g_str_hash,
+                                                 g_str_equal,
+                                                 g_free,
+                                                 NULL);
+      buffer_append_int32(&column->dictionary_offsets, 0);
+    }
+    reset_column(column);
+  }
+
+  if((writer->file = fopen(path, "wb")) == NULL) {
+    *errmsg = g_strdup(g_strerror(errno));
+    free_writer(writer);
+    return NULL;
+  }
+
+  /* Write the magic number followed by the schema */
+  write_bytes(writer, ARROW_MAGIC "\0", ARROW_MAGIC_PADDED_SIZE);
+  fb_reset(&writer->builder);
+  fb_finish(&writer->builder, build_message(&writer->builder,
+                                            ARROW_HEADER_SCHEMA,
+                                            build_schema(writer),
+                                            0));
+  writer->num_body_buffers = 0;
+  write_message(writer, &block);
+
+  if(writer->error) {
+    *errmsg = g_strdup(g_strerror(writer->error));
+    free_writer(writer);
+    return NULL;
+  }
+
+  return writer;
+}
+
+void gtfs_arrow_writer_append(gtfs_arrow_writer_t *writer,
+                              unsigned int fields_present,
+                              const gtfs_field_value_t *field_values) {
+  arrow_column_t *column;
+  const gtfs_field_value_t *field_value;
+  unsigned int record = writer->num_records;
+
+  for(unsigned int field_number = 0;
+      field_number < writer->num_columns;
+      field_number++) {
+    column = &writer->columns[field_number];
+
+    /* A missing value is marked in the validity bitmap, and zero (or
+       an empty string) stored in its place */
+    field_value = (fields_present & (1 << field_number))?
+      &field_values[field_number]: NULL;
+    buffer_append_bit(&column->validity, record, field_value != NULL);
+    if(field_value == NULL) {
+      column->null_count++;
+    }
+
+    switch(column->field_spec->type) {
+    case TYPE_BOOLEAN:
+      buffer_append_bit(&column->values,
+                        record,
+                        field_value && field_value->boolean_value);
+      break;
+
+    case TYPE_INTEGER:
+      buffer_append_int32(&column->values,
+                          field_value? field_value->integer_value: 0);
+      break;
+
+    case TYPE_DOUBLE:
+      buffer_append_double(&column->values,
+                           field_value? field_value->double_value: 0);
+      break;
+
+    case TYPE_STRING:
+      if(column->dictionary) {
+        buffer_append_int32(&column->values,
+                            field_value?
+                            dictionary_index(column,
+                                             field_value->string_value):
+                            0);
+      }
+      else {
+        if(field_value) {
+          buffer_append(&column->data,
+                        field_value->string_value,
+                        strlen(field_value->string_value));
+        }
+        buffer_append_int32(&column->values, column->data.size);
+      }
+      break;
+
+    case TYPE_DATE:
+      buffer_append_int32(&column->values,
+                          field_value?
+                          gtfs_day_from_date(field_value->date_value):
+                          0);
+      break;
+
+    case TYPE_TIME:
+      buffer_append_int32(&column->values,
+                          field_value? field_value->time_value: 0);
+      break;
+
+    default:
+      /* Unrecognized field type; this should never be reached */
+      assert(false);
+    }
+  }
+
+  if(++writer->num_records == ARROW_RECORDS_PER_BATCH) {
+    write_record_batch(writer);
+  }
+}
+
+bool gtfs_arrow_writer_close(gtfs_arrow_writer_t *writer) {
+  static const uint32_t end_of_stream[2] = { ARROW_CONTINUATION, 0 };
+  fb_builder_t *builder = &writer->builder;
+  size_t schema, dictionaries, record_batches;
+  uint32_t footer_size;
+  bool result;
+
+  /* Write the records remaining, or an empty record batch if the file
+     has none, so every dictionary is written */
+  if(writer->num_records > 0 || writer->record_batch_blocks->len == 0) {
+    write_record_batch(writer);
+  }
+  write_bytes(writer, end_of_stream, sizeof(end_of_stream));
+
+  /* The footer repeats the schema and locates each dictionary and
+     record batch, and is followed by its size and the magic
+     number */
+  fb_reset(builder);
+  schema = build_schema(writer);
+  dictionaries = fb_create_struct_vector(builder,
+                                         writer->dictionary_blocks->data,
+                                         writer->dictionary_blocks->len,
+                                         sizeof(arrow_block_t));
+  record_batches =
+    fb_create_struct_vector(builder,
+                            writer->record_batch_blocks->data,
+                            writer->record_batch_blocks->len,
+                            sizeof(arrow_block_t));
+  fb_start_table(builder);
+  fb_add_int16(builder, 0, ARROW_METADATA_V5);
+  fb_add_offset(builder, 1, schema);
+  fb_add_offset(builder, 2, dictionaries);
+  fb_add_offset(builder, 3, record_batches);
+  fb_finish(builder, fb_end_table(builder));
+
+  footer_size = builder->size;
+  write_bytes(writer, fb_data(builder), builder->size);
+  write_bytes(writer, &footer_size, sizeof(footer_size));
+  write_bytes(writer, ARROW_MAGIC, ARROW_MAGIC_SIZE);
+
+  if(fclose(writer->file) != 0 && !writer->error) {
+    writer->error = errno;
+    fprintf(stderr,
+            "gtfs_arrow_writer_close: "
+            "Error writing \"%s\": %s\n",
+            writer->path,
+            g_strerror(writer->error));
+  }
+  writer->file = NULL;
+
+  result = !writer->error;
+  free_writer(writer);
+  return result;
+}
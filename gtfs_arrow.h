@@ -0,0 +1,62 @@
+/* Writing the records of a GTFS file to a columnar file in the Apache
+   Arrow IPC file format ("Feather version 2"), which analytics tools
+   can read directly. Each field becomes a typed column: booleans are
+   stored as Bool, integers and times (in seconds since midnight) as
+   Int32, doubles as Float64, dates as Date32 and strings as Utf8,
+   with strings likely to repeat dictionary-encoded. Records are
+   written in record batches ("row groups") of a bounded size as they
+   arrive, so only one batch is held in memory at a time, along with
+   the distinct values of each dictionary-encoded column.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_ARROW_H__
+#define __GTFS_ARROW_H__
+
+#include <stdbool.h>
+
+#include "gtfs_file.h"
+
+/* The number of records written in each record batch */
+#define ARROW_RECORDS_PER_BATCH 64 * 1024
+
+/* A columnar file being written */
+typedef struct gtfs_arrow_writer gtfs_arrow_writer_t;
+
+/* Creates the file at "path" to hold the records of a GTFS file, with
+   a column for each of its fields named from "column_names" (in field
+   order). Returns NULL and sets "errmsg" to a message (to be freed
+   with g_free) on failure */
+gtfs_arrow_writer_t *gtfs_arrow_writer_open(const char *path,
+                                            const gtfs_file_spec_t
+                                            *gtfs_file_spec,
+                                            char **column_names,
+                                            char **errmsg);
+
+/* Adds a record, given a bitmask of the fields present and the values
+   parsed for them, writing a record batch once enough records have
+   accumulated */
+void gtfs_arrow_writer_append(gtfs_arrow_writer_t *writer,
+                              unsigned int fields_present,
+                              const gtfs_field_value_t *field_values);
+
+/* Writes the records remaining and the file's footer and closes it;
+   returns FALSE if any part of the file could not be written */
+bool gtfs_arrow_writer_close(gtfs_arrow_writer_t *writer);
+
+#endif
@@ -0,0 +1,803 @@
+/* Reading the member files of a GTFS bundle, which may be either a
+   ZIP file or a directory holding the extracted files.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Include the definition of "madvise" */
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zip.h>
+#include <zlib.h>
+
+#include "gtfs_bundle.h"
+
+/* Signatures and sizes of the ZIP structures we read */
+#define ZIP_END_OF_CENTRAL_DIR_SIGNATURE 0x06054b50
+#define ZIP_END_OF_CENTRAL_DIR_SIZE 22
+#define ZIP_MAX_COMMENT_SIZE 0xffff
+#define ZIP_CENTRAL_DIR_ENTRY_SIGNATURE 0x02014b50
+#define ZIP_CENTRAL_DIR_ENTRY_SIZE 46
+#define ZIP_LOCAL_HEADER_SIGNATURE 0x04034b50
+#define ZIP_LOCAL_HEADER_SIZE 30
+
+/* Values marking a ZIP64 bundle, whose true values are stored
+   elsewhere */
+#define ZIP64_COUNT 0xffff
+#define ZIP64_SIZE 0xffffffff
+
+/* The compression methods we handle ourselves, and the flag marking
+   an encrypted member */
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+#define ZIP_FLAG_ENCRYPTED 0x0001
+
+/* The extension of the files read from a directory */
+#define GTFS_FILE_EXTENSION ".txt"
+
+/* A member file of a bundle */
+typedef struct {
+  char *name;
+
+  /* The member's compression method and flags, the CRC-32 of its
+     data, its compressed and uncompressed sizes and the offset of its
+     local header within the mapping of the bundle, when the bundle is
+     mapped */
+  unsigned int method;
+  unsigned int flags;
+  uint32_t crc;
+  uint64_t compressed_size;
+  uint64_t size;
+  uint64_t local_header_offset;
+} gtfs_bundle_entry_t;
+
+struct gtfs_bundle {
+  char *path;
+  bool is_directory;
+
+  /* The mapping of a ZIP bundle, or NULL if it is read through
+     libzip */
+  const unsigned char *map;
+  size_t map_size;
+
+  GArray *entries;
+  size_t buffer_size;
+  unsigned int num_inflate_buffers;
+};
+
+/* The ways in which a member's data are read */
+typedef enum {
+  MEMBER_MAPPED,
+  MEMBER_INFLATED,
+  MEMBER_LIBZIP
+} gtfs_member_source_t;
+
+/* A buffer in the ring an inflate thread fills, holding "size" bytes
+   of the member's data (zero at its end, or -1 on error) */
+typedef struct {
+  char *data;
+  ssize_t size;
+} gtfs_inflate_buffer_t;
+
+struct gtfs_member {
+  const gtfs_bundle_entry_t *entry;
+  gtfs_member_source_t source;
+
+  /* The member's data, when it is mapped (either the part of the
+     bundle's mapping holding a stored member or the mapping of an
+     extracted file, which "file_map" holds for unmapping) and the
+     offset of the next byte to read */
+  const unsigned char *data;
+  size_t size;
+  size_t offset;
+  void *file_map;
+  size_t file_map_size;
+
+  /* The zlib stream inflating a deflated member from the bundle's
+     mapping, and the CRC-32 of the data read so far from a member of
+     a ZIP bundle, checked once it has all been read as libzip would */
+  z_stream stream;
+  bool stream_ended;
+  bool check_crc;
+  uLong crc;
+
+  /* The libzip handles through which the member is otherwise read;
+     libzip handles cannot be shared between threads, so each member
+     opens the bundle for itself */
+  struct zip *zip;
+  struct zip_file *zip_file;
+
+  /* The buffer into which the member is read when it cannot be parsed
+     in place */
+  char *buffer;
+  size_t buffer_size;
+
+  /* The thread inflating the member ahead of its reader, when there
+     is one, and its ring of buffers: the thread takes free buffers,
+     fills them and passes them to the reader, which returns each one
+     once it has consumed it. "current_buffer" is the buffer being
+     consumed and "current_offset" the offset of its next unread byte;
+     "inflate_ended" is set once the reader receives the last buffer
+     and "cancelled" tells the thread to stop early */
+  GThread *inflate_thread;
+  gtfs_inflate_buffer_t *inflate_buffers;
+  GAsyncQueue *free_buffers;
+  GAsyncQueue *filled_buffers;
+  gtfs_inflate_buffer_t *current_buffer;
+  size_t current_offset;
+  bool inflate_ended;
+  gint cancelled;
+};
+
+/* Reads little-endian values from the mapping of a ZIP bundle */
+inline static unsigned int read_u16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+inline static uint32_t read_u32(const unsigned char *p) {
+  return (uint32_t)p[0] |
+    ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) |
+    ((uint32_t)p[3] << 24);
+}
+
+/* Empties a bundle's list of members */
+static void clear_entries(gtfs_bundle_t *bundle) {
+  for(unsigned int index = 0; index < bundle->entries->len; index++) {
+    g_free(g_array_index(bundle->entries, gtfs_bundle_entry_t, index).name);
+  }
+  g_array_set_size(bundle->entries, 0);
+}
+
+/* Maps a file into memory for reading sequentially; returns TRUE on
+   success, leaving "map" NULL for an empty file */
+static bool map_file(const char *path, void **map, size_t *size) {
+  struct stat stat_buf;
+  bool result = false;
+  int fd;
+
+  *map = NULL;
+  *size = 0;
+
+  if((fd = open(path, O_RDONLY)) != -1) {
+    if(fstat(fd, &stat_buf) == 0) {
+      *size = stat_buf.st_size;
+      if(*size == 0) {
+        result = true;
+      }
+      else if((*map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0))
+              != MAP_FAILED) {
+        madvise(*map, *size, MADV_SEQUENTIAL);
+        result = true;
+      }
+      else {
+        *map = NULL;
+      }
+    }
+
+    close(fd);
+  }
+
+  return result;
+}
+
+/* Reads the central directory of a mapped ZIP bundle into its list
+   of members; returns FALSE if the bundle is not one we can read
+   ourselves, in which case libzip reads it instead */
+static bool read_central_dir(gtfs_bundle_t *bundle) {
+  const unsigned char *map = bundle->map;
+  const unsigned char *end_of_central_dir = NULL;
+  const unsigned char *entry_data;
+  gtfs_bundle_entry_t entry;
+  size_t search_start, offset;
+  unsigned int num_entries, name_len, extra_len, comment_len;
+  uint64_t central_dir_offset, central_dir_size;
+
+  if(bundle->map_size < ZIP_END_OF_CENTRAL_DIR_SIZE) {
+    return false;
+  }
+
+  /* Find the end-of-central-directory record, searching backwards
+     past any comment that follows it */
+  search_start = bundle->map_size - ZIP_END_OF_CENTRAL_DIR_SIZE;
+  offset = search_start;
+  while(end_of_central_dir == NULL &&
+        search_start - offset <= ZIP_MAX_COMMENT_SIZE) {
+    if(read_u32(map + offset) == ZIP_END_OF_CENTRAL_DIR_SIGNATURE) {
+      end_of_central_dir = map + offset;
+    }
+    else if(offset == 0) {
+      break;
+    }
+    else {
+      offset--;
+    }
+  }
+  if(end_of_central_dir == NULL) {
+    return false;
+  }
+
+  num_entries = read_u16(end_of_central_dir + 10);
+  central_dir_size = read_u32(end_of_central_dir + 12);
+  central_dir_offset = read_u32(end_of_central_dir + 16);
+  if(num_entries == ZIP64_COUNT ||
+     central_dir_size == ZIP64_SIZE ||
+     central_dir_offset == ZIP64_SIZE ||
+     central_dir_offset + central_dir_size > offset) {
+    return false;
+  }
+
+  entry_data = map + central_dir_offset;
+  for(unsigned int index = 0; index < num_entries; index++) {
+    if(entry_data + ZIP_CENTRAL_DIR_ENTRY_SIZE > end_of_central_dir ||
+       read_u32(entry_data) != ZIP_CENTRAL_DIR_ENTRY_SIGNATURE) {
+      return false;
+    }
+
+    name_len = read_u16(entry_data + 28);
+    extra_len = read_u16(entry_data + 30);
+    comment_len = read_u16(entry_data + 32);
+    if(entry_data + ZIP_CENTRAL_DIR_ENTRY_SIZE + name_len >
+       end_of_central_dir) {
+      return false;
+    }
+
+    entry.flags = read_u16(entry_data + 8);
+    entry.method = read_u16(entry_data + 10);
+    entry.crc = read_u32(entry_data + 16);
+    entry.compressed_size = read_u32(entry_data + 20);
+    entry.size = read_u32(entry_data + 24);
+    entry.local_header_offset = read_u32(entry_data + 42);
+    if(entry.compressed_size == ZIP64_SIZE ||
+       entry.size == ZIP64_SIZE ||
+       entry.local_header_offset == ZIP64_SIZE) {
+      return false;
+    }
+
+    entry.name = g_strndup((const char *)entry_data +
+                           ZIP_CENTRAL_DIR_ENTRY_SIZE,
+                           name_len);
+    g_array_append_val(bundle->entries, entry);
+
+    entry_data += ZIP_CENTRAL_DIR_ENTRY_SIZE +
+      name_len + extra_len + comment_len;
+  }
+
+  return true;
+}
+
+/* Reads the list of members of a ZIP bundle through libzip; returns
+   FALSE and sets "errmsg" on failure */
+static bool read_zip_entries(gtfs_bundle_t *bundle, char **errmsg) {
+  struct zip *zip;
+  struct zip_stat zip_stat_buf;
+  gtfs_bundle_entry_t entry;
+  char zip_error_str[256];
+  int zip_error, num_files;
+
+  if((zip = zip_open(bundle->path, ZIP_CHECKCONS, &zip_error)) == NULL) {
+    zip_error_to_str(zip_error_str, sizeof(zip_error_str), zip_error, errno);
+    *errmsg = g_strdup(zip_error_str);
+    return false;
+  }
+
+  num_files = zip_get_num_files(zip);
+  for(int index = 0; index < num_files; index++) {
+    if(zip_stat_index(zip, index, 0, &zip_stat_buf) == 0) {
+      memset(&entry, 0, sizeof(entry));
+      entry.name = g_strdup(zip_stat_buf.name);
+      entry.size = zip_stat_buf.size;
+      g_array_append_val(bundle->entries, entry);
+    }
+  }
+
+  zip_close(zip);
+
+  return true;
+}
+
+/* Reads the list of GTFS files in an extracted bundle; returns FALSE
+   and sets "errmsg" on failure */
+static bool read_dir_entries(gtfs_bundle_t *bundle, char **errmsg) {
+  GDir *dir;
+  GError *error = NULL;
+  gtfs_bundle_entry_t entry;
+  struct stat stat_buf;
+  const char *name;
+  char *path;
+
+  if((dir = g_dir_open(bundle->path, 0, &error)) == NULL) {
+    *errmsg = g_strdup(error->message);
+    g_error_free(error);
+    return false;
+  }
+
+  while(name = g_dir_read_name(dir)) {
+    if(g_str_has_suffix(name, GTFS_FILE_EXTENSION)) {
+      path = g_build_filename(bundle->path, name, NULL);
+      if(stat(path, &stat_buf) == 0 && S_ISREG(stat_buf.st_mode)) {
+        memset(&entry, 0, sizeof(entry));
+        entry.name = g_strdup(name);
+        entry.size = stat_buf.st_size;
+        g_array_append_val(bundle->entries, entry);
+      }
+      g_free(path);
+    }
+  }
+
+  g_dir_close(dir);
+
+  return true;
+}
+
+/* Opens the GTFS bundle at "path", a ZIP file or a directory */
+gtfs_bundle_t *gtfs_bundle_open(const char *path,
+                                bool use_mmap,
+                                size_t buffer_size,
+                                unsigned int num_inflate_buffers,
+                                char **errmsg) {
+  gtfs_bundle_t *bundle;
+  void *map;
+  bool opened;
+
+  bundle = g_new0(gtfs_bundle_t, 1);
+  bundle->path = g_strdup(path);
+  bundle->is_directory = g_file_test(path, G_FILE_TEST_IS_DIR);
+  bundle->entries = g_array_new(FALSE, FALSE, sizeof(gtfs_bundle_entry_t));
+  bundle->buffer_size = buffer_size;
+  bundle->num_inflate_buffers = num_inflate_buffers;
+
+  if(bundle->is_directory) {
+    opened = read_dir_entries(bundle, errmsg);
+  }
+  else {
+    /* Map the bundle and read its directory ourselves if we can,
+       falling back to libzip (which also reports any error) if
+       not */
+    if(use_mmap && map_file(path, &map, &bundle->map_size) && map) {
+      bundle->map = map;
+      if(!read_central_dir(bundle)) {
+        clear_entries(bundle);
+        munmap(map, bundle->map_size);
+        bundle->map = NULL;
+      }
+    }
+
+    opened = bundle->map || read_zip_entries(bundle, errmsg);
+  }
+
+  if(!opened) {
+    gtfs_bundle_close(bundle);
+    bundle = NULL;
+  }
+
+  return bundle;
+}
+
+/* Closes a GTFS bundle */
+void gtfs_bundle_close(gtfs_bundle_t *bundle) {
+  if(bundle->map) {
+    munmap((void *)bundle->map, bundle->map_size);
+  }
+  clear_entries(bundle);
+  g_array_free(bundle->entries, TRUE);
+  g_free(bundle->path);
+  g_free(bundle);
+}
+
+/* Returns the number of member files in a bundle */
+unsigned int gtfs_bundle_num_members(const gtfs_bundle_t *bundle) {
+  return bundle->entries->len;
+}
+
+/* Returns the name of a member file of a bundle */
+const char *gtfs_bundle_member_name(const gtfs_bundle_t *bundle,
+                                    unsigned int index) {
+  return g_array_index(bundle->entries, gtfs_bundle_entry_t, index).name;
+}
+
+/* Returns the entry for the member of a bundle with the given name,
+   or NULL if there is none */
+static const gtfs_bundle_entry_t *find_entry(const gtfs_bundle_t *bundle,
+                                             const char *name) {
+  for(unsigned int index = 0; index < bundle->entries->len; index++) {
+    const gtfs_bundle_entry_t *entry =
+      &g_array_index(bundle->entries, gtfs_bundle_entry_t, index);
+
+    if(strcmp(entry->name, name) == 0) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+/* Returns TRUE if a bundle contains a member with the given name */
+bool gtfs_bundle_locate(const gtfs_bundle_t *bundle,
+                        const char *name,
+                        uint64_t *size) {
+  const gtfs_bundle_entry_t *entry = find_entry(bundle, name);
+
+  if(entry && size) {
+    *size = entry->size;
+  }
+
+  return entry != NULL;
+}
+
+/* Locates a member's data within the mapping of its bundle, choosing
+   how it is to be read; returns FALSE if its local header is
+   invalid */
+static bool open_mapped_member(gtfs_bundle_t *bundle,
+                               gtfs_member_t *member) {
+  const gtfs_bundle_entry_t *entry = member->entry;
+  const unsigned char *local_header;
+  uint64_t data_offset;
+
+  if(entry->local_header_offset + ZIP_LOCAL_HEADER_SIZE > bundle->map_size) {
+    return false;
+  }
+
+  local_header = bundle->map + entry->local_header_offset;
+  if(read_u32(local_header) != ZIP_LOCAL_HEADER_SIGNATURE) {
+    return false;
+  }
+
+  data_offset = entry->local_header_offset + ZIP_LOCAL_HEADER_SIZE +
+    read_u16(local_header + 26) + read_u16(local_header + 28);
+  if(data_offset + entry->compressed_size > bundle->map_size) {
+    return false;
+  }
+
+  member->data = bundle->map + data_offset;
+  member->size = entry->compressed_size;
+  member->check_crc = true;
+  member->crc = crc32(0, Z_NULL, 0);
+
+  if(entry->method == ZIP_METHOD_STORED) {
+    /* A stored member is parsed straight from the mapping */
+    member->source = MEMBER_MAPPED;
+    if(entry->size != entry->compressed_size) {
+      return false;
+    }
+  }
+  else {
+    /* A deflated member is inflated from the mapping; the stream's
+       input is the member's entire compressed data */
+    member->source = MEMBER_INFLATED;
+    member->stream.next_in = (Bytef *)member->data;
+    member->stream.avail_in = member->size;
+    if(inflateInit2(&member->stream, -MAX_WBITS) != Z_OK) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Inflates up to "size" bytes of a deflated member into "buf" */
+static ssize_t inflate_member(gtfs_member_t *member, char *buf, size_t size) {
+  int status;
+
+  if(member->stream_ended) {
+    return 0;
+  }
+
+  member->stream.next_out = (Bytef *)buf;
+  member->stream.avail_out = size;
+  status = inflate(&member->stream, Z_SYNC_FLUSH);
+  if(status == Z_STREAM_END) {
+    member->stream_ended = true;
+    if(member->stream.total_out != member->entry->size) {
+      return -1;
+    }
+  }
+  else if(status != Z_OK) {
+    return -1;
+  }
+
+  return size - member->stream.avail_out;
+}
+
+/* Adds a block of a ZIP member's data to its CRC-32, once the block
+   has been read; returns FALSE if this was the last block and the CRC
+   does not match the one in the bundle's directory */
+static bool check_member_crc(gtfs_member_t *member,
+                             const char *data,
+                             ssize_t size) {
+  if(!member->check_crc || size < 0) {
+    return true;
+  }
+
+  if(size > 0) {
+    member->crc = crc32(member->crc, (const Bytef *)data, size);
+  }
+
+  return size > 0 || member->crc == member->entry->crc;
+}
+
+/* Reads up to "size" bytes of a member's data into "buf" on the
+   calling thread */
+static ssize_t read_member(gtfs_member_t *member, char *buf, size_t size) {
+  ssize_t result = -1;
+
+  switch(member->source) {
+  case MEMBER_MAPPED:
+    result = MIN(size, member->size - member->offset);
+    memcpy(buf, member->data + member->offset, result);
+    member->offset += result;
+    if(!check_member_crc(member, buf, result)) {
+      result = -1;
+    }
+    break;
+
+  case MEMBER_INFLATED:
+    result = inflate_member(member, buf, size);
+    if(!check_member_crc(member, buf, result)) {
+      result = -1;
+    }
+    break;
+
+  case MEMBER_LIBZIP:
+    result = zip_fread(member->zip_file, buf, size);
+    break;
+  }
+
+  return result;
+}
+
+/* Entry point for a member's inflate thread: fills each free buffer
+   in turn and passes it on to the reader, until the end of the member
+   (or an error) is reached or the reader closes the member early */
+static gpointer inflate_buffers(gpointer data) {
+  gtfs_member_t *member = (gtfs_member_t *)data;
+  gtfs_inflate_buffer_t *buffer;
+
+  do {
+    buffer = g_async_queue_pop(member->free_buffers);
+    if(g_atomic_int_get(&member->cancelled)) {
+      buffer->size = 0;
+    }
+    else {
+      buffer->size = read_member(member, buffer->data, member->buffer_size);
+    }
+    g_async_queue_push(member->filled_buffers, buffer);
+  } while(buffer->size > 0);
+
+  return NULL;
+}
+
+/* Starts a thread inflating a member into a ring of "num_buffers"
+   buffers ahead of its reader */
+static void start_inflate_thread(gtfs_member_t *member,
+                                 unsigned int num_buffers) {
+  member->inflate_buffers = g_new0(gtfs_inflate_buffer_t, num_buffers + 1);
+  member->free_buffers = g_async_queue_new();
+  member->filled_buffers = g_async_queue_new();
+  for(unsigned int index = 0; index < num_buffers; index++) {
+    member->inflate_buffers[index].data = g_malloc(member->buffer_size);
+    g_async_queue_push(member->free_buffers,
+                       &member->inflate_buffers[index]);
+  }
+
+  member->inflate_thread = g_thread_new("inflate", inflate_buffers, member);
+}
+
+/* Hands the buffer the reader has consumed back to the inflate thread
+   and waits for the next one it fills */
+static void next_inflate_buffer(gtfs_member_t *member) {
+  if(member->current_buffer) {
+    g_async_queue_push(member->free_buffers, member->current_buffer);
+  }
+
+  member->current_buffer = g_async_queue_pop(member->filled_buffers);
+  member->current_offset = 0;
+  member->inflate_ended = member->current_buffer->size <= 0;
+}
+
+/* Stops a member's inflate thread, waiting for it to finish the buffer
+   it is filling if the member has not been read to its end */
+static void stop_inflate_thread(gtfs_member_t *member) {
+  gtfs_inflate_buffer_t *buffer;
+
+  if(!member->inflate_ended) {
+    g_atomic_int_set(&member->cancelled, 1);
+    if(member->current_buffer) {
+      g_async_queue_push(member->free_buffers, member->current_buffer);
+    }
+    do {
+      buffer = g_async_queue_pop(member->filled_buffers);
+      g_async_queue_push(member->free_buffers, buffer);
+    } while(buffer->size > 0);
+  }
+
+  g_thread_join(member->inflate_thread);
+
+  for(buffer = member->inflate_buffers; buffer->data; buffer++) {
+    g_free(buffer->data);
+  }
+  g_free(member->inflate_buffers);
+  g_async_queue_unref(member->free_buffers);
+  g_async_queue_unref(member->filled_buffers);
+}
+
+/* Opens a member of a bundle for reading */
+gtfs_member_t *gtfs_member_open(gtfs_bundle_t *bundle,
+                                const char *name,
+                                char **errmsg) {
+  const gtfs_bundle_entry_t *entry;
+  gtfs_member_t *member;
+  char zip_error_str[256];
+  char *path;
+  int zip_error;
+  bool opened;
+
+  if((entry = find_entry(bundle, name)) == NULL) {
+    *errmsg = g_strdup("No such file");
+    return NULL;
+  }
+
+  member = g_new0(gtfs_member_t, 1);
+  member->entry = entry;
+  member->buffer_size = bundle->buffer_size;
+
+  if(bundle->is_directory) {
+    /* An extracted file is parsed straight from its own mapping */
+    member->source = MEMBER_MAPPED;
+    path = g_build_filename(bundle->path, name, NULL);
+    opened = map_file(path, &member->file_map, &member->file_map_size);
+    if(opened) {
+      member->data = member->file_map;
+      member->size = member->file_map_size;
+    }
+    else {
+      *errmsg = g_strdup(g_strerror(errno));
+    }
+    g_free(path);
+  }
+  else if(bundle->map &&
+          !(entry->flags & ZIP_FLAG_ENCRYPTED) &&
+          (entry->method == ZIP_METHOD_STORED ||
+           entry->method == ZIP_METHOD_DEFLATED)) {
+    opened = open_mapped_member(bundle, member);
+    if(!opened) {
+      *errmsg = g_strdup("Invalid ZIP member");
+    }
+  }
+  else {
+    member->source = MEMBER_LIBZIP;
+    opened = false;
+    if((member->zip = zip_open(bundle->path, 0, &zip_error)) == NULL) {
+      zip_error_to_str(zip_error_str, sizeof(zip_error_str), zip_error, errno);
+      *errmsg = g_strdup(zip_error_str);
+    }
+    else if((member->zip_file = zip_fopen(member->zip, name, 0)) == NULL) {
+      *errmsg = g_strdup(zip_strerror(member->zip));
+    }
+    else {
+      opened = true;
+    }
+  }
+
+  if(!opened) {
+    gtfs_member_close(member);
+    member = NULL;
+  }
+  else if(member->source != MEMBER_MAPPED &&
+          bundle->num_inflate_buffers > 0) {
+    start_inflate_thread(member, bundle->num_inflate_buffers);
+  }
+
+  return member;
+}
+
+
+/* Returns the next block of a member's data */
+ssize_t gtfs_member_next_block(gtfs_member_t *member, const char **data) {
+  gtfs_inflate_buffer_t *buffer;
+  ssize_t result;
+
+  if(member->inflate_thread) {
+    /* Return what remains of the buffer being consumed, or else the
+       next buffer the inflate thread fills */
+    if(member->current_buffer == NULL ||
+       (!member->inflate_ended &&
+        member->current_offset == member->current_buffer->size)) {
+      next_inflate_buffer(member);
+    }
+
+    buffer = member->current_buffer;
+    result = buffer->size;
+    if(result > 0) {
+      *data = buffer->data + member->current_offset;
+      result -= member->current_offset;
+      member->current_offset = buffer->size;
+    }
+  }
+  else if(member->source == MEMBER_MAPPED) {
+    /* Return the remainder of the mapping in one block */
+    *data = (const char *)member->data + member->offset;
+    result = member->size - member->offset;
+    member->offset = member->size;
+    if(!check_member_crc(member, *data, result)) {
+      result = -1;
+    }
+  }
+  else {
+    if(member->buffer == NULL) {
+      member->buffer = g_malloc(member->buffer_size);
+    }
+
+    *data = member->buffer;
+    result = read_member(member, member->buffer, member->buffer_size);
+  }
+
+  return result;
+}
+
+/* Reads up to "size" bytes of a member's data into "buf" */
+ssize_t gtfs_member_read(gtfs_member_t *member, char *buf, size_t size) {
+  const char *data;
+  ssize_t result;
+
+  if(member->inflate_thread) {
+    /* Copy as much as is wanted from the buffer being consumed,
+       leaving the rest for the next read */
+    result = gtfs_member_next_block(member, &data);
+    if(result > 0) {
+      result = MIN(result, size);
+      memcpy(buf, data, result);
+      member->current_offset = (data - member->current_buffer->data) + result;
+    }
+  }
+  else {
+    result = read_member(member, buf, size);
+  }
+
+  return result;
+}
+
+/* Closes a member of a bundle */
+void gtfs_member_close(gtfs_member_t *member) {
+  if(member->inflate_thread) {
+    stop_inflate_thread(member);
+  }
+  if(member->source == MEMBER_INFLATED) {
+    inflateEnd(&member->stream);
+  }
+  if(member->file_map) {
+    munmap(member->file_map, member->file_map_size);
+  }
+  if(member->zip_file) {
+    zip_fclose(member->zip_file);
+  }
+  if(member->zip) {
+    zip_close(member->zip);
+  }
+  g_free(member->buffer);
+  g_free(member);
+}
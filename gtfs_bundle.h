@@ -0,0 +1,107 @@
+/* Reading the member files of a GTFS bundle, which may be either a
+   ZIP file or a directory holding the extracted files.
+
+   A ZIP file is mapped into memory and its directory read directly:
+   stored members are then parsed straight from the mapping, without
+   being copied, and deflated members are inflated with zlib into
+   large buffers. Members the mapping can't handle (encrypted members,
+   or those using other compression methods) and bundles it can't
+   handle (ZIP64 bundles) are read through libzip instead. The files
+   in a directory are mapped individually and parsed straight from
+   their mappings.
+
+   Members that are not parsed in place may be inflated (or read) on a
+   thread of their own, into a ring of buffers, while the previous
+   buffer is parsed.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_BUNDLE_H__
+#define __GTFS_BUNDLE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* The size, in bytes, of the buffer into which each member is read
+   when it cannot be parsed in place, by default */
+#define DEFAULT_READ_BUFFER_SIZE 1024 * 1024
+
+/* The number of buffers each member is inflated into ahead of its
+   reader, by default */
+#define DEFAULT_INFLATE_BUFFERS 2
+
+/* An open GTFS bundle; once opened, a bundle may be shared between
+   threads, each opening members of its own */
+typedef struct gtfs_bundle gtfs_bundle_t;
+
+/* An open member file of a GTFS bundle, used by one thread at a
+   time */
+typedef struct gtfs_member gtfs_member_t;
+
+/* Opens the GTFS bundle at "path", a ZIP file or a directory. If
+   "use_mmap" is FALSE, a ZIP file is read entirely through libzip.
+   Members that cannot be parsed in place are read through buffers of
+   "buffer_size" bytes, by a thread of their own filling a ring of
+   "num_inflate_buffers" such buffers unless this is zero. Returns NULL
+   and sets "errmsg" to a message (to be freed with g_free) on
+   failure */
+gtfs_bundle_t *gtfs_bundle_open(const char *path,
+                                bool use_mmap,
+                                size_t buffer_size,
+                                unsigned int num_inflate_buffers,
+                                char **errmsg);
+
+/* Closes a GTFS bundle, once all its members are closed */
+void gtfs_bundle_close(gtfs_bundle_t *bundle);
+
+/* Returns the number of member files in a bundle, and the name of
+   each */
+unsigned int gtfs_bundle_num_members(const gtfs_bundle_t *bundle);
+const char *gtfs_bundle_member_name(const gtfs_bundle_t *bundle,
+                                    unsigned int index);
+
+/* Returns TRUE if a bundle contains a member with the given name and,
+   if so, stores its uncompressed size in "size" (if not NULL) */
+bool gtfs_bundle_locate(const gtfs_bundle_t *bundle,
+                        const char *name,
+                        uint64_t *size);
+
+/* Opens a member of a bundle for reading; returns NULL and sets
+   "errmsg" to a message (to be freed with g_free) on failure */
+gtfs_member_t *gtfs_member_open(gtfs_bundle_t *bundle,
+                                const char *name,
+                                char **errmsg);
+
+/* Returns the next block of a member's data in "data", without
+   copying it where possible; the block remains valid until the next
+   call. Returns the number of bytes in the block, zero at the end of
+   the member or -1 on error */
+ssize_t gtfs_member_next_block(gtfs_member_t *member, const char **data);
+
+/* Reads up to "size" bytes of a member's data into "buf"; returns the
+   number of bytes read, zero at the end of the member or -1 on
+   error */
+ssize_t gtfs_member_read(gtfs_member_t *member, char *buf, size_t size);
+
+/* Closes a member of a bundle, stopping its inflate thread if it has
+   not been read to its end */
+void gtfs_member_close(gtfs_member_t *member);
+
+#endif
@@ -0,0 +1,517 @@
+/* A CSV tokenizer for GTFS files that locates delimiters, quotes and
+   newlines a block at a time using SIMD instructions.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <csv.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "gtfs_csv.h"
+
+/* The size, in bytes, of the blocks scanned for structural
+   characters---one bit of a mask for each */
+#define BLOCK_SIZE 64
+
+/* The initial size of the buffer holding each field */
+#define FIELD_SIZE 256
+
+#define DELIMITER ','
+#define QUOTE '"'
+
+#define IS_NEWLINE(c) ((c) == '\r' || (c) == '\n')
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t')
+
+/* The states of the parser, matching libcsv's: before the first field
+   of a record, before any other field, within an unquoted field,
+   within a quoted field and after a quote within a quoted field (which
+   either ends it or is the first of an escaped pair) */
+enum {
+  ROW_NOT_BEGUN,
+  FIELD_NOT_BEGUN,
+  FIELD_BEGUN,
+  FIELD_QUOTED,
+  QUOTE_SEEN
+};
+
+static const char *tokenizer_names[] = {
+  "auto",
+  "libcsv",
+  "scalar",
+  "sse2",
+  "avx2"
+};
+
+/* Scans a block a byte at a time */
+static void scan_block_scalar(const unsigned char *block,
+                              uint64_t *structural,
+                              uint64_t *quotes) {
+  uint64_t structural_mask = 0, quote_mask = 0;
+
+  for(unsigned int index = 0; index < BLOCK_SIZE; index++) {
+    unsigned char c = block[index];
+
+    if(c == QUOTE) {
+      quote_mask |= (uint64_t)1 << index;
+    }
+    if(c == DELIMITER || c == QUOTE || IS_NEWLINE(c)) {
+      structural_mask |= (uint64_t)1 << index;
+    }
+  }
+
+  *structural = structural_mask;
+  *quotes = quote_mask;
+}
+
+#ifdef HAVE_X86_SIMD
+/* Scans a block sixteen bytes at a time with SSE2 */
+__attribute__((target("sse2")))
+static void scan_block_sse2(const unsigned char *block,
+                            uint64_t *structural,
+                            uint64_t *quotes) {
+  const __m128i delimiter = _mm_set1_epi8(DELIMITER);
+  const __m128i quote = _mm_set1_epi8(QUOTE);
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  uint64_t structural_mask = 0, quote_mask = 0;
+
+  for(unsigned int index = 0; index < BLOCK_SIZE; index += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(block + index));
+    __m128i is_quote = _mm_cmpeq_epi8(bytes, quote);
+    __m128i is_structural =
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, delimiter),
+                                is_quote),
+                   _mm_or_si128(_mm_cmpeq_epi8(bytes, cr),
+                                _mm_cmpeq_epi8(bytes, lf)));
+
+    structural_mask |=
+      (uint64_t)(uint16_t)_mm_movemask_epi8(is_structural) << index;
+    quote_mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_quote) << index;
+  }
+
+  *structural = structural_mask;
+  *quotes = quote_mask;
+}
+
+/* Scans a block thirty-two bytes at a time with AVX2 */
+__attribute__((target("avx2")))
+static void scan_block_avx2(const unsigned char *block,
+                            uint64_t *structural,
+                            uint64_t *quotes) {
+  const __m256i delimiter = _mm256_set1_epi8(DELIMITER);
+  const __m256i quote = _mm256_set1_epi8(QUOTE);
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  uint64_t structural_mask = 0, quote_mask = 0;
+
+  for(unsigned int index = 0; index < BLOCK_SIZE; index += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(block + index));
+    __m256i is_quote = _mm256_cmpeq_epi8(bytes, quote);
+    __m256i is_structural =
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, delimiter),
+                                      is_quote),
+                      _mm256_or_si256(_mm256_cmpeq_epi8(bytes, cr),
+                                      _mm256_cmpeq_epi8(bytes, lf)));
+
+    structural_mask |=
+      (uint64_t)(uint32_t)_mm256_movemask_epi8(is_structural) << index;
+    quote_mask |=
+      (uint64_t)(uint32_t)_mm256_movemask_epi8(is_quote) << index;
+  }
+
+  *structural = structural_mask;
+  *quotes = quote_mask;
+}
+#endif
+
+/* Returns TRUE if this processor supports a tokenizer */
+bool gtfs_csv_tokenizer_supported(gtfs_csv_tokenizer_t tokenizer) {
+  switch(tokenizer) {
+  case GTFS_CSV_AUTO:
+  case GTFS_CSV_LIBCSV:
+  case GTFS_CSV_SCALAR:
+    return true;
+
+#ifdef HAVE_X86_SIMD
+  case GTFS_CSV_SSE2:
+    return __builtin_cpu_supports("sse2");
+
+  case GTFS_CSV_AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+
+  default:
+    return false;
+  }
+}
+
+/* Returns the tokenizer GTFS_CSV_AUTO chooses on this processor */
+gtfs_csv_tokenizer_t gtfs_csv_best_tokenizer(void) {
+  if(gtfs_csv_tokenizer_supported(GTFS_CSV_AVX2)) {
+    return GTFS_CSV_AVX2;
+  }
+  else if(gtfs_csv_tokenizer_supported(GTFS_CSV_SSE2)) {
+    return GTFS_CSV_SSE2;
+  }
+  else {
+    return GTFS_CSV_SCALAR;
+  }
+}
+
+/* Returns the name of a tokenizer */
+const char *gtfs_csv_tokenizer_name(gtfs_csv_tokenizer_t tokenizer) {
+  return tokenizer_names[tokenizer];
+}
+
+/* Finds the tokenizer with the given name */
+bool gtfs_csv_tokenizer_from_name(const char *name,
+                                  gtfs_csv_tokenizer_t *tokenizer) {
+  for(unsigned int index = 0;
+      index < G_N_ELEMENTS(tokenizer_names);
+      index++) {
+    if(strcmp(name, tokenizer_names[index]) == 0) {
+      *tokenizer = index;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Initializes a parser to use the given tokenizer */
+bool gtfs_csv_init(gtfs_csv_parser_t *csv, gtfs_csv_tokenizer_t tokenizer) {
+  memset(csv, 0, sizeof(*csv));
+
+  if(tokenizer == GTFS_CSV_AUTO) {
+    tokenizer = gtfs_csv_best_tokenizer();
+  }
+  if(!gtfs_csv_tokenizer_supported(tokenizer)) {
+    return false;
+  }
+  csv->tokenizer = tokenizer;
+
+  switch(tokenizer) {
+  case GTFS_CSV_LIBCSV:
+    return csv_init(&csv->libcsv, CSV_STRICT | CSV_APPEND_NULL) == 0;
+
+#ifdef HAVE_X86_SIMD
+  case GTFS_CSV_SSE2:
+    csv->scan_block = scan_block_sse2;
+    break;
+
+  case GTFS_CSV_AVX2:
+    csv->scan_block = scan_block_avx2;
+    break;
+#endif
+
+  default:
+    csv->scan_block = scan_block_scalar;
+    break;
+  }
+
+  csv->state = ROW_NOT_BEGUN;
+  csv->field_size = FIELD_SIZE;
+  csv->field = g_malloc(csv->field_size);
+
+  return true;
+}
+
+/* Scans the block of "s" starting at "block_start" for structural
+   characters; a block running past the end of the data is copied and
+   padded first, so nothing is read beyond it */
+static void scan_block(gtfs_csv_parser_t *csv,
+                       const unsigned char *s,
+                       size_t len,
+                       size_t block_start) {
+  unsigned char padded_block[BLOCK_SIZE];
+
+  if(block_start + BLOCK_SIZE <= len) {
+    csv->scan_block(s + block_start,
+                    &csv->structural_mask,
+                    &csv->quote_mask);
+  }
+  else {
+    memset(padded_block, 0, sizeof(padded_block));
+    memcpy(padded_block, s + block_start, len - block_start);
+    csv->scan_block(padded_block,
+                    &csv->structural_mask,
+                    &csv->quote_mask);
+  }
+
+  csv->block_start = block_start;
+  csv->block_valid = true;
+}
+
+/* Returns the offset of the first structural character (or, if
+   "quotes_only", the first quote) in "s" at or after "offset", or
+   "len" if there is none */
+static size_t find_structural(gtfs_csv_parser_t *csv,
+                              const unsigned char *s,
+                              size_t len,
+                              size_t offset,
+                              bool quotes_only) {
+  size_t block_start;
+  uint64_t mask;
+
+  while(offset < len) {
+    block_start = offset & ~(size_t)(BLOCK_SIZE - 1);
+    if(!csv->block_valid || csv->block_start != block_start) {
+      scan_block(csv, s, len, block_start);
+    }
+
+    mask = (quotes_only? csv->quote_mask: csv->structural_mask) >>
+      (offset - block_start);
+    if(mask) {
+      return offset + __builtin_ctzll(mask);
+    }
+
+    offset = block_start + BLOCK_SIZE;
+  }
+
+  return len;
+}
+
+/* Appends data to the field being parsed */
+inline static void append_to_field(gtfs_csv_parser_t *csv,
+                                   const unsigned char *data,
+                                   size_t len) {
+  if(csv->field_len + len + 1 > csv->field_size) {
+    while(csv->field_len + len + 1 > csv->field_size) {
+      csv->field_size *= 2;
+    }
+    csv->field = g_realloc(csv->field, csv->field_size);
+  }
+
+  memcpy(csv->field + csv->field_len, data, len);
+  csv->field_len += len;
+}
+
+/* Passes the field parsed to "cb1", NUL-terminated and, if it was not
+   quoted, without trailing whitespace */
+inline static void submit_field(gtfs_csv_parser_t *csv,
+                                bool quoted,
+                                void (*cb1)(void *, size_t, void *),
+                                void *data) {
+  if(!quoted) {
+    while(csv->field_len > 0 && IS_SPACE(csv->field[csv->field_len - 1])) {
+      csv->field_len--;
+    }
+  }
+
+  csv->field[csv->field_len] = '\0';
+  if(cb1) {
+    cb1(csv->field, csv->field_len, data);
+  }
+
+  csv->field_len = 0;
+  csv->spaces = 0;
+}
+
+/* Parses CSV data */
+size_t gtfs_csv_parse(gtfs_csv_parser_t *csv,
+                      const void *s,
+                      size_t len,
+                      void (*cb1)(void *, size_t, void *),
+                      void (*cb2)(int, void *),
+                      void *data) {
+  const unsigned char *bytes = s;
+  size_t offset = 0, end;
+  unsigned char c;
+
+  if(csv->tokenizer == GTFS_CSV_LIBCSV) {
+    return csv_parse(&csv->libcsv, s, len, cb1, cb2, data);
+  }
+
+  /* The blocks scanned belong to the previous call's data */
+  csv->block_valid = false;
+
+  while(offset < len) {
+    switch(csv->state) {
+    case ROW_NOT_BEGUN:
+      /* Skip blank lines and whitespace before the first field */
+      while(offset < len &&
+            (IS_NEWLINE(bytes[offset]) || IS_SPACE(bytes[offset]))) {
+        offset++;
+      }
+      if(offset == len) {
+        break;
+      }
+      csv->state = FIELD_NOT_BEGUN;
+      /* Fall through */
+
+    case FIELD_NOT_BEGUN:
+      /* Skip whitespace before the field, then see how it begins */
+      while(offset < len && IS_SPACE(bytes[offset])) {
+        offset++;
+      }
+      if(offset == len) {
+        break;
+      }
+
+      c = bytes[offset];
+      if(c == DELIMITER) {
+        submit_field(csv, false, cb1, data);
+        offset++;
+      }
+      else if(IS_NEWLINE(c)) {
+        submit_field(csv, false, cb1, data);
+        if(cb2) {
+          cb2(c, data);
+        }
+        csv->state = ROW_NOT_BEGUN;
+        offset++;
+      }
+      else if(c == QUOTE) {
+        csv->state = FIELD_QUOTED;
+        offset++;
+      }
+      else {
+        csv->state = FIELD_BEGUN;
+      }
+      break;
+
+    case FIELD_BEGUN:
+      /* Take everything up to the next structural character */
+      end = find_structural(csv, bytes, len, offset, false);
+      append_to_field(csv, bytes + offset, end - offset);
+      offset = end;
+      if(offset == len) {
+        break;
+      }
+
+      c = bytes[offset];
+      if(c == QUOTE) {
+        /* A quote within an unquoted field is not allowed */
+        csv->status = CSV_EPARSE;
+        return offset;
+      }
+
+      submit_field(csv, false, cb1, data);
+      if(IS_NEWLINE(c)) {
+        if(cb2) {
+          cb2(c, data);
+        }
+        csv->state = ROW_NOT_BEGUN;
+      }
+      else {
+        csv->state = FIELD_NOT_BEGUN;
+      }
+      offset++;
+      break;
+
+    case FIELD_QUOTED:
+      /* Take everything, delimiters and newlines included, up to the
+         next quote */
+      end = find_structural(csv, bytes, len, offset, true);
+      append_to_field(csv, bytes + offset, end - offset);
+      offset = end;
+      if(offset < len) {
+        csv->state = QUOTE_SEEN;
+        csv->spaces = 0;
+        offset++;
+      }
+      break;
+
+    case QUOTE_SEEN:
+      c = bytes[offset];
+      if(c == QUOTE && csv->spaces == 0) {
+        /* An escaped quote */
+        append_to_field(csv, &c, 1);
+        csv->state = FIELD_QUOTED;
+      }
+      else if(IS_SPACE(c)) {
+        csv->spaces++;
+      }
+      else if(c == DELIMITER) {
+        submit_field(csv, true, cb1, data);
+        csv->state = FIELD_NOT_BEGUN;
+      }
+      else if(IS_NEWLINE(c)) {
+        submit_field(csv, true, cb1, data);
+        if(cb2) {
+          cb2(c, data);
+        }
+        csv->state = ROW_NOT_BEGUN;
+      }
+      else {
+        /* Anything else following a closing quote is not allowed */
+        csv->status = CSV_EPARSE;
+        return offset;
+      }
+      offset++;
+      break;
+    }
+  }
+
+  return len;
+}
+
+/* Ends parsing */
+int gtfs_csv_fini(gtfs_csv_parser_t *csv,
+                  void (*cb1)(void *, size_t, void *),
+                  void (*cb2)(int, void *),
+                  void *data) {
+  if(csv->tokenizer == GTFS_CSV_LIBCSV) {
+    return csv_fini(&csv->libcsv, cb1, cb2, data);
+  }
+
+  /* As libcsv does without CSV_STRICT_FINI, pass on an unterminated
+     quoted field as it stands */
+  if(csv->state != ROW_NOT_BEGUN) {
+    submit_field(csv,
+                 csv->state == FIELD_QUOTED || csv->state == QUOTE_SEEN,
+                 cb1,
+                 data);
+    if(cb2) {
+      cb2(-1, data);
+    }
+  }
+
+  csv->state = ROW_NOT_BEGUN;
+  csv->field_len = 0;
+  csv->spaces = 0;
+  csv->status = 0;
+
+  return 0;
+}
+
+/* Returns a description of the last error a parser encountered */
+const char *gtfs_csv_strerror(gtfs_csv_parser_t *csv) {
+  if(csv->tokenizer == GTFS_CSV_LIBCSV) {
+    return csv_strerror(csv_error(&csv->libcsv));
+  }
+
+  return csv_strerror(csv->status);
+}
+
+/* Frees the memory used by a parser */
+void gtfs_csv_free(gtfs_csv_parser_t *csv) {
+  if(csv->tokenizer == GTFS_CSV_LIBCSV) {
+    csv_free(&csv->libcsv);
+  }
+
+  g_free(csv->field);
+  csv->field = NULL;
+}
@@ -0,0 +1,119 @@
+/* A CSV tokenizer for GTFS files that locates delimiters, quotes and
+   newlines a block at a time using SIMD instructions (SSE2 or AVX2,
+   chosen at run time, with a scalar fallback) rather than a byte at a
+   time, while producing exactly the fields and records libcsv does
+   with the options CSV_STRICT and CSV_APPEND_NULL: fields are passed
+   to the same callbacks, NUL-terminated, with unquoted fields trimmed
+   of surrounding spaces and tabs, quoted fields unescaped, blank lines
+   skipped and a quote within an unquoted field (or anything but a
+   delimiter, a newline or whitespace after a closing quote) treated as
+   an error. libcsv itself may be used instead.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_CSV_H__
+#define __GTFS_CSV_H__
+
+#include <csv.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The tokenizers available; GTFS_CSV_AUTO chooses the fastest the
+   processor supports */
+typedef enum {
+  GTFS_CSV_AUTO,
+  GTFS_CSV_LIBCSV,
+  GTFS_CSV_SCALAR,
+  GTFS_CSV_SSE2,
+  GTFS_CSV_AVX2
+} gtfs_csv_tokenizer_t;
+
+/* Finds the delimiters, quotes and newlines in a 64-byte block,
+   setting a bit in "structural" for each and in "quotes" for each
+   quote */
+typedef void (*gtfs_csv_scan_block_t)(const unsigned char *block,
+                                      uint64_t *structural,
+                                      uint64_t *quotes);
+
+typedef struct {
+  gtfs_csv_tokenizer_t tokenizer;
+
+  /* The libcsv parser used by the GTFS_CSV_LIBCSV tokenizer */
+  struct csv_parser libcsv;
+
+  /* The function scanning each block for structural characters, and
+     the masks it produced for the block of the current buffer at
+     offset "block_start", if "block_valid" */
+  gtfs_csv_scan_block_t scan_block;
+  bool block_valid;
+  size_t block_start;
+  uint64_t structural_mask;
+  uint64_t quote_mask;
+
+  /* The parser's state between calls: where in a record it is, the
+     field parsed so far, the number of spaces seen after a closing
+     quote and whether an error has occurred */
+  int state;
+  char *field;
+  size_t field_len;
+  size_t field_size;
+  unsigned int spaces;
+  int status;
+} gtfs_csv_parser_t;
+
+/* Returns the tokenizer GTFS_CSV_AUTO chooses on this processor */
+gtfs_csv_tokenizer_t gtfs_csv_best_tokenizer(void);
+
+/* Returns TRUE if this processor supports a tokenizer */
+bool gtfs_csv_tokenizer_supported(gtfs_csv_tokenizer_t tokenizer);
+
+/* Returns the name of a tokenizer, or finds the tokenizer with the
+   given name, returning FALSE if there is none */
+const char *gtfs_csv_tokenizer_name(gtfs_csv_tokenizer_t tokenizer);
+bool gtfs_csv_tokenizer_from_name(const char *name,
+                                  gtfs_csv_tokenizer_t *tokenizer);
+
+/* Initializes a parser to use the given tokenizer; returns FALSE if
+   the processor does not support it */
+bool gtfs_csv_init(gtfs_csv_parser_t *csv, gtfs_csv_tokenizer_t tokenizer);
+
+/* Parses "len" bytes of CSV data, as csv_parse does, passing each
+   field to "cb1" and the end of each record to "cb2"; returns the
+   number of bytes parsed, which is less than "len" on error */
+size_t gtfs_csv_parse(gtfs_csv_parser_t *csv,
+                      const void *s,
+                      size_t len,
+                      void (*cb1)(void *, size_t, void *),
+                      void (*cb2)(int, void *),
+                      void *data);
+
+/* Ends parsing, as csv_fini does, passing on any final field and
+   record not terminated by a newline; returns zero on success */
+int gtfs_csv_fini(gtfs_csv_parser_t *csv,
+                  void (*cb1)(void *, size_t, void *),
+                  void (*cb2)(int, void *),
+                  void *data);
+
+/* Returns a description of the last error a parser encountered */
+const char *gtfs_csv_strerror(gtfs_csv_parser_t *csv);
+
+/* Frees the memory used by a parser */
+void gtfs_csv_free(gtfs_csv_parser_t *csv);
+
+#endif
@@ -0,0 +1,214 @@
+/* Finds the departures from a feed's stops over a window of service
+   days.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <glib.h>
+#include <stdbool.h>
+
+#include "gtfs_departures.h"
+#include "gtfs_sqlite.h"
+
+/* ---------------------------------------------------------------- */
+
+/* A trip whose departures are found: the number of its service, and
+   the route and headsign shown for its departures */
+typedef struct {
+  int service;
+  gtfs_field_value_t route_id;
+  char *headsign;
+} departure_trip_t;
+
+/* ---------------------------------------------------------------- */
+
+/* Reads an ID from a column of the current row of a query, as an
+   integer if IDs are interned as integers; a string remains valid
+   only until the query is stepped again */
+static void column_id(sqlite3_stmt *select_stmt,
+                      int column,
+                      bool integer_ids,
+                      gtfs_field_value_t *id) {
+  if(integer_ids) {
+    id->integer_value = sqlite3_column_int(select_stmt, column);
+  }
+  else {
+    id->string_value = (char *)sqlite3_column_text(select_stmt, column);
+  }
+}
+
+/* Frees a trip */
+static void free_departure_trip(gpointer data) {
+  departure_trip_t *trip = data;
+
+  g_free(trip->headsign);
+  g_free(trip);
+}
+
+/* Reads each trip whose service is known, together with its route
+   and headsign, into a table keyed by trip ID as text, copying route
+   IDs held as strings into "route_ids"; returns FALSE and sets
+   "errmsg" on failure */
+static bool read_trips(sqlite3 *db,
+                       const gtfs_service_days_t *service_days,
+                       bool integer_ids,
+                       bool skip_frequent_trips,
+                       GHashTable *trips,
+                       GStringChunk *route_ids,
+                       char **errmsg) {
+  bool result = true;
+  const char *stmt_str;
+  sqlite3_stmt *select_stmt;
+  departure_trip_t *trip;
+  int service;
+  int sqlite_result;
+
+  /* Once trips run at regular intervals are expanded, their runs
+     depart in their place */
+  stmt_str =
+    skip_frequent_trips && gtfs_sqlite_table_exists(db, "frequencies")?
+    "SELECT id, route_id, service_id, headsign "
+    "FROM trips "
+    "WHERE id NOT IN "
+    "(SELECT trip_id FROM frequencies)":
+    "SELECT id, route_id, service_id, headsign "
+    "FROM trips";
+  if(sqlite3_prepare_v2(db, stmt_str, -1, &select_stmt, NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return false;
+  }
+  while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    service = gtfs_service_days_find(service_days,
+                                     (const char *)
+                                     sqlite3_column_text(select_stmt, 2));
+    if(service != -1) {
+      trip = g_new(departure_trip_t, 1);
+      trip->service = service;
+      column_id(select_stmt, 1, integer_ids, &trip->route_id);
+      if(!integer_ids) {
+        trip->route_id.string_value =
+          g_string_chunk_insert_const(route_ids,
+                                      trip->route_id.string_value);
+      }
+      trip->headsign =
+        g_strdup((const char *)sqlite3_column_text(select_stmt, 3));
+
+      g_hash_table_insert(trips,
+                          g_strdup((const char *)
+                                   sqlite3_column_text(select_stmt, 0)),
+                          trip);
+    }
+  }
+  if(sqlite_result != SQLITE_DONE) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    result = false;
+  }
+  sqlite3_finalize(select_stmt);
+
+  return result;
+}
+
+/* ---------------------------------------------------------------- */
+
+bool gtfs_find_departures(sqlite3 *db,
+                          const gtfs_service_days_t *service_days,
+                          int first_day,
+                          unsigned int num_days,
+                          bool integer_ids,
+                          bool skip_frequent_trips,
+                          gtfs_departure_func_t func,
+                          void *data,
+                          char **errmsg) {
+  bool result;
+  GHashTable *trips;
+  GStringChunk *route_ids;
+  sqlite3_stmt *select_stmt;
+  const departure_trip_t *trip;
+  gtfs_departure_t departure;
+  int sqlite_result;
+
+  trips = g_hash_table_new_full(g_str_hash,
+                                g_str_equal,
+                                g_free,
+                                free_departure_trip);
+  route_ids = g_string_chunk_new(4096);
+
+  /* Find the trips whose services are known, then expand their stop
+     times into departures; stop times without a departure time are
+     interpolated by consumers and have no place on a departure board,
+     nor have those at which no pickup is made (pickup type 1) */
+  result = read_trips(db,
+                      service_days,
+                      integer_ids,
+                      skip_frequent_trips,
+                      trips,
+                      route_ids,
+                      errmsg);
+  if(result &&
+     sqlite3_prepare_v2(db,
+                        "SELECT trip_id, stop_id, stop_sequence, "
+                        "departure_time, stop_headsign "
+                        "FROM stop_times "
+                        "WHERE departure_time IS NOT NULL "
+                        "AND (pickup_type IS NULL OR pickup_type <> 1)",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    result = false;
+  }
+
+  if(result) {
+    while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+      trip = g_hash_table_lookup(trips, sqlite3_column_text(select_stmt, 0));
+      if(trip == NULL) {
+        continue;
+      }
+
+      column_id(select_stmt, 0, integer_ids, &departure.trip_id);
+      column_id(select_stmt, 1, integer_ids, &departure.stop_id);
+      departure.route_id = trip->route_id;
+      departure.stop_sequence = sqlite3_column_int(select_stmt, 2);
+      departure.departure_time = sqlite3_column_int(select_stmt, 3);
+
+      /* A stop's own headsign overrides its trip's */
+      departure.headsign =
+        sqlite3_column_type(select_stmt, 4) != SQLITE_NULL?
+        (const char *)sqlite3_column_text(select_stmt, 4):
+        trip->headsign;
+
+      for(unsigned int day = 0; day < num_days; day++) {
+        if(gtfs_service_days_runs(service_days,
+                                  trip->service,
+                                  first_day + day)) {
+          departure.day = first_day + day;
+          func(&departure, data);
+        }
+      }
+    }
+    if(sqlite_result != SQLITE_DONE) {
+      *errmsg = g_strdup(sqlite3_errmsg(db));
+      result = false;
+    }
+    sqlite3_finalize(select_stmt);
+  }
+
+  g_string_chunk_free(route_ids);
+  g_hash_table_destroy(trips);
+
+  return result;
+}
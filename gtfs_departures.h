@@ -0,0 +1,69 @@
+/* Finds the departures from a feed's stops over a window of service
+   days: each stop time at which passengers may board, on each day
+   within the window on which its trip's service runs, with the route
+   and headsign a departure board shows for it.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_DEPARTURES_H__
+#define __GTFS_DEPARTURES_H__
+
+#include <sqlite3.h>
+#include <stdbool.h>
+
+#include "gtfs_file.h"
+#include "gtfs_service_days.h"
+
+/* A departure from a stop: the IDs of the stop, trip and route as they
+   are stored (integers, if the database interns IDs, or else strings),
+   the stop's sequence number on the trip, the time the trip departs in
+   seconds since midnight, the headsign shown (NULL if there is none)
+   and the day on which the trip departs. Strings remain valid only
+   until the call made with the departure returns */
+typedef struct {
+  gtfs_field_value_t stop_id;
+  gtfs_field_value_t trip_id;
+  gtfs_field_value_t route_id;
+  int stop_sequence;
+  int departure_time;
+  const char *headsign;
+  int day;
+} gtfs_departure_t;
+
+/* Called for each departure found */
+typedef void (*gtfs_departure_func_t)(const gtfs_departure_t *departure,
+                                      void *data);
+
+/* Finds each departure on the "num_days" days from "first_day" from
+   the stop times in a database, whose IDs are interned as integers if
+   "integer_ids" is TRUE, calling "func" with "data" for each. Stop
+   times without a departure time, or at which no pickup is made, have
+   no departures, nor have the trips listed in the "frequencies" table
+   if "skip_frequent_trips" is TRUE. Returns FALSE and sets "errmsg" to
+   a message (to be freed with g_free) on failure */
+bool gtfs_find_departures(sqlite3 *db,
+                          const gtfs_service_days_t *service_days,
+                          int first_day,
+                          unsigned int num_days,
+                          bool integer_ids,
+                          bool skip_frequent_trips,
+                          gtfs_departure_func_t func,
+                          void *data,
+                          char **errmsg);
+
+#endif
@@ -50,10 +50,23 @@ typedef union {
   int integer_value;
   double double_value;
   char *string_value;
-  struct tm date_value;
-  int time_value;
+  char date_value[11];    /* in ISO 8601 ("YYYY-MM-DD") format */
+  int time_value;         /* in seconds since midnight */
 } gtfs_field_value_t;
 
+/* Identifies the kind of GTFS object a string field identifies, if
+   any---each kind has its own space of identifiers, within which each
+   identifier is interned as a dense integer when the database is
+   created with compact IDs */
+typedef enum {
+  ID_SPACE_NONE,
+  ID_SPACE_ROUTE,
+  ID_SPACE_SERVICE,
+  ID_SPACE_STOP,
+  ID_SPACE_TRIP,
+  NUM_ID_SPACES
+} gtfs_id_space_t;
+
 /* Defines a field present in a GTFS file and stored in the
    database */
 typedef struct {
@@ -61,6 +74,7 @@ typedef struct {
   gtfs_field_type_t type;
   unsigned int length;
   bool required;
+  gtfs_id_space_t id_space;
 } gtfs_field_spec_t;
 
 /* Specifies a GTFS file (contained within a GTFS bundle) and how it
@@ -81,11 +95,22 @@ typedef struct {
   unsigned int num_fields;
   gtfs_field_spec_t **field_specs;
 
+  /* The number of fields making up the natural key that identifies
+     each object, used to match records against those already in the
+     database when it is updated, and their field numbers */
+  unsigned int num_key_fields;
+  unsigned int *key_fields;
+
   /* SQL create-table and insert-object statements, plus an array of
      statements used to create the needed indices on the table */
   const char *create_table_stmt_str;
   const char *insert_stmt_str;
   const char **create_index_stmt_strs;
+
+  /* A flag indicating whether the table is clustered on the natural
+     key (created WITHOUT ROWID, with its records inserted in key
+     order) when the database is created with clustered tables */
+  bool clustered;
 } gtfs_file_spec_t;
 
 #endif
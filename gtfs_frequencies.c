@@ -0,0 +1,183 @@
+/* The trips a feed runs at regular intervals and the runs into which
+   each is expanded.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "gtfs_frequencies.h"
+
+/* The longest trip ID given to a run of a trip run at regular
+   intervals: the trip's own ID, of up to 255 characters, followed by
+   "@" and the time the run starts */
+#define MAX_RUN_ID_LENGTH 255 + 16
+
+/* ---------------------------------------------------------------- */
+
+/* A period over which a trip runs at regular intervals: the times of
+   its first run's departure and of the end of the period, and the
+   interval between runs, in seconds */
+typedef struct {
+  int start_time, end_time;
+  int headway;
+} headway_t;
+
+/* A trip run at regular intervals: its GTFS identifier and the periods
+   over which it runs */
+typedef struct {
+  char *name;
+  GArray *headways;
+} frequent_trip_t;
+
+struct gtfs_frequencies {
+  /* The trips, keyed by ID as text */
+  GHashTable *trips;
+};
+
+/* ---------------------------------------------------------------- */
+
+/* Frees a trip */
+static void free_frequent_trip(gpointer data) {
+  frequent_trip_t *trip = data;
+
+  g_free(trip->name);
+  g_array_free(trip->headways, TRUE);
+  g_free(trip);
+}
+
+/* ---------------------------------------------------------------- */
+
+gtfs_frequencies_t *gtfs_frequencies_read(sqlite3 *db, char **errmsg) {
+  gtfs_frequencies_t *frequencies;
+  sqlite3_stmt *select_stmt;
+  frequent_trip_t *trip;
+  headway_t headway;
+  const char *trip_id;
+  int sqlite_result;
+
+  if(sqlite3_prepare_v2(db,
+                        "SELECT trip_id, start_time, end_time, "
+                        "headway_secs "
+                        "FROM frequencies "
+                        "ORDER BY trip_id, start_time",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return NULL;
+  }
+
+  frequencies = g_new(gtfs_frequencies_t, 1);
+  frequencies->trips = g_hash_table_new_full(g_str_hash,
+                                             g_str_equal,
+                                             g_free,
+                                             free_frequent_trip);
+
+  while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    trip_id = (const char *)sqlite3_column_text(select_stmt, 0);
+    trip = g_hash_table_lookup(frequencies->trips, trip_id);
+    if(trip == NULL) {
+      trip = g_new(frequent_trip_t, 1);
+      trip->name = g_strdup(trip_id);
+      trip->headways = g_array_new(FALSE, FALSE, sizeof(headway_t));
+      g_hash_table_insert(frequencies->trips, g_strdup(trip_id), trip);
+    }
+
+    headway.start_time = sqlite3_column_int(select_stmt, 1);
+    headway.end_time = sqlite3_column_int(select_stmt, 2);
+    headway.headway = sqlite3_column_int(select_stmt, 3);
+    g_array_append_val(trip->headways, headway);
+  }
+  if(sqlite_result != SQLITE_DONE) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    gtfs_frequencies_free(frequencies);
+    frequencies = NULL;
+  }
+  sqlite3_finalize(select_stmt);
+
+  return frequencies;
+}
+
+void gtfs_frequencies_set_trip_name(gtfs_frequencies_t *frequencies,
+                                    const char *trip_id,
+                                    const char *name) {
+  frequent_trip_t *trip;
+
+  if(trip = g_hash_table_lookup(frequencies->trips, trip_id)) {
+    g_free(trip->name);
+    trip->name = g_strdup(name);
+  }
+}
+
+const char *gtfs_frequencies_trip_name(const gtfs_frequencies_t *frequencies,
+                                       const char *trip_id) {
+  const frequent_trip_t *trip;
+
+  trip = g_hash_table_lookup(frequencies->trips, trip_id);
+  return trip? trip->name: NULL;
+}
+
+unsigned int gtfs_frequencies_runs(const gtfs_frequencies_t *frequencies,
+                                   const char *trip_id,
+                                   gtfs_trip_run_func_t func,
+                                   void *data) {
+  unsigned int result = 0;
+  const frequent_trip_t *trip;
+  const headway_t *headway;
+  char run_id[MAX_RUN_ID_LENGTH + 1];
+  gtfs_trip_run_t run;
+
+  if((trip = g_hash_table_lookup(frequencies->trips, trip_id)) == NULL) {
+    return 0;
+  }
+
+  run.id = run_id;
+  for(unsigned int index = 0; index < trip->headways->len; index++) {
+    headway = &g_array_index(trip->headways, headway_t, index);
+    if(headway->headway <= 0) {
+      fprintf(stderr,
+              "gtfs_frequencies_runs: "
+              "Headway of trip \"%s\" is not positive\n",
+              trip->name);
+      continue;
+    }
+
+    for(run.start_time = headway->start_time;
+        run.start_time < headway->end_time;
+        run.start_time += headway->headway) {
+      g_snprintf(run_id,
+                 sizeof(run_id),
+                 "%s@%02d:%02d:%02d",
+                 trip->name,
+                 run.start_time / 3600,
+                 run.start_time / 60 % 60,
+                 run.start_time % 60);
+      func(&run, data);
+      result++;
+    }
+  }
+
+  return result;
+}
+
+void gtfs_frequencies_free(gtfs_frequencies_t *frequencies) {
+  g_hash_table_destroy(frequencies->trips);
+  g_free(frequencies);
+}
@@ -0,0 +1,75 @@
+/* The trips a feed runs at regular intervals, as listed in its
+   "frequencies" table, and the runs into which each is expanded: over
+   each period the table lists for a trip, a run starts at the start of
+   the period and then every headway until the period ends. Each run
+   is identified by the trip's GTFS identifier followed by "@" and the
+   time it starts, as in "T1@08:30:00".
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_FREQUENCIES_H__
+#define __GTFS_FREQUENCIES_H__
+
+#include <sqlite3.h>
+#include <stdbool.h>
+
+/* A run of a trip: its ID, which remains valid only until the call
+   made with the run returns, and the time it starts, in seconds since
+   midnight */
+typedef struct {
+  const char *id;
+  int start_time;
+} gtfs_trip_run_t;
+
+/* Called for each run of a trip */
+typedef void (*gtfs_trip_run_func_t)(const gtfs_trip_run_t *run,
+                                     void *data);
+
+/* The trips listed in a feed's frequencies table */
+typedef struct gtfs_frequencies gtfs_frequencies_t;
+
+/* Reads the periods over which each trip in a database's frequencies
+   table runs. Returns NULL and sets "errmsg" to a message (to be freed
+   with g_free) on failure */
+gtfs_frequencies_t *gtfs_frequencies_read(sqlite3 *db, char **errmsg);
+
+/* Sets the GTFS identifier from which a trip's runs are named, given
+   the trip's ID as text; this is the ID itself unless the database
+   interns IDs as integers. Does nothing if the trip is not listed */
+void gtfs_frequencies_set_trip_name(gtfs_frequencies_t *frequencies,
+                                    const char *trip_id,
+                                    const char *name);
+
+/* Returns the GTFS identifier of a trip, given its ID as text, or NULL
+   if the trip is not listed */
+const char *gtfs_frequencies_trip_name(const gtfs_frequencies_t *frequencies,
+                                       const char *trip_id);
+
+/* Calls "func" with "data" for each run of a trip, given its ID as
+   text, period by period in order of the periods' start times; a
+   period whose headway is not positive has no runs, and is reported on
+   the standard error. Returns the number of calls made */
+unsigned int gtfs_frequencies_runs(const gtfs_frequencies_t *frequencies,
+                                   const char *trip_id,
+                                   gtfs_trip_run_func_t func,
+                                   void *data);
+
+/* Frees the trips listed in a frequencies table */
+void gtfs_frequencies_free(gtfs_frequencies_t *frequencies);
+
+#endif
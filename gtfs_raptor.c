@@ -0,0 +1,1021 @@
+/* Writes a feed's timetable laid out for RAPTOR routers, and maps the
+   file written into memory for reading.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gtfs_raptor.h"
+
+/* The alignment, in bytes, of each section within the file */
+#define SECTION_ALIGNMENT 8
+
+/* The time given to a stop time that has none, until it is
+   interpolated */
+#define NO_TIME INT32_MIN
+
+/* ---------------------------------------------------------------- */
+
+/* A trip listed in the "trips" table: the offsets of its ID and its
+   route's ID among the strings, the number of its service and whether
+   any stop times have been read for it */
+typedef struct {
+  uint32_t id;
+  uint32_t route_id;
+  uint32_t service;
+  bool seen;
+} listed_trip_t;
+
+/* A trip's visit to a stop, as read from the "stop_times" table */
+typedef struct {
+  uint32_t stop;
+  int32_t arrival_time, departure_time;
+} trip_stop_t;
+
+/* A trip with valid stop times: its ID, its service and the position
+   of its first stop among the stops visited by every trip read */
+typedef struct {
+  uint32_t id;
+  uint32_t service;
+  uint32_t first_stop;
+} read_trip_t;
+
+/* The trips that run on the same route through the same sequence of
+   stops, from which one or more patterns are made */
+typedef struct {
+  uint32_t route_id;
+  uint32_t num_stops;
+  uint32_t *stops;
+  GArray *trips;
+} trip_group_t;
+
+/* The timetable as it is read from the database and laid out */
+typedef struct {
+  /* The strings, with the offset (plus one, so no offset is NULL) of
+     each keyed by the string itself */
+  GString *strings;
+  GHashTable *string_offsets;
+
+  /* The stops, with the number (plus one) of each keyed by its ID */
+  GArray *stops;
+  GHashTable *stop_numbers;
+
+  /* The services and their bitsets, with the number (plus one) of each
+     keyed by its ID */
+  GArray *services;
+  GArray *service_days;
+  GHashTable *service_numbers;
+
+  /* The trips listed in the "trips" table, keyed by ID */
+  GHashTable *listed_trips;
+
+  /* The trips read, the stops they visit and the groups they fall
+     into, in the order each group was first seen */
+  GArray *read_trips;
+  GArray *trip_stops;
+  GHashTable *trip_groups;
+  GPtrArray *trip_group_list;
+
+  /* The patterns laid out from the groups and the contents of the
+     file's other sections */
+  GArray *patterns;
+  GArray *pattern_stops;
+  GArray *trips;
+  GArray *arrival_times;
+  GArray *departure_times;
+  GArray *stop_patterns;
+
+  /* The number of stops of the group whose trips are being sorted */
+  uint32_t sorted_group_size;
+
+  gtfs_raptor_counts_t *counts;
+} raptor_builder_t;
+
+/* The size of each record in each section, in bytes */
+static const size_t section_record_sizes[GTFS_RAPTOR_NUM_SECTIONS] = {
+  sizeof(gtfs_raptor_stop_t),
+  sizeof(gtfs_raptor_pattern_t),
+  sizeof(uint32_t),
+  sizeof(gtfs_raptor_trip_t),
+  sizeof(int32_t),
+  sizeof(int32_t),
+  sizeof(uint32_t),
+  sizeof(gtfs_raptor_service_t),
+  sizeof(uint8_t),
+  sizeof(char)
+};
+
+/* ---------------------------------------------------------------- */
+
+/* Returns the offset of a string among the builder's strings, adding
+   it if it is not there already */
+static uint32_t add_string(raptor_builder_t *builder, const char *str) {
+  gpointer offset;
+
+  if((offset = g_hash_table_lookup(builder->string_offsets, str)) == NULL) {
+    offset = GUINT_TO_POINTER(builder->strings->len + 1);
+    g_string_append_len(builder->strings, str, strlen(str) + 1);
+    g_hash_table_insert(builder->string_offsets, g_strdup(str), offset);
+  }
+
+  return GPOINTER_TO_UINT(offset) - 1;
+}
+
+/* Hashes a group of trips by its route and stops */
+static guint hash_trip_group(gconstpointer key) {
+  const trip_group_t *group = key;
+  guint hash = 2166136261u;
+
+  hash = (hash ^ group->route_id) * 16777619u;
+  for(uint32_t index = 0; index < group->num_stops; index++) {
+    hash = (hash ^ group->stops[index]) * 16777619u;
+  }
+
+  return hash;
+}
+
+/* Returns TRUE if two groups of trips share a route and stops */
+static gboolean trip_groups_equal(gconstpointer a, gconstpointer b) {
+  const trip_group_t *group_a = a, *group_b = b;
+
+  return group_a->route_id == group_b->route_id &&
+    group_a->num_stops == group_b->num_stops &&
+    memcmp(group_a->stops,
+           group_b->stops,
+           group_a->num_stops * sizeof(uint32_t)) == 0;
+}
+
+/* Frees a group of trips */
+static void free_trip_group(gpointer data) {
+  trip_group_t *group = data;
+
+  g_free(group->stops);
+  g_array_free(group->trips, TRUE);
+  g_free(group);
+}
+
+/* Creates an empty builder, which fills in "counts" as it goes */
+static raptor_builder_t *new_builder(gtfs_raptor_counts_t *counts) {
+  raptor_builder_t *builder = g_new0(raptor_builder_t, 1);
+
+  builder->strings = g_string_new(NULL);
+  builder->string_offsets = g_hash_table_new_full(g_str_hash,
+                                                  g_str_equal,
+                                                  g_free,
+                                                  NULL);
+  builder->stops = g_array_new(FALSE, FALSE, sizeof(gtfs_raptor_stop_t));
+  builder->stop_numbers = g_hash_table_new_full(g_str_hash,
+                                                g_str_equal,
+                                                g_free,
+                                                NULL);
+  builder->services =
+    g_array_new(FALSE, FALSE, sizeof(gtfs_raptor_service_t));
+  builder->service_days = g_array_new(FALSE, TRUE, sizeof(uint8_t));
+  builder->service_numbers = g_hash_table_new_full(g_str_hash,
+                                                   g_str_equal,
+                                                   g_free,
+                                                   NULL);
+  builder->listed_trips = g_hash_table_new_full(g_str_hash,
+                                                g_str_equal,
+                                                g_free,
+                                                g_free);
+  builder->read_trips = g_array_new(FALSE, FALSE, sizeof(read_trip_t));
+  builder->trip_stops = g_array_new(FALSE, FALSE, sizeof(trip_stop_t));
+  builder->trip_groups = g_hash_table_new(hash_trip_group,
+                                          trip_groups_equal);
+  builder->trip_group_list = g_ptr_array_new_with_free_func(free_trip_group);
+  builder->patterns =
+    g_array_new(FALSE, FALSE, sizeof(gtfs_raptor_pattern_t));
+  builder->pattern_stops = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  builder->trips = g_array_new(FALSE, FALSE, sizeof(gtfs_raptor_trip_t));
+  builder->arrival_times = g_array_new(FALSE, FALSE, sizeof(int32_t));
+  builder->departure_times = g_array_new(FALSE, FALSE, sizeof(int32_t));
+  builder->stop_patterns = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+
+  memset(counts, 0, sizeof(*counts));
+  builder->counts = counts;
+
+  return builder;
+}
+
+/* Frees a builder */
+static void free_builder(raptor_builder_t *builder) {
+  g_string_free(builder->strings, TRUE);
+  g_hash_table_destroy(builder->string_offsets);
+  g_array_free(builder->stops, TRUE);
+  g_hash_table_destroy(builder->stop_numbers);
+  g_array_free(builder->services, TRUE);
+  g_array_free(builder->service_days, TRUE);
+  g_hash_table_destroy(builder->service_numbers);
+  g_hash_table_destroy(builder->listed_trips);
+  g_array_free(builder->read_trips, TRUE);
+  g_array_free(builder->trip_stops, TRUE);
+  g_hash_table_destroy(builder->trip_groups);
+  g_ptr_array_free(builder->trip_group_list, TRUE);
+  g_array_free(builder->patterns, TRUE);
+  g_array_free(builder->pattern_stops, TRUE);
+  g_array_free(builder->trips, TRUE);
+  g_array_free(builder->arrival_times, TRUE);
+  g_array_free(builder->departure_times, TRUE);
+  g_array_free(builder->stop_patterns, TRUE);
+  g_free(builder);
+}
+
+/* ---------------------------------------------------------------- */
+
+/* Reads each stop's ID and position, in order of ID; returns FALSE and
+   sets "errmsg" on failure */
+static bool read_stops(sqlite3 *db,
+                       raptor_builder_t *builder,
+                       char **errmsg) {
+  sqlite3_stmt *select_stmt;
+  gtfs_raptor_stop_t stop;
+  const char *stop_id;
+  int sqlite_result;
+
+  if(sqlite3_prepare_v2(db,
+                        "SELECT id, lat, lon FROM stops ORDER BY id",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return false;
+  }
+
+  memset(&stop, 0, sizeof(stop));
+  while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    stop_id = (const char *)sqlite3_column_text(select_stmt, 0);
+    stop.id = add_string(builder, stop_id);
+    stop.lat = sqlite3_column_double(select_stmt, 1);
+    stop.lon = sqlite3_column_double(select_stmt, 2);
+    g_array_append_val(builder->stops, stop);
+    g_hash_table_insert(builder->stop_numbers,
+                        g_strdup(stop_id),
+                        GUINT_TO_POINTER(builder->stops->len));
+  }
+  if(sqlite_result != SQLITE_DONE) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(select_stmt);
+
+  return sqlite_result == SQLITE_DONE;
+}
+
+/* Returns the number of the service with the given ID, adding it with
+   the days on which it runs if it is not there already */
+static uint32_t add_service(raptor_builder_t *builder,
+                            const gtfs_service_days_t *service_days,
+                            const char *service_id) {
+  gtfs_raptor_service_t service;
+  gpointer number;
+  uint8_t *days;
+  int service_number, last_day;
+
+  if((number = g_hash_table_lookup(builder->service_numbers, service_id))) {
+    return GPOINTER_TO_UINT(number) - 1;
+  }
+
+  service.id = add_string(builder, service_id);
+  service.first_day = 0;
+  service.num_days = 0;
+  service.days = builder->service_days->len;
+
+  /* A service missing from the calendars never runs */
+  service_number = gtfs_service_days_find(service_days, service_id);
+  if(service_number != -1 &&
+     gtfs_service_days_range(service_days,
+                             service_number,
+                             &service.first_day,
+                             &last_day)) {
+    service.num_days = last_day - service.first_day + 1;
+    g_array_set_size(builder->service_days,
+                     service.days + (service.num_days + 7) / 8);
+    days = (uint8_t *)builder->service_days->data + service.days;
+    for(uint32_t offset = 0; offset < service.num_days; offset++) {
+      if(gtfs_service_days_runs(service_days,
+                                service_number,
+                                service.first_day + offset)) {
+        days[offset / 8] |= 1 << (offset % 8);
+      }
+    }
+  }
+
+  g_array_append_val(builder->services, service);
+  g_hash_table_insert(builder->service_numbers,
+                      g_strdup(service_id),
+                      GUINT_TO_POINTER(builder->services->len));
+
+  return builder->services->len - 1;
+}
+
+/* Reads each trip's route and service, leaving out the trips run at
+   regular intervals if "skip_frequency_trips" is TRUE; returns FALSE
+   and sets "errmsg" on failure */
+static bool read_trips(sqlite3 *db,
+                       raptor_builder_t *builder,
+                       const gtfs_service_days_t *service_days,
+                       bool skip_frequency_trips,
+                       char **errmsg) {
+  sqlite3_stmt *select_stmt;
+  listed_trip_t *trip;
+  int sqlite_result;
+
+  if(sqlite3_prepare_v2(db,
+                        skip_frequency_trips?
+                        "SELECT id, route_id, service_id FROM trips "
+                        "WHERE id NOT IN "
+                        "(SELECT trip_id FROM frequencies)":
+                        "SELECT id, route_id, service_id FROM trips",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return false;
+  }
+
+  while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    trip = g_new(listed_trip_t, 1);
+    trip->id = add_string(builder,
+                          (const char *)sqlite3_column_text(select_stmt, 0));
+    trip->route_id =
+      add_string(builder, (const char *)sqlite3_column_text(select_stmt, 1));
+    trip->service =
+      add_service(builder,
+                  service_days,
+                  (const char *)sqlite3_column_text(select_stmt, 2));
+    trip->seen = false;
+    g_hash_table_insert(builder->listed_trips,
+                        g_strdup((const char *)
+                                 sqlite3_column_text(select_stmt, 0)),
+                        trip);
+  }
+  if(sqlite_result != SQLITE_DONE) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(select_stmt);
+
+  return sqlite_result == SQLITE_DONE;
+}
+
+/* Fills in the times missing from a trip's stops, taking a stop's
+   arrival time from its departure time and vice versa and otherwise
+   interpolating evenly between the stops either side; returns FALSE if
+   the trip has no time at its first or last stop or its times run
+   backward */
+static bool interpolate_times(trip_stop_t *stops, unsigned int num_stops) {
+  unsigned int index, previous, next;
+  int32_t from_time, to_time;
+
+  for(index = 0; index < num_stops; index++) {
+    if(stops[index].arrival_time == NO_TIME) {
+      stops[index].arrival_time = stops[index].departure_time;
+    }
+    else if(stops[index].departure_time == NO_TIME) {
+      stops[index].departure_time = stops[index].arrival_time;
+    }
+  }
+  if(stops[0].departure_time == NO_TIME ||
+     stops[num_stops - 1].arrival_time == NO_TIME) {
+    return false;
+  }
+
+  for(index = 1; index < num_stops; index++) {
+    if(stops[index].arrival_time == NO_TIME) {
+      previous = index - 1;
+      for(next = index + 1; stops[next].arrival_time == NO_TIME; next++);
+      from_time = stops[previous].departure_time;
+      to_time = stops[next].arrival_time;
+      for(; index < next; index++) {
+        stops[index].arrival_time = stops[index].departure_time =
+          from_time + (int64_t)(to_time - from_time) * (index - previous) /
+          (next - previous);
+      }
+    }
+  }
+
+  for(index = 0; index < num_stops; index++) {
+    if(stops[index].departure_time < stops[index].arrival_time ||
+       (index > 0 &&
+        stops[index].arrival_time < stops[index - 1].departure_time)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Adds a trip whose stops were read from position "first_stop" on to
+   the group of trips sharing its route and stops, unless the trip has
+   too few stops, any stop is unknown ("valid" is FALSE) or its times
+   cannot be completed, in which case its stops are dropped */
+static void add_trip(raptor_builder_t *builder,
+                     listed_trip_t *listed_trip,
+                     bool valid,
+                     uint32_t first_stop) {
+  trip_stop_t *stops;
+  unsigned int num_stops;
+  trip_group_t key, *group;
+  read_trip_t trip;
+  uint32_t trip_number;
+
+  listed_trip->seen = true;
+
+  stops = &g_array_index(builder->trip_stops, trip_stop_t, first_stop);
+  num_stops = builder->trip_stops->len - first_stop;
+  if(!valid || num_stops < 2 || !interpolate_times(stops, num_stops)) {
+    builder->counts->num_skipped_trips++;
+    g_array_set_size(builder->trip_stops, first_stop);
+    return;
+  }
+
+  key.route_id = listed_trip->route_id;
+  key.num_stops = num_stops;
+  key.stops = g_new(uint32_t, num_stops);
+  for(unsigned int index = 0; index < num_stops; index++) {
+    key.stops[index] = stops[index].stop;
+  }
+
+  if((group = g_hash_table_lookup(builder->trip_groups, &key))) {
+    g_free(key.stops);
+  }
+  else {
+    group = g_new(trip_group_t, 1);
+    *group = key;
+    group->trips = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+    g_hash_table_add(builder->trip_groups, group);
+    g_ptr_array_add(builder->trip_group_list, group);
+  }
+
+  trip.id = listed_trip->id;
+  trip.service = listed_trip->service;
+  trip.first_stop = first_stop;
+  g_array_append_val(builder->read_trips, trip);
+  trip_number = builder->read_trips->len - 1;
+  g_array_append_val(group->trips, trip_number);
+}
+
+/* Reads each listed trip's stop times, in order, adding each trip to
+   its group; returns FALSE and sets "errmsg" on failure */
+static bool read_stop_times(sqlite3 *db,
+                            raptor_builder_t *builder,
+                            char **errmsg) {
+  sqlite3_stmt *select_stmt;
+  const char *row_trip_id;
+  char *trip_id = NULL;
+  listed_trip_t *listed_trip = NULL;
+  bool valid = true;
+  uint32_t first_stop = 0;
+  gpointer stop_number;
+  trip_stop_t stop;
+  GHashTableIter iter;
+  gpointer value;
+  int sqlite_result;
+
+  if(sqlite3_prepare_v2(db,
+                        "SELECT trip_id, stop_id, arrival_time, "
+                        "departure_time "
+                        "FROM stop_times "
+                        "ORDER BY trip_id, stop_sequence",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return false;
+  }
+
+  while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    /* Complete the trip before whenever another begins */
+    row_trip_id = (const char *)sqlite3_column_text(select_stmt, 0);
+    if(trip_id == NULL || strcmp(row_trip_id, trip_id)) {
+      if(listed_trip) {
+        add_trip(builder, listed_trip, valid, first_stop);
+      }
+      g_free(trip_id);
+      trip_id = g_strdup(row_trip_id);
+      listed_trip = g_hash_table_lookup(builder->listed_trips, trip_id);
+      valid = true;
+      first_stop = builder->trip_stops->len;
+    }
+
+    /* Stop times of trips not listed (or left out) are ignored */
+    if(listed_trip == NULL || !valid) {
+      continue;
+    }
+
+    stop_number =
+      g_hash_table_lookup(builder->stop_numbers,
+                          sqlite3_column_text(select_stmt, 1));
+    if(stop_number == NULL) {
+      valid = false;
+      continue;
+    }
+
+    stop.stop = GPOINTER_TO_UINT(stop_number) - 1;
+    stop.arrival_time = sqlite3_column_type(select_stmt, 2) == SQLITE_NULL?
+      NO_TIME: sqlite3_column_int(select_stmt, 2);
+    stop.departure_time = sqlite3_column_type(select_stmt, 3) == SQLITE_NULL?
+      NO_TIME: sqlite3_column_int(select_stmt, 3);
+    g_array_append_val(builder->trip_stops, stop);
+  }
+  if(listed_trip) {
+    add_trip(builder, listed_trip, valid, first_stop);
+  }
+  g_free(trip_id);
+
+  if(sqlite_result != SQLITE_DONE) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(select_stmt);
+
+  /* Trips without any stop times are left out too */
+  g_hash_table_iter_init(&iter, builder->listed_trips);
+  while(g_hash_table_iter_next(&iter, NULL, &value)) {
+    if(!((listed_trip_t *)value)->seen) {
+      builder->counts->num_skipped_trips++;
+    }
+  }
+
+  return sqlite_result == SQLITE_DONE;
+}
+
+/* ---------------------------------------------------------------- */
+
+/* Returns the stops visited by a trip read */
+static const trip_stop_t *read_trip_stops(const raptor_builder_t *builder,
+                                          uint32_t trip) {
+  return &g_array_index(builder->trip_stops,
+                        trip_stop_t,
+                        g_array_index(builder->read_trips,
+                                      read_trip_t,
+                                      trip).first_stop);
+}
+
+/* Compares two trips of a group by their departure times at each stop
+   in turn, then by their arrival times */
+static gint compare_group_trips(gconstpointer a,
+                                gconstpointer b,
+                                gpointer data) {
+  const raptor_builder_t *builder = data;
+  const trip_stop_t *stops_a, *stops_b;
+  uint32_t trip_a = *(const uint32_t *)a, trip_b = *(const uint32_t *)b;
+
+  stops_a = read_trip_stops(builder, trip_a);
+  stops_b = read_trip_stops(builder, trip_b);
+  for(unsigned int index = 0; index < builder->sorted_group_size; index++) {
+    if(stops_a[index].departure_time != stops_b[index].departure_time) {
+      return stops_a[index].departure_time < stops_b[index].departure_time?
+        -1: 1;
+    }
+    if(stops_a[index].arrival_time != stops_b[index].arrival_time) {
+      return stops_a[index].arrival_time < stops_b[index].arrival_time?
+        -1: 1;
+    }
+  }
+
+  return trip_a < trip_b? -1: trip_a > trip_b;
+}
+
+/* Returns TRUE if one trip of a group neither arrives at nor departs
+   from any stop before another, so both can share a pattern with the
+   second running after the first */
+static bool trip_follows(const raptor_builder_t *builder,
+                         uint32_t earlier_trip,
+                         uint32_t later_trip,
+                         uint32_t num_stops) {
+  const trip_stop_t *earlier = read_trip_stops(builder, earlier_trip);
+  const trip_stop_t *later = read_trip_stops(builder, later_trip);
+
+  for(uint32_t index = 0; index < num_stops; index++) {
+    if(later[index].arrival_time < earlier[index].arrival_time ||
+       later[index].departure_time < earlier[index].departure_time) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Lays out the patterns made from a group of trips: sorts the trips by
+   departure time, then places each in the first pattern whose last
+   trip it does not overtake, starting another pattern if it overtakes
+   the last trip of every one, so a router scanning a pattern's trips
+   in order finds them running in order at every stop */
+static void lay_out_patterns(raptor_builder_t *builder, trip_group_t *group) {
+  const uint32_t *trips = (const uint32_t *)group->trips->data;
+  const trip_stop_t *stops;
+  GArray *last_trips;
+  uint32_t *trip_patterns;
+  uint32_t pattern_number;
+  gtfs_raptor_pattern_t pattern;
+  gtfs_raptor_trip_t trip;
+  const read_trip_t *read_trip;
+
+  builder->sorted_group_size = group->num_stops;
+  g_array_sort_with_data(group->trips, compare_group_trips, builder);
+
+  last_trips = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  trip_patterns = g_new(uint32_t, group->trips->len);
+  for(uint32_t index = 0; index < group->trips->len; index++) {
+    for(pattern_number = 0;
+        pattern_number < last_trips->len &&
+          !trip_follows(builder,
+                        g_array_index(last_trips, uint32_t, pattern_number),
+                        trips[index],
+                        group->num_stops);
+        pattern_number++);
+    if(pattern_number == last_trips->len) {
+      g_array_append_val(last_trips, trips[index]);
+    }
+    else {
+      g_array_index(last_trips, uint32_t, pattern_number) = trips[index];
+    }
+    trip_patterns[index] = pattern_number;
+  }
+
+  for(pattern_number = 0; pattern_number < last_trips->len; pattern_number++) {
+    pattern.route_id = group->route_id;
+    pattern.first_stop = builder->pattern_stops->len;
+    pattern.num_stops = group->num_stops;
+    pattern.first_trip = builder->trips->len;
+    pattern.num_trips = 0;
+    pattern.first_time = builder->arrival_times->len;
+    g_array_append_vals(builder->pattern_stops,
+                        group->stops,
+                        group->num_stops);
+
+    for(uint32_t index = 0; index < group->trips->len; index++) {
+      if(trip_patterns[index] != pattern_number) {
+        continue;
+      }
+
+      read_trip = &g_array_index(builder->read_trips,
+                                 read_trip_t,
+                                 trips[index]);
+      trip.id = read_trip->id;
+      trip.service = read_trip->service;
+      g_array_append_val(builder->trips, trip);
+
+      stops = read_trip_stops(builder, trips[index]);
+      for(uint32_t stop = 0; stop < group->num_stops; stop++) {
+        g_array_append_val(builder->arrival_times,
+                           stops[stop].arrival_time);
+        g_array_append_val(builder->departure_times,
+                           stops[stop].departure_time);
+      }
+      pattern.num_trips++;
+    }
+    g_array_append_val(builder->patterns, pattern);
+  }
+
+  g_free(trip_patterns);
+  g_array_free(last_trips, TRUE);
+}
+
+/* Lists for each stop the patterns that visit it, each only once even
+   if it visits the stop more than once */
+static void index_stop_patterns(raptor_builder_t *builder) {
+  gtfs_raptor_stop_t *stops = (gtfs_raptor_stop_t *)builder->stops->data;
+  const gtfs_raptor_pattern_t *pattern;
+  const uint32_t *pattern_stops;
+  uint32_t *last_patterns, first_pattern = 0, stop;
+  bool counting;
+
+  /* Count the patterns visiting each stop, then place each stop's list
+     after the last stop's and fill in the lists */
+  last_patterns = g_new(uint32_t, builder->stops->len);
+  for(counting = true; ; counting = false) {
+    memset(last_patterns, 0xff, builder->stops->len * sizeof(uint32_t));
+    for(uint32_t index = 0; index < builder->stops->len; index++) {
+      if(counting) {
+        stops[index].num_patterns = 0;
+      }
+      else {
+        stops[index].first_pattern = first_pattern;
+        first_pattern += stops[index].num_patterns;
+        stops[index].num_patterns = 0;
+      }
+    }
+    if(!counting) {
+      g_array_set_size(builder->stop_patterns, first_pattern);
+    }
+
+    for(uint32_t index = 0; index < builder->patterns->len; index++) {
+      pattern = &g_array_index(builder->patterns,
+                               gtfs_raptor_pattern_t,
+                               index);
+      pattern_stops = &g_array_index(builder->pattern_stops,
+                                     uint32_t,
+                                     pattern->first_stop);
+      for(uint32_t offset = 0; offset < pattern->num_stops; offset++) {
+        stop = pattern_stops[offset];
+        if(last_patterns[stop] != index) {
+          last_patterns[stop] = index;
+          if(!counting) {
+            g_array_index(builder->stop_patterns,
+                          uint32_t,
+                          stops[stop].first_pattern +
+                          stops[stop].num_patterns) = index;
+          }
+          stops[stop].num_patterns++;
+        }
+      }
+    }
+
+    if(!counting) {
+      break;
+    }
+  }
+  g_free(last_patterns);
+}
+
+/* ---------------------------------------------------------------- */
+
+/* Writes the builder's sections, preceded by the header listing them,
+   to "file"; returns FALSE on failure, leaving "errno" set */
+static bool write_sections(const raptor_builder_t *builder, FILE *file) {
+  static const uint8_t zeros[SECTION_ALIGNMENT];
+  const void *data[GTFS_RAPTOR_NUM_SECTIONS] = {
+    builder->stops->data,
+    builder->patterns->data,
+    builder->pattern_stops->data,
+    builder->trips->data,
+    builder->arrival_times->data,
+    builder->departure_times->data,
+    builder->stop_patterns->data,
+    builder->services->data,
+    builder->service_days->data,
+    builder->strings->str
+  };
+  const uint64_t counts[GTFS_RAPTOR_NUM_SECTIONS] = {
+    builder->stops->len,
+    builder->patterns->len,
+    builder->pattern_stops->len,
+    builder->trips->len,
+    builder->arrival_times->len,
+    builder->departure_times->len,
+    builder->stop_patterns->len,
+    builder->services->len,
+    builder->service_days->len,
+    builder->strings->len
+  };
+  gtfs_raptor_header_t header;
+  uint64_t offset, size;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, GTFS_RAPTOR_MAGIC, sizeof(header.magic));
+  header.byte_order = GTFS_RAPTOR_BYTE_ORDER;
+  header.version = GTFS_RAPTOR_VERSION;
+  header.num_sections = GTFS_RAPTOR_NUM_SECTIONS;
+
+  offset = sizeof(header);
+  for(unsigned int section = 0;
+      section < GTFS_RAPTOR_NUM_SECTIONS;
+      section++) {
+    offset += -offset & (SECTION_ALIGNMENT - 1);
+    header.sections[section].offset = offset;
+    header.sections[section].count = counts[section];
+    offset += counts[section] * section_record_sizes[section];
+  }
+
+  if(fwrite(&header, sizeof(header), 1, file) != 1) {
+    return false;
+  }
+  offset = sizeof(header);
+  for(unsigned int section = 0;
+      section < GTFS_RAPTOR_NUM_SECTIONS;
+      section++) {
+    size = header.sections[section].offset - offset;
+    if(size > 0 && fwrite(zeros, size, 1, file) != 1) {
+      return false;
+    }
+
+    size = counts[section] * section_record_sizes[section];
+    if(size > 0 && fwrite(data[section], size, 1, file) != 1) {
+      return false;
+    }
+    offset = header.sections[section].offset + size;
+  }
+
+  return true;
+}
+
+/* Writes the file to a temporary file beside "path", then renames it to
+   "path"; returns FALSE and sets "errmsg" on failure */
+static bool write_file(const raptor_builder_t *builder,
+                       const char *path,
+                       char **errmsg) {
+  char *temp_path;
+  FILE *file = NULL;
+  bool result;
+  int fd;
+
+  temp_path = g_strconcat(path, ".XXXXXX", NULL);
+  result = (fd = g_mkstemp_full(temp_path, O_RDWR, 0666)) != -1 &&
+    (file = fdopen(fd, "wb")) != NULL &&
+    write_sections(builder, file);
+  if(!result) {
+    *errmsg = g_strdup(g_strerror(errno));
+  }
+
+  if(file) {
+    if(fclose(file) != 0 && result) {
+      *errmsg = g_strdup(g_strerror(errno));
+      result = false;
+    }
+  }
+  else if(fd != -1) {
+    close(fd);
+  }
+
+  if(result && rename(temp_path, path) != 0) {
+    *errmsg = g_strdup(g_strerror(errno));
+    result = false;
+  }
+  if(!result && fd != -1) {
+    unlink(temp_path);
+  }
+  g_free(temp_path);
+
+  return result;
+}
+
+/* ---------------------------------------------------------------- */
+
+bool gtfs_raptor_write(sqlite3 *db,
+                       const gtfs_service_days_t *service_days,
+                       bool skip_frequency_trips,
+                       const char *path,
+                       gtfs_raptor_counts_t *counts,
+                       char **errmsg) {
+  raptor_builder_t *builder;
+  bool result;
+
+  builder = new_builder(counts);
+  result = read_stops(db, builder, errmsg) &&
+    read_trips(db, builder, service_days, skip_frequency_trips, errmsg) &&
+    read_stop_times(db, builder, errmsg);
+
+  if(result) {
+    for(unsigned int index = 0;
+        index < builder->trip_group_list->len;
+        index++) {
+      lay_out_patterns(builder,
+                       g_ptr_array_index(builder->trip_group_list, index));
+    }
+    index_stop_patterns(builder);
+
+    counts->num_stops = builder->stops->len;
+    counts->num_patterns = builder->patterns->len;
+    counts->num_trips = builder->trips->len;
+
+    result = write_file(builder, path, errmsg);
+  }
+  free_builder(builder);
+
+  return result;
+}
+
+gtfs_raptor_t *gtfs_raptor_open(const char *path, char **errmsg) {
+  gtfs_raptor_t *raptor;
+  const gtfs_raptor_header_t *header;
+  const gtfs_raptor_section_t *section;
+  const void *sections[GTFS_RAPTOR_NUM_SECTIONS];
+  struct stat stat_buf;
+  void *map;
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) == -1) {
+    *errmsg = g_strdup(g_strerror(errno));
+    return NULL;
+  }
+  if(fstat(fd, &stat_buf) != 0) {
+    *errmsg = g_strdup(g_strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  if((size_t)stat_buf.st_size < sizeof(gtfs_raptor_header_t)) {
+    *errmsg = g_strdup("File too short");
+    close(fd);
+    return NULL;
+  }
+
+  map = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    *errmsg = g_strdup(g_strerror(errno));
+    return NULL;
+  }
+
+  raptor = g_new0(gtfs_raptor_t, 1);
+  raptor->map = map;
+  raptor->map_size = stat_buf.st_size;
+
+  /* Check the header, then that each section lies within the file */
+  header = map;
+  if(memcmp(header->magic, GTFS_RAPTOR_MAGIC, sizeof(header->magic))) {
+    *errmsg = g_strdup("Not a RAPTOR timetable");
+    gtfs_raptor_close(raptor);
+    return NULL;
+  }
+  if(header->byte_order != GTFS_RAPTOR_BYTE_ORDER) {
+    *errmsg = g_strdup("Timetable written in another byte order");
+    gtfs_raptor_close(raptor);
+    return NULL;
+  }
+  if(header->version != GTFS_RAPTOR_VERSION ||
+     header->num_sections < GTFS_RAPTOR_NUM_SECTIONS) {
+    *errmsg = g_strdup_printf("Unsupported timetable version %u",
+                              header->version);
+    gtfs_raptor_close(raptor);
+    return NULL;
+  }
+
+  for(unsigned int index = 0; index < GTFS_RAPTOR_NUM_SECTIONS; index++) {
+    section = &header->sections[index];
+    if(section->offset % SECTION_ALIGNMENT != 0 ||
+       section->offset > raptor->map_size ||
+       section->count > (raptor->map_size - section->offset) /
+       section_record_sizes[index] ||
+       section->count > UINT32_MAX) {
+      *errmsg = g_strdup("Timetable truncated or corrupt");
+      gtfs_raptor_close(raptor);
+      return NULL;
+    }
+    sections[index] = (const char *)map + section->offset;
+  }
+
+  /* Each string must end within the strings section */
+  section = &header->sections[GTFS_RAPTOR_STRINGS];
+  if(section->count > 0 &&
+     ((const char *)sections[GTFS_RAPTOR_STRINGS])[section->count - 1]) {
+    *errmsg = g_strdup("Timetable truncated or corrupt");
+    gtfs_raptor_close(raptor);
+    return NULL;
+  }
+
+  raptor->header = header;
+  raptor->stops = sections[GTFS_RAPTOR_STOPS];
+  raptor->num_stops = header->sections[GTFS_RAPTOR_STOPS].count;
+  raptor->patterns = sections[GTFS_RAPTOR_PATTERNS];
+  raptor->num_patterns = header->sections[GTFS_RAPTOR_PATTERNS].count;
+  raptor->pattern_stops = sections[GTFS_RAPTOR_PATTERN_STOPS];
+  raptor->trips = sections[GTFS_RAPTOR_TRIPS];
+  raptor->num_trips = header->sections[GTFS_RAPTOR_TRIPS].count;
+  raptor->arrival_times = sections[GTFS_RAPTOR_ARRIVAL_TIMES];
+  raptor->departure_times = sections[GTFS_RAPTOR_DEPARTURE_TIMES];
+  raptor->stop_patterns = sections[GTFS_RAPTOR_STOP_PATTERNS];
+  raptor->services = sections[GTFS_RAPTOR_SERVICES];
+  raptor->num_services = header->sections[GTFS_RAPTOR_SERVICES].count;
+  raptor->service_days = sections[GTFS_RAPTOR_SERVICE_DAYS];
+  raptor->strings = sections[GTFS_RAPTOR_STRINGS];
+
+  return raptor;
+}
+
+const char *gtfs_raptor_string(const gtfs_raptor_t *raptor,
+                               uint32_t offset) {
+  return raptor->strings + offset;
+}
+
+bool gtfs_raptor_service_runs(const gtfs_raptor_t *raptor,
+                              uint32_t service,
+                              int day) {
+  const gtfs_raptor_service_t *runs = &raptor->services[service];
+  uint32_t offset = (uint32_t)(day - runs->first_day);
+
+  return offset < runs->num_days &&
+    (raptor->service_days[runs->days + offset / 8] >> (offset % 8)) & 1;
+}
+
+void gtfs_raptor_close(gtfs_raptor_t *raptor) {
+  munmap(raptor->map, raptor->map_size);
+  g_free(raptor);
+}
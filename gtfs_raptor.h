@@ -0,0 +1,214 @@
+/* A feed's timetable laid out for routers using RAPTOR (Round-Based
+   Public Transit Routing), in a single file designed to be mapped into
+   memory and used in place. Trips are grouped into patterns, each the
+   trips of a route that visit the same sequence of stops without any
+   overtaking another, and each pattern's trips are sorted by departure
+   time. The file holds a header followed by flat arrays ("sections")
+   of fixed-size records, each aligned on eight bytes, that refer to
+   one another by position:
+
+     - Stops, in the order in which the database sorts their IDs, each
+       with its position and the range of the stop-patterns section
+       listing the patterns that visit it.
+     - Patterns, each with its route and the ranges of the pattern-stops,
+       trips and time sections holding its stops, trips and times.
+     - Pattern stops, the stop number of each stop each pattern visits.
+     - Trips, each with the number of the service on which it runs.
+     - Arrival and departure times, in seconds after midnight (noon less
+       twelve hours) of the day of service, as a matrix for each pattern
+       with a row for each trip holding its time at each stop. A trip's
+       times at stops listed without them are interpolated.
+     - Stop patterns, the pattern numbers listed for each stop.
+     - Services, each with the span of days its bitset covers and the
+       bitset's position in the service-days section.
+     - Service days, the bitsets, a bit for each day from the first, the
+       first day's bit being the least significant bit of its first
+       byte.
+     - Strings, the stops', routes', trips' and services' IDs as
+       NUL-terminated strings, referred to by their offset in the
+       section. IDs are as they read as text in the database---for an
+       ID interned as an integer, the integer's decimal digits.
+
+   Values are stored in the byte order of the machine that wrote the
+   file. The version in the header is raised whenever the layout of
+   anything already in the file changes, while sections added later are
+   appended after those before them, so a reader can use a file with
+   more sections than it knows.
+
+   Days are numbered as days since the Unix epoch, 1 January 1970.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_RAPTOR_H__
+#define __GTFS_RAPTOR_H__
+
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gtfs_service_days.h"
+
+/* The magic number that opens the file, the value written to its
+   header to show the byte order and the version of its layout */
+#define GTFS_RAPTOR_MAGIC "GTFSRPTR"
+#define GTFS_RAPTOR_BYTE_ORDER 0x01020304
+#define GTFS_RAPTOR_VERSION 1
+
+/* The file's sections, in the order they are listed in its header */
+enum {
+  GTFS_RAPTOR_STOPS,
+  GTFS_RAPTOR_PATTERNS,
+  GTFS_RAPTOR_PATTERN_STOPS,
+  GTFS_RAPTOR_TRIPS,
+  GTFS_RAPTOR_ARRIVAL_TIMES,
+  GTFS_RAPTOR_DEPARTURE_TIMES,
+  GTFS_RAPTOR_STOP_PATTERNS,
+  GTFS_RAPTOR_SERVICES,
+  GTFS_RAPTOR_SERVICE_DAYS,
+  GTFS_RAPTOR_STRINGS,
+  GTFS_RAPTOR_NUM_SECTIONS
+};
+
+/* A section of the file: its offset from the start of the file, in
+   bytes, and the number of records it holds */
+typedef struct {
+  uint64_t offset;
+  uint64_t count;
+} gtfs_raptor_section_t;
+
+/* The header at the start of the file */
+typedef struct {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t version;
+  uint32_t num_sections;
+  uint32_t padding;
+  gtfs_raptor_section_t sections[GTFS_RAPTOR_NUM_SECTIONS];
+} gtfs_raptor_header_t;
+
+/* A stop: its ID, the patterns that visit it (listed in the
+   stop-patterns section) and its position */
+typedef struct {
+  uint32_t id;
+  uint32_t first_pattern;
+  uint32_t num_patterns;
+  uint32_t padding;
+  double lat, lon;
+} gtfs_raptor_stop_t;
+
+/* A pattern: the ID of its route, its stops (listed in the
+   pattern-stops section), its trips and the start of its matrices of
+   arrival and departure times, in which trip "t" reaches its "s"th
+   stop at the time at "first_time + t * num_stops + s" */
+typedef struct {
+  uint32_t route_id;
+  uint32_t first_stop;
+  uint32_t num_stops;
+  uint32_t first_trip;
+  uint32_t num_trips;
+  uint32_t first_time;
+} gtfs_raptor_pattern_t;
+
+/* A trip: its ID and the number of the service on which it runs */
+typedef struct {
+  uint32_t id;
+  uint32_t service;
+} gtfs_raptor_trip_t;
+
+/* A service: its ID and the days on which it runs, as a bitset of
+   "num_days" bits (none if the service never runs) starting at byte
+   "days" of the service-days section and covering the days from
+   "first_day" */
+typedef struct {
+  uint32_t id;
+  int32_t first_day;
+  uint32_t num_days;
+  uint32_t days;
+} gtfs_raptor_service_t;
+
+/* The numbers of things written to the file */
+typedef struct {
+  unsigned int num_stops;
+  unsigned int num_patterns;
+  unsigned int num_trips;
+
+  /* The trips left out, as they had fewer than two stops, a stop not
+     in the "stops" table, no time at their first or last stop or times
+     running backward */
+  unsigned int num_skipped_trips;
+} gtfs_raptor_counts_t;
+
+/* A file mapped into memory for reading, with the arrays it holds */
+typedef struct {
+  const gtfs_raptor_header_t *header;
+
+  const gtfs_raptor_stop_t *stops;
+  uint32_t num_stops;
+  const gtfs_raptor_pattern_t *patterns;
+  uint32_t num_patterns;
+  const uint32_t *pattern_stops;
+  const gtfs_raptor_trip_t *trips;
+  uint32_t num_trips;
+  const int32_t *arrival_times;
+  const int32_t *departure_times;
+  const uint32_t *stop_patterns;
+  const gtfs_raptor_service_t *services;
+  uint32_t num_services;
+  const uint8_t *service_days;
+  const char *strings;
+
+  /* The mapping itself */
+  void *map;
+  size_t map_size;
+} gtfs_raptor_t;
+
+/* Writes a database's timetable to the file at "path", replacing the
+   file (by renaming a new one over it, so readers already mapping the
+   old file are undisturbed) if it exists, and sets "counts" to the
+   numbers of things written. The days on which each service runs are
+   taken from "service_days". Trips listed in the "frequencies" table
+   are left out if "skip_frequency_trips" is TRUE, as once they are
+   expanded their runs stand in their place. Returns FALSE and sets
+   "errmsg" to a message (to be freed with g_free) on failure */
+bool gtfs_raptor_write(sqlite3 *db,
+                       const gtfs_service_days_t *service_days,
+                       bool skip_frequency_trips,
+                       const char *path,
+                       gtfs_raptor_counts_t *counts,
+                       char **errmsg);
+
+/* Maps the file at "path" into memory, checking its header and that
+   each of its sections lies within it. Returns NULL and sets "errmsg"
+   to a message (to be freed with g_free) on failure */
+gtfs_raptor_t *gtfs_raptor_open(const char *path, char **errmsg);
+
+/* Returns the string at an offset in the strings section */
+const char *gtfs_raptor_string(const gtfs_raptor_t *raptor,
+                               uint32_t offset);
+
+/* Returns TRUE if the service with the given number runs on the given
+   day */
+bool gtfs_raptor_service_runs(const gtfs_raptor_t *raptor,
+                              uint32_t service,
+                              int day);
+
+/* Unmaps a file */
+void gtfs_raptor_close(gtfs_raptor_t *raptor);
+
+#endif
@@ -0,0 +1,540 @@
+/* The days on which each service in a feed runs, as a bitset per
+   service.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtfs_service_days.h"
+#include "gtfs_sqlite.h"
+
+/* The exception types in "calendar_dates" that add a service on a day
+   and remove it; any other type is undefined and ignored */
+#define EXCEPTION_SERVICE_ADDED 1
+#define EXCEPTION_SERVICE_REMOVED 2
+
+/* ---------------------------------------------------------------- */
+
+/* The days a single service runs: a bit for each of "num_days" days
+   from "first_day", or no days at all if "num_days" is zero */
+typedef struct {
+  char *service_id;
+  int first_day;
+  unsigned int num_days;
+  guint8 *days;
+} service_t;
+
+struct gtfs_service_days {
+  /* The services, in the order they were first seen, and the number of
+     each (plus one, so no number is NULL) keyed by its ID */
+  GArray *services;
+  GHashTable *service_numbers;
+
+  /* TRUE if the database stores service IDs interned as integers */
+  bool integer_ids;
+};
+
+/* ---------------------------------------------------------------- */
+
+/* Returns the day of the week on which a day falls, counting from
+   Monday as zero (the order of the weekday columns in "calendars");
+   the Unix epoch fell on a Thursday */
+static int weekday(int day) {
+  return ((day + 3) % 7 + 7) % 7;
+}
+
+/* Returns TRUE if a service runs on a day */
+static bool service_runs(const service_t *service, int day) {
+  unsigned int offset = (unsigned int)(day - service->first_day);
+
+  return offset < service->num_days &&
+    (service->days[offset / 8] >> (offset % 8)) & 1;
+}
+
+/* Changes the span of days a service's bitset covers, keeping the
+   bits for the days within both the old and new spans */
+static void resize_service(service_t *service,
+                           int first_day,
+                           unsigned int num_days) {
+  guint8 *days;
+  unsigned int offset;
+
+  days = g_malloc0((num_days + 7) / 8);
+  for(offset = 0; offset < num_days; offset++) {
+    if(service_runs(service, first_day + offset)) {
+      days[offset / 8] |= 1 << (offset % 8);
+    }
+  }
+
+  g_free(service->days);
+  service->first_day = first_day;
+  service->num_days = num_days;
+  service->days = days;
+}
+
+/* Extends a service's bitset, if it does not already, to cover the
+   days from "first_day" to "last_day" */
+static void extend_service(service_t *service, int first_day, int last_day) {
+  if(service->num_days > 0) {
+    first_day = MIN(first_day, service->first_day);
+    last_day = MAX(last_day,
+                   service->first_day + (int)service->num_days - 1);
+  }
+
+  if(first_day != service->first_day ||
+     last_day - first_day + 1 != (int)service->num_days) {
+    resize_service(service, first_day, last_day - first_day + 1);
+  }
+}
+
+/* Sets whether a service runs on a day, first extending its bitset to
+   cover the day if the service is to run on it */
+static void set_service_runs(service_t *service, int day, bool runs) {
+  unsigned int offset;
+
+  if(runs) {
+    extend_service(service, day, day);
+  }
+
+  offset = (unsigned int)(day - service->first_day);
+  if(offset < service->num_days) {
+    if(runs) {
+      service->days[offset / 8] |= 1 << (offset % 8);
+    }
+    else {
+      service->days[offset / 8] &= ~(1 << (offset % 8));
+    }
+  }
+}
+
+/* Shrinks a service's bitset to span only the days from the first on
+   which it runs to the last */
+static void trim_service(service_t *service) {
+  int first_day, last_day;
+
+  first_day = service->first_day;
+  last_day = service->first_day + (int)service->num_days - 1;
+  while(first_day <= last_day && !service_runs(service, first_day)) {
+    first_day++;
+  }
+  while(last_day >= first_day && !service_runs(service, last_day)) {
+    last_day--;
+  }
+
+  if(first_day > last_day) {
+    g_free(service->days);
+    service->first_day = 0;
+    service->num_days = 0;
+    service->days = NULL;
+  }
+  else if(first_day != service->first_day ||
+          last_day - first_day + 1 != (int)service->num_days) {
+    resize_service(service, first_day, last_day - first_day + 1);
+  }
+}
+
+/* Creates an empty set of services */
+static gtfs_service_days_t *new_service_days(void) {
+  gtfs_service_days_t *service_days;
+
+  service_days = g_new0(gtfs_service_days_t, 1);
+  service_days->services = g_array_new(FALSE, FALSE, sizeof(service_t));
+  service_days->service_numbers = g_hash_table_new(g_str_hash, g_str_equal);
+
+  return service_days;
+}
+
+/* Returns the service with the given ID, adding it, running on no day
+   at all, if it has not been seen before */
+static service_t *find_service(gtfs_service_days_t *service_days,
+                               const char *service_id) {
+  service_t service;
+  guint number;
+
+  number = GPOINTER_TO_UINT(g_hash_table_lookup(service_days->
+                                                service_numbers,
+                                                service_id));
+  if(number == 0) {
+    memset(&service, 0, sizeof(service));
+    service.service_id = g_strdup(service_id);
+    g_array_append_val(service_days->services, service);
+
+    number = service_days->services->len;
+    g_hash_table_insert(service_days->service_numbers,
+                        service.service_id,
+                        GUINT_TO_POINTER(number));
+  }
+
+  return &g_array_index(service_days->services, service_t, number - 1);
+}
+
+/* Steps through the rows of a query, passing each to a function, and
+   finalizes the query; returns FALSE and sets "errmsg" if the query
+   could not be prepared or run */
+static bool for_each_row(sqlite3 *db,
+                         const char *stmt_str,
+                         void (*row_func)(gtfs_service_days_t *,
+                                          sqlite3_stmt *),
+                         gtfs_service_days_t *service_days,
+                         char **errmsg) {
+  sqlite3_stmt *select_stmt;
+  int sqlite_result;
+
+  if(sqlite3_prepare_v2(db, stmt_str, -1, &select_stmt, NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return false;
+  }
+
+  while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    row_func(service_days, select_stmt);
+  }
+  if(sqlite_result != SQLITE_DONE) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(select_stmt);
+
+  return sqlite_result == SQLITE_DONE;
+}
+
+/* Adds the days a service runs by the weekly schedule in a row of the
+   "calendars" table */
+static void add_weekly_schedule(gtfs_service_days_t *service_days,
+                                sqlite3_stmt *select_stmt) {
+  service_t *service;
+  int first_day, last_day;
+
+  if(sqlite3_column_type(select_stmt, 0) == SQLITE_INTEGER) {
+    service_days->integer_ids = true;
+  }
+
+  service = find_service(service_days,
+                         (const char *)sqlite3_column_text(select_stmt, 0));
+  first_day = gtfs_day_from_date((const char *)
+                                 sqlite3_column_text(select_stmt, 8));
+  last_day = gtfs_day_from_date((const char *)
+                                sqlite3_column_text(select_stmt, 9));
+
+  if(first_day <= last_day) {
+    extend_service(service, first_day, last_day);
+  }
+  for(int day = first_day; day <= last_day; day++) {
+    if(*sqlite3_column_text(select_stmt, weekday(day) + 1) == 't') {
+      set_service_runs(service, day, true);
+    }
+  }
+}
+
+/* Applies the exception to a service's weekly schedule in a row of the
+   "calendar_dates" table */
+static void add_exception(gtfs_service_days_t *service_days,
+                          sqlite3_stmt *select_stmt) {
+  service_t *service;
+  int day, exception_type;
+
+  if(sqlite3_column_type(select_stmt, 0) == SQLITE_INTEGER) {
+    service_days->integer_ids = true;
+  }
+
+  service = find_service(service_days,
+                         (const char *)sqlite3_column_text(select_stmt, 0));
+  day = gtfs_day_from_date((const char *)sqlite3_column_text(select_stmt, 1));
+
+  exception_type = sqlite3_column_int(select_stmt, 2);
+  if(exception_type == EXCEPTION_SERVICE_ADDED) {
+    set_service_runs(service, day, true);
+  }
+  else if(exception_type == EXCEPTION_SERVICE_REMOVED) {
+    set_service_runs(service, day, false);
+  }
+}
+
+/* Adds the days a service runs from a row of the "service_days"
+   table */
+static void add_stored_service(gtfs_service_days_t *service_days,
+                               sqlite3_stmt *select_stmt) {
+  service_t *service;
+  const guint8 *days;
+  int first_day, last_day, size;
+
+  if(sqlite3_column_type(select_stmt, 0) == SQLITE_INTEGER) {
+    service_days->integer_ids = true;
+  }
+
+  service = find_service(service_days,
+                         (const char *)sqlite3_column_text(select_stmt, 0));
+  if(sqlite3_column_type(select_stmt, 1) != SQLITE_NULL &&
+     sqlite3_column_type(select_stmt, 2) != SQLITE_NULL) {
+    first_day = gtfs_day_from_date((const char *)
+                                   sqlite3_column_text(select_stmt, 1));
+    last_day = gtfs_day_from_date((const char *)
+                                  sqlite3_column_text(select_stmt, 2));
+    days = sqlite3_column_blob(select_stmt, 3);
+    size = sqlite3_column_bytes(select_stmt, 3);
+
+    /* Take only as many days as the blob has bits for */
+    if(last_day >= first_day && size > 0) {
+      service->first_day = first_day;
+      service->num_days = MIN(last_day - first_day + 1, size * 8);
+      service->days = g_malloc0((service->num_days + 7) / 8);
+      memcpy(service->days, days, (service->num_days + 7) / 8);
+    }
+  }
+}
+
+/* ---------------------------------------------------------------- */
+
+int gtfs_day_from_date(const char *date) {
+  int year, month, day, year_of_era, day_of_year, day_of_era;
+
+  year = (date[0] - '0') * 1000 + (date[1] - '0') * 100 +
+    (date[2] - '0') * 10 + (date[3] - '0');
+  month = (date[5] - '0') * 10 + (date[6] - '0');
+  day = (date[8] - '0') * 10 + (date[9] - '0');
+
+  /* Count from 1 March 0000, so leap days fall at the end of each
+     year, in 400-year eras of 146,097 days */
+  if(month <= 2) {
+    year--;
+  }
+  year_of_era = year % 400;
+  day_of_year = (153 * (month > 2? month - 3: month + 9) + 2) / 5 + day - 1;
+  day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+    day_of_year;
+
+  return (year / 400) * 146097 + day_of_era - 719468;
+}
+
+void gtfs_date_from_day(int day, char *date) {
+  int era, day_of_era, year_of_era, day_of_year, month_index;
+  int year, month, day_of_month;
+
+  /* Reverse the count made by gtfs_day_from_date */
+  day += 719468;
+  era = day / 146097;
+  day_of_era = day - era * 146097;
+  year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+                 day_of_era / 146096) / 365;
+  day_of_year = day_of_era -
+    (year_of_era * 365 + year_of_era / 4 - year_of_era / 100);
+  month_index = (5 * day_of_year + 2) / 153;
+
+  day_of_month = day_of_year - (153 * month_index + 2) / 5 + 1;
+  month = month_index < 10? month_index + 3: month_index - 9;
+  year = era * 400 + year_of_era + (month <= 2);
+
+  sprintf(date, "%04d-%02d-%02d", year, month, day_of_month);
+}
+
+gtfs_service_days_t *gtfs_service_days_expand(sqlite3 *db, char **errmsg) {
+  gtfs_service_days_t *service_days;
+  bool result;
+
+  service_days = new_service_days();
+
+  /* Set the days of each service's weekly schedule, then apply the
+     exceptions to it */
+  result = for_each_row(db,
+                        "SELECT service_id, monday, tuesday, wednesday, "
+                        "thursday, friday, saturday, sunday, start_date, "
+                        "end_date FROM calendars",
+                        add_weekly_schedule,
+                        service_days,
+                        errmsg) &&
+    (!gtfs_sqlite_table_exists(db, "calendar_dates") ||
+     for_each_row(db,
+                  "SELECT service_id, date, exception_type "
+                  "FROM calendar_dates",
+                  add_exception,
+                  service_days,
+                  errmsg));
+  if(!result) {
+    gtfs_service_days_free(service_days);
+    return NULL;
+  }
+
+  for(unsigned int number = 0;
+      number < service_days->services->len;
+      number++) {
+    trim_service(&g_array_index(service_days->services, service_t, number));
+  }
+
+  return service_days;
+}
+
+gtfs_service_days_t *gtfs_service_days_read(sqlite3 *db, char **errmsg) {
+  gtfs_service_days_t *service_days;
+
+  service_days = new_service_days();
+  if(!for_each_row(db,
+                   "SELECT service_id, start_date, end_date, days "
+                   "FROM service_days",
+                   add_stored_service,
+                   service_days,
+                   errmsg)) {
+    gtfs_service_days_free(service_days);
+    return NULL;
+  }
+
+  return service_days;
+}
+
+bool gtfs_service_days_write(const gtfs_service_days_t *service_days,
+                             sqlite3 *db,
+                             char **errmsg) {
+  bool result = true;
+  char *stmt_str;
+  sqlite3_stmt *insert_stmt;
+  const service_t *service;
+  char first_date[11], last_date[11];
+
+  /* Replace the table within a savepoint, so it is left as it was if
+     it cannot be written in full */
+  stmt_str = g_strdup_printf("SAVEPOINT service_days; "
+                             "DROP TABLE IF EXISTS service_days; "
+                             "CREATE TABLE service_days("
+                             "service_id %s PRIMARY KEY, "
+                             "start_date DATE, "
+                             "end_date DATE, "
+                             "days BLOB NOT NULL);",
+                             service_days->integer_ids?
+                             "INTEGER": "VARCHAR(255)");
+  if(sqlite3_exec(db, stmt_str, NULL, NULL, NULL) != SQLITE_OK ||
+     sqlite3_prepare_v2(db,
+                        "INSERT INTO service_days(service_id, start_date, "
+                        "end_date, days) VALUES (?, ?, ?, ?)",
+                        -1,
+                        &insert_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    g_free(stmt_str);
+    sqlite3_exec(db,
+                 "ROLLBACK TO service_days; RELEASE service_days",
+                 NULL,
+                 NULL,
+                 NULL);
+    return false;
+  }
+  g_free(stmt_str);
+
+  for(unsigned int number = 0;
+      number < service_days->services->len && result;
+      number++) {
+    service = &g_array_index(service_days->services, service_t, number);
+
+    if(service_days->integer_ids) {
+      sqlite3_bind_int64(insert_stmt,
+                         1,
+                         g_ascii_strtoll(service->service_id, NULL, 10));
+    }
+    else {
+      sqlite3_bind_text(insert_stmt,
+                        1,
+                        service->service_id,
+                        -1,
+                        SQLITE_STATIC);
+    }
+
+    if(service->num_days > 0) {
+      gtfs_date_from_day(service->first_day, first_date);
+      gtfs_date_from_day(service->first_day + service->num_days - 1,
+                         last_date);
+      sqlite3_bind_text(insert_stmt, 2, first_date, -1, SQLITE_STATIC);
+      sqlite3_bind_text(insert_stmt, 3, last_date, -1, SQLITE_STATIC);
+      sqlite3_bind_blob(insert_stmt,
+                        4,
+                        service->days,
+                        (service->num_days + 7) / 8,
+                        SQLITE_STATIC);
+    }
+    else {
+      sqlite3_bind_null(insert_stmt, 2);
+      sqlite3_bind_null(insert_stmt, 3);
+      sqlite3_bind_zeroblob(insert_stmt, 4, 0);
+    }
+
+    if(sqlite3_step(insert_stmt) != SQLITE_DONE) {
+      *errmsg = g_strdup(sqlite3_errmsg(db));
+      result = false;
+    }
+    sqlite3_reset(insert_stmt);
+  }
+  sqlite3_finalize(insert_stmt);
+
+  sqlite3_exec(db,
+               result?
+               "RELEASE service_days":
+               "ROLLBACK TO service_days; RELEASE service_days",
+               NULL,
+               NULL,
+               NULL);
+
+  return result;
+}
+
+unsigned int gtfs_service_days_num_services(const gtfs_service_days_t
+                                            *service_days) {
+  return service_days->services->len;
+}
+
+int gtfs_service_days_find(const gtfs_service_days_t *service_days,
+                           const char *service_id) {
+  return (int)GPOINTER_TO_UINT(g_hash_table_lookup(service_days->
+                                                   service_numbers,
+                                                   service_id)) - 1;
+}
+
+bool gtfs_service_days_runs(const gtfs_service_days_t *service_days,
+                            int service,
+                            int day) {
+  return service_runs(&g_array_index(service_days->services,
+                                     service_t,
+                                     service),
+                      day);
+}
+
+bool gtfs_service_days_range(const gtfs_service_days_t *service_days,
+                             int service,
+                             int *first_day,
+                             int *last_day) {
+  const service_t *service_entry =
+    &g_array_index(service_days->services, service_t, service);
+
+  *first_day = service_entry->first_day;
+  *last_day = service_entry->first_day + (int)service_entry->num_days - 1;
+
+  return service_entry->num_days > 0;
+}
+
+void gtfs_service_days_free(gtfs_service_days_t *service_days) {
+  service_t *service;
+
+  for(unsigned int number = 0;
+      number < service_days->services->len;
+      number++) {
+    service = &g_array_index(service_days->services, service_t, number);
+    g_free(service->service_id);
+    g_free(service->days);
+  }
+  g_array_free(service_days->services, TRUE);
+  g_hash_table_destroy(service_days->service_numbers);
+  g_free(service_days);
+}
@@ -0,0 +1,93 @@
+/* The days on which each service in a feed runs, found by combining
+   the weekly schedules in a database's "calendars" table with the
+   exceptions in its "calendar_dates" table and held as a bitset per
+   service, spanning the days from the first on which the service runs
+   to the last. These are stored in the database's "service_days"
+   table, with a row for each service holding its ID, the dates of its
+   first and last days (both NULL if it never runs) and a blob with a
+   bit for each day from the first to the last, the first day's bit
+   being the least significant bit of the blob's first byte. Consumers
+   of the database can read the table back through this interface and
+   find whether a service runs on a given day with a single lookup.
+
+   Days are numbered as days since the Unix epoch, 1 January 1970.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_SERVICE_DAYS_H__
+#define __GTFS_SERVICE_DAYS_H__
+
+#include <sqlite3.h>
+#include <stdbool.h>
+
+/* The days on which each of a feed's services runs */
+typedef struct gtfs_service_days gtfs_service_days_t;
+
+/* Converts a date in ISO 8601 ("YYYY-MM-DD") format, in which dates
+   are stored in the database, to a day number */
+int gtfs_day_from_date(const char *date);
+
+/* Converts a day number to a date in ISO 8601 format, writing it and
+   a terminating NUL to the eleven characters at "date" */
+void gtfs_date_from_day(int day, char *date);
+
+/* Expands the service calendars in a database into the days each
+   service runs. Returns NULL and sets "errmsg" to a message (to be
+   freed with g_free) on failure */
+gtfs_service_days_t *gtfs_service_days_expand(sqlite3 *db, char **errmsg);
+
+/* Reads the days each service runs from a database's "service_days"
+   table. Returns NULL and sets "errmsg" to a message (to be freed with
+   g_free) on failure */
+gtfs_service_days_t *gtfs_service_days_read(sqlite3 *db, char **errmsg);
+
+/* Writes the days each service runs to a database's "service_days"
+   table, replacing the table if it exists. Returns FALSE and sets
+   "errmsg" to a message (to be freed with g_free) on failure */
+bool gtfs_service_days_write(const gtfs_service_days_t *service_days,
+                             sqlite3 *db,
+                             char **errmsg);
+
+/* Returns the number of services */
+unsigned int gtfs_service_days_num_services(const gtfs_service_days_t
+                                            *service_days);
+
+/* Returns the number (counting from zero) of the service with the
+   given ID, as the ID reads as text in the database---for an ID
+   interned as an integer, the integer's decimal digits---or -1 if
+   there is no such service */
+int gtfs_service_days_find(const gtfs_service_days_t *service_days,
+                           const char *service_id);
+
+/* Returns TRUE if the service with the given number runs on the given
+   day */
+bool gtfs_service_days_runs(const gtfs_service_days_t *service_days,
+                            int service,
+                            int day);
+
+/* Finds the first and last days on which the service with the given
+   number runs; returns FALSE if it never runs */
+bool gtfs_service_days_range(const gtfs_service_days_t *service_days,
+                             int service,
+                             int *first_day,
+                             int *last_day);
+
+/* Frees the days each service runs */
+void gtfs_service_days_free(gtfs_service_days_t *service_days);
+
+#endif
@@ -0,0 +1,272 @@
+/* Encodes the points of each shape as a polyline.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <assert.h>
+#include <glib.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtfs_shapes.h"
+
+/* The factors by which coordinates and distances are multiplied before
+   being rounded to integers and encoded: six and four decimal places
+   respectively */
+#define COORDINATE_PRECISION 1e6
+#define DISTANCE_PRECISION 1e4
+
+/* Each encoded value is split into chunks of five bits, least
+   significant first, each chunk but the last being marked with the
+   continuation bit and every chunk offset into printable ASCII */
+#define CHUNK_BITS 5
+#define CHUNK_MASK 0x1f
+#define CHUNK_CONTINUES 0x20
+#define CHUNK_OFFSET 63
+
+/* The most characters a single encoded value takes */
+#define MAX_VALUE_CHARS 13
+
+/* ---------------------------------------------------------------- */
+
+/* A point of the shape being encoded, with the order in which it was
+   added, which keeps points with the same sequence number in their
+   original order */
+typedef struct {
+  int sequence;
+  unsigned int order;
+  int64_t lat, lon;
+  double distance;
+  bool has_distance;
+} shape_point_t;
+
+struct gtfs_shape_encoder {
+  /* The ID of the shape being encoded, or NULL if the encoder holds no
+     points, and its points */
+  char *shape_id;
+  GArray *points;
+
+  /* The IDs of the shapes already encoded */
+  GHashTable *encoded_shape_ids;
+};
+
+/* ---------------------------------------------------------------- */
+
+/* Compares two points by sequence number, then by the order in which
+   they were added */
+static int compare_shape_points(const void *a, const void *b) {
+  const shape_point_t *point_a = a, *point_b = b;
+
+  if(point_a->sequence != point_b->sequence) {
+    return point_a->sequence < point_b->sequence? -1: 1;
+  }
+  return point_a->order < point_b->order? -1: point_a->order > point_b->order;
+}
+
+/* Appends a single value to an encoded string, as the difference from
+   the value before */
+static void append_value(GString *str, int64_t value, int64_t previous) {
+  int64_t delta = value - previous;
+  uint64_t bits;
+
+  /* Move the sign into the least significant bit, so small negative
+     differences take as few chunks as small positive ones */
+  bits = delta < 0? ~((uint64_t)delta << 1): (uint64_t)delta << 1;
+
+  while(bits > CHUNK_MASK) {
+    g_string_append_c(str,
+                      ((bits & CHUNK_MASK) | CHUNK_CONTINUES) +
+                      CHUNK_OFFSET);
+    bits >>= CHUNK_BITS;
+  }
+  g_string_append_c(str, bits + CHUNK_OFFSET);
+}
+
+/* Reads a single value from an encoded string, as the difference from
+   the value before, advancing "str" past it; returns FALSE if the
+   string ends (or is malformed) before the value does */
+static bool read_value(const char **str, int64_t *value) {
+  uint64_t bits = 0;
+  unsigned int shift = 0;
+  int chunk;
+
+  do {
+    chunk = (unsigned char)**str - CHUNK_OFFSET;
+    if(chunk < 0 || chunk > (CHUNK_MASK | CHUNK_CONTINUES) ||
+       shift >= MAX_VALUE_CHARS * CHUNK_BITS) {
+      return false;
+    }
+    bits |= (uint64_t)(chunk & CHUNK_MASK) << shift;
+    shift += CHUNK_BITS;
+    (*str)++;
+  } while(chunk & CHUNK_CONTINUES);
+
+  *value += (bits & 1)? (int64_t)~(bits >> 1): (int64_t)(bits >> 1);
+  return true;
+}
+
+/* ---------------------------------------------------------------- */
+
+gtfs_shape_encoder_t *gtfs_shape_encoder_new(void) {
+  gtfs_shape_encoder_t *encoder = g_new(gtfs_shape_encoder_t, 1);
+
+  encoder->shape_id = NULL;
+  encoder->points = g_array_new(FALSE, FALSE, sizeof(shape_point_t));
+  encoder->encoded_shape_ids = g_hash_table_new_full(g_str_hash,
+                                                     g_str_equal,
+                                                     g_free,
+                                                     NULL);
+
+  return encoder;
+}
+
+bool gtfs_shape_encoder_ends_shape(const gtfs_shape_encoder_t *encoder,
+                                   const char *shape_id) {
+  return encoder->shape_id != NULL && strcmp(encoder->shape_id, shape_id);
+}
+
+bool gtfs_shape_encoder_add(gtfs_shape_encoder_t *encoder,
+                            const char *shape_id,
+                            int sequence,
+                            double lat,
+                            double lon,
+                            const double *distance) {
+  shape_point_t point;
+
+  assert(!gtfs_shape_encoder_ends_shape(encoder, shape_id));
+
+  if(encoder->shape_id == NULL) {
+    if(g_hash_table_contains(encoder->encoded_shape_ids, shape_id)) {
+      return false;
+    }
+    encoder->shape_id = g_strdup(shape_id);
+  }
+
+  point.sequence = sequence;
+  point.order = encoder->points->len;
+  point.lat = llround(lat * COORDINATE_PRECISION);
+  point.lon = llround(lon * COORDINATE_PRECISION);
+  point.has_distance = distance != NULL;
+  point.distance = distance? *distance: 0;
+  g_array_append_val(encoder->points, point);
+
+  return true;
+}
+
+bool gtfs_shape_encoder_encode(gtfs_shape_encoder_t *encoder,
+                               gtfs_encoded_shape_t *shape) {
+  shape_point_t *points, *point;
+  unsigned int num_points;
+  int64_t min_lat, min_lon, max_lat, max_lon;
+  int64_t lat = 0, lon = 0, distance = 0, point_distance;
+  bool has_distances = true;
+  GString *points_str, *distances_str;
+
+  if(encoder->shape_id == NULL) {
+    return false;
+  }
+
+  points = (shape_point_t *)encoder->points->data;
+  num_points = encoder->points->len;
+  qsort(points, num_points, sizeof(shape_point_t), compare_shape_points);
+
+  /* Encode the points in order, finding the box that bounds them */
+  points_str = g_string_sized_new(num_points * 8 + 1);
+  min_lat = max_lat = points[0].lat;
+  min_lon = max_lon = points[0].lon;
+  for(point = points; point < points + num_points; point++) {
+    append_value(points_str, point->lat, lat);
+    append_value(points_str, point->lon, lon);
+    lat = point->lat;
+    lon = point->lon;
+
+    min_lat = MIN(min_lat, lat);
+    max_lat = MAX(max_lat, lat);
+    min_lon = MIN(min_lon, lon);
+    max_lon = MAX(max_lon, lon);
+
+    has_distances = has_distances && point->has_distance;
+  }
+
+  /* Encode the distances travelled, if every point has one */
+  distances_str = NULL;
+  if(has_distances) {
+    distances_str = g_string_sized_new(num_points * 3 + 1);
+    for(point = points; point < points + num_points; point++) {
+      point_distance = llround(point->distance * DISTANCE_PRECISION);
+      append_value(distances_str, point_distance, distance);
+      distance = point_distance;
+    }
+  }
+
+  /* The encoder's copy of the shape ID passes to the encoded shape,
+     and another is kept so the shape is recognized if it reappears */
+  shape->shape_id = encoder->shape_id;
+  shape->num_points = num_points;
+  shape->min_lat = min_lat / COORDINATE_PRECISION;
+  shape->min_lon = min_lon / COORDINATE_PRECISION;
+  shape->max_lat = max_lat / COORDINATE_PRECISION;
+  shape->max_lon = max_lon / COORDINATE_PRECISION;
+  shape->points = g_string_free(points_str, FALSE);
+  shape->distances = distances_str? g_string_free(distances_str, FALSE): NULL;
+
+  g_hash_table_add(encoder->encoded_shape_ids, g_strdup(encoder->shape_id));
+  encoder->shape_id = NULL;
+  g_array_set_size(encoder->points, 0);
+
+  return true;
+}
+
+void gtfs_shape_encoder_free(gtfs_shape_encoder_t *encoder) {
+  g_free(encoder->shape_id);
+  g_array_free(encoder->points, TRUE);
+  g_hash_table_destroy(encoder->encoded_shape_ids);
+  g_free(encoder);
+}
+
+unsigned int gtfs_shape_decode_points(const char *points,
+                                      unsigned int max_points,
+                                      double *lats,
+                                      double *lons) {
+  unsigned int result = 0;
+  int64_t lat = 0, lon = 0;
+
+  while(result < max_points && *points &&
+        read_value(&points, &lat) && read_value(&points, &lon)) {
+    lats[result] = lat / COORDINATE_PRECISION;
+    lons[result] = lon / COORDINATE_PRECISION;
+    result++;
+  }
+
+  return result;
+}
+
+unsigned int gtfs_shape_decode_distances(const char *encoded,
+                                         unsigned int max_points,
+                                         double *distances) {
+  unsigned int result = 0;
+  int64_t distance = 0;
+
+  while(result < max_points && *encoded && read_value(&encoded, &distance)) {
+    distances[result++] = distance / DISTANCE_PRECISION;
+  }
+
+  return result;
+}
@@ -0,0 +1,97 @@
+/* Encodes the points of a shape, as they are read from "shapes.txt",
+   into a compact form stored as a single row of the "shapes" table:
+   the points' latitudes and longitudes, in order, as a polyline in the
+   format of Google's "Encoded Polyline Algorithm" with six decimal
+   places of precision rather than five (often called "polyline6"),
+   and the distance travelled to each point, when given, in the same
+   format with four decimal places. Each value is stored as the
+   difference from the one before, so nearby points take only a few
+   characters each, and every character is printable ASCII. Consumers
+   of the database can decode both through this interface.
+
+   An encoder holds only the points of the shape it is encoding, so a
+   shape's points must be read together, one shape after another;
+   within a shape they may be in any order, and are put in order of
+   sequence number as the shape is encoded.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_SHAPES_H__
+#define __GTFS_SHAPES_H__
+
+#include <stdbool.h>
+
+/* A shape once encoded: its ID, the number of its points, the box
+   bounding them (as encoded, rounded to six decimal places), its
+   encoded points and, if every point has one, its encoded distances
+   travelled, or else NULL. The strings are to be freed with g_free */
+typedef struct {
+  char *shape_id;
+  unsigned int num_points;
+  double min_lat, min_lon;
+  double max_lat, max_lon;
+  char *points;
+  char *distances;
+} gtfs_encoded_shape_t;
+
+/* An encoder of shapes */
+typedef struct gtfs_shape_encoder gtfs_shape_encoder_t;
+
+/* Creates an encoder of shapes */
+gtfs_shape_encoder_t *gtfs_shape_encoder_new(void);
+
+/* Returns TRUE if a point of the shape "shape_id" would end the shape
+   whose points the encoder holds, which must then be encoded before
+   the point is added */
+bool gtfs_shape_encoder_ends_shape(const gtfs_shape_encoder_t *encoder,
+                                   const char *shape_id);
+
+/* Adds a point to the shape the encoder holds, with the distance
+   travelled to it if "distance" is not NULL. Returns FALSE, adding
+   nothing, if the shape has already been encoded, its points not
+   having been read together */
+bool gtfs_shape_encoder_add(gtfs_shape_encoder_t *encoder,
+                            const char *shape_id,
+                            int sequence,
+                            double lat,
+                            double lon,
+                            const double *distance);
+
+/* Encodes the shape the encoder holds into "shape", leaving the
+   encoder empty; returns FALSE if it holds no shape */
+bool gtfs_shape_encoder_encode(gtfs_shape_encoder_t *encoder,
+                               gtfs_encoded_shape_t *shape);
+
+/* Frees an encoder, discarding any shape it holds */
+void gtfs_shape_encoder_free(gtfs_shape_encoder_t *encoder);
+
+/* Decodes up to "max_points" points from a shape's encoded points into
+   "lats" and "lons"; returns the number decoded, which is fewer only if
+   the string holds fewer (or is malformed) */
+unsigned int gtfs_shape_decode_points(const char *points,
+                                      unsigned int max_points,
+                                      double *lats,
+                                      double *lons);
+
+/* Decodes up to "max_points" distances from a shape's encoded
+   distances into "distances"; returns the number decoded */
+unsigned int gtfs_shape_decode_distances(const char *encoded,
+                                         unsigned int max_points,
+                                         double *distances);
+
+#endif
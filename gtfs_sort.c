@@ -0,0 +1,568 @@
+/* Sorting the records of a GTFS file by key, so they can be inserted
+   into a table clustered on that key in key order.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <assert.h>
+#include <errno.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gtfs_sort.h"
+
+/* The size, in bytes, of the storage first allocated for the run of
+   records held in memory */
+#define INITIAL_RUN_SIZE 64 * 1024
+
+/* ---------------------------------------------------------------- */
+
+/* Each record is encoded as its size in bytes (including this header)
+   and the bitmask of its fields present, followed by the value of
+   each field present: first the key fields, in key order, and then
+   the rest in field order. Booleans take a byte, integers and times
+   four bytes, doubles eight bytes, dates eleven bytes (including
+   their terminating NUL) and strings their length plus one */
+typedef struct {
+  uint32_t size;
+  uint32_t fields_present;
+} sort_record_header_t;
+
+/* A run of records spilled to a temporary file, and the record at its
+   head while runs are being merged */
+typedef struct {
+  FILE *file;
+  char *record;
+  size_t record_capacity;
+  bool exhausted;
+} sort_run_t;
+
+struct gtfs_sorter {
+  /* The types of the records' fields, the numbers of their key
+     fields and the order in which fields are encoded */
+  unsigned int num_fields;
+  gtfs_field_type_t *field_types;
+  unsigned int num_key_fields;
+  unsigned int *field_order;
+
+  /* The most memory the run held in memory may use */
+  size_t memory_limit;
+
+  /* The run held in memory: the encoded records, one after another,
+     and the offset of each, in key order once the run is sorted */
+  char *data;
+  size_t data_size, data_used;
+  GArray *offsets;
+
+  /* The runs spilled to temporary files */
+  GArray *runs;
+
+  /* TRUE once the runs are being merged, in which case the next
+     record of the run held in memory and, if the record last fetched
+     must be replaced by the next from its run, that run's number
+     (with the run held in memory numbered after the spilled runs) */
+  bool merging;
+  unsigned int next_record;
+  bool advance_pending;
+  unsigned int last_run;
+
+  /* The value of "errno" once a temporary file could not be written
+     or read (or zero) */
+  int error;
+};
+
+/* ---------------------------------------------------------------- */
+
+/* Returns the number of bytes a field value takes once encoded */
+static size_t encoded_value_size(gtfs_field_type_t field_type,
+                                 const gtfs_field_value_t *field_value) {
+  switch(field_type) {
+  case TYPE_BOOLEAN:
+    return 1;
+
+  case TYPE_INTEGER:
+  case TYPE_TIME:
+    return sizeof(int);
+
+  case TYPE_DOUBLE:
+    return sizeof(double);
+
+  case TYPE_STRING:
+    return strlen(field_value->string_value) + 1;
+
+  case TYPE_DATE:
+    return sizeof(field_value->date_value);
+
+  default:
+    /* Unrecognized field type; this should never be reached */
+    assert(false);
+  }
+
+  return 0;
+}
+
+/* Returns the number of bytes an encoded field value takes */
+static size_t encoded_size(gtfs_field_type_t field_type, const char *data) {
+  gtfs_field_value_t field_value;
+
+  field_value.string_value = (char *)data;
+  return encoded_value_size(field_type, &field_value);
+}
+
+/* Encodes a field value at "data", returning the bytes it takes */
+static size_t encode_value(gtfs_field_type_t field_type,
+                           const gtfs_field_value_t *field_value,
+                           char *data) {
+  size_t size = encoded_value_size(field_type, field_value);
+
+  switch(field_type) {
+  case TYPE_BOOLEAN:
+    *data = field_value->boolean_value;
+    break;
+
+  case TYPE_INTEGER:
+    memcpy(data, &field_value->integer_value, size);
+    break;
+
+  case TYPE_TIME:
+    memcpy(data, &field_value->time_value, size);
+    break;
+
+  case TYPE_DOUBLE:
+    memcpy(data, &field_value->double_value, size);
+    break;
+
+  case TYPE_STRING:
+    memcpy(data, field_value->string_value, size);
+    break;
+
+  case TYPE_DATE:
+    memcpy(data, field_value->date_value, size);
+    break;
+
+  default:
+    /* Unrecognized field type; this should never be reached */
+    assert(false);
+  }
+
+  return size;
+}
+
+/* Decodes the field value at "data", returning the bytes it takes;
+   a string value points into "data" itself */
+static size_t decode_value(gtfs_field_type_t field_type,
+                           const char *data,
+                           gtfs_field_value_t *field_value) {
+  switch(field_type) {
+  case TYPE_BOOLEAN:
+    field_value->boolean_value = *data;
+    break;
+
+  case TYPE_INTEGER:
+    memcpy(&field_value->integer_value, data, sizeof(int));
+    break;
+
+  case TYPE_TIME:
+    memcpy(&field_value->time_value, data, sizeof(int));
+    break;
+
+  case TYPE_DOUBLE:
+    memcpy(&field_value->double_value, data, sizeof(double));
+    break;
+
+  case TYPE_STRING:
+    field_value->string_value = (char *)data;
+    break;
+
+  case TYPE_DATE:
+    memcpy(field_value->date_value, data, sizeof(field_value->date_value));
+    break;
+
+  default:
+    /* Unrecognized field type; this should never be reached */
+    assert(false);
+  }
+
+  return encoded_size(field_type, data);
+}
+
+/* Compares two field values as SQLite orders them */
+static int compare_values(gtfs_field_type_t field_type,
+                          const gtfs_field_value_t *a,
+                          const gtfs_field_value_t *b) {
+  switch(field_type) {
+  case TYPE_BOOLEAN:
+    return a->boolean_value - b->boolean_value;
+
+  case TYPE_INTEGER:
+  case TYPE_TIME:
+    return (a->integer_value > b->integer_value) -
+      (a->integer_value < b->integer_value);
+
+  case TYPE_DOUBLE:
+    return (a->double_value > b->double_value) -
+      (a->double_value < b->double_value);
+
+  case TYPE_STRING:
+    return strcmp(a->string_value, b->string_value);
+
+  case TYPE_DATE:
+    return strcmp(a->date_value, b->date_value);
+
+  default:
+    /* Unrecognized field type; this should never be reached */
+    assert(false);
+  }
+
+  return 0;
+}
+
+/* Compares the keys of two encoded records, with absent values
+   first */
+static int compare_records(const gtfs_sorter_t *sorter,
+                           const char *a,
+                           const char *b) {
+  sort_record_header_t a_header, b_header;
+  gtfs_field_value_t a_value, b_value;
+  unsigned int field_number, field_bit;
+  gtfs_field_type_t field_type;
+  int result = 0;
+
+  memcpy(&a_header, a, sizeof(a_header));
+  memcpy(&b_header, b, sizeof(b_header));
+  a += sizeof(a_header);
+  b += sizeof(b_header);
+
+  for(unsigned int key_field = 0;
+      key_field < sorter->num_key_fields && result == 0;
+      key_field++) {
+    field_number = sorter->field_order[key_field];
+    field_bit = 1 << field_number;
+    field_type = sorter->field_types[field_number];
+
+    if((a_header.fields_present & field_bit) &&
+       (b_header.fields_present & field_bit)) {
+      a += decode_value(field_type, a, &a_value);
+      b += decode_value(field_type, b, &b_value);
+      result = compare_values(field_type, &a_value, &b_value);
+    }
+    else {
+      result = ((a_header.fields_present & field_bit) != 0) -
+        ((b_header.fields_present & field_bit) != 0);
+    }
+  }
+
+  return result;
+}
+
+/* Compares two records of the run held in memory, given their
+   offsets */
+static gint compare_offsets(gconstpointer a, gconstpointer b, gpointer data) {
+  const gtfs_sorter_t *sorter = data;
+
+  return compare_records(sorter,
+                         sorter->data + *(const size_t *)a,
+                         sorter->data + *(const size_t *)b);
+}
+
+/* Notes the first error to occur with a temporary file */
+static void set_error(gtfs_sorter_t *sorter, const char *action) {
+  if(!sorter->error) {
+    sorter->error = errno? errno: EIO;
+    fprintf(stderr,
+            "gtfs_sorter: "
+            "Error %s temporary file: %s\n",
+            action,
+            g_strerror(sorter->error));
+  }
+}
+
+/* Sorts the run held in memory and writes it to a temporary file,
+   emptying it */
+static void spill_run(gtfs_sorter_t *sorter) {
+  sort_run_t run;
+  const char *record;
+  sort_record_header_t header;
+
+  g_array_sort_with_data(sorter->offsets, compare_offsets, sorter);
+
+  memset(&run, 0, sizeof(run));
+  if((run.file = tmpfile()) == NULL) {
+    set_error(sorter, "creating");
+  }
+  else {
+    for(unsigned int index = 0;
+        index < sorter->offsets->len && !sorter->error;
+        index++) {
+      record = sorter->data + g_array_index(sorter->offsets, size_t, index);
+      memcpy(&header, record, sizeof(header));
+      if(fwrite(record, 1, header.size, run.file) != header.size) {
+        set_error(sorter, "writing");
+      }
+    }
+    if(fflush(run.file) != 0) {
+      set_error(sorter, "writing");
+    }
+    g_array_append_val(sorter->runs, run);
+  }
+
+  sorter->data_used = 0;
+  g_array_set_size(sorter->offsets, 0);
+}
+
+/* Reads the next record of a spilled run into its head, marking the
+   run exhausted once it has none left */
+static void read_run_record(gtfs_sorter_t *sorter, sort_run_t *run) {
+  sort_record_header_t header;
+
+  if(sorter->error ||
+     fread(&header, sizeof(header), 1, run->file) != 1) {
+    if(ferror(run->file)) {
+      set_error(sorter, "reading");
+    }
+    run->exhausted = true;
+    return;
+  }
+
+  if(header.size > run->record_capacity) {
+    run->record_capacity = header.size;
+    run->record = g_realloc(run->record, run->record_capacity);
+  }
+  memcpy(run->record, &header, sizeof(header));
+  if(fread(run->record + sizeof(header),
+           1,
+           header.size - sizeof(header),
+           run->file) != header.size - sizeof(header)) {
+    set_error(sorter, "reading");
+    run->exhausted = true;
+  }
+}
+
+/* Sorts the run held in memory and starts merging it with the runs
+   spilled to disk, reading the head of each */
+static void start_merging(gtfs_sorter_t *sorter) {
+  sort_run_t *run;
+
+  g_array_sort_with_data(sorter->offsets, compare_offsets, sorter);
+
+  for(unsigned int run_number = 0;
+      run_number < sorter->runs->len;
+      run_number++) {
+    run = &g_array_index(sorter->runs, sort_run_t, run_number);
+    rewind(run->file);
+    read_run_record(sorter, run);
+  }
+
+  sorter->merging = true;
+  sorter->next_record = 0;
+  sorter->advance_pending = false;
+}
+
+/* ---------------------------------------------------------------- */
+
+gtfs_sorter_t *gtfs_sorter_new(unsigned int num_fields,
+                               const gtfs_field_type_t *field_types,
+                               unsigned int num_key_fields,
+                               const unsigned int *key_fields,
+                               size_t memory_limit) {
+  gtfs_sorter_t *sorter;
+  unsigned int num_ordered = 0;
+  bool is_key_field;
+
+  sorter = g_new0(gtfs_sorter_t, 1);
+  sorter->num_fields = num_fields;
+  sorter->field_types = g_new(gtfs_field_type_t, num_fields);
+  memcpy(sorter->field_types,
+         field_types,
+         num_fields * sizeof(gtfs_field_type_t));
+  sorter->num_key_fields = num_key_fields;
+  sorter->memory_limit = memory_limit;
+  sorter->offsets = g_array_new(FALSE, FALSE, sizeof(size_t));
+  sorter->runs = g_array_new(FALSE, FALSE, sizeof(sort_run_t));
+
+  /* Encode the key fields first, so records can be compared without
+     stepping over any other field */
+  sorter->field_order = g_new(unsigned int, num_fields);
+  for(unsigned int key_field = 0; key_field < num_key_fields; key_field++) {
+    sorter->field_order[num_ordered++] = key_fields[key_field];
+  }
+  for(unsigned int field_number = 0;
+      field_number < num_fields;
+      field_number++) {
+    is_key_field = false;
+    for(unsigned int key_field = 0; key_field < num_key_fields; key_field++) {
+      is_key_field = is_key_field || key_fields[key_field] == field_number;
+    }
+    if(!is_key_field) {
+      sorter->field_order[num_ordered++] = field_number;
+    }
+  }
+
+  return sorter;
+}
+
+void gtfs_sorter_add(gtfs_sorter_t *sorter,
+                     unsigned int fields_present,
+                     const gtfs_field_value_t *field_values) {
+  sort_record_header_t header;
+  unsigned int field_number;
+  size_t offset;
+
+  assert(!sorter->merging);
+
+  /* Find the size of the record once encoded */
+  header.size = sizeof(header);
+  header.fields_present = fields_present;
+  for(unsigned int field = 0; field < sorter->num_fields; field++) {
+    field_number = sorter->field_order[field];
+    if(fields_present & (1 << field_number)) {
+      header.size += encoded_value_size(sorter->field_types[field_number],
+                                        &field_values[field_number]);
+    }
+  }
+
+  /* Spill the run held in memory if this record would take it past
+     its limit, then make sure there is room for the record */
+  if(sorter->offsets->len > 0 &&
+     sorter->data_used + header.size +
+     (sorter->offsets->len + 1) * sizeof(size_t) > sorter->memory_limit) {
+    spill_run(sorter);
+  }
+  if(sorter->data_used + header.size > sorter->data_size) {
+    sorter->data_size = MAX(sorter->data_used + header.size,
+                            MIN(MAX(sorter->data_size * 2,
+                                    INITIAL_RUN_SIZE),
+                                sorter->memory_limit));
+    sorter->data = g_realloc(sorter->data, sorter->data_size);
+  }
+
+  /* Encode the record */
+  offset = sorter->data_used;
+  memcpy(sorter->data + offset, &header, sizeof(header));
+  sorter->data_used += sizeof(header);
+  for(unsigned int field = 0; field < sorter->num_fields; field++) {
+    field_number = sorter->field_order[field];
+    if(fields_present & (1 << field_number)) {
+      sorter->data_used +=
+        encode_value(sorter->field_types[field_number],
+                     &field_values[field_number],
+                     sorter->data + sorter->data_used);
+    }
+  }
+  g_array_append_val(sorter->offsets, offset);
+}
+
+bool gtfs_sorter_next(gtfs_sorter_t *sorter,
+                      unsigned int *fields_present,
+                      gtfs_field_value_t *field_values) {
+  unsigned int num_runs = sorter->runs->len;
+  const char *record = NULL, *run_record;
+  sort_run_t *run;
+  sort_record_header_t header;
+  unsigned int field_number;
+
+  if(!sorter->merging) {
+    start_merging(sorter);
+  }
+
+  /* Replace the record last fetched with the next from its run */
+  if(sorter->advance_pending) {
+    if(sorter->last_run == num_runs) {
+      sorter->next_record++;
+    }
+    else {
+      read_run_record(sorter,
+                      &g_array_index(sorter->runs,
+                                     sort_run_t,
+                                     sorter->last_run));
+    }
+    sorter->advance_pending = false;
+  }
+
+  /* Find the least record at the head of any run, favouring earlier
+     runs among equal records so records with the same key keep the
+     order in which they were added */
+  for(unsigned int run_number = 0; run_number <= num_runs; run_number++) {
+    run_record = NULL;
+    if(run_number < num_runs) {
+      run = &g_array_index(sorter->runs, sort_run_t, run_number);
+      if(!run->exhausted) {
+        run_record = run->record;
+      }
+    }
+    else if(sorter->next_record < sorter->offsets->len) {
+      run_record = sorter->data +
+        g_array_index(sorter->offsets, size_t, sorter->next_record);
+    }
+
+    if(run_record &&
+       (record == NULL || compare_records(sorter, run_record, record) < 0)) {
+      record = run_record;
+      sorter->last_run = run_number;
+    }
+  }
+
+  if(record == NULL) {
+    return false;
+  }
+  sorter->advance_pending = true;
+
+  /* Decode the record */
+  memcpy(&header, record, sizeof(header));
+  *fields_present = header.fields_present;
+  record += sizeof(header);
+  for(unsigned int field = 0; field < sorter->num_fields; field++) {
+    field_number = sorter->field_order[field];
+    if(header.fields_present & (1 << field_number)) {
+      record += decode_value(sorter->field_types[field_number],
+                             record,
+                             &field_values[field_number]);
+    }
+  }
+
+  return true;
+}
+
+unsigned int gtfs_sorter_runs_spilled(const gtfs_sorter_t *sorter) {
+  return sorter->runs->len;
+}
+
+bool gtfs_sorter_free(gtfs_sorter_t *sorter) {
+  bool result = !sorter->error;
+  sort_run_t *run;
+
+  /* Closing each temporary file removes it */
+  for(unsigned int run_number = 0;
+      run_number < sorter->runs->len;
+      run_number++) {
+    run = &g_array_index(sorter->runs, sort_run_t, run_number);
+    fclose(run->file);
+    g_free(run->record);
+  }
+  g_array_free(sorter->runs, TRUE);
+
+  g_array_free(sorter->offsets, TRUE);
+  g_free(sorter->data);
+  g_free(sorter->field_order);
+  g_free(sorter->field_types);
+  g_free(sorter);
+
+  return result;
+}
@@ -0,0 +1,69 @@
+/* Sorting the records of a GTFS file by key, so they can be inserted
+   into a table clustered on that key in key order. Records are
+   gathered in memory, encoded compactly, until a limit on the memory
+   they use is reached; each such run of records is then sorted and
+   spilled to a temporary file, and once every record has been added
+   the runs are merged, with the last run merged from memory. Records
+   that fit within the limit are never written out at all.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_SORT_H__
+#define __GTFS_SORT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gtfs_file.h"
+
+/* A set of records being sorted */
+typedef struct gtfs_sorter gtfs_sorter_t;
+
+/* Creates a sorter for records of "num_fields" fields with values of
+   the given types, ordered by the fields numbered in "key_fields" as
+   SQLite orders them (absent values first), using up to
+   "memory_limit" bytes of memory to hold records before spilling them
+   to disk */
+gtfs_sorter_t *gtfs_sorter_new(unsigned int num_fields,
+                               const gtfs_field_type_t *field_types,
+                               unsigned int num_key_fields,
+                               const unsigned int *key_fields,
+                               size_t memory_limit);
+
+/* Adds a record, given a bitmask of the fields present and the values
+   parsed for them */
+void gtfs_sorter_add(gtfs_sorter_t *sorter,
+                     unsigned int fields_present,
+                     const gtfs_field_value_t *field_values);
+
+/* Fetches the next record in key order once every record has been
+   added, setting the string values in "field_values" to point to
+   storage that remains valid only until the next call; returns FALSE
+   once every record has been fetched */
+bool gtfs_sorter_next(gtfs_sorter_t *sorter,
+                      unsigned int *fields_present,
+                      gtfs_field_value_t *field_values);
+
+/* Returns the number of runs of records spilled to disk so far */
+unsigned int gtfs_sorter_runs_spilled(const gtfs_sorter_t *sorter);
+
+/* Frees a sorter and removes its temporary files; returns FALSE if
+   any record could not be spilled to disk or read back */
+bool gtfs_sorter_free(gtfs_sorter_t *sorter);
+
+#endif
@@ -0,0 +1,43 @@
+/* Helpers for querying a SQLite database.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gtfs_sqlite.h"
+
+bool gtfs_sqlite_table_exists(sqlite3 *db, const char *name) {
+  bool result;
+  sqlite3_stmt *select_stmt;
+
+  if(sqlite3_prepare_v2(db,
+                        "SELECT 1 FROM sqlite_master "
+                        "WHERE type = 'table' AND name = ?",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    return false;
+  }
+  sqlite3_bind_text(select_stmt, 1, name, -1, SQLITE_STATIC);
+  result = sqlite3_step(select_stmt) == SQLITE_ROW;
+  sqlite3_finalize(select_stmt);
+
+  return result;
+}
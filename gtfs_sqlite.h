@@ -0,0 +1,31 @@
+/* Helpers for querying a SQLite database, shared by the loader and
+   the modules that read back what it loaded.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_SQLITE_H__
+#define __GTFS_SQLITE_H__
+
+#include <sqlite3.h>
+#include <stdbool.h>
+
+/* Returns TRUE if the table with the given name exists in the
+   database */
+bool gtfs_sqlite_table_exists(sqlite3 *db, const char *name);
+
+#endif
@@ -0,0 +1,412 @@
+/* A spatial index over the stops in a database.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <glib.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gtfs_stop_index.h"
+
+/* The number of cells along each side of the grid laid over the stops
+   to order them along a Hilbert curve, a power of two */
+#define HILBERT_GRID_SIZE 65536
+
+/* The margin, in degrees, added to each side of the box searched for
+   stops, covering the rounding of positions to the single-precision
+   values the R*Tree holds */
+#define BOX_MARGIN 1e-5
+
+/* The radius searched first for the stops nearest a point when the
+   stops' density cannot be estimated, and the number of times the
+   radius is doubled at most before every stop is searched */
+#define DEFAULT_NEAREST_RADIUS 100.0
+#define MAX_RADIUS_DOUBLINGS 32
+
+/* ---------------------------------------------------------------- */
+
+/* A stop to be indexed, with its distance along the Hilbert curve */
+typedef struct {
+  sqlite3_int64 stop;
+  double lat, lon;
+  uint32_t hilbert_distance;
+} indexed_stop_t;
+
+struct gtfs_stop_index {
+  /* The statement that reads the stops within a box */
+  sqlite3_stmt *select_stmt;
+
+  /* The number of stops indexed and the area they cover, in square
+     metres, from which the radius likely to hold a given number of
+     stops is estimated */
+  unsigned int num_stops;
+  double area;
+};
+
+/* ---------------------------------------------------------------- */
+
+/* Returns the distance along a Hilbert curve filling the grid of the
+   cell at column "x" and row "y" */
+static uint32_t hilbert_distance(uint32_t x, uint32_t y) {
+  uint32_t distance = 0, rx, ry, swap;
+
+  for(uint32_t size = HILBERT_GRID_SIZE / 2; size > 0; size /= 2) {
+    rx = (x & size) > 0;
+    ry = (y & size) > 0;
+    distance += size * size * ((3 * rx) ^ ry);
+
+    /* Rotate the quadrant so the curve within it runs the right
+       way */
+    if(ry == 0) {
+      if(rx == 1) {
+        x = HILBERT_GRID_SIZE - 1 - x;
+        y = HILBERT_GRID_SIZE - 1 - y;
+      }
+      swap = x;
+      x = y;
+      y = swap;
+    }
+  }
+
+  return distance;
+}
+
+/* Returns the cell along one side of the grid holding a coordinate
+   between "min" and "max" */
+static uint32_t grid_cell(double coordinate, double min, double max) {
+  double cell = 0;
+
+  if(max > min) {
+    cell = (coordinate - min) / (max - min) * (HILBERT_GRID_SIZE - 1);
+  }
+
+  return (uint32_t)cell;
+}
+
+/* Orders stops by their distance along the Hilbert curve */
+static gint compare_indexed_stops(gconstpointer a, gconstpointer b) {
+  const indexed_stop_t *stop_a = a, *stop_b = b;
+
+  return (stop_a->hilbert_distance > stop_b->hilbert_distance) -
+    (stop_a->hilbert_distance < stop_b->hilbert_distance);
+}
+
+/* Orders stops found by a query nearest first, then by row ID */
+static gint compare_matches(gconstpointer a, gconstpointer b) {
+  const gtfs_stop_match_t *match_a = a, *match_b = b;
+
+  if(match_a->distance != match_b->distance) {
+    return (match_a->distance > match_b->distance) -
+      (match_a->distance < match_b->distance);
+  }
+
+  return (match_a->stop > match_b->stop) - (match_a->stop < match_b->stop);
+}
+
+/* Reads the position of every stop, ordering the stops along a Hilbert
+   curve over the area they cover; returns NULL and sets "errmsg" on
+   failure */
+static GArray *read_stops(sqlite3 *db, char **errmsg) {
+  GArray *stops;
+  indexed_stop_t stop, *stop_entry;
+  sqlite3_stmt *select_stmt;
+  double min_lat = 90, max_lat = -90, min_lon = 180, max_lon = -180;
+  int sqlite_result;
+
+  if(sqlite3_prepare_v2(db,
+                        "SELECT rowid, lat, lon FROM stops "
+                        "WHERE lat IS NOT NULL AND lon IS NOT NULL",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return NULL;
+  }
+
+  stops = g_array_new(FALSE, FALSE, sizeof(indexed_stop_t));
+  while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    stop.stop = sqlite3_column_int64(select_stmt, 0);
+    stop.lat = sqlite3_column_double(select_stmt, 1);
+    stop.lon = sqlite3_column_double(select_stmt, 2);
+    g_array_append_val(stops, stop);
+
+    min_lat = MIN(min_lat, stop.lat);
+    max_lat = MAX(max_lat, stop.lat);
+    min_lon = MIN(min_lon, stop.lon);
+    max_lon = MAX(max_lon, stop.lon);
+  }
+  if(sqlite_result != SQLITE_DONE) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    g_array_free(stops, TRUE);
+    stops = NULL;
+  }
+  sqlite3_finalize(select_stmt);
+
+  if(stops) {
+    for(unsigned int index = 0; index < stops->len; index++) {
+      stop_entry = &g_array_index(stops, indexed_stop_t, index);
+      stop_entry->hilbert_distance =
+        hilbert_distance(grid_cell(stop_entry->lon, min_lon, max_lon),
+                         grid_cell(stop_entry->lat, min_lat, max_lat));
+    }
+    g_array_sort(stops, compare_indexed_stops);
+  }
+
+  return stops;
+}
+
+/* Adds to "matches" the stops within "radius" of a point, in no
+   particular order */
+static void find_stops_within(gtfs_stop_index_t *stop_index,
+                              double lat,
+                              double lon,
+                              double radius,
+                              GArray *matches) {
+  sqlite3_stmt *select_stmt = stop_index->select_stmt;
+  gtfs_stop_match_t match;
+  double angle, lat_delta, lon_delta;
+  double min_lon = -180, max_lon = 180;
+
+  /* Search the box bounding the circle within "radius" of the point,
+     taking in every longitude if the circle reaches a pole or crosses
+     the antimeridian */
+  angle = radius / GTFS_EARTH_RADIUS;
+  lat_delta = GTFS_DEGREES(angle);
+  if(fabs(lat) + lat_delta < 90 && sin(angle) < cos(GTFS_RADIANS(lat))) {
+    lon_delta = GTFS_DEGREES(asin(sin(angle) / cos(GTFS_RADIANS(lat))));
+    if(lon - lon_delta > -180 && lon + lon_delta < 180) {
+      min_lon = lon - lon_delta;
+      max_lon = lon + lon_delta;
+    }
+  }
+
+  sqlite3_bind_double(select_stmt, 1, lat - lat_delta - BOX_MARGIN);
+  sqlite3_bind_double(select_stmt, 2, lat + lat_delta + BOX_MARGIN);
+  sqlite3_bind_double(select_stmt, 3, min_lon - BOX_MARGIN);
+  sqlite3_bind_double(select_stmt, 4, max_lon + BOX_MARGIN);
+
+  /* Keep only those stops within the box that lie within the circle */
+  while(sqlite3_step(select_stmt) == SQLITE_ROW) {
+    match.stop = sqlite3_column_int64(select_stmt, 0);
+    match.lat = sqlite3_column_double(select_stmt, 1);
+    match.lon = sqlite3_column_double(select_stmt, 2);
+    match.distance = gtfs_stop_distance(lat, lon, match.lat, match.lon);
+    if(match.distance <= radius) {
+      g_array_append_val(matches, match);
+    }
+  }
+  sqlite3_reset(select_stmt);
+}
+
+/* ---------------------------------------------------------------- */
+
+double gtfs_stop_distance(double lat_a, double lon_a,
+                          double lat_b, double lon_b) {
+  double lat_sin, lon_sin, a;
+
+  /* Use the haversine formula, which is accurate over short
+     distances */
+  lat_sin = sin(GTFS_RADIANS(lat_b - lat_a) / 2);
+  lon_sin = sin(GTFS_RADIANS(lon_b - lon_a) / 2);
+  a = lat_sin * lat_sin +
+    cos(GTFS_RADIANS(lat_a)) * cos(GTFS_RADIANS(lat_b)) * lon_sin * lon_sin;
+
+  return 2 * GTFS_EARTH_RADIUS * asin(MIN(sqrt(a), 1.0));
+}
+
+bool gtfs_stop_index_build(sqlite3 *db,
+                           unsigned int *num_stops,
+                           char **errmsg) {
+  bool result = true;
+  GArray *stops;
+  const indexed_stop_t *stop;
+  sqlite3_stmt *insert_stmt;
+
+  if((stops = read_stops(db, errmsg)) == NULL) {
+    return false;
+  }
+
+  /* Replace the index within a savepoint, so it is left as it was if
+     it cannot be written in full */
+  if(sqlite3_exec(db,
+                  "SAVEPOINT stops_rtree; "
+                  "DROP TABLE IF EXISTS stops_rtree; "
+                  "CREATE VIRTUAL TABLE stops_rtree USING rtree("
+                  "id, min_lat, max_lat, min_lon, max_lon, +lat, +lon);",
+                  NULL,
+                  NULL,
+                  NULL) != SQLITE_OK ||
+     sqlite3_prepare_v2(db,
+                        "INSERT INTO stops_rtree "
+                        "VALUES (?, ?, ?, ?, ?, ?, ?)",
+                        -1,
+                        &insert_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    g_array_free(stops, TRUE);
+    sqlite3_exec(db,
+                 "ROLLBACK TO stops_rtree; RELEASE stops_rtree",
+                 NULL,
+                 NULL,
+                 NULL);
+    return false;
+  }
+
+  for(unsigned int index = 0; index < stops->len && result; index++) {
+    stop = &g_array_index(stops, indexed_stop_t, index);
+    sqlite3_bind_int64(insert_stmt, 1, stop->stop);
+    sqlite3_bind_double(insert_stmt, 2, stop->lat);
+    sqlite3_bind_double(insert_stmt, 3, stop->lat);
+    sqlite3_bind_double(insert_stmt, 4, stop->lon);
+    sqlite3_bind_double(insert_stmt, 5, stop->lon);
+    sqlite3_bind_double(insert_stmt, 6, stop->lat);
+    sqlite3_bind_double(insert_stmt, 7, stop->lon);
+    if(sqlite3_step(insert_stmt) != SQLITE_DONE) {
+      *errmsg = g_strdup(sqlite3_errmsg(db));
+      result = false;
+    }
+    sqlite3_reset(insert_stmt);
+  }
+  sqlite3_finalize(insert_stmt);
+
+  sqlite3_exec(db,
+               result?
+               "RELEASE stops_rtree":
+               "ROLLBACK TO stops_rtree; RELEASE stops_rtree",
+               NULL,
+               NULL,
+               NULL);
+
+  *num_stops = stops->len;
+  g_array_free(stops, TRUE);
+
+  return result;
+}
+
+gtfs_stop_index_t *gtfs_stop_index_open(sqlite3 *db, char **errmsg) {
+  gtfs_stop_index_t *stop_index;
+  sqlite3_stmt *select_stmt;
+  double height, width;
+
+  /* Estimate the area the stops cover from the box bounding them */
+  if(sqlite3_prepare_v2(db,
+                        "SELECT count(*), min(min_lat), max(max_lat), "
+                        "min(min_lon), max(max_lon) FROM stops_rtree",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return NULL;
+  }
+
+  stop_index = g_new0(gtfs_stop_index_t, 1);
+  if(sqlite3_step(select_stmt) == SQLITE_ROW) {
+    stop_index->num_stops = sqlite3_column_int(select_stmt, 0);
+    height = GTFS_RADIANS(sqlite3_column_double(select_stmt, 2) -
+                          sqlite3_column_double(select_stmt, 1)) *
+      GTFS_EARTH_RADIUS;
+    width = GTFS_RADIANS(sqlite3_column_double(select_stmt, 4) -
+                         sqlite3_column_double(select_stmt, 3)) *
+      GTFS_EARTH_RADIUS *
+      cos(GTFS_RADIANS((sqlite3_column_double(select_stmt, 1) +
+                        sqlite3_column_double(select_stmt, 2)) / 2));
+    stop_index->area = height * width;
+  }
+  sqlite3_finalize(select_stmt);
+
+  if(sqlite3_prepare_v2(db,
+                        "SELECT id, lat, lon FROM stops_rtree "
+                        "WHERE max_lat >= ? AND min_lat <= ? "
+                        "AND max_lon >= ? AND min_lon <= ?",
+                        -1,
+                        &stop_index->select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    g_free(stop_index);
+    return NULL;
+  }
+
+  return stop_index;
+}
+
+unsigned int gtfs_stop_index_within(gtfs_stop_index_t *stop_index,
+                                    double lat,
+                                    double lon,
+                                    double radius,
+                                    gtfs_stop_match_t **matches) {
+  GArray *found;
+  unsigned int result;
+
+  found = g_array_new(FALSE, FALSE, sizeof(gtfs_stop_match_t));
+  find_stops_within(stop_index, lat, lon, radius, found);
+  g_array_sort(found, compare_matches);
+
+  result = found->len;
+  *matches = (gtfs_stop_match_t *)g_array_free(found, FALSE);
+
+  return result;
+}
+
+unsigned int gtfs_stop_index_nearest(gtfs_stop_index_t *stop_index,
+                                     double lat,
+                                     double lon,
+                                     unsigned int k,
+                                     gtfs_stop_match_t *matches) {
+  GArray *found;
+  double radius;
+  unsigned int result, doublings = 0;
+
+  /* Start with the radius of the circle that would hold "k" stops were
+     they spread evenly, doubling it until the circle holds enough; the
+     "k" nearest of those within the circle are then the "k" nearest of
+     all */
+  radius = stop_index->area > 0 && stop_index->num_stops > 0?
+    sqrt(k * stop_index->area / (G_PI * stop_index->num_stops)):
+    DEFAULT_NEAREST_RADIUS;
+
+  found = g_array_new(FALSE, FALSE, sizeof(gtfs_stop_match_t));
+  while(true) {
+    if(doublings++ == MAX_RADIUS_DOUBLINGS) {
+      radius = G_PI * GTFS_EARTH_RADIUS;
+    }
+    find_stops_within(stop_index, lat, lon, radius, found);
+    if(found->len >= k || found->len >= stop_index->num_stops ||
+       radius >= G_PI * GTFS_EARTH_RADIUS) {
+      break;
+    }
+
+    g_array_set_size(found, 0);
+    radius *= 2;
+  }
+  g_array_sort(found, compare_matches);
+
+  result = MIN(k, found->len);
+  if(result > 0) {
+    memcpy(matches, found->data, result * sizeof(gtfs_stop_match_t));
+  }
+  g_array_free(found, TRUE);
+
+  return result;
+}
+
+void gtfs_stop_index_close(gtfs_stop_index_t *stop_index) {
+  sqlite3_finalize(stop_index->select_stmt);
+  g_free(stop_index);
+}
@@ -0,0 +1,94 @@
+/* A spatial index over the stops in a database, for finding the stops
+   within a given distance of a point or nearest to it without scanning
+   the whole "stops" table. The index is the SQLite R*Tree virtual
+   table "stops_rtree", holding for each stop (identified by its row ID
+   in "stops") a box bounding its position, and its exact latitude and
+   longitude. Stops are added in the order of a Hilbert curve over the
+   area they cover, so the stops under each node of the tree lie close
+   together. Consumers of the database can query the table through
+   this interface.
+
+   Distances are in metres, measured along a great circle on a sphere
+   the size of the Earth.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_STOP_INDEX_H__
+#define __GTFS_STOP_INDEX_H__
+
+#include <sqlite3.h>
+#include <stdbool.h>
+
+/* The mean radius of the Earth, in metres, on which distances are
+   measured */
+#define GTFS_EARTH_RADIUS 6371008.8
+
+/* Conversions between degrees and radians */
+#define GTFS_DEGREES(radians) ((radians) * 180.0 / G_PI)
+#define GTFS_RADIANS(degrees) ((degrees) * G_PI / 180.0)
+
+/* A stop found by a query: its row ID in the "stops" table, its
+   position and its distance from the point queried */
+typedef struct {
+  sqlite3_int64 stop;
+  double lat, lon;
+  double distance;
+} gtfs_stop_match_t;
+
+/* An open spatial index */
+typedef struct gtfs_stop_index gtfs_stop_index_t;
+
+/* Returns the distance between two points given in degrees */
+double gtfs_stop_distance(double lat_a, double lon_a,
+                          double lat_b, double lon_b);
+
+/* Builds the spatial index over a database's stops, replacing the
+   index if it exists, and sets "num_stops" to the number of stops
+   indexed. Returns FALSE and sets "errmsg" to a message (to be freed
+   with g_free) on failure */
+bool gtfs_stop_index_build(sqlite3 *db,
+                           unsigned int *num_stops,
+                           char **errmsg);
+
+/* Opens a database's spatial index for querying. Returns NULL and sets
+   "errmsg" to a message (to be freed with g_free) on failure */
+gtfs_stop_index_t *gtfs_stop_index_open(sqlite3 *db, char **errmsg);
+
+/* Finds the stops within "radius" of a point, ordered nearest first,
+   setting "matches" to an array of them (to be freed with g_free);
+   returns the number found */
+unsigned int gtfs_stop_index_within(gtfs_stop_index_t *stop_index,
+                                    double lat,
+                                    double lon,
+                                    double radius,
+                                    gtfs_stop_match_t **matches);
+
+/* Finds the "k" stops nearest a point, ordered nearest first, storing
+   them in "matches", which must have room for "k" stops; returns the
+   number found, which is fewer than "k" only if there are fewer
+   stops */
+unsigned int gtfs_stop_index_nearest(gtfs_stop_index_t *stop_index,
+                                     double lat,
+                                     double lon,
+                                     unsigned int k,
+                                     gtfs_stop_match_t *matches);
+
+/* Closes a spatial index */
+void gtfs_stop_index_close(gtfs_stop_index_t *stop_index);
+
+#endif
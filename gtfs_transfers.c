@@ -0,0 +1,382 @@
+/* Finds the transfers that can be made on foot between stops.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <glib.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "gtfs_sqlite.h"
+#include "gtfs_stop_index.h"
+#include "gtfs_transfers.h"
+
+/* ---------------------------------------------------------------- */
+
+/* A stop placed in the grid: the number of its cell, counting along
+   each row of cells from the south-west, and its index */
+typedef struct {
+  int64_t cell;
+  unsigned int stop;
+} grid_stop_t;
+
+/* A search for the transfers that can be made on foot between stops:
+   each stop's ID, as stored and as text (held in "strings"), the pairs
+   of stops between which the feed forbids transfers and the function
+   called for each transfer found */
+typedef struct {
+  GArray *stop_ids;
+  GPtrArray *stop_id_strs;
+  GStringChunk *strings;
+  GHashTable *forbidden_transfers;
+  gtfs_walking_transfer_func_t func;
+  void *data;
+} walking_transfer_search_t;
+
+/* ---------------------------------------------------------------- */
+
+/* Orders stops by cell, then by index */
+static int compare_grid_stops(const void *a, const void *b) {
+  const grid_stop_t *stop_a = a, *stop_b = b;
+
+  if(stop_a->cell != stop_b->cell) {
+    return stop_a->cell < stop_b->cell? -1: 1;
+  }
+  return stop_a->stop < stop_b->stop? -1: stop_a->stop > stop_b->stop;
+}
+
+/* Returns the index of the first stop in a cell, or of the first stop
+   after it if it holds none */
+static unsigned int find_cell(const grid_stop_t *grid_stops,
+                              unsigned int num_stops,
+                              int64_t cell) {
+  unsigned int low = 0, high = num_stops, middle;
+
+  while(low < high) {
+    middle = low + (high - low) / 2;
+    if(grid_stops[middle].cell < cell) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+/* Finds the row and column of the cell holding a point, given the
+   size of each cell in degrees and the number of columns */
+static void find_cell_position(double lat,
+                               double lon,
+                               double cell_height,
+                               double cell_width,
+                               int64_t num_columns,
+                               int64_t *row,
+                               int64_t *column) {
+  *row = (int64_t)floor((lat + 90) / cell_height);
+  *column = (int64_t)floor((lon + 180) / cell_width) % num_columns;
+  if(*column < 0) {
+    *column += num_columns;
+  }
+}
+
+/* Reads the ID and position of each stop, adding its ID as stored and
+   as text to a search for walking transfers and its position to "lats"
+   and "lons"; returns FALSE and sets "errmsg" on failure */
+static bool read_stops(sqlite3 *db,
+                       bool integer_ids,
+                       walking_transfer_search_t *search,
+                       GArray *lats,
+                       GArray *lons,
+                       char **errmsg) {
+  bool result = true;
+  sqlite3_stmt *select_stmt;
+  gtfs_field_value_t stop_id;
+  char *stop_id_str;
+  double position;
+  int sqlite_result;
+
+  if(sqlite3_prepare_v2(db,
+                        "SELECT id, lat, lon FROM stops",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return false;
+  }
+  while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    stop_id_str =
+      g_string_chunk_insert(search->strings,
+                            (const char *)
+                            sqlite3_column_text(select_stmt, 0));
+    if(integer_ids) {
+      stop_id.integer_value = sqlite3_column_int(select_stmt, 0);
+    }
+    else {
+      stop_id.string_value = stop_id_str;
+    }
+    g_array_append_val(search->stop_ids, stop_id);
+    g_ptr_array_add(search->stop_id_strs, stop_id_str);
+
+    position = sqlite3_column_double(select_stmt, 1);
+    g_array_append_val(lats, position);
+    position = sqlite3_column_double(select_stmt, 2);
+    g_array_append_val(lons, position);
+  }
+  if(sqlite_result != SQLITE_DONE) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    result = false;
+  }
+  sqlite3_finalize(select_stmt);
+
+  return result;
+}
+
+/* Reads the pairs of stops between which the feed's transfers table
+   says no transfer is possible (transfer type 3), whatever the route
+   or trip, into a set of their IDs as text; returns FALSE and sets
+   "errmsg" on failure */
+static bool read_forbidden_transfers(sqlite3 *db,
+                                     GHashTable *transfers,
+                                     char **errmsg) {
+  bool result = true;
+  sqlite3_stmt *select_stmt;
+  int sqlite_result;
+
+  /* A bundle without "transfers.txt" forbids none */
+  if(!gtfs_sqlite_table_exists(db, "transfers")) {
+    return true;
+  }
+
+  if(sqlite3_prepare_v2(db,
+                        "SELECT from_stop_id, to_stop_id "
+                        "FROM transfers "
+                        "WHERE transfer_type = 3 "
+                        "AND from_route_id IS NULL "
+                        "AND to_route_id IS NULL "
+                        "AND from_trip_id IS NULL "
+                        "AND to_trip_id IS NULL",
+                        -1,
+                        &select_stmt,
+                        NULL) != SQLITE_OK) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    return false;
+  }
+  while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    g_hash_table_add(transfers,
+                     g_strconcat((const char *)
+                                 sqlite3_column_text(select_stmt, 0),
+                                 "\n",
+                                 (const char *)
+                                 sqlite3_column_text(select_stmt, 1),
+                                 NULL));
+  }
+  if(sqlite_result != SQLITE_DONE) {
+    *errmsg = g_strdup(sqlite3_errmsg(db));
+    result = false;
+  }
+  sqlite3_finalize(select_stmt);
+
+  return result;
+}
+
+/* Passes a pair of stops found near each other to the function called
+   for each walking transfer, unless the feed forbids transfers between
+   them */
+static void add_walking_transfer(unsigned int from_stop,
+                                 unsigned int to_stop,
+                                 double distance,
+                                 void *data) {
+  walking_transfer_search_t *search = data;
+  char *key;
+  bool forbidden;
+
+  if(g_hash_table_size(search->forbidden_transfers) > 0) {
+    key = g_strconcat(g_ptr_array_index(search->stop_id_strs, from_stop),
+                      "\n",
+                      g_ptr_array_index(search->stop_id_strs, to_stop),
+                      NULL);
+    forbidden = g_hash_table_contains(search->forbidden_transfers, key);
+    g_free(key);
+    if(forbidden) {
+      return;
+    }
+  }
+
+  search->func(&g_array_index(search->stop_ids,
+                              gtfs_field_value_t,
+                              from_stop),
+               &g_array_index(search->stop_ids,
+                              gtfs_field_value_t,
+                              to_stop),
+               distance,
+               search->data);
+}
+
+/* ---------------------------------------------------------------- */
+
+unsigned long gtfs_find_nearby_stops(const double *lats,
+                                     const double *lons,
+                                     unsigned int num_stops,
+                                     double max_distance,
+                                     gtfs_nearby_stop_func_t func,
+                                     void *data) {
+  unsigned long result = 0;
+  grid_stop_t *grid_stops;
+  double max_angle, max_abs_lat, sin_half_width;
+  double cell_height, cell_width;
+  int64_t num_columns, row, column, cell;
+  unsigned int index, stop;
+  int first_column_offset, last_column_offset;
+  double distance;
+
+  if(num_stops == 0 || max_distance <= 0) {
+    return 0;
+  }
+
+  /* Two stops within "max_distance" of each other differ in latitude
+     by at most the angle that distance subtends at the centre of the
+     Earth, which is the height of each row of cells */
+  max_angle = max_distance / GTFS_EARTH_RADIUS;
+  cell_height = GTFS_DEGREES(max_angle);
+
+  /* They differ in longitude by at most an angle that grows with their
+     distance from the equator; the columns of cells are made wide
+     enough for the stop furthest from it, or span every longitude if
+     the stops come close enough to a pole that they can differ by any
+     angle at all */
+  max_abs_lat = 0;
+  for(stop = 0; stop < num_stops; stop++) {
+    max_abs_lat = MAX(max_abs_lat, fabs(lats[stop]));
+  }
+  sin_half_width =
+    sin(MIN(max_angle, G_PI) / 2) / cos(GTFS_RADIANS(max_abs_lat));
+  if(sin_half_width < 1) {
+    cell_width = GTFS_DEGREES(2 * asin(sin_half_width));
+    num_columns = MAX(1, (int64_t)floor(360 / cell_width));
+  }
+  else {
+    num_columns = 1;
+  }
+  cell_width = 360.0 / num_columns;
+
+  /* Place each stop in its cell and order the stops by cell */
+  grid_stops = g_new(grid_stop_t, num_stops);
+  for(stop = 0; stop < num_stops; stop++) {
+    find_cell_position(lats[stop],
+                       lons[stop],
+                       cell_height,
+                       cell_width,
+                       num_columns,
+                       &row,
+                       &column);
+    grid_stops[stop].cell = row * num_columns + column;
+    grid_stops[stop].stop = stop;
+  }
+  qsort(grid_stops, num_stops, sizeof(grid_stop_t), compare_grid_stops);
+
+  /* Compare each stop with those in its own cell and the cells around
+     it, whose columns wrap around at the antimeridian; with fewer than
+     three columns, each column is visited once */
+  first_column_offset = num_columns >= 3? -1: 0;
+  last_column_offset = num_columns >= 2? 1: 0;
+  for(stop = 0; stop < num_stops; stop++) {
+    find_cell_position(lats[stop],
+                       lons[stop],
+                       cell_height,
+                       cell_width,
+                       num_columns,
+                       &row,
+                       &column);
+
+    for(int row_offset = -1; row_offset <= 1; row_offset++) {
+      for(int column_offset = first_column_offset;
+          column_offset <= last_column_offset;
+          column_offset++) {
+        cell = (row + row_offset) * num_columns +
+          (column + column_offset + num_columns) % num_columns;
+        for(index = find_cell(grid_stops, num_stops, cell);
+            index < num_stops && grid_stops[index].cell == cell;
+            index++) {
+          if(grid_stops[index].stop == stop) {
+            continue;
+          }
+
+          distance = gtfs_stop_distance(lats[stop],
+                                        lons[stop],
+                                        lats[grid_stops[index].stop],
+                                        lons[grid_stops[index].stop]);
+          if(distance <= max_distance) {
+            func(stop, grid_stops[index].stop, distance, data);
+            result++;
+          }
+        }
+      }
+    }
+  }
+
+  g_free(grid_stops);
+  return result;
+}
+
+bool gtfs_find_walking_transfers(sqlite3 *db,
+                                 double max_distance,
+                                 bool integer_ids,
+                                 gtfs_walking_transfer_func_t func,
+                                 void *data,
+                                 char **errmsg) {
+  walking_transfer_search_t search;
+  GArray *lats, *lons;
+  bool result;
+
+  search.stop_ids = g_array_new(FALSE, FALSE, sizeof(gtfs_field_value_t));
+  search.stop_id_strs = g_ptr_array_new();
+  search.strings = g_string_chunk_new(4096);
+  search.forbidden_transfers = g_hash_table_new_full(g_str_hash,
+                                                     g_str_equal,
+                                                     g_free,
+                                                     NULL);
+  search.func = func;
+  search.data = data;
+  lats = g_array_new(FALSE, FALSE, sizeof(double));
+  lons = g_array_new(FALSE, FALSE, sizeof(double));
+
+  /* Read the stops and the transfers the feed forbids, then find the
+     pairs of stops near each other */
+  result = read_stops(db, integer_ids, &search, lats, lons, errmsg) &&
+    read_forbidden_transfers(db, search.forbidden_transfers, errmsg);
+  if(result) {
+    gtfs_find_nearby_stops((double *)lats->data,
+                           (double *)lons->data,
+                           lats->len,
+                           max_distance,
+                           add_walking_transfer,
+                           &search);
+  }
+
+  g_array_free(lons, TRUE);
+  g_array_free(lats, TRUE);
+  g_hash_table_destroy(search.forbidden_transfers);
+  g_string_chunk_free(search.strings);
+  g_ptr_array_free(search.stop_id_strs, TRUE);
+  g_array_free(search.stop_ids, TRUE);
+
+  return result;
+}
@@ -0,0 +1,79 @@
+/* Finds the transfers that can be made on foot between stops: each
+   pair of stops within a given distance of each other. Rather than
+   measure the distance between every pair, which takes time growing
+   with the square of the number of stops, the stops are placed in a
+   grid of cells at least that distance across, and each stop is
+   compared only with those in its own cell and the eight around it.
+
+   The transfers on foot in a feed are the pairs of its stops found
+   this way, less those between which its transfers table says no
+   transfer is possible, whatever the route or trip.
+
+   Distances are in metres, measured as by gtfs_stop_distance().
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __GTFS_TRANSFERS_H__
+#define __GTFS_TRANSFERS_H__
+
+#include <sqlite3.h>
+#include <stdbool.h>
+
+#include "gtfs_file.h"
+
+/* Called for a pair of stops, given by their indices, found within the
+   distance searched of each other */
+typedef void (*gtfs_nearby_stop_func_t)(unsigned int from_stop,
+                                        unsigned int to_stop,
+                                        double distance,
+                                        void *data);
+
+/* Called for a transfer on foot between two stops, given by their IDs
+   as they are stored (integers, if the database interns IDs, or else
+   strings) */
+typedef void (*gtfs_walking_transfer_func_t)(const gtfs_field_value_t
+                                             *from_stop_id,
+                                             const gtfs_field_value_t
+                                             *to_stop_id,
+                                             double distance,
+                                             void *data);
+
+/* Finds each pair of distinct stops, among "num_stops" stops at the
+   positions given in degrees, within "max_distance" of each other,
+   calling "func" with "data" for the pair in each direction; returns
+   the number of calls made */
+unsigned long gtfs_find_nearby_stops(const double *lats,
+                                     const double *lons,
+                                     unsigned int num_stops,
+                                     double max_distance,
+                                     gtfs_nearby_stop_func_t func,
+                                     void *data);
+
+/* Finds each transfer on foot, between stops within "max_distance" of
+   each other, among the stops in a database whose IDs are interned as
+   integers if "integer_ids" is TRUE, calling "func" with "data" for
+   each. Returns FALSE and sets "errmsg" to a message (to be freed with
+   g_free) on failure */
+bool gtfs_find_walking_transfers(sqlite3 *db,
+                                 double max_distance,
+                                 bool integer_ids,
+                                 gtfs_walking_transfer_func_t func,
+                                 void *data,
+                                 char **errmsg);
+
+#endif
@@ -1,7 +1,8 @@
-/* Converts a GTFS bundle (in ZIP-file format) to a SQLite 3 database.
+/* Converts a GTFS bundle (in ZIP-file format, or extracted into a
+   directory) to a SQLite 3 database.
 
-   Requires glib2, libcsv (http://libcsv.sourceforge.net/) and libzip
-   (http://www.nih.at/libzip/).
+   Requires glib2, libcsv (http://libcsv.sourceforge.net/), libzip
+   (http://www.nih.at/libzip/) and zlib.
 
    Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
 
@@ -20,55 +21,364 @@
    You should have received a copy of the GNU General Public License
    along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
 
-/* Include the definition of "strptime" and "strdup" */
-#define _XOPEN_SOURCE 500
-
 #include <assert.h>
 #include <errno.h>
-#include <csv.h>
 #include <glib.h>
+#include <math.h>
 #include <sqlite3.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <time.h>
-#include <zip.h>
+#include <unistd.h>
 
+#include "gtfs_arrow.h"
+#include "gtfs_bundle.h"
+#include "gtfs_csv.h"
+#include "gtfs_departures.h"
+#include "gtfs_frequencies.h"
+#include "gtfs_raptor.h"
+#include "gtfs_service_days.h"
+#include "gtfs_shapes.h"
+#include "gtfs_stop_index.h"
+#include "gtfs_sort.h"
+#include "gtfs_sqlite.h"
+#include "gtfs_transfers.h"
 #include "gtfs_file.h"
+#include "field_parsers.h"
 #include "agency.h"
 #include "calendar.h"
 #include "calendar_dates.h"
 #include "routes.h"
 #include "stops.h"
+#include "shapes.h"
 #include "trips.h"
 #include "stop_times.h"
+#include "frequencies.h"
+#include "transfers.h"
+#include "departures.h"
+#include "encoded_shapes.h"
+#include "walking_transfers.h"
 
 /* The maximum number of records (i.e., INSERT statements) to include
-   in a single database transaction */
+   in a single database transaction, by default */
 #define RECORDS_PER_TRANSACTION 2048
 
-/* The size, in bytes, of the buffer used to read CSV data from the
-   GTFS ZIP file */
-#define BUFFER_SIZE 20 * 1024
+/* The bounds on the number of records per transaction when this is
+   adapted during loading, and the time, in seconds, each transaction
+   (including its commit) should take */
+#define MIN_RECORDS_PER_TRANSACTION 256
+#define MAX_RECORDS_PER_TRANSACTION 1024 * 1024
+#define TRANSACTION_TARGET_TIME 0.5
 
 /* The maximum number of columns (fields) contained in any GTFS-bundle
    member file */
 #define MAX_COLUMNS 16
 
+/* The maximum number of records carried in each batch of parsed
+   records written to the database together (and, when files are
+   loaded in parallel, passed from a parsing thread to the database
+   writer) */
+#define RECORDS_PER_BATCH 512
+
+/* The most records inserted by a single multi-row INSERT statement,
+   which must be a power of two no greater than RECORDS_PER_BATCH, and
+   the number of INSERT statements this implies for each file: one
+   each for inserting 1, 2, 4, ... MAX_ROWS_PER_INSERT records */
+#define MAX_ROWS_PER_INSERT 64
+#define MAX_INSERT_STMTS 7
+
+/* The size, in bytes, of the storage each record batch sets aside for
+   string field values */
+#define BATCH_STRINGS_SIZE 256 * 1024
+
+/* The number of record batches allocated for each parsing thread---this
+   bounds how far parsing may run ahead of the database writer */
+#define BATCHES_PER_THREAD 4
+
+/* The most indices defined on any table, and the most columns in any
+   index's key */
+#define MAX_INDICES 4
+#define MAX_INDEX_KEY_FIELDS 4
+
+/* The offset basis and prime of the 64-bit FNV-1a hash function, used
+   to hash records when updating the database */
+#define HASH_OFFSET_BASIS 14695981039346656037ULL
+#define HASH_PRIME 1099511628211ULL
+
+/* The size, in bytes, of the chunks into which large files are split
+   for parsing in parallel, and the size a file must reach before it
+   is split */
+#define CHUNK_SIZE 4 * 1024 * 1024
+#define SPLIT_FILE_MIN_SIZE 2 * CHUNK_SIZE
+
+/* The number of chunks allocated for each chunk-parsing thread---this
+   bounds how far reading a split file may run ahead of the database
+   writer */
+#define CHUNKS_PER_THREAD 2
+
+/* The number of bytes in a megabyte, for reporting sizes */
+#define BYTES_PER_MEGABYTE (1024.0 * 1024.0)
+
+/* The most memory, in megabytes, used by default to hold the records
+   of a clustered table while they are sorted by key */
+#define DEFAULT_SORT_MEMORY 256
+
+/* The extension given the columnar file written for each table */
+#define ARROW_FILE_EXTENSION ".arrow"
+
+/* The speed, in metres per second, at which a transfer on foot between
+   stops is taken to be walked */
+#define WALKING_SPEED 1.4
+
 /* ---------------------------------------------------------------- */
 
+/* An arena holding the bytes of string field values, which are bound
+   to INSERT statements without being copied again; it is emptied
+   rather than freed once the records using it have been written */
+typedef struct {
+  char *data;
+  size_t size, used;
+} gtfs_string_arena_t;
+
+/* An index defined on a GTFS file's table. Each index is created
+   before its table is loaded and built as records are inserted, which
+   needs no sorting, for as long as the records arrive in the order of
+   its key; once a record arrives out of order the index is dropped
+   and created again only after every file has been loaded */
+typedef struct {
+  const char *create_index_stmt_str;
+
+  /* The index's name, whether its key must be unique and the numbers
+     of the fields making up its key */
+  char *name;
+  bool unique;
+  unsigned int num_key_fields;
+  unsigned int key_fields[MAX_INDEX_KEY_FIELDS];
+
+  /* TRUE while the index is being built as records are inserted */
+  bool sorted;
+} gtfs_index_t;
+
+/* A record already in the database, identified when the database is
+   updated by the hash of its natural key */
+typedef struct {
+  guint64 key_hash;
+  guint64 record_hash;
+  sqlite3_int64 rowid;
+} gtfs_existing_record_t;
+
+/* The dictionary of an ID space, used when the database is created
+   with compact IDs: the integer interned for each identifier seen so
+   far and, in the order of their integers, those interned during this
+   load (the rest having been read from the space's lookup table),
+   which are added to the lookup table once loading is complete */
+typedef struct {
+  GHashTable *ids;
+  GPtrArray *new_ids;
+  unsigned int first_new_id;
+} gtfs_id_dictionary_t;
+
+/* A record read from the database, with its values as they are
+   stored */
+typedef struct {
+  unsigned int fields_present;
+  gtfs_field_value_t field_values[MAX_COLUMNS];
+} gtfs_stored_record_t;
+
+/* Statistics showing where the time went in loading a single file */
+typedef struct {
+  /* The number of bytes read from the bundle and passed to the CSV
+     parser */
+  guint64 bytes_inflated;
+  guint64 bytes_tokenized;
+
+  /* The number of records parsed and the number the database
+     rejected */
+  unsigned long rows_parsed;
+  unsigned long rows_rejected;
+
+  /* The time, in seconds, spent reading (inflating) the file---or,
+     when it is inflated on a thread of its own, waiting for it to be
+     inflated---in the CSV tokenizer (less any time spent writing
+     records from within its callbacks) and in binding and stepping
+     SQLite statements */
+  double inflate_time;
+  double parse_time;
+  double write_time;
+} gtfs_load_stats_t;
+
+/* A structure that tracks the loading of a single GTFS file */
+typedef struct gtfs_load_job {
+  const gtfs_file_spec_t *gtfs_file_spec;
+
+  /* The uncompressed size of the file, used to start work on the
+     largest files first */
+  uint64_t size;
+
+  /* Measures the time taken to load the file, from the moment a
+     parsing thread picks it up until its last record is written */
+  GTimer *timer;
+
+  /* The pre-compiled INSERT statements for the file's table, of which
+     the statement at index "n" inserts 2^n records at once, and the
+     number of objects loaded into it so far; these are used only by
+     the database writer */
+  sqlite3_stmt *insert_stmts[MAX_INSERT_STMTS];
+  unsigned int num_insert_stmts;
+  unsigned long objects_loaded;
+
+  /* The column-number-to-field-number mapping read from the file's
+     header, shared with the threads parsing its chunks if the file
+     is split */
+  unsigned int field_for_column[MAX_COLUMNS];
+
+  /* Nonzero if any thread parsing a chunk of the file, when it is
+     split, failed to parse it; set atomically */
+  gint chunk_failed;
+
+  /* The sequence number of the next batch (or chain of batches) the
+     database writer will insert, and those received ahead of it */
+  unsigned long next_chunk;
+  GHashTable *pending_chunks;
+
+  /* The indices defined on the file's table and, while any is still
+     being built as records are inserted, a copy of the last record
+     inserted, against which the next record's key is compared; these
+     too are used only by the database writer */
+  gtfs_index_t indices[MAX_INDICES];
+  unsigned int num_indices;
+  bool last_record_saved;
+  unsigned int last_record_fields_present;
+  gtfs_field_value_t last_record_values[MAX_COLUMNS];
+  gtfs_string_arena_t last_record_strings;
+
+  /* TRUE if the file's records are being matched against those
+     already in its table, which is being updated rather than created;
+     in that case, the existing records ordered by key hash, a flag
+     for each set once it is matched, the statements used to update
+     and delete existing records and the number of records updated,
+     deleted and found unchanged */
+  bool update;
+  gtfs_existing_record_t *existing_records;
+  bool *existing_records_matched;
+  size_t num_existing_records;
+  sqlite3_stmt *update_stmt, *delete_stmt;
+  unsigned long objects_updated, objects_deleted, objects_unchanged;
+
+  /* The columnar file to which the Arrow sink writes the file's
+     records */
+  gtfs_arrow_writer_t *arrow_writer;
+
+  /* When the file's table is clustered, the sorter through which the
+     SQLite sink passes its records, so they are inserted in key
+     order once the last has been written */
+  gtfs_sorter_t *sorter;
+
+  /* When the SQLite sink loads "shapes.txt", the encoder through which
+     it passes each shape's points, the job that writes the encoded
+     shapes to their own table, the batch collecting them, the encoded
+     strings the batch refers to and the IDs of the shapes already
+     reported for points not listed together */
+  gtfs_shape_encoder_t *shape_encoder;
+  struct gtfs_load_job *shapes_job;
+  struct gtfs_record_batch *shapes_batch;
+  GPtrArray *shape_strings;
+  size_t shape_strings_size;
+  GHashTable *scattered_shape_ids;
+
+  /* The statistics gathered for the file, which the parsing threads
+     pass to the database writer along with their record batches */
+  gtfs_load_stats_t stats;
+} gtfs_load_job_t;
+
+/* A search for the departures within the departures table's window:
+   the job whose sorter orders the departures found, and each day
+   within the window in ISO 8601 format */
+typedef struct {
+  gtfs_load_job_t *job;
+  char (*dates)[11];
+} gtfs_departure_search_t;
+
+/* A trip run at regular intervals, whose record and stop times are
+   the template for each of its runs: the trip's record and its stop
+   times in sequence order, with their values as they are stored, the
+   time of its first departure and the batches to which the runs'
+   records are added */
+typedef struct {
+  unsigned int trip_fields_present;
+  gtfs_field_value_t trip_values[MAX_COLUMNS];
+  GArray *stop_times;
+  int first_time;
+  struct gtfs_record_batch *trips_batch, *stop_times_batch;
+} gtfs_trip_template_t;
+
+/* A chunk of a large file, split at a record boundary and parsed
+   independently of the rest of the file */
+typedef struct {
+  /* The job (file) the chunk belongs to and its sequence number
+     within the file */
+  gtfs_load_job_t *job;
+  unsigned long chunk;
+
+  /* The chunk's data */
+  char *data;
+  size_t size, capacity;
+} gtfs_file_chunk_t;
+
+/* A batch of parsed records, written to the database together and,
+   when loading in parallel, passed from a parsing thread to the
+   database writer */
+typedef struct gtfs_record_batch {
+  /* The job (file) these records belong to */
+  gtfs_load_job_t *job;
+
+  /* The sequence number of the batch within the file, used by the
+     database writer to insert records in their original order; every
+     batch holding records from the same chunk of a split file shares
+     the chunk's sequence number */
+  unsigned long chunk;
+
+  /* For the first batch of a chunk, the chunk itself, and the next
+     batch holding records from the same chunk */
+  gtfs_file_chunk_t *file_chunk;
+  struct gtfs_record_batch *next;
+
+  /* TRUE if this is the last batch for the file; in that case
+     "load_error" indicates whether the file could not be read */
+  bool end_of_file;
+  bool load_error;
+
+  /* The number of records in the batch */
+  unsigned int num_records;
+
+  /* The statistics gathered by the parsing thread since it handed
+     over its previous batch */
+  gtfs_load_stats_t stats;
+
+  /* For each record, a bitmask of the fields present and the values
+     parsed for them */
+  unsigned int fields_present[RECORDS_PER_BATCH];
+  gtfs_field_value_t field_values[RECORDS_PER_BATCH][MAX_COLUMNS];
+
+  /* The arena holding the batch's string field values, and its
+     storage */
+  gtfs_string_arena_t strings;
+  char string_data[BATCH_STRINGS_SIZE];
+} gtfs_record_batch_t;
+
 /* A structure that represents the current state of parsing a file
    within a GTFS bundle */
 typedef struct {
-  /* Handles to the SQLite 3 database and GTFS ZIP files,
-     respectively */
-  sqlite3 *db;
+  /* The GTFS file being parsed */
   const gtfs_file_spec_t *gtfs_file_spec;
 
-  /* A pool of gtfs_field_value_t objects, used to hold parsed field
-     values */
-  gtfs_field_value_t field_values[MAX_COLUMNS];
+  /* Where the values of the current record are being parsed to,
+     within the current record batch */
+  gtfs_field_value_t *record_values;
+  gtfs_string_arena_t *strings;
 
   /* A mapping between column numbers in the file and field numbers in
      the GTFS-file spec---this accounts for the fact the order of
@@ -79,30 +389,232 @@ typedef struct {
      FALSE otherwise */
   bool header_parsed;
 
-  /* A hash table of fields parsed so far */
-  GHashTable *fields;
+  /* A bitmask, indexed by field number, of the fields parsed so far
+     for the current record (MAX_COLUMNS must not exceed its width);
+     the values themselves are held in "record_values" */
+  unsigned int fields_present;
 
   /* The number of fields parsed for the current record */
   unsigned int fields_parsed;
 
-  /* The number of records parsed for the current file */
-  unsigned long records_parsed;
+  /* The statistics gathered since the last batch was handed to the
+     database writer */
+  gtfs_load_stats_t stats;
 
-  /* The number of objects loaded into the database from the current
-     file */
-  unsigned long objects_loaded;
+  /* The job for the file being parsed, the batch currently being
+     filled and, when loading in parallel, the queues of empty and
+     filled record batches shared with the database writer; the queues
+     are NULL when this thread writes each batch itself */
+  gtfs_load_job_t *job;
+  GAsyncQueue *free_batches, *filled_batches;
+  gtfs_record_batch_t *batch;
 
-  /* The pre-compiled INSERT statement used to insert rows from the
-     GTFS file currently being parsed */
-  sqlite3_stmt *insert_stmt;
+  /* The sequence number to give the next batch handed to the database
+     writer */
+  unsigned long next_chunk;
+
+  /* When parsing a chunk of a split file, the chunk and the chain of
+     record batches holding its records, which is handed to the
+     database writer in one piece once the chunk is parsed */
+  gtfs_file_chunk_t *file_chunk;
+  gtfs_record_batch_t *chunk_batches;
+
+  /* The most arena storage a single record of this file can need for
+     its string field values */
+  size_t max_record_strings_size;
 } gtfs_parsing_state_t;
 
+/* A structure shared by the threads taking part in a parallel load */
+typedef struct {
+  /* The path to the GTFS bundle, which each parsing thread opens for
+     itself */
+  gtfs_bundle_t *gtfs_bundle;
+
+  /* The jobs making up the load and a queue of those not yet picked
+     up by a parsing thread */
+  gtfs_load_job_t *jobs;
+  unsigned int num_jobs;
+  GAsyncQueue *pending_jobs;
+
+  /* Queues of empty and filled record batches */
+  GAsyncQueue *free_batches, *filled_batches;
+
+  /* If large files are to be split, a queue of empty chunks and the
+     pool of threads that parse them; NULL otherwise */
+  GAsyncQueue *free_chunks;
+  GThreadPool *chunk_parsers;
+} gtfs_parallel_load_t;
+
+/* An output sink, to which the records parsed from each file are
+   written: a SQLite database, a directory of Arrow files or nowhere at
+   all. A sink is opened before any file is loaded; then each file's
+   table is begun, written batch by batch (by a single thread, in the
+   records' original order) and ended, possibly alongside other files'
+   tables; finally the output is completed, with anything deferred
+   until every table was loaded, and the sink is closed */
+typedef struct {
+  /* The sink's name, as given with "--output-format", and whether it
+     needs an output path */
+  const char *name;
+  bool path_required;
+
+  /* Opens the output at "path"; returns FALSE on error */
+  bool (*open)(const char *path);
+
+  /* Prepares to write a job's records; returns FALSE on error */
+  bool (*begin_table)(gtfs_load_job_t *job);
+
+  /* Writes a batch of a job's records, counting those written in the
+     job's "objects_loaded" */
+  void (*write_batch)(gtfs_record_batch_t *batch);
+
+  /* Completes a job's table once its last record is written, or once
+     the file has failed to load if "load_error" is TRUE, freeing the
+     resources held for it; it is safe to end a table more than once.
+     Returns FALSE if the table's records could not be written */
+  bool (*end_table)(gtfs_load_job_t *job, bool load_error);
+
+  /* Completes the output once every table has loaded, building the
+     indices deferred until then and any tables derived from those
+     loaded, using up to "num_threads" threads, or NULL if the sink has
+     nothing to complete */
+  void (*finish)(unsigned int num_threads);
+
+  /* Closes the output; returns FALSE on error */
+  bool (*close)(void);
+} gtfs_output_sink_t;
+
 /* ---------------------------------------------------------------- */
 
+/* The sink to which records are output */
+const gtfs_output_sink_t *output_sink;
+
+/* The database the SQLite sink writes to, and whether it is loaded
+   quickly at the risk of its corruption if the load is interrupted */
+sqlite3 *output_db;
+bool bulk_load_database = false;
+
 /* Precompiled "BEGIN TRANSACTION" and "END TRANSACTION" statements,
    used to group inserted records into batches before being written
-   out to disk */
+   out to disk, and whether a transaction is open */
 sqlite3_stmt *begin_transaction_stmt, *end_transaction_stmt;
+bool transaction_open = false;
+
+/* The number of records to insert in each transaction, and whether
+   this is adapted as loading proceeds so each transaction takes about
+   TRANSACTION_TARGET_TIME */
+unsigned long records_per_transaction = RECORDS_PER_TRANSACTION;
+bool adapt_records_per_transaction = false;
+
+/* The number of records inserted in the current transaction, and the
+   time since it began */
+unsigned long records_in_transaction;
+GTimer *transaction_timer;
+
+/* TRUE if an existing database is being updated, in which case only
+   records that have changed are written to it */
+bool update_database = false;
+
+/* TRUE if the identifiers of trips, stops, routes and services are
+   stored as integers, each interned in the dictionary for its ID
+   space, with the identifiers themselves kept in lookup tables named
+   for each space */
+bool compact_ids = false;
+const char *id_table_names[NUM_ID_SPACES] = {
+  NULL,
+  "route_ids",
+  "service_ids",
+  "stop_ids",
+  "trip_ids"
+};
+gtfs_id_dictionary_t id_dictionaries[NUM_ID_SPACES];
+
+/* TRUE if the tables marked clustered in their specs are created
+   WITHOUT ROWID, clustered on their natural keys, and the most memory
+   (in bytes) used to sort each one's records before they are
+   inserted */
+bool clustered_tables = false;
+size_t sort_memory = (size_t)DEFAULT_SORT_MEMORY * 1024 * 1024;
+
+/* TRUE if the days each service runs are stored, once every file is
+   loaded, as a bitset per service in the service_days table */
+bool store_service_days = false;
+
+/* The number of days of service covered by the departures table built
+   once every file is loaded (zero, if none is built) and the first of
+   those days, as a number of days since the Unix epoch */
+unsigned int departure_days = 0;
+int departures_first_day;
+
+/* TRUE if each trip run at regular intervals, as given in the
+   frequencies table, is expanded once every file is loaded into a trip
+   and stop times for each of its runs */
+bool expand_frequencies = false;
+
+/* TRUE if a spatial index over the stops is built, once every file is
+   loaded, in the stops_rtree table */
+bool index_stops = false;
+
+/* The greatest distance, in metres, between two stops for which a
+   transfer on foot between them is added to the walking_transfers
+   table built once every file is loaded (zero, if none is built) */
+unsigned int walking_transfer_distance = 0;
+
+/* The path of the file to which the timetable is written, laid out for
+   RAPTOR routers, once every file is loaded (NULL, if none is
+   written) */
+const char *raptor_path = NULL;
+
+/* The directory to which the Arrow sink writes its files */
+const char *output_path;
+
+/* The tokenizer with which each file's CSV data is parsed */
+gtfs_csv_tokenizer_t csv_tokenizer = GTFS_CSV_AUTO;
+
+/* PRAGMA statements that configure the database for a bulk load,
+   trading its integrity in the event of a crash (or power loss) for
+   speed: the database is written without syncing to disk and with
+   its rollback journal held in memory (still needed to roll back a
+   multi-record INSERT that fails part-way), with large page, cache
+   and memory-map sizes, and held locked for the duration of the
+   load */
+const char *bulk_load_pragma_strs[] = {
+  "PRAGMA page_size = 65536",
+  "PRAGMA journal_mode = MEMORY",
+  "PRAGMA synchronous = OFF",
+  "PRAGMA cache_size = -262144",
+  "PRAGMA mmap_size = 268435456",
+  "PRAGMA locking_mode = EXCLUSIVE",
+  "PRAGMA temp_store = MEMORY",
+  NULL
+};
+
+/* PRAGMA statements that restore SQLite's usual, durable settings
+   once a bulk load is complete */
+const char *durable_pragma_strs[] = {
+  "PRAGMA journal_mode = DELETE",
+  "PRAGMA synchronous = FULL",
+  "PRAGMA locking_mode = NORMAL",
+  NULL
+};
+
+/* The indices whose creation has been deferred until every file has
+   been loaded, as gtfs_index_t objects */
+GPtrArray *deferred_indices;
+
+/* The statistics for each file loaded and each index created once
+   loading was complete, as JSON objects to be written to the file
+   named with "--stats-json", and the total time, in seconds, spent
+   creating those indices; likewise for each table derived from those
+   loaded */
+GPtrArray *file_stats_json, *index_stats_json, *derived_stats_json;
+double deferred_index_time = 0;
+
+/* The interval, in seconds, between reports of the database writer's
+   progress (or zero, if progress is not reported), and the time of
+   the last report */
+int progress_interval = 0;
+gint64 last_progress_time;
 
 /* The set of GTFS-file specifiers; together these specify how the
    bundle as a whole should be processed */
@@ -112,486 +624,4176 @@ const gtfs_file_spec_t *gtfs_file_specs[] = {
   &calendar_dates_file_spec,
   &routes_file_spec,
   &stops_file_spec,
+  &shapes_file_spec,
   &trips_file_spec,
   &stop_times_file_spec,
+  &frequencies_file_spec,
+  &transfers_file_spec,
   NULL
 };
 
 /* ---------------------------------------------------------------- */
 
+/* Prepares the statements that insert objects into the database from
+   a GTFS file, generated from the file spec's single-record INSERT
+   statement: these insert 1, 2, 4 and so on records at once, up to
+   MAX_ROWS_PER_INSERT records or as many as SQLite's limit on the
+   number of bound parameters allows */
+static int prepare_insert_stmts(sqlite3 *db, gtfs_load_job_t *job) {
+  const gtfs_file_spec_t *gtfs_file_spec = job->gtfs_file_spec;
+  int result = SQLITE_OK;
+  unsigned int max_rows, rows;
+  const char *values_str;
+  GString *row_str, *stmt_str;
+
+  max_rows = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1) /
+    gtfs_file_spec->num_fields;
+
+  /* Build the list of parameters for a single record */
+  row_str = g_string_new("(");
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    g_string_append(row_str, field_number == 0? "?": ", ?");
+  }
+  g_string_append_c(row_str, ')');
+
+  /* Each statement starts with the spec's statement up to its list of
+     values, to which we add a further list for each record */
+  values_str = strstr(gtfs_file_spec->insert_stmt_str, "VALUES");
+  assert(values_str);
+  stmt_str = g_string_new_len(gtfs_file_spec->insert_stmt_str,
+                              values_str -
+                              gtfs_file_spec->insert_stmt_str +
+                              strlen("VALUES"));
+
+  job->num_insert_stmts = 0;
+  rows = 0;
+  while(result == SQLITE_OK &&
+        job->num_insert_stmts < MAX_INSERT_STMTS &&
+        1u << job->num_insert_stmts <= max_rows) {
+    while(rows < 1u << job->num_insert_stmts) {
+      g_string_append(stmt_str, rows == 0? " ": ", ");
+      g_string_append_len(stmt_str, row_str->str, row_str->len);
+      rows++;
+    }
+
+    result = sqlite3_prepare_v2(db,
+                                stmt_str->str,
+                                stmt_str->len,
+                                &job->insert_stmts[job->num_insert_stmts],
+                                NULL);
+    if(result == SQLITE_OK) {
+      job->num_insert_stmts++;
+    }
+  }
+
+  g_string_free(stmt_str, TRUE);
+  g_string_free(row_str, TRUE);
+
+  /* Free any statements prepared before an error */
+  if(result != SQLITE_OK) {
+    while(job->num_insert_stmts > 0) {
+      sqlite3_finalize(job->insert_stmts[--job->num_insert_stmts]);
+    }
+  }
+
+  return result;
+}
+
+/* Frees the INSERT statements prepared for a GTFS file */
+static int finalize_insert_stmts(gtfs_load_job_t *job) {
+  int result = SQLITE_OK;
+
+  while(job->num_insert_stmts > 0) {
+    if(sqlite3_finalize(job->insert_stmts[--job->num_insert_stmts]) !=
+       SQLITE_OK) {
+      result = SQLITE_ERROR;
+    }
+  }
+
+  return result;
+}
+
+/* Returns the name of a GTFS file's table, found from the spec's
+   INSERT statement */
+static char *table_name(const gtfs_file_spec_t *gtfs_file_spec) {
+  const char *name_str;
+
+  name_str = gtfs_file_spec->insert_stmt_str + strlen("INSERT INTO ");
+  return g_strndup(name_str, strcspn(name_str, "("));
+}
+
+/* Returns the names of the columns of a GTFS file's table into which
+   its fields are loaded, in field order, found from the spec's INSERT
+   statement */
+static gchar **table_column_names(const gtfs_file_spec_t *gtfs_file_spec) {
+  const char *columns_str;
+  char *column_list;
+  gchar **result;
+
+  columns_str = strchr(gtfs_file_spec->insert_stmt_str, '(') + 1;
+  column_list = g_strndup(columns_str, strcspn(columns_str, ")"));
+  result = g_strsplit(column_list, ",", 0);
+  for(unsigned int column = 0; result[column]; column++) {
+    g_strstrip(result[column]);
+  }
+  g_free(column_list);
+
+  return result;
+}
+
+/* Returns the number of the field loaded into a column of a GTFS
+   file's table, or -1 if no field is loaded into it */
+static int field_for_table_column(const gtfs_file_spec_t *gtfs_file_spec,
+                                  const char *column_name) {
+  int result = -1;
+  gchar **column_names;
+
+  column_names = table_column_names(gtfs_file_spec);
+  for(unsigned int field_number = 0;
+      column_names[field_number] && result == -1;
+      field_number += 1) {
+    if(strcmp(column_names[field_number], column_name) == 0) {
+      result = field_number;
+    }
+  }
+  g_strfreev(column_names);
+
+  return result;
+}
+
+/* Returns the statement creating a GTFS file's table when identifiers
+   are stored as integers: the spec's own statement, with each column
+   into which an identifier is loaded given the type INTEGER */
+static char *compact_create_table_stmt_str(const gtfs_file_spec_t
+                                           *gtfs_file_spec) {
+  const char *stmt_str = gtfs_file_spec->create_table_stmt_str;
+  const char *columns_str, *type_str;
+  char *column_name;
+  gchar **definitions;
+  GString *result;
+  size_t name_len, type_len;
+  int field_number;
+
+  /* Step through the table's column definitions, replacing the type of
+     each that holds identifiers */
+  columns_str = strchr(stmt_str, '(') + 1;
+  result = g_string_new_len(stmt_str, columns_str - stmt_str);
+  definitions = g_strsplit(columns_str, ", ", 0);
+  for(unsigned int definition = 0; definitions[definition]; definition++) {
+    if(definition > 0) {
+      g_string_append(result, ", ");
+    }
+
+    name_len = strcspn(definitions[definition], " ");
+    column_name = g_strndup(definitions[definition], name_len);
+    field_number = field_for_table_column(gtfs_file_spec, column_name);
+    g_free(column_name);
+
+    /* A column named within a table constraint has no type to
+       replace */
+    if(field_number != -1 &&
+       gtfs_file_spec->field_specs[field_number]->id_space !=
+       ID_SPACE_NONE &&
+       definitions[definition][name_len] == ' ') {
+      type_str = definitions[definition] + name_len + 1;
+      type_len = strcspn(type_str, " ,()");
+      if(type_str[type_len] == '(') {
+        type_len += strcspn(type_str + type_len, ")") + 1;
+      }
+
+      g_string_append_len(result, definitions[definition], name_len);
+      g_string_append(result, " INTEGER");
+      g_string_append(result, type_str + type_len);
+    }
+    else {
+      g_string_append(result, definitions[definition]);
+    }
+  }
+  g_strfreev(definitions);
+
+  return g_string_free(result, FALSE);
+}
+
+/* Returns TRUE if a GTFS file's table is clustered on its natural
+   key */
+inline static bool table_clustered(const gtfs_file_spec_t *gtfs_file_spec) {
+  return clustered_tables && gtfs_file_spec->clustered;
+}
+
 /* Creates a table to hold data from the GTFS file currently being
    processed */
-inline static int create_table(sqlite3 *db,
-                               const gtfs_file_spec_t *gtfs_file_spec,
-                               char **errmsg) {
-  return sqlite3_exec(db,
-                      gtfs_file_spec->create_table_stmt_str,
-                      NULL,
-                      NULL,
-                      errmsg);
-}
-
-/* Inserts one object into the database from the GTFS file currently
-   being parsed */
-inline static int
-prepare_insert_stmt(sqlite3 *db,
-                    const gtfs_file_spec_t *gtfs_file_spec,
-                    sqlite3_stmt **insert_stmt) {
-  return sqlite3_prepare_v2(db,
-                            gtfs_file_spec->insert_stmt_str,
-                            strlen(gtfs_file_spec->insert_stmt_str),
-                            insert_stmt,
-                            NULL);
-}
-
-/* Executes any "CREATE INDEX" commands defined for the GTFS file */
-inline static int
-create_indices(sqlite3 *db,
-               const gtfs_file_spec_t *gtfs_file_spec,
-               char **errmsg) {
-  int result = SQLITE_OK;
+static int create_table(sqlite3 *db,
+                        const gtfs_file_spec_t *gtfs_file_spec,
+                        char **errmsg) {
+  GString *stmt_str;
+  char *compact_stmt_str;
+  gchar **column_names;
+  int result;
+
+  if(compact_ids) {
+    compact_stmt_str = compact_create_table_stmt_str(gtfs_file_spec);
+    stmt_str = g_string_new(compact_stmt_str);
+    g_free(compact_stmt_str);
+  }
+  else {
+    stmt_str = g_string_new(gtfs_file_spec->create_table_stmt_str);
+  }
+
+  /* Cluster the table on its natural key, first making that key the
+     table's primary key if it has none */
+  if(table_clustered(gtfs_file_spec)) {
+    g_string_truncate(stmt_str, strrchr(stmt_str->str, ')') - stmt_str->str);
+    if(strstr(stmt_str->str, "PRIMARY KEY") == NULL) {
+      column_names = table_column_names(gtfs_file_spec);
+      g_string_append(stmt_str, ", PRIMARY KEY (");
+      for(unsigned int key_field = 0;
+          key_field < gtfs_file_spec->num_key_fields;
+          key_field++) {
+        g_string_append_printf(stmt_str,
+                               key_field == 0? "%s": ", %s",
+                               column_names[gtfs_file_spec->
+                                            key_fields[key_field]]);
+      }
+      g_string_append_c(stmt_str, ')');
+      g_strfreev(column_names);
+    }
+    g_string_append(stmt_str, ") WITHOUT ROWID;");
+  }
+
+  result = sqlite3_exec(db, stmt_str->str, NULL, NULL, errmsg);
+  g_string_free(stmt_str, TRUE);
+
+  return result;
+}
+
+/* Initializes an index from its "CREATE INDEX" statement; returns
+   TRUE if every column of its key is loaded from a field, so that
+   the order of records by its key can be checked as they are
+   inserted */
+static bool init_index(gtfs_index_t *index,
+                       const gtfs_file_spec_t *gtfs_file_spec,
+                       const char *create_index_stmt_str) {
+  bool result = true;
+  const char *name_str, *key_str;
+  char *key_list;
+  gchar **column_names;
+  int field_number;
+
+  memset(index, 0, sizeof(*index));
+  index->create_index_stmt_str = create_index_stmt_str;
+  index->unique = g_str_has_prefix(create_index_stmt_str,
+                                   "CREATE UNIQUE INDEX");
+
+  name_str = strstr(create_index_stmt_str, "INDEX ") + strlen("INDEX ");
+  index->name = g_strndup(name_str, strcspn(name_str, " "));
+
+  key_str = strchr(create_index_stmt_str, '(') + 1;
+  key_list = g_strndup(key_str, strcspn(key_str, ")"));
+  column_names = g_strsplit(key_list, ",", 0);
+  for(unsigned int column = 0; column_names[column] && result; column++) {
+    field_number = field_for_table_column(gtfs_file_spec,
+                                          g_strstrip(column_names[column]));
+    if(field_number != -1 && column < MAX_INDEX_KEY_FIELDS) {
+      index->key_fields[index->num_key_fields++] = field_number;
+    }
+    else {
+      result = false;
+    }
+  }
+  g_strfreev(column_names);
+  g_free(key_list);
+
+  return result;
+}
+
+/* Returns TRUE if an index's key is the natural key on which its
+   table is clustered, making the index redundant */
+static bool index_clusters_table(const gtfs_file_spec_t *gtfs_file_spec,
+                                 const gtfs_index_t *index) {
+  bool result = table_clustered(gtfs_file_spec) &&
+    index->num_key_fields == gtfs_file_spec->num_key_fields;
+
+  for(unsigned int key_field = 0;
+      key_field < index->num_key_fields && result;
+      key_field++) {
+    result = index->key_fields[key_field] ==
+      gtfs_file_spec->key_fields[key_field];
+  }
+
+  return result;
+}
+
+/* Creates, before a GTFS file is loaded, those of the indices defined
+   on its table whose key order can be checked as records are
+   inserted; the remainder are created after every file is loaded. An
+   index on the key a table is clustered on is not created at all */
+static void create_indices(sqlite3 *db, gtfs_load_job_t *job) {
+  const gtfs_file_spec_t *gtfs_file_spec = job->gtfs_file_spec;
   const char *index_stmt_str;
-  unsigned int index_stmt_index;
+  unsigned int stmt_number = 0;
+  gtfs_index_t *index;
+  bool key_order_checked;
+  char *errmsg;
+
+  job->num_indices = 0;
+  while((index_stmt_str =
+         gtfs_file_spec->create_index_stmt_strs[stmt_number++])) {
+    assert(job->num_indices < MAX_INDICES);
+    index = &job->indices[job->num_indices++];
+
+    key_order_checked = init_index(index, gtfs_file_spec, index_stmt_str);
+    if(key_order_checked && index_clusters_table(gtfs_file_spec, index)) {
+      g_free(index->name);
+      job->num_indices--;
+    }
+    else if(key_order_checked) {
+      if(sqlite3_exec(db, index_stmt_str, NULL, NULL, &errmsg) ==
+         SQLITE_OK) {
+        index->sorted = true;
+      }
+      else {
+        fprintf(stderr,
+                "create_indices: "
+                "Error creating index on table: %s\n",
+                errmsg);
+        sqlite3_free(errmsg);
+      }
+    }
+  }
+}
+
+/* Drops an index that was being built as records were inserted, now
+   that a record has arrived out of order, deferring its creation */
+static void drop_sorted_index(sqlite3 *db, gtfs_index_t *index) {
+  char *drop_index_stmt_str;
+  char *errmsg;
+
+  drop_index_stmt_str = g_strdup_printf("DROP INDEX %s", index->name);
+  if(sqlite3_exec(db, drop_index_stmt_str, NULL, NULL, &errmsg) !=
+     SQLITE_OK) {
+    fprintf(stderr,
+            "drop_sorted_index: "
+            "Error dropping index \"%s\": %s\n",
+            index->name,
+            errmsg);
+    sqlite3_free(errmsg);
+  }
+  g_free(drop_index_stmt_str);
+
+  index->sorted = false;
+}
+
+/* Completes the indices on a file's table once it has been loaded:
+   those built as its records were inserted are finished, while the
+   rest are added to the list of deferred indices */
+static void finish_indices(gtfs_load_job_t *job) {
+  gtfs_index_t *index, *deferred_index;
+
+  for(unsigned int index_number = 0;
+      index_number < job->num_indices;
+      index_number++) {
+    index = &job->indices[index_number];
+    if(index->sorted) {
+      g_free(index->name);
+    }
+    else {
+      deferred_index = g_new(gtfs_index_t, 1);
+      *deferred_index = *index;
+      g_ptr_array_add(deferred_indices, deferred_index);
+    }
+  }
+  job->num_indices = 0;
+
+  g_free(job->last_record_strings.data);
+  job->last_record_strings.data = NULL;
+  job->last_record_strings.size = 0;
+}
+
+/* Frees an index whose creation was deferred */
+static void free_deferred_index(gpointer data) {
+  gtfs_index_t *index = data;
+
+  g_free(index->name);
+  g_free(index);
+}
+
+/* Creates the indices deferred until every file has been loaded,
+   allowing SQLite to sort each index's keys using up to
+   "num_threads" threads */
+static void create_deferred_indices(sqlite3 *db, unsigned int num_threads) {
+  gtfs_index_t *index;
+  char *threads_pragma_str;
+  char *errmsg;
+  GTimer *index_timer;
+
+  threads_pragma_str = g_strdup_printf("PRAGMA threads = %u",
+                                       num_threads - 1);
+  if(sqlite3_exec(db, threads_pragma_str, NULL, NULL, &errmsg) !=
+     SQLITE_OK) {
+    fprintf(stderr,
+            "create_deferred_indices: "
+            "Error setting number of sorting threads: %s\n",
+            errmsg);
+    sqlite3_free(errmsg);
+  }
+  g_free(threads_pragma_str);
+
+  for(unsigned int index_number = 0;
+      index_number < deferred_indices->len;
+      index_number++) {
+    index = g_ptr_array_index(deferred_indices, index_number);
+
+    printf("Creating index \"%s\": ", index->name);
+    fflush(stdout);
+
+    index_timer = g_timer_new();
+    if(sqlite3_exec(db,
+                    index->create_index_stmt_str,
+                    NULL,
+                    NULL,
+                    &errmsg) == SQLITE_OK) {
+      printf("created in %.2f seconds\n",
+             g_timer_elapsed(index_timer, NULL));
+      g_ptr_array_add(index_stats_json,
+                      g_strdup_printf("{\"name\": \"%s\", "
+                                      "\"seconds\": %.6f}",
+                                      index->name,
+                                      g_timer_elapsed(index_timer, NULL)));
+    }
+    else {
+      puts("");
+      fprintf(stderr,
+              "create_deferred_indices: "
+              "Error creating index on table: %s\n",
+              errmsg);
+      sqlite3_free(errmsg);
+    }
+    deferred_index_time += g_timer_elapsed(index_timer, NULL);
+    g_timer_destroy(index_timer);
+  }
+}
 
-  index_stmt_index = 0;
-  index_stmt_str =
-    gtfs_file_spec->create_index_stmt_strs[index_stmt_index];
-  while(index_stmt_str && result == SQLITE_OK) {
+/* Executes each of a list of PRAGMA statements, stopping at the first
+   that fails */
+static int configure_database(sqlite3 *db,
+                              const char *pragma_strs[],
+                              char **errmsg) {
+  int result = SQLITE_OK;
+
+  for(unsigned int pragma_index = 0;
+      pragma_strs[pragma_index] && result == SQLITE_OK;
+      pragma_index++) {
     result = sqlite3_exec(db,
-                          index_stmt_str,
+                          pragma_strs[pragma_index],
                           NULL,
                           NULL,
                           errmsg);
-    index_stmt_str =
-      gtfs_file_spec->create_index_stmt_strs[++index_stmt_index];
   }
 
   return result;
 }
 
-/* Invoked by the CSV parser each time a field has been parsed */
-static void field_parsed(void *val, size_t len, void *data) {
-  gtfs_parsing_state_t *parsing_state = (gtfs_parsing_state_t *)data;
-  const gtfs_file_spec_t *gtfs_file_spec =
-    parsing_state->gtfs_file_spec;
+/* Returns the time, in seconds, since a time read from
+   g_get_monotonic_time */
+static double seconds_since(gint64 start_time) {
+  return (g_get_monotonic_time() - start_time) / (double)G_USEC_PER_SEC;
+}
 
-  if(parsing_state->header_parsed) {
-    /* We've parsed the header already; this field contains real data */
+/* Adds the statistics gathered in "from" to those in "to", then
+   clears them */
+static void move_load_stats(gtfs_load_stats_t *to, gtfs_load_stats_t *from) {
+  to->bytes_inflated += from->bytes_inflated;
+  to->bytes_tokenized += from->bytes_tokenized;
+  to->rows_parsed += from->rows_parsed;
+  to->rows_rejected += from->rows_rejected;
+  to->inflate_time += from->inflate_time;
+  to->parse_time += from->parse_time;
+  to->write_time += from->write_time;
 
-    unsigned int field_number;
-    gtfs_field_spec_t *field_spec;
-    gtfs_field_value_t *field_value;
+  memset(from, 0, sizeof(*from));
+}
 
-    field_number =
-      parsing_state->field_for_column[parsing_state->fields_parsed];
+/* Returns the most memory, in bytes, this process has had resident at
+   once */
+static guint64 peak_rss(void) {
+  struct rusage usage;
+
+  if(getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+
+  /* Linux reports the figure in kilobytes */
+  return (guint64)usage.ru_maxrss * 1024;
+}
+
+/* Prints a line reporting the progress of the load, if progress is
+   being reported and it is time to, in terms of the file whose
+   records the database writer has just written */
+static void report_progress(const gtfs_load_job_t *job) {
+  if(progress_interval > 0 &&
+     seconds_since(last_progress_time) >= progress_interval) {
+    fprintf(stderr,
+            "Progress: \"%s\": %lu rows parsed, %lu written, "
+            "%.1f MB inflated; peak RSS %.1f MB\n",
+            job->gtfs_file_spec->filename,
+            job->stats.rows_parsed,
+            job->objects_loaded + job->objects_updated +
+            job->objects_unchanged,
+            job->stats.bytes_inflated / BYTES_PER_MEGABYTE,
+            peak_rss() / BYTES_PER_MEGABYTE);
+    last_progress_time = g_get_monotonic_time();
+  }
+}
+
+/* Prints the number of objects loaded from a GTFS file and the time
+   it took */
+static void report_objects_loaded(const gtfs_file_spec_t *gtfs_file_spec,
+                                  long objects_loaded,
+                                  gdouble time_elapsed) {
+  const char *object_name;
+
+  object_name = objects_loaded == 1?
+    gtfs_file_spec->name.singular:
+    gtfs_file_spec->name.plural;
+  printf("%lu %s added in %.2f seconds",
+         objects_loaded,
+         object_name,
+         time_elapsed);
+  if(time_elapsed > 0 && objects_loaded > 0) {
+    printf(" (%.2fms/%s)",
+           (time_elapsed * 1000) / objects_loaded,
+           gtfs_file_spec->name.singular);
+  }
+}
+
+/* Records the statistics for a file once it has been loaded, for
+   writing to the file named with "--stats-json" */
+static void record_file_stats(const gtfs_load_job_t *job,
+                              double time_elapsed) {
+  const gtfs_load_stats_t *stats = &job->stats;
+
+  g_ptr_array_add(file_stats_json,
+                  g_strdup_printf("{\"file\": \"%s\", "
+                                  "\"seconds\": %.6f, "
+                                  "\"objects_added\": %lu, "
+                                  "\"objects_updated\": %lu, "
+                                  "\"objects_deleted\": %lu, "
+                                  "\"objects_unchanged\": %lu, "
+                                  "\"rows_parsed\": %lu, "
+                                  "\"rows_rejected\": %lu, "
+                                  "\"bytes_inflated\": %"
+                                  G_GUINT64_FORMAT ", "
+                                  "\"bytes_tokenized\": %"
+                                  G_GUINT64_FORMAT ", "
+                                  "\"inflate_seconds\": %.6f, "
+                                  "\"parse_seconds\": %.6f, "
+                                  "\"write_seconds\": %.6f}",
+                                  job->gtfs_file_spec->filename,
+                                  time_elapsed,
+                                  job->objects_loaded,
+                                  job->objects_updated,
+                                  job->objects_deleted,
+                                  job->objects_unchanged,
+                                  stats->rows_parsed,
+                                  stats->rows_rejected,
+                                  stats->bytes_inflated,
+                                  stats->bytes_tokenized,
+                                  stats->inflate_time,
+                                  stats->parse_time,
+                                  stats->write_time));
+}
+
+/* Records the time taken to build a table derived from those loaded,
+   for writing to the file named with "--stats-json" */
+static void record_derived_table_stats(const char *name,
+                                       double time_elapsed) {
+  g_ptr_array_add(derived_stats_json,
+                  g_strdup_printf("{\"name\": \"%s\", "
+                                  "\"seconds\": %.6f}",
+                                  name,
+                                  time_elapsed));
+}
+
+/* Writes the statistics recorded for each file, index and derived
+   table, together with the time taken to load the bundle and the peak
+   memory used, to a file as a JSON object, with each file, index and
+   derived table on a line of its own; returns TRUE on success */
+static bool write_stats_json(const char *path, double time_elapsed) {
+  FILE *stats_file;
+  bool result;
+
+  if((stats_file = fopen(path, "w")) == NULL) {
+    fprintf(stderr,
+            "write_stats_json: "
+            "Error opening \"%s\": %s\n",
+            path,
+            strerror(errno));
+    return false;
+  }
+
+  fputs("{\n  \"files\": [", stats_file);
+  for(unsigned int index = 0; index < file_stats_json->len; index++) {
+    fprintf(stats_file,
+            "%s\n    %s",
+            index > 0? ",": "",
+            (char *)g_ptr_array_index(file_stats_json, index));
+  }
+  fputs("\n  ],\n  \"indices\": [", stats_file);
+  for(unsigned int index = 0; index < index_stats_json->len; index++) {
+    fprintf(stats_file,
+            "%s\n    %s",
+            index > 0? ",": "",
+            (char *)g_ptr_array_index(index_stats_json, index));
+  }
+  fputs("\n  ],\n  \"derived_tables\": [", stats_file);
+  for(unsigned int index = 0; index < derived_stats_json->len; index++) {
+    fprintf(stats_file,
+            "%s\n    %s",
+            index > 0? ",": "",
+            (char *)g_ptr_array_index(derived_stats_json, index));
+  }
+  fprintf(stats_file,
+          "\n  ],\n"
+          "  \"index_seconds\": %.6f,\n"
+          "  \"seconds\": %.6f,\n"
+          "  \"peak_rss_bytes\": %" G_GUINT64_FORMAT "\n"
+          "}\n",
+          deferred_index_time,
+          time_elapsed,
+          peak_rss());
+
+  result = !ferror(stats_file);
+  if(fclose(stats_file) != 0 || !result) {
+    fprintf(stderr,
+            "write_stats_json: "
+            "Error writing \"%s\"\n",
+            path);
+    result = false;
+  }
+
+  return result;
+}
+
+/* Starts a new database transaction */
+static void begin_transaction(void) {
+  assert(sqlite3_step(begin_transaction_stmt) == SQLITE_DONE);
+  assert(sqlite3_reset(begin_transaction_stmt) == SQLITE_OK);
+  transaction_open = true;
+
+  records_in_transaction = 0;
+  g_timer_start(transaction_timer);
+}
+
+/* Ends (commits) the current database transaction */
+static void end_transaction(void) {
+  assert(sqlite3_step(end_transaction_stmt) == SQLITE_DONE);
+  assert(sqlite3_reset(end_transaction_stmt) == SQLITE_OK);
+  transaction_open = false;
+}
+
+/* Counts records about to be inserted (or updated or deleted), first
+   starting a transaction if none is open or, if the current
+   transaction has reached its limit on the number of records, ending
+   it and starting a new one; transactions are otherwise ended as each
+   table is completed */
+static void count_records_in_transaction(unsigned int num_records) {
+  gdouble transaction_time_elapsed;
+
+  if(!transaction_open) {
+    begin_transaction();
+  }
+  else if(records_in_transaction >= records_per_transaction) {
+    end_transaction();
+
+    /* Grow or shrink the transaction size if this transaction took
+       much less or much longer than we aim for */
+    if(adapt_records_per_transaction) {
+      transaction_time_elapsed = g_timer_elapsed(transaction_timer, NULL);
+      if(transaction_time_elapsed < TRANSACTION_TARGET_TIME / 2 &&
+         records_per_transaction < MAX_RECORDS_PER_TRANSACTION) {
+        records_per_transaction *= 2;
+      }
+      else if(transaction_time_elapsed > TRANSACTION_TARGET_TIME * 2 &&
+              records_per_transaction > MIN_RECORDS_PER_TRANSACTION) {
+        records_per_transaction /= 2;
+      }
+    }
+
+    begin_transaction();
+  }
+
+  records_in_transaction += num_records;
+}
+
+/* Copies a string field value of "len" bytes into an arena, which
+   must have room for it, returning the copy */
+inline static char *copy_string(gtfs_string_arena_t *arena,
+                                const char *val,
+                                size_t len) {
+  char *result = &arena->data[arena->used];
+
+  memcpy(result, val, len);
+  result[len] = '\0';
+  arena->used += len + 1;
+
+  return result;
+}
+
+/* Returns the type of a field's values as they are written to the
+   database, which for an identifier interned as an integer is
+   TYPE_INTEGER */
+inline static gtfs_field_type_t
+stored_field_type(const gtfs_field_spec_t *field_spec) {
+  return (compact_ids && field_spec->id_space != ID_SPACE_NONE)?
+    TYPE_INTEGER: field_spec->type;
+}
+
+/* Binds a parsed field value to a parameter (numbered from 1) of an
+   INSERT statement, binding NULL if the value is not present */
+static int bind_field_value(sqlite3_stmt *insert_stmt,
+                            unsigned int parameter,
+                            const gtfs_field_spec_t *field_spec,
+                            const gtfs_field_value_t *field_value) {
+  static const char *true_char = "t";
+  static const char *false_char = "f";
+
+  int sqlite_result;
+
+  if(field_value == NULL) {
+    return sqlite3_bind_null(insert_stmt, parameter);
+  }
+
+  switch(stored_field_type(field_spec)) {
+  case TYPE_BOOLEAN:
+    /* Map boolean values to "t" and "f" to match Active Record's
+       behaviour */
+    sqlite_result =
+      sqlite3_bind_text(insert_stmt,
+                        parameter,
+                        field_value->boolean_value ?
+                        true_char : false_char,
+                        1,
+                        SQLITE_STATIC);
+    break;
+
+  case TYPE_INTEGER:
+    sqlite_result =
+      sqlite3_bind_int(insert_stmt,
+                       parameter,
+                       field_value->integer_value);
+    break;
+
+  case TYPE_DOUBLE:
+    sqlite_result =
+      sqlite3_bind_double(insert_stmt,
+                          parameter,
+                          field_value->double_value);
+    break;
+
+  case TYPE_STRING:
+    /* The string was truncated when it was parsed and stays in its
+       arena until the record has been written, so SQLite need not
+       copy it */
+    sqlite_result =
+      sqlite3_bind_text(insert_stmt,
+                        parameter,
+                        field_value->string_value,
+                        -1,
+                        SQLITE_STATIC);
+    break;
+
+  case TYPE_DATE:
+    sqlite_result =
+      sqlite3_bind_text(insert_stmt,
+                        parameter,
+                        field_value->date_value,
+                        10,
+                        SQLITE_STATIC);
+    break;
+
+  case TYPE_TIME:
+    sqlite_result =
+      sqlite3_bind_int(insert_stmt,
+                       parameter,
+                       field_value->time_value);
+    break;
+
+  default:
+    /* Unrecognized field type; this should never be reached */
+    assert(false);
+  }
+
+  return sqlite_result;
+}
+
+/* Compares the values of a field in two records as SQLite orders
+   them, with absent (NULL) values first */
+static int compare_field_values(const gtfs_field_spec_t *field_spec,
+                                const gtfs_field_value_t *a,
+                                const gtfs_field_value_t *b) {
+  if(a == NULL || b == NULL) {
+    return (a != NULL) - (b != NULL);
+  }
+
+  switch(stored_field_type(field_spec)) {
+  case TYPE_BOOLEAN:
+    return a->boolean_value - b->boolean_value;
+
+  case TYPE_INTEGER:
+    return (a->integer_value > b->integer_value) -
+      (a->integer_value < b->integer_value);
+
+  case TYPE_DOUBLE:
+    return (a->double_value > b->double_value) -
+      (a->double_value < b->double_value);
+
+  case TYPE_STRING:
+    return strcmp(a->string_value, b->string_value);
+
+  case TYPE_DATE:
+    return strcmp(a->date_value, b->date_value);
+
+  case TYPE_TIME:
+    return (a->time_value > b->time_value) -
+      (a->time_value < b->time_value);
+
+  default:
+    /* Unrecognized field type; this should never be reached */
+    assert(false);
+  }
+
+  return 0;
+}
+
+/* Compares the keys of two records in an index */
+static int compare_index_keys(const gtfs_file_spec_t *gtfs_file_spec,
+                              const gtfs_index_t *index,
+                              const gtfs_field_value_t *a_values,
+                              unsigned int a_fields_present,
+                              const gtfs_field_value_t *b_values,
+                              unsigned int b_fields_present) {
+  int result = 0;
+  unsigned int field_number;
+
+  for(unsigned int key_field = 0;
+      key_field < index->num_key_fields && result == 0;
+      key_field++) {
+    field_number = index->key_fields[key_field];
+    result =
+      compare_field_values(gtfs_file_spec->field_specs[field_number],
+                           (a_fields_present & (1 << field_number))?
+                           &a_values[field_number]: NULL,
+                           (b_fields_present & (1 << field_number))?
+                           &b_values[field_number]: NULL);
+  }
+
+  return result;
+}
+
+/* Saves a copy of the last record in a batch about to be written,
+   including its strings, which do not outlive the batch */
+static void save_last_record(gtfs_load_job_t *job,
+                             gtfs_record_batch_t *batch) {
+  const gtfs_file_spec_t *gtfs_file_spec = job->gtfs_file_spec;
+  unsigned int record = batch->num_records - 1;
+  gtfs_field_value_t *field_value;
+  size_t strings_size = 0;
+
+  job->last_record_fields_present = batch->fields_present[record];
+  memcpy(job->last_record_values,
+         batch->field_values[record],
+         sizeof(job->last_record_values));
+
+  /* Make sure our arena has room for the record's strings, then copy
+     them to it */
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    if(stored_field_type(gtfs_file_spec->field_specs[field_number]) ==
+       TYPE_STRING &&
+       (job->last_record_fields_present & (1 << field_number))) {
+      strings_size +=
+        strlen(job->last_record_values[field_number].string_value) + 1;
+    }
+  }
+  if(strings_size > job->last_record_strings.size) {
+    g_free(job->last_record_strings.data);
+    job->last_record_strings.data = g_malloc(strings_size);
+    job->last_record_strings.size = strings_size;
+  }
+  job->last_record_strings.used = 0;
+
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    field_value = &job->last_record_values[field_number];
+    if(stored_field_type(gtfs_file_spec->field_specs[field_number]) ==
+       TYPE_STRING &&
+       (job->last_record_fields_present & (1 << field_number))) {
+      field_value->string_value =
+        copy_string(&job->last_record_strings,
+                    field_value->string_value,
+                    strlen(field_value->string_value));
+    }
+  }
+
+  job->last_record_saved = true;
+}
+
+/* Checks the records in a batch about to be written are in the order
+   of the key of each index still being built as records are inserted,
+   dropping any index for which they are not---before any record that
+   would violate a unique index is inserted */
+static void check_index_order(sqlite3 *db, gtfs_record_batch_t *batch) {
+  gtfs_load_job_t *job = batch->job;
+  gtfs_index_t *index;
+  bool indices_sorted = false;
+  int comparison;
+
+  if(batch->num_records == 0) {
+    return;
+  }
+
+  for(unsigned int index_number = 0;
+      index_number < job->num_indices;
+      index_number++) {
+    index = &job->indices[index_number];
+
+    /* Compare each record with the one before it, starting with the
+       last record of the previous batch */
+    for(unsigned int record = job->last_record_saved? 0: 1;
+        record < batch->num_records && index->sorted;
+        record++) {
+      comparison =
+        compare_index_keys(job->gtfs_file_spec,
+                           index,
+                           record > 0?
+                           batch->field_values[record - 1]:
+                           job->last_record_values,
+                           record > 0?
+                           batch->fields_present[record - 1]:
+                           job->last_record_fields_present,
+                           batch->field_values[record],
+                           batch->fields_present[record]);
+      if(comparison > 0 || (comparison == 0 && index->unique)) {
+        drop_sorted_index(db, index);
+      }
+    }
+
+    indices_sorted = indices_sorted || index->sorted;
+  }
+
+  if(indices_sorted) {
+    save_last_record(job, batch);
+  }
+}
+
+/* Adds bytes to a record's hash */
+static guint64 hash_bytes(guint64 hash, const void *data, size_t len) {
+  const unsigned char *bytes = data;
+
+  for(size_t index = 0; index < len; index++) {
+    hash = (hash ^ bytes[index]) * HASH_PRIME;
+  }
+
+  return hash;
+}
+
+/* Adds a value to a record's hash as it is stored in the database:
+   as NULL, text or a number, with integers and real numbers alike
+   hashed as doubles, since SQLite may store either as the other */
+static guint64 hash_value(guint64 hash,
+                          int value_type,
+                          double number,
+                          const char *text,
+                          size_t len) {
+  unsigned char type_byte = value_type;
+
+  hash = hash_bytes(hash, &type_byte, 1);
+  if(value_type == SQLITE_FLOAT) {
+    /* Make sure negative zero hashes as zero */
+    if(number == 0) {
+      number = 0;
+    }
+    hash = hash_bytes(hash, &number, sizeof(number));
+  }
+  else if(value_type == SQLITE_TEXT) {
+    hash = hash_bytes(hash, &len, sizeof(len));
+    hash = hash_bytes(hash, text, len);
+  }
+
+  return hash;
+}
+
+/* Adds a parsed field value to a record's hash, as it will be stored
+   in the database by bind_field_value */
+static guint64 hash_field_value(guint64 hash,
+                                const gtfs_field_spec_t *field_spec,
+                                const gtfs_field_value_t *field_value) {
+  if(field_value == NULL) {
+    return hash_value(hash, SQLITE_NULL, 0, NULL, 0);
+  }
+
+  switch(stored_field_type(field_spec)) {
+  case TYPE_BOOLEAN:
+    return hash_value(hash,
+                      SQLITE_TEXT,
+                      0,
+                      field_value->boolean_value? "t": "f",
+                      1);
+
+  case TYPE_INTEGER:
+    return hash_value(hash,
+                      SQLITE_FLOAT,
+                      field_value->integer_value,
+                      NULL,
+                      0);
+
+  case TYPE_DOUBLE:
+    return hash_value(hash,
+                      SQLITE_FLOAT,
+                      field_value->double_value,
+                      NULL,
+                      0);
+
+  case TYPE_STRING:
+    return hash_value(hash,
+                      SQLITE_TEXT,
+                      0,
+                      field_value->string_value,
+                      strlen(field_value->string_value));
+
+  case TYPE_DATE:
+    return hash_value(hash,
+                      SQLITE_TEXT,
+                      0,
+                      field_value->date_value,
+                      10);
+
+  case TYPE_TIME:
+    return hash_value(hash,
+                      SQLITE_FLOAT,
+                      field_value->time_value,
+                      NULL,
+                      0);
+
+  default:
+    /* Unrecognized field type; this should never be reached */
+    assert(false);
+  }
+
+  return hash;
+}
+
+/* Adds the value of a column in the current row of a SELECT statement
+   to a record's hash */
+static guint64 hash_column_value(guint64 hash,
+                                 sqlite3_stmt *select_stmt,
+                                 int column) {
+  switch(sqlite3_column_type(select_stmt, column)) {
+  case SQLITE_NULL:
+    return hash_value(hash, SQLITE_NULL, 0, NULL, 0);
+
+  case SQLITE_INTEGER:
+  case SQLITE_FLOAT:
+    return hash_value(hash,
+                      SQLITE_FLOAT,
+                      sqlite3_column_double(select_stmt, column),
+                      NULL,
+                      0);
+
+  default:
+    return hash_value(hash,
+                      SQLITE_TEXT,
+                      0,
+                      (const char *)sqlite3_column_text(select_stmt, column),
+                      sqlite3_column_bytes(select_stmt, column));
+  }
+}
+
+/* Hashes the natural key and the full contents of a parsed record */
+static void hash_record(const gtfs_file_spec_t *gtfs_file_spec,
+                        const gtfs_field_value_t *field_values,
+                        unsigned int fields_present,
+                        guint64 *key_hash,
+                        guint64 *record_hash) {
+  unsigned int field_number;
+
+  *key_hash = HASH_OFFSET_BASIS;
+  for(unsigned int key_field = 0;
+      key_field < gtfs_file_spec->num_key_fields;
+      key_field++) {
+    field_number = gtfs_file_spec->key_fields[key_field];
+    *key_hash =
+      hash_field_value(*key_hash,
+                       gtfs_file_spec->field_specs[field_number],
+                       (fields_present & (1 << field_number))?
+                       &field_values[field_number]: NULL);
+  }
+
+  *record_hash = HASH_OFFSET_BASIS;
+  for(field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    *record_hash =
+      hash_field_value(*record_hash,
+                       gtfs_file_spec->field_specs[field_number],
+                       (fields_present & (1 << field_number))?
+                       &field_values[field_number]: NULL);
+  }
+}
+
+/* Orders existing records by key hash */
+static int compare_existing_records(const void *a, const void *b) {
+  const gtfs_existing_record_t *record_a = a, *record_b = b;
+
+  return (record_a->key_hash > record_b->key_hash) -
+    (record_a->key_hash < record_b->key_hash);
+}
+
+/* Returns TRUE if a GTFS file's table exists in the database */
+static bool table_exists(sqlite3 *db, const gtfs_file_spec_t *gtfs_file_spec) {
+  bool result;
+  char *name;
+
+  name = table_name(gtfs_file_spec);
+  result = gtfs_sqlite_table_exists(db, name);
+  g_free(name);
+
+  return result;
+}
+
+/* Returns TRUE if a GTFS file's table exists but has no row IDs,
+   having been created clustered on its natural key */
+static bool table_without_rowid(sqlite3 *db,
+                                const gtfs_file_spec_t *gtfs_file_spec) {
+  bool result = false;
+  char *name, *stmt_str;
+  sqlite3_stmt *select_stmt;
+
+  if(table_exists(db, gtfs_file_spec)) {
+    name = table_name(gtfs_file_spec);
+    stmt_str = g_strdup_printf("SELECT rowid FROM %s", name);
+    if(sqlite3_prepare_v2(db, stmt_str, -1, &select_stmt, NULL) ==
+       SQLITE_OK) {
+      sqlite3_finalize(select_stmt);
+    }
+    else {
+      result = true;
+    }
+    g_free(stmt_str);
+    g_free(name);
+  }
+
+  return result;
+}
+
+/* Prepares to update a GTFS file's existing table: reads and hashes
+   the records it holds, in the same way as records parsed from the
+   file are hashed, ordering them by key hash, and prepares the
+   statements used to update and delete records; returns TRUE on
+   success */
+static bool load_existing_records(sqlite3 *db, gtfs_load_job_t *job) {
+  const gtfs_file_spec_t *gtfs_file_spec = job->gtfs_file_spec;
+  bool result = true;
+  char *name, *columns_str, *stmt_str;
+  gchar **column_names;
+  GString *update_stmt_str;
+  GArray *existing_records;
+  gtfs_existing_record_t existing_record;
+  sqlite3_stmt *select_stmt;
+  unsigned int field_number;
+  int sqlite_result;
+  gint64 start_time = g_get_monotonic_time();
+
+  name = table_name(gtfs_file_spec);
+  column_names = table_column_names(gtfs_file_spec);
+  columns_str = g_strjoinv(", ", column_names);
+
+  /* Read and hash every record in the table */
+  stmt_str = g_strdup_printf("SELECT rowid, %s FROM %s", columns_str, name);
+  if(sqlite3_prepare_v2(db, stmt_str, -1, &select_stmt, NULL) ==
+     SQLITE_OK) {
+    existing_records = g_array_new(FALSE,
+                                   FALSE,
+                                   sizeof(gtfs_existing_record_t));
+    while((sqlite_result = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+      existing_record.rowid = sqlite3_column_int64(select_stmt, 0);
+
+      existing_record.key_hash = HASH_OFFSET_BASIS;
+      for(unsigned int key_field = 0;
+          key_field < gtfs_file_spec->num_key_fields;
+          key_field++) {
+        existing_record.key_hash =
+          hash_column_value(existing_record.key_hash,
+                            select_stmt,
+                            gtfs_file_spec->key_fields[key_field] + 1);
+      }
+
+      existing_record.record_hash = HASH_OFFSET_BASIS;
+      for(field_number = 0;
+          field_number < gtfs_file_spec->num_fields;
+          field_number += 1) {
+        existing_record.record_hash =
+          hash_column_value(existing_record.record_hash,
+                            select_stmt,
+                            field_number + 1);
+      }
+
+      g_array_append_val(existing_records, existing_record);
+    }
+    if(sqlite_result != SQLITE_DONE) {
+      fprintf(stderr,
+              "load_existing_records: "
+              "Error reading table \"%s\": %s\n",
+              name,
+              sqlite3_errmsg(db));
+      result = false;
+    }
+    sqlite3_finalize(select_stmt);
+
+    job->num_existing_records = existing_records->len;
+    job->existing_records =
+      (gtfs_existing_record_t *)g_array_free(existing_records, FALSE);
+    qsort(job->existing_records,
+          job->num_existing_records,
+          sizeof(gtfs_existing_record_t),
+          compare_existing_records);
+    job->existing_records_matched = g_new0(bool,
+                                           job->num_existing_records);
+  }
+  else {
+    fprintf(stderr,
+            "load_existing_records: "
+            "Error reading table \"%s\": %s\n",
+            name,
+            sqlite3_errmsg(db));
+    result = false;
+  }
+  g_free(stmt_str);
+
+  /* Prepare the statements that update and delete records by row ID */
+  update_stmt_str = g_string_new("UPDATE ");
+  g_string_append_printf(update_stmt_str, "%s SET ", name);
+  for(field_number = 0; column_names[field_number]; field_number++) {
+    g_string_append_printf(update_stmt_str,
+                           field_number == 0? "%s = ?": ", %s = ?",
+                           column_names[field_number]);
+  }
+  g_string_append(update_stmt_str, " WHERE rowid = ?");
+  stmt_str = g_strdup_printf("DELETE FROM %s WHERE rowid = ?", name);
+
+  if(result &&
+     (sqlite3_prepare_v2(db,
+                         update_stmt_str->str,
+                         -1,
+                         &job->update_stmt,
+                         NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2(db,
+                         stmt_str,
+                         -1,
+                         &job->delete_stmt,
+                         NULL) != SQLITE_OK)) {
+    fprintf(stderr,
+            "load_existing_records: "
+            "Error preparing statement: %s\n",
+            sqlite3_errmsg(db));
+    result = false;
+  }
+
+  g_free(stmt_str);
+  g_string_free(update_stmt_str, TRUE);
+  g_free(columns_str);
+  g_strfreev(column_names);
+  g_free(name);
+
+  job->update = true;
+  job->stats.write_time += seconds_since(start_time);
+  return result;
+}
+
+/* Returns the index of the existing record a parsed record matches,
+   or -1 if it matches none; among existing records with the same key,
+   an unmatched record with the same contents is preferred */
+static long find_existing_record(gtfs_load_job_t *job,
+                                 guint64 key_hash,
+                                 guint64 record_hash) {
+  long result = -1;
+  size_t low = 0, high = job->num_existing_records, middle;
+
+  /* Find the first existing record with this key */
+  while(low < high) {
+    middle = low + (high - low) / 2;
+    if(job->existing_records[middle].key_hash < key_hash) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+
+  for(size_t index = low;
+      index < job->num_existing_records &&
+        job->existing_records[index].key_hash == key_hash;
+      index++) {
+    if(!job->existing_records_matched[index]) {
+      if(job->existing_records[index].record_hash == record_hash) {
+        return index;
+      }
+      else if(result == -1) {
+        result = index;
+      }
+    }
+  }
+
+  return result;
+}
+
+/* Matches the records in a batch about to be written against those
+   already in the table being updated, updating any existing record
+   that has changed; only the new records are left in the batch, to
+   be inserted */
+static void match_existing_records(sqlite3 *db, gtfs_record_batch_t *batch) {
+  gtfs_load_job_t *job = batch->job;
+  const gtfs_file_spec_t *gtfs_file_spec = job->gtfs_file_spec;
+  unsigned int num_new_records = 0;
+  guint64 key_hash, record_hash;
+  long existing;
+
+  for(unsigned int record = 0; record < batch->num_records; record++) {
+    hash_record(gtfs_file_spec,
+                batch->field_values[record],
+                batch->fields_present[record],
+                &key_hash,
+                &record_hash);
+
+    existing = find_existing_record(job, key_hash, record_hash);
+    if(existing == -1) {
+      /* A new record; keep it in the batch */
+      if(num_new_records != record) {
+        batch->fields_present[num_new_records] =
+          batch->fields_present[record];
+        memcpy(batch->field_values[num_new_records],
+               batch->field_values[record],
+               sizeof(batch->field_values[record]));
+      }
+      num_new_records++;
+      continue;
+    }
+
+    job->existing_records_matched[existing] = true;
+    if(job->existing_records[existing].record_hash == record_hash) {
+      job->objects_unchanged++;
+      continue;
+    }
+
+    /* The record has changed; update it in place */
+    count_records_in_transaction(1);
+    for(unsigned int field_number = 0;
+        field_number < gtfs_file_spec->num_fields;
+        field_number += 1) {
+      bind_field_value(job->update_stmt,
+                       field_number + 1,
+                       gtfs_file_spec->field_specs[field_number],
+                       (batch->fields_present[record] &
+                        (1 << field_number))?
+                       &batch->field_values[record][field_number]:
+                       NULL);
+    }
+    sqlite3_bind_int64(job->update_stmt,
+                       gtfs_file_spec->num_fields + 1,
+                       job->existing_records[existing].rowid);
+
+    if(sqlite3_step(job->update_stmt) == SQLITE_DONE) {
+      job->objects_updated++;
+    }
+    else {
+      fprintf(stderr,
+              "match_existing_records: "
+              "Error updating record: %s\n",
+              sqlite3_errmsg(db));
+      job->stats.rows_rejected++;
+    }
+    sqlite3_reset(job->update_stmt);
+  }
+
+  batch->num_records = num_new_records;
+}
+
+/* Completes the update of a file's table once every record in the
+   file has been written, deleting the existing records no record in
+   the file matched---unless the file could not be read or any part of
+   it (including any chunk of a split file) failed to parse, when the
+   records left unmatched may simply not have been reached---and frees
+   the resources used */
+static void finish_existing_records(sqlite3 *db,
+                                    gtfs_load_job_t *job,
+                                    bool load_error) {
+  gint64 start_time = g_get_monotonic_time();
+
+  for(size_t index = 0;
+      index < job->num_existing_records && !load_error;
+      index++) {
+    if(!job->existing_records_matched[index]) {
+      count_records_in_transaction(1);
+      sqlite3_bind_int64(job->delete_stmt,
+                         1,
+                         job->existing_records[index].rowid);
+      if(sqlite3_step(job->delete_stmt) == SQLITE_DONE) {
+        job->objects_deleted++;
+      }
+      else {
+        fprintf(stderr,
+                "finish_existing_records: "
+                "Error deleting record: %s\n",
+                sqlite3_errmsg(db));
+      }
+      sqlite3_reset(job->delete_stmt);
+    }
+  }
+  job->stats.write_time += seconds_since(start_time);
+
+  sqlite3_finalize(job->update_stmt);
+  sqlite3_finalize(job->delete_stmt);
+  job->update_stmt = job->delete_stmt = NULL;
+
+  g_free(job->existing_records);
+  g_free(job->existing_records_matched);
+  job->existing_records = NULL;
+  job->existing_records_matched = NULL;
+  job->num_existing_records = 0;
+}
+
+/* Prepares the dictionaries that intern identifiers as integers: when
+   updating a database that already has lookup tables, reads the
+   identifiers they hold, so each keeps its integer, and otherwise
+   creates the tables; returns TRUE on success */
+static bool open_id_dictionaries(sqlite3 *db) {
+  bool result = true;
+  gtfs_id_dictionary_t *dictionary;
+  const char *table_name;
+  char *stmt_str, *errmsg;
+  sqlite3_stmt *select_stmt;
+  unsigned int id;
+
+  for(unsigned int id_space = ID_SPACE_NONE + 1;
+      id_space < NUM_ID_SPACES && result;
+      id_space++) {
+    dictionary = &id_dictionaries[id_space];
+    dictionary->ids = g_hash_table_new_full(g_str_hash,
+                                            g_str_equal,
+                                            g_free,
+                                            NULL);
+    dictionary->new_ids = g_ptr_array_new();
+    dictionary->first_new_id = 1;
+
+    table_name = id_table_names[id_space];
+    if(update_database && gtfs_sqlite_table_exists(db, table_name)) {
+      stmt_str = g_strdup_printf("SELECT id, gtfs_id FROM %s", table_name);
+      if(sqlite3_prepare_v2(db, stmt_str, -1, &select_stmt, NULL) ==
+         SQLITE_OK) {
+        while(sqlite3_step(select_stmt) == SQLITE_ROW) {
+          id = sqlite3_column_int(select_stmt, 0);
+          g_hash_table_insert(dictionary->ids,
+                              g_strdup((const char *)
+                                       sqlite3_column_text(select_stmt, 1)),
+                              GUINT_TO_POINTER(id));
+          if(id >= dictionary->first_new_id) {
+            dictionary->first_new_id = id + 1;
+          }
+        }
+        sqlite3_finalize(select_stmt);
+      }
+      else {
+        fprintf(stderr,
+                "open_id_dictionaries: "
+                "Error reading table \"%s\": %s\n",
+                table_name,
+                sqlite3_errmsg(db));
+        result = false;
+      }
+    }
+    else {
+      stmt_str = g_strdup_printf("CREATE TABLE %s("
+                                 "id INTEGER PRIMARY KEY, "
+                                 "gtfs_id VARCHAR(255) NOT NULL UNIQUE);",
+                                 table_name);
+      if(sqlite3_exec(db, stmt_str, NULL, NULL, &errmsg) != SQLITE_OK) {
+        fprintf(stderr,
+                "Error creating lookup table: %s\n",
+                errmsg);
+        sqlite3_free(errmsg);
+        result = false;
+      }
+    }
+    g_free(stmt_str);
+  }
+
+  return result;
+}
+
+/* Returns the integer interned for an identifier in a dictionary,
+   interning it if it has not been seen before */
+static unsigned int intern_id(gtfs_id_dictionary_t *dictionary,
+                              const char *gtfs_id) {
+  char *new_id;
+  gpointer id;
+
+  id = g_hash_table_lookup(dictionary->ids, gtfs_id);
+  if(id == NULL) {
+    new_id = g_strdup(gtfs_id);
+    id = GUINT_TO_POINTER(dictionary->first_new_id +
+                          dictionary->new_ids->len);
+    g_hash_table_insert(dictionary->ids, new_id, id);
+    g_ptr_array_add(dictionary->new_ids, new_id);
+  }
+
+  return GPOINTER_TO_UINT(id);
+}
+
+/* Replaces each identifier in a batch of records with the integer
+   interned for it in its ID space, interning those not seen before */
+static void intern_ids(gtfs_record_batch_t *batch) {
+  const gtfs_file_spec_t *gtfs_file_spec = batch->job->gtfs_file_spec;
+  const gtfs_field_spec_t *field_spec;
+  gtfs_id_dictionary_t *dictionary;
+  gtfs_field_value_t *field_value;
+
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    field_spec = gtfs_file_spec->field_specs[field_number];
+    if(field_spec->id_space != ID_SPACE_NONE) {
+      dictionary = &id_dictionaries[field_spec->id_space];
+
+      for(unsigned int record = 0; record < batch->num_records; record++) {
+        if(batch->fields_present[record] & (1 << field_number)) {
+          field_value = &batch->field_values[record][field_number];
+          field_value->integer_value =
+            intern_id(dictionary, field_value->string_value);
+        }
+      }
+    }
+  }
+}
+
+/* Adds the identifiers interned during this load to their lookup
+   tables */
+static void write_id_dictionaries(sqlite3 *db) {
+  gtfs_id_dictionary_t *dictionary;
+  char *stmt_str;
+  sqlite3_stmt *insert_stmt;
+
+  for(unsigned int id_space = ID_SPACE_NONE + 1;
+      id_space < NUM_ID_SPACES;
+      id_space++) {
+    dictionary = &id_dictionaries[id_space];
+
+    stmt_str = g_strdup_printf("INSERT INTO %s(id, gtfs_id) VALUES (?, ?)",
+                               id_table_names[id_space]);
+    if(sqlite3_prepare_v2(db, stmt_str, -1, &insert_stmt, NULL) !=
+       SQLITE_OK) {
+      fprintf(stderr,
+              "write_id_dictionaries: "
+              "Error preparing INSERT statement for table \"%s\": %s\n",
+              id_table_names[id_space],
+              sqlite3_errmsg(db));
+      g_free(stmt_str);
+      continue;
+    }
+    for(unsigned int index = 0; index < dictionary->new_ids->len; index++) {
+      count_records_in_transaction(1);
+      sqlite3_bind_int(insert_stmt, 1, dictionary->first_new_id + index);
+      sqlite3_bind_text(insert_stmt,
+                        2,
+                        g_ptr_array_index(dictionary->new_ids, index),
+                        -1,
+                        SQLITE_STATIC);
+      if(sqlite3_step(insert_stmt) != SQLITE_DONE) {
+        fprintf(stderr,
+                "write_id_dictionaries: "
+                "Error inserting identifier: %s\n",
+                sqlite3_errmsg(db));
+      }
+      sqlite3_reset(insert_stmt);
+    }
+    sqlite3_finalize(insert_stmt);
+    g_free(stmt_str);
+  }
+}
+
+/* Frees the dictionaries that intern identifiers */
+static void free_id_dictionaries(void) {
+  gtfs_id_dictionary_t *dictionary;
+
+  for(unsigned int id_space = ID_SPACE_NONE + 1;
+      id_space < NUM_ID_SPACES;
+      id_space++) {
+    dictionary = &id_dictionaries[id_space];
+    if(dictionary->ids) {
+      g_hash_table_destroy(dictionary->ids);
+      g_ptr_array_free(dictionary->new_ids, TRUE);
+    }
+    memset(dictionary, 0, sizeof(*dictionary));
+  }
+}
+
+/* Opens the SQLite database at "path", configuring it for a bulk load
+   if one was requested */
+static bool sqlite_sink_open(const char *path) {
+  char *errmsg;
+
+  if(sqlite3_open(path, &output_db) != SQLITE_OK) {
+    fprintf(stderr,
+            "Error creating database \"%s\": %s\n",
+            path,
+            sqlite3_errmsg(output_db));
+    sqlite3_close(output_db);
+    return false;
+  }
+
+  /* Trade durability for speed if a bulk load was requested */
+  if(bulk_load_database &&
+     configure_database(output_db,
+                        bulk_load_pragma_strs,
+                        &errmsg) != SQLITE_OK) {
+    fprintf(stderr,
+            "Error configuring database for bulk load: %s\n",
+            errmsg);
+    sqlite3_free(errmsg);
+  }
+
+  /* Existing records are matched and replaced by row ID, which the
+     clustered tables of a database do not have */
+  if(update_database && table_without_rowid(output_db, &trips_file_spec)) {
+    fprintf(stderr,
+            "Error: A database with clustered tables cannot be updated\n");
+    sqlite3_close(output_db);
+    return false;
+  }
+
+  /* A database being updated keeps the form of identifiers it was
+     created with */
+  if(update_database && table_exists(output_db, &trips_file_spec)) {
+    compact_ids = gtfs_sqlite_table_exists(output_db,
+                                           id_table_names[ID_SPACE_TRIP]);
+  }
+
+  /* Prepare to intern identifiers as integers, if they are to be */
+  if(compact_ids && !open_id_dictionaries(output_db)) {
+    free_id_dictionaries();
+    sqlite3_close(output_db);
+    return false;
+  }
+
+  /* Precompile our "BEGIN TRANSACTION" and "END TRANSACTION"
+     statements */
+  assert(sqlite3_prepare_v2(output_db,
+                            "BEGIN TRANSACTION",
+                            strlen("BEGIN TRANSACTION"),
+                            &begin_transaction_stmt,
+                            NULL) == SQLITE_OK);
+  assert(sqlite3_prepare_v2(output_db,
+                            "END TRANSACTION",
+                            strlen("END TRANSACTION"),
+                            &end_transaction_stmt,
+                            NULL) == SQLITE_OK);
+
+  transaction_timer = g_timer_new();
+  deferred_indices = g_ptr_array_new_with_free_func(free_deferred_index);
+
+  return true;
+}
+
+/* Creates a sorter that orders the records of a table by its natural
+   key, as their values are stored (once identifiers are interned) */
+static gtfs_sorter_t *new_key_sorter(const gtfs_file_spec_t *gtfs_file_spec) {
+  gtfs_field_type_t field_types[MAX_COLUMNS];
+
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    field_types[field_number] =
+      stored_field_type(gtfs_file_spec->field_specs[field_number]);
+  }
+
+  return gtfs_sorter_new(gtfs_file_spec->num_fields,
+                         field_types,
+                         gtfs_file_spec->num_key_fields,
+                         gtfs_file_spec->key_fields,
+                         sort_memory);
+}
+
+/* Allocates an empty batch for a job's records, filled by the
+   database writer itself rather than by a parsing thread */
+static gtfs_record_batch_t *new_record_batch(gtfs_load_job_t *job) {
+  gtfs_record_batch_t *batch;
+
+  batch = g_new(gtfs_record_batch_t, 1);
+  batch->job = job;
+  batch->num_records = 0;
+  batch->strings.data = batch->string_data;
+  batch->strings.size = sizeof(batch->string_data);
+  batch->strings.used = 0;
+
+  return batch;
+}
+
+/* Prepares the database for loading a GTFS file: creates its table
+   or, when updating the database and the table exists, reads the
+   records it already holds; then prepares the statements that insert
+   records and creates the indices that can be built as records are
+   inserted; returns TRUE on success. The points in "shapes.txt" are
+   instead encoded shape by shape, and the shapes written to their own
+   table by a job of their own */
+static bool sqlite_sink_begin_table(gtfs_load_job_t *job) {
+  const gtfs_file_spec_t *gtfs_file_spec = job->gtfs_file_spec;
+  char *errmsg;
+
+  if(gtfs_file_spec == &shapes_file_spec) {
+    job->shapes_job = g_new0(gtfs_load_job_t, 1);
+    job->shapes_job->gtfs_file_spec = &encoded_shapes_file_spec;
+    job->shape_encoder = gtfs_shape_encoder_new();
+    job->shapes_batch = new_record_batch(job->shapes_job);
+    job->shape_strings = g_ptr_array_new_with_free_func(g_free);
+    job->scattered_shape_ids = g_hash_table_new_full(g_str_hash,
+                                                     g_str_equal,
+                                                     g_free,
+                                                     NULL);
+    return sqlite_sink_begin_table(job->shapes_job);
+  }
+
+  if(update_database && table_exists(output_db, gtfs_file_spec)) {
+    if(!load_existing_records(output_db, job)) {
+      return false;
+    }
+  }
+  else if(create_table(output_db, gtfs_file_spec, &errmsg) != SQLITE_OK) {
+    fprintf(stderr,
+            "Error creating database table: %s\n",
+            errmsg);
+    sqlite3_free(errmsg);
+    return false;
+  }
+
+  if(prepare_insert_stmts(output_db, job) != SQLITE_OK) {
+    fprintf(stderr,
+            "Error preparing INSERT statement: %s\n",
+            sqlite3_errmsg(output_db));
+    return false;
+  }
+
+  /* The indices on an existing table are already in place */
+  if(!job->update) {
+    create_indices(output_db, job);
+  }
+
+  /* The records of a clustered table are sorted by key before being
+     inserted */
+  if(table_clustered(gtfs_file_spec)) {
+    job->sorter = new_key_sorter(gtfs_file_spec);
+  }
+
+  return true;
+}
+
+/* Inserts the records in a batch into the database, as many at a time
+   as the file's INSERT statements allow, starting a new transaction
+   whenever the current one reaches its limit */
+static void insert_records(gtfs_record_batch_t *batch) {
+  gtfs_load_job_t *job = batch->job;
+  const gtfs_file_spec_t *gtfs_file_spec = job->gtfs_file_spec;
+  unsigned int record = 0, retry_end = 0, stmt_index, rows;
+  sqlite3_stmt *insert_stmt;
+
+  if(job->update) {
+    match_existing_records(output_db, batch);
+  }
+  check_index_order(output_db, batch);
+
+  while(record < batch->num_records) {
+    /* Choose the statement inserting the most records without
+       exceeding those remaining, or insert records one at a time if
+       they are being retried */
+    stmt_index = job->num_insert_stmts - 1;
+    while(stmt_index > 0 &&
+          (record < retry_end ||
+           1u << stmt_index > batch->num_records - record)) {
+      stmt_index--;
+    }
+    insert_stmt = job->insert_stmts[stmt_index];
+    rows = 1 << stmt_index;
+
+    /* End and start a new transaction if we've reached our limit on
+       the number of objects in this one */
+    count_records_in_transaction(rows);
+
+    /* Bind each field value of each record to the statement; every
+       parameter is bound, so the statement's bindings need never be
+       cleared */
+    for(unsigned int row = 0; row < rows; row++) {
+      for(unsigned int field_number = 0;
+          field_number < gtfs_file_spec->num_fields;
+          field_number += 1) {
+        if(bind_field_value(insert_stmt,
+                            row * gtfs_file_spec->num_fields +
+                            field_number + 1,
+                            gtfs_file_spec->field_specs[field_number],
+                            (batch->fields_present[record + row] &
+                             (1 << field_number))?
+                            &batch->field_values[record + row][field_number]:
+                            NULL) != SQLITE_OK) {
+          fprintf(stderr,
+                  "insert_records: "
+                  "Error binding value for field \"%s\": %s\n",
+                  gtfs_file_spec->field_specs[field_number]->name,
+                  sqlite3_errmsg(output_db));
+        }
+      }
+    }
+
+    /* Insert the records into the database */
+    if(sqlite3_step(insert_stmt) == SQLITE_DONE) {
+      job->objects_loaded += rows;
+      record += rows;
+    }
+    else if(rows > 1) {
+      /* Insert these records again one at a time, so only those at
+         fault are rejected */
+      retry_end = record + rows;
+    }
+    else {
+      fprintf(stderr,
+              "insert_records: "
+              "Error inserting record: %s\n",
+              sqlite3_errmsg(output_db));
+      job->stats.rows_rejected++;
+      record++;
+    }
+
+    sqlite3_reset(insert_stmt);
+  }
+}
+
+/* Inserts the shapes encoded so far into their table, then frees
+   their strings */
+static void flush_encoded_shapes(gtfs_load_job_t *job) {
+  gtfs_record_batch_t *batch = job->shapes_batch;
+
+  if(batch->num_records > 0) {
+    insert_records(batch);
+    batch->num_records = 0;
+  }
+
+  g_ptr_array_set_size(job->shape_strings, 0);
+  job->shape_strings_size = 0;
+}
+
+/* Encodes the shape whose points the encoder holds, if any, and adds
+   it to the batch of shapes to be inserted, inserting the batch once
+   it is full */
+static void queue_encoded_shape(gtfs_load_job_t *job) {
+  gtfs_record_batch_t *batch = job->shapes_batch;
+  gtfs_encoded_shape_t shape;
+  gtfs_field_value_t *field_values;
+  unsigned int record;
+
+  if(!gtfs_shape_encoder_encode(job->shape_encoder, &shape)) {
+    return;
+  }
+
+  record = batch->num_records++;
+  field_values = batch->field_values[record];
+  field_values[ENCODED_SHAPE_ID].string_value = shape.shape_id;
+  field_values[ENCODED_SHAPE_NUM_POINTS].integer_value = shape.num_points;
+  field_values[ENCODED_SHAPE_MIN_LAT].double_value = shape.min_lat;
+  field_values[ENCODED_SHAPE_MIN_LON].double_value = shape.min_lon;
+  field_values[ENCODED_SHAPE_MAX_LAT].double_value = shape.max_lat;
+  field_values[ENCODED_SHAPE_MAX_LON].double_value = shape.max_lon;
+  field_values[ENCODED_SHAPE_POINTS].string_value = shape.points;
+  field_values[ENCODED_SHAPE_DISTANCES].string_value = shape.distances;
+  batch->fields_present[record] = shape.distances?
+    (1 << (ENCODED_SHAPE_DISTANCES + 1)) - 1:
+    (1 << ENCODED_SHAPE_DISTANCES) - 1;
+
+  /* The batch refers to the shape's strings until it is inserted */
+  g_ptr_array_add(job->shape_strings, shape.shape_id);
+  g_ptr_array_add(job->shape_strings, shape.points);
+  g_ptr_array_add(job->shape_strings, shape.distances);
+  job->shape_strings_size += strlen(shape.points) +
+    (shape.distances? strlen(shape.distances): 0);
+
+  if(batch->num_records == RECORDS_PER_BATCH ||
+     job->shape_strings_size >= BATCH_STRINGS_SIZE) {
+    flush_encoded_shapes(job);
+  }
+}
+
+/* Passes the points in a batch of records from "shapes.txt" to the
+   shape encoder, encoding each shape once the first point of the next
+   is reached, so no more than a single shape's points are held at
+   once. A point missing a required field is rejected, as is a point
+   of a shape whose points are not listed together, each such shape
+   being reported just once */
+static void write_shape_points(gtfs_record_batch_t *batch) {
+  const unsigned int required_fields =
+    (1 << SHAPE_ID) | (1 << SHAPE_PT_LAT) | (1 << SHAPE_PT_LON) |
+    (1 << SHAPE_PT_SEQUENCE);
+  gtfs_load_job_t *job = batch->job;
+  gtfs_field_value_t *field_values;
+  const char *shape_id;
+
+  for(unsigned int record = 0; record < batch->num_records; record++) {
+    if((batch->fields_present[record] & required_fields) !=
+       required_fields) {
+      job->stats.rows_rejected++;
+      continue;
+    }
+
+    field_values = batch->field_values[record];
+    shape_id = field_values[SHAPE_ID].string_value;
+    if(gtfs_shape_encoder_ends_shape(job->shape_encoder, shape_id)) {
+      queue_encoded_shape(job);
+    }
+
+    if(!gtfs_shape_encoder_add(job->shape_encoder,
+                               shape_id,
+                               field_values[SHAPE_PT_SEQUENCE].integer_value,
+                               field_values[SHAPE_PT_LAT].double_value,
+                               field_values[SHAPE_PT_LON].double_value,
+                               (batch->fields_present[record] &
+                                (1 << SHAPE_DIST_TRAVELED))?
+                               &field_values[SHAPE_DIST_TRAVELED].
+                               double_value:
+                               NULL)) {
+      if(!g_hash_table_contains(job->scattered_shape_ids, shape_id)) {
+        fprintf(stderr,
+                "write_shape_points: "
+                "Points of shape \"%s\" are not listed together\n",
+                shape_id);
+        g_hash_table_add(job->scattered_shape_ids, g_strdup(shape_id));
+      }
+      job->stats.rows_rejected++;
+    }
+  }
+}
+
+/* Writes a batch of records to the database, first interning their
+   identifiers if they are stored as integers; the records of a
+   clustered table are held by its sorter until the last is written,
+   and the points of shapes are encoded before they are written */
+static void sqlite_sink_write_batch(gtfs_record_batch_t *batch) {
+  gtfs_load_job_t *job = batch->job;
+
+  if(compact_ids) {
+    intern_ids(batch);
+  }
+
+  if(job->shapes_job) {
+    write_shape_points(batch);
+  }
+  else if(job->sorter) {
+    for(unsigned int record = 0; record < batch->num_records; record++) {
+      gtfs_sorter_add(job->sorter,
+                      batch->fields_present[record],
+                      batch->field_values[record]);
+    }
+  }
+  else {
+    insert_records(batch);
+  }
+}
+
+/* Adds a record, with its values as they are stored, to a batch the
+   database writer fills itself, copying its strings into the batch;
+   the records already in the batch are inserted first if it has no
+   room for this one */
+static void add_stored_record(gtfs_record_batch_t *batch,
+                              unsigned int fields_present,
+                              const gtfs_field_value_t *field_values) {
+  const gtfs_file_spec_t *gtfs_file_spec = batch->job->gtfs_file_spec;
+  gtfs_field_value_t *field_value;
+  unsigned int record;
+  size_t strings_size;
+
+  /* Insert the records in the batch once it has no room for this
+     one */
+  strings_size = 0;
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    if(stored_field_type(gtfs_file_spec->field_specs[field_number]) ==
+       TYPE_STRING &&
+       (fields_present & (1 << field_number))) {
+      strings_size += strlen(field_values[field_number].string_value) + 1;
+    }
+  }
+  if(batch->num_records == RECORDS_PER_BATCH ||
+     batch->strings.size - batch->strings.used < strings_size) {
+    insert_records(batch);
+    batch->num_records = 0;
+    batch->strings.used = 0;
+  }
+
+  /* Add the record to the batch, copying its strings, which the caller
+     may keep only until it adds the next record */
+  record = batch->num_records++;
+  batch->fields_present[record] = fields_present;
+  memcpy(batch->field_values[record],
+         field_values,
+         gtfs_file_spec->num_fields * sizeof(gtfs_field_value_t));
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    field_value = &batch->field_values[record][field_number];
+    if(stored_field_type(gtfs_file_spec->field_specs[field_number]) ==
+       TYPE_STRING &&
+       (fields_present & (1 << field_number))) {
+      field_value->string_value =
+        copy_string(&batch->strings,
+                    field_value->string_value,
+                    strlen(field_value->string_value));
+    }
+  }
+}
+
+/* Inserts the records of a clustered table in key order, fetching
+   them from its sorter into a batch of records at a time */
+static void insert_sorted_records(gtfs_load_job_t *job) {
+  gtfs_record_batch_t *batch;
+  gtfs_field_value_t field_values[MAX_COLUMNS];
+  unsigned int fields_present;
+  gint64 start_time = g_get_monotonic_time();
+
+  batch = new_record_batch(job);
+  while(gtfs_sorter_next(job->sorter, &fields_present, field_values)) {
+    add_stored_record(batch, fields_present, field_values);
+  }
+
+  if(batch->num_records > 0) {
+    insert_records(batch);
+  }
+  g_free(batch);
+
+  job->stats.write_time += seconds_since(start_time);
+}
+
+/* Completes a file's table: inserts the records of a clustered table,
+   now they can be sorted, removes the existing records the file no
+   longer contains when updating, commits the records written, frees
+   the INSERT statements and completes the indices on the table;
+   returns FALSE if the records of a clustered table could not be
+   sorted. For "shapes.txt", the last shape is encoded and the shapes'
+   own table completed instead, its counts becoming the file's */
+static bool sqlite_sink_end_table(gtfs_load_job_t *job, bool load_error) {
+  gtfs_load_job_t *shapes_job = job->shapes_job;
+  bool result = true;
+  gint64 start_time;
+
+  if(shapes_job) {
+    if(!load_error) {
+      start_time = g_get_monotonic_time();
+      queue_encoded_shape(job);
+      flush_encoded_shapes(job);
+      job->stats.write_time += seconds_since(start_time);
+    }
+    result = sqlite_sink_end_table(shapes_job, load_error);
+
+    job->objects_loaded = shapes_job->objects_loaded;
+    job->update = shapes_job->update;
+    job->objects_updated = shapes_job->objects_updated;
+    job->objects_deleted = shapes_job->objects_deleted;
+    job->objects_unchanged = shapes_job->objects_unchanged;
+    move_load_stats(&job->stats, &shapes_job->stats);
+
+    gtfs_shape_encoder_free(job->shape_encoder);
+    g_free(job->shapes_batch);
+    g_ptr_array_free(job->shape_strings, TRUE);
+    g_hash_table_destroy(job->scattered_shape_ids);
+    g_free(shapes_job);
+    job->shape_encoder = NULL;
+    job->shapes_batch = NULL;
+    job->shape_strings = NULL;
+    job->scattered_shape_ids = NULL;
+    job->shapes_job = NULL;
+
+    return result;
+  }
+
+  if(job->sorter) {
+    if(!load_error) {
+      insert_sorted_records(job);
+    }
+    result = gtfs_sorter_free(job->sorter);
+    job->sorter = NULL;
+  }
+
+  if(job->update) {
+    finish_existing_records(output_db, job, load_error);
+  }
+
+  if(transaction_open) {
+    end_transaction();
+  }
+
+  if(finalize_insert_stmts(job) != SQLITE_OK) {
+    fprintf(stderr,
+            "sqlite_sink_end_table: "
+            "Error finalizing INSERT statement: %s\n",
+            sqlite3_errmsg(output_db));
+  }
+
+  /* Complete the indices on the table, deferring those not built as
+     its records were inserted */
+  finish_indices(job);
+
+  return result;
+}
+
+/* Reads a field's value, as it is stored in the database, from a
+   column of the current row of a query; returns FALSE if the column
+   is NULL. A string value remains valid only until the query is
+   stepped again */
+static bool column_field_value(sqlite3_stmt *select_stmt,
+                               int column,
+                               const gtfs_field_spec_t *field_spec,
+                               gtfs_field_value_t *field_value) {
+  if(sqlite3_column_type(select_stmt, column) == SQLITE_NULL) {
+    return false;
+  }
+
+  switch(stored_field_type(field_spec)) {
+  case TYPE_BOOLEAN:
+    field_value->boolean_value =
+      *sqlite3_column_text(select_stmt, column) == 't';
+    break;
+
+  case TYPE_INTEGER:
+    field_value->integer_value = sqlite3_column_int(select_stmt, column);
+    break;
+
+  case TYPE_DOUBLE:
+    field_value->double_value = sqlite3_column_double(select_stmt, column);
+    break;
+
+  case TYPE_STRING:
+    field_value->string_value =
+      (char *)sqlite3_column_text(select_stmt, column);
+    break;
+
+  case TYPE_DATE:
+    g_strlcpy(field_value->date_value,
+              (const char *)sqlite3_column_text(select_stmt, column),
+              sizeof(field_value->date_value));
+    break;
+
+  case TYPE_TIME:
+    field_value->time_value = sqlite3_column_int(select_stmt, column);
+    break;
+
+  default:
+    /* Unrecognized field type; this should never be reached */
+    assert(false);
+  }
+
+  return true;
+}
+
+/* Adds a departure found to the sorter of the departures table */
+static void add_departure(const gtfs_departure_t *departure, void *data) {
+  gtfs_departure_search_t *search = data;
+  gtfs_field_value_t field_values[MAX_COLUMNS];
+  unsigned int fields_present;
+
+  fields_present = (1 << departures_file_spec.num_fields) - 1;
+  field_values[DEPARTURE_STOP_ID] = departure->stop_id;
+  memcpy(field_values[DEPARTURE_DATE].date_value,
+         search->dates[departure->day - departures_first_day],
+         sizeof(field_values[DEPARTURE_DATE].date_value));
+  field_values[DEPARTURE_TIME].time_value = departure->departure_time;
+  field_values[DEPARTURE_TRIP_ID] = departure->trip_id;
+  field_values[DEPARTURE_STOP_SEQUENCE].integer_value =
+    departure->stop_sequence;
+  field_values[DEPARTURE_ROUTE_ID] = departure->route_id;
+  if(departure->headsign) {
+    field_values[DEPARTURE_HEADSIGN].string_value =
+      (char *)departure->headsign;
+  }
+  else {
+    fields_present &= ~(1 << DEPARTURE_HEADSIGN);
+  }
+
+  gtfs_sorter_add(search->job->sorter, fields_present, field_values);
+}
+
+/* Builds the departures table, replacing any built before: finds the
+   departures within the table's window from the stop times in the
+   database, then sorts them by key and inserts them in that order */
+static void build_departures(sqlite3 *db,
+                             const gtfs_service_days_t *service_days) {
+  const gtfs_file_spec_t *gtfs_file_spec = &departures_file_spec;
+  gtfs_load_job_t job;
+  gtfs_departure_search_t search;
+  char *errmsg;
+  GTimer *departures_timer;
+  bool result;
+
+  printf("Building departures: ");
+  fflush(stdout);
+  departures_timer = g_timer_new();
+
+  memset(&job, 0, sizeof(job));
+  job.gtfs_file_spec = gtfs_file_spec;
+
+  if(sqlite3_exec(db,
+                  "DROP TABLE IF EXISTS departures",
+                  NULL,
+                  NULL,
+                  &errmsg) != SQLITE_OK ||
+     create_table(db, gtfs_file_spec, &errmsg) != SQLITE_OK) {
+    puts("");
+    fprintf(stderr,
+            "build_departures: "
+            "Error creating database table: %s\n",
+            errmsg);
+    sqlite3_free(errmsg);
+    g_timer_destroy(departures_timer);
+    return;
+  }
+  if(prepare_insert_stmts(db, &job) != SQLITE_OK) {
+    puts("");
+    fprintf(stderr,
+            "build_departures: "
+            "Error preparing INSERT statement: %s\n",
+            sqlite3_errmsg(db));
+    g_timer_destroy(departures_timer);
+    return;
+  }
+  job.sorter = new_key_sorter(gtfs_file_spec);
+
+  /* Expand the stop times into departures; once trips run at regular
+     intervals are expanded, their runs depart in their place */
+  search.job = &job;
+  search.dates = g_malloc(departure_days * sizeof(*search.dates));
+  for(unsigned int day = 0; day < departure_days; day++) {
+    gtfs_date_from_day(departures_first_day + day, search.dates[day]);
+  }
+
+  result = gtfs_find_departures(db,
+                                service_days,
+                                departures_first_day,
+                                departure_days,
+                                compact_ids,
+                                expand_frequencies,
+                                add_departure,
+                                &search,
+                                &errmsg);
+  if(!result) {
+    fprintf(stderr,
+            "build_departures: "
+            "Error finding departures: %s\n",
+            errmsg);
+    g_free(errmsg);
+  }
+  g_free(search.dates);
+
+  if(result) {
+    insert_sorted_records(&job);
+  }
+  if(!gtfs_sorter_free(job.sorter)) {
+    result = false;
+  }
+
+  if(transaction_open) {
+    end_transaction();
+  }
+  if(finalize_insert_stmts(&job) != SQLITE_OK) {
+    fprintf(stderr,
+            "build_departures: "
+            "Error finalizing INSERT statement: %s\n",
+            sqlite3_errmsg(db));
+  }
+
+  g_timer_stop(departures_timer);
+  record_derived_table_stats("departures",
+                             g_timer_elapsed(departures_timer, NULL));
+
+  if(result) {
+    report_objects_loaded(gtfs_file_spec,
+                          job.objects_loaded,
+                          g_timer_elapsed(departures_timer, NULL));
+    puts("");
+  }
+  else {
+    puts("");
+    fprintf(stderr,
+            "build_departures: "
+            "Error building departures table\n");
+  }
+  g_timer_destroy(departures_timer);
+}
+
+/* Names each trip run at regular intervals after its GTFS identifier,
+   found in the trips' dictionary, when identifiers are interned */
+static void name_frequent_trips(gtfs_frequencies_t *frequencies) {
+  GHashTableIter iter;
+  gpointer gtfs_id, id;
+  char id_str[16];
+
+  g_hash_table_iter_init(&iter, id_dictionaries[ID_SPACE_TRIP].ids);
+  while(g_hash_table_iter_next(&iter, &gtfs_id, &id)) {
+    g_snprintf(id_str, sizeof(id_str), "%u", GPOINTER_TO_UINT(id));
+    gtfs_frequencies_set_trip_name(frequencies, id_str, gtfs_id);
+  }
+}
+
+/* Reads a record from the current row of a query whose columns hold
+   the fields of a table in order, copying its strings into "strings";
+   returns a bitmask of the fields present */
+static unsigned int read_stored_record(sqlite3_stmt *select_stmt,
+                                       const gtfs_file_spec_t
+                                       *gtfs_file_spec,
+                                       GStringChunk *strings,
+                                       gtfs_field_value_t *field_values) {
+  const gtfs_field_spec_t *field_spec;
+  unsigned int result = 0;
+
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    field_spec = gtfs_file_spec->field_specs[field_number];
+    if(column_field_value(select_stmt,
+                          field_number,
+                          field_spec,
+                          &field_values[field_number])) {
+      result |= 1 << field_number;
+      if(stored_field_type(field_spec) == TYPE_STRING) {
+        field_values[field_number].string_value =
+          g_string_chunk_insert(strings,
+                                field_values[field_number].string_value);
+      }
+    }
+  }
+
+  return result;
+}
+
+/* Adds a trip and its stop times for a run of a trip run at regular
+   intervals, copying them from the trip's template: the run's stop
+   times are offset from the trip's by the difference between the time
+   the run starts and the trip's first departure */
+static void add_trip_run(const gtfs_trip_run_t *run, void *data) {
+  gtfs_trip_template_t *template = data;
+  const gtfs_stored_record_t *stop_time;
+  gtfs_field_value_t field_values[MAX_COLUMNS];
+  gtfs_field_value_t run_id;
+  int offset;
+
+  if(compact_ids) {
+    run_id.integer_value = intern_id(&id_dictionaries[ID_SPACE_TRIP],
+                                     run->id);
+  }
+  else {
+    run_id.string_value = (char *)run->id;
+  }
+
+  memcpy(field_values,
+         template->trip_values,
+         sizeof(template->trip_values));
+  field_values[TRIP_ID] = run_id;
+  add_stored_record(template->trips_batch,
+                    template->trip_fields_present,
+                    field_values);
+
+  offset = run->start_time - template->first_time;
+  for(unsigned int stop = 0; stop < template->stop_times->len; stop++) {
+    stop_time = &g_array_index(template->stop_times,
+                               gtfs_stored_record_t,
+                               stop);
+    memcpy(field_values,
+           stop_time->field_values,
+           sizeof(stop_time->field_values));
+    field_values[STOP_TIME_TRIP_ID] = run_id;
+    if(stop_time->fields_present & (1 << STOP_TIME_ARRIVAL_TIME)) {
+      field_values[STOP_TIME_ARRIVAL_TIME].time_value += offset;
+    }
+    if(stop_time->fields_present & (1 << STOP_TIME_DEPARTURE_TIME)) {
+      field_values[STOP_TIME_DEPARTURE_TIME].time_value += offset;
+    }
+    add_stored_record(template->stop_times_batch,
+                      stop_time->fields_present,
+                      field_values);
+  }
+}
+
+/* Adds a trip and its stop times for each run of a trip run at regular
+   intervals, given its ID as text, taking its record in the trips
+   table and its stop times, in sequence order, as a template */
+static void add_trip_runs(sqlite3_stmt *trip_select_stmt,
+                          const gtfs_frequencies_t *frequencies,
+                          const char *trip_id,
+                          GArray *stop_times,
+                          GStringChunk *strings,
+                          gtfs_record_batch_t *trips_batch,
+                          gtfs_record_batch_t *stop_times_batch) {
+  const gtfs_stored_record_t *first_stop_time =
+    &g_array_index(stop_times, gtfs_stored_record_t, 0);
+  gtfs_trip_template_t template;
+
+  /* Read the trip's own record */
+  bind_field_value(trip_select_stmt,
+                   1,
+                   trips_file_spec.field_specs[TRIP_ID],
+                   &first_stop_time->field_values[STOP_TIME_TRIP_ID]);
+  if(sqlite3_step(trip_select_stmt) != SQLITE_ROW) {
+    fprintf(stderr,
+            "add_trip_runs: "
+            "Trip \"%s\" is not in table \"trips\"\n",
+            gtfs_frequencies_trip_name(frequencies, trip_id));
+    sqlite3_reset(trip_select_stmt);
+    return;
+  }
+  template.trip_fields_present = read_stored_record(trip_select_stmt,
+                                                    &trips_file_spec,
+                                                    strings,
+                                                    template.trip_values);
+  sqlite3_reset(trip_select_stmt);
+
+  /* The runs are timed from the trip's first departure */
+  if(first_stop_time->fields_present & (1 << STOP_TIME_DEPARTURE_TIME)) {
+    template.first_time =
+      first_stop_time->field_values[STOP_TIME_DEPARTURE_TIME].time_value;
+  }
+  else if(first_stop_time->fields_present &
+          (1 << STOP_TIME_ARRIVAL_TIME)) {
+    template.first_time =
+      first_stop_time->field_values[STOP_TIME_ARRIVAL_TIME].time_value;
+  }
+  else {
+    fprintf(stderr,
+            "add_trip_runs: "
+            "First stop time of trip \"%s\" has no time\n",
+            gtfs_frequencies_trip_name(frequencies, trip_id));
+    return;
+  }
+
+  template.stop_times = stop_times;
+  template.trips_batch = trips_batch;
+  template.stop_times_batch = stop_times_batch;
+  gtfs_frequencies_runs(frequencies, trip_id, add_trip_run, &template);
+}
+
+/* Adds the runs of each trip in the frequencies table, reading the
+   trips' stop times in a single query, ordered by trip, and holding
+   only one trip's at a time; returns TRUE on success */
+static bool add_frequent_trip_runs(sqlite3 *db,
+                                   const gtfs_frequencies_t *frequencies,
+                                   gtfs_record_batch_t *trips_batch,
+                                   gtfs_record_batch_t *stop_times_batch) {
+  bool result = true;
+  gchar **column_names;
+  char *columns_str, *stmt_str;
+  sqlite3_stmt *trip_select_stmt, *select_stmt;
+  GArray *stop_times;
+  GStringChunk *strings;
+  gtfs_stored_record_t *stop_time;
+  const char *trip_id;
+  char *current_trip_id = NULL;
+  int sqlite_result;
+
+  column_names = table_column_names(&trips_file_spec);
+  columns_str = g_strjoinv(", ", column_names);
+  stmt_str = g_strdup_printf("SELECT %s FROM trips WHERE %s = ?",
+                             columns_str,
+                             column_names[TRIP_ID]);
+  if(sqlite3_prepare_v2(db, stmt_str, -1, &trip_select_stmt, NULL) !=
+     SQLITE_OK) {
+    fprintf(stderr,
+            "add_frequent_trip_runs: "
+            "Error reading table \"trips\": %s\n",
+            sqlite3_errmsg(db));
+    result = false;
+  }
+  g_free(stmt_str);
+  g_free(columns_str);
+  g_strfreev(column_names);
+  if(!result) {
+    return false;
+  }
+
+  column_names = table_column_names(&stop_times_file_spec);
+  columns_str = g_strjoinv(", ", column_names);
+  stmt_str = g_strdup_printf("SELECT %s FROM stop_times "
+                             "WHERE trip_id IN "
+                             "(SELECT trip_id FROM frequencies) "
+                             "ORDER BY trip_id, stop_sequence",
+                             columns_str);
+  if(sqlite3_prepare_v2(db, stmt_str, -1, &select_stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr,
+            "add_frequent_trip_runs: "
+            "Error reading table \"stop_times\": %s\n",
+            sqlite3_errmsg(db));
+    result = false;
+  }
+  g_free(stmt_str);
+  g_free(columns_str);
+  g_strfreev(column_names);
+  if(!result) {
+    sqlite3_finalize(trip_select_stmt);
+    return false;
+  }
+
+  stop_times = g_array_new(FALSE, FALSE, sizeof(gtfs_stored_record_t));
+  strings = g_string_chunk_new(4096);
+
+  /* Collect each trip's stop times, adding its runs once the first
+     stop time of the next trip is read */
+  do {
+    sqlite_result = sqlite3_step(select_stmt);
+    trip_id = sqlite_result == SQLITE_ROW?
+      (const char *)sqlite3_column_text(select_stmt, STOP_TIME_TRIP_ID):
+      NULL;
+
+    if(current_trip_id &&
+       (trip_id == NULL || strcmp(trip_id, current_trip_id))) {
+      add_trip_runs(trip_select_stmt,
+                    frequencies,
+                    current_trip_id,
+                    stop_times,
+                    strings,
+                    trips_batch,
+                    stop_times_batch);
+      g_array_set_size(stop_times, 0);
+      g_string_chunk_clear(strings);
+      g_free(current_trip_id);
+      current_trip_id = NULL;
+    }
+
+    if(trip_id) {
+      if(current_trip_id == NULL) {
+        current_trip_id = g_strdup(trip_id);
+      }
+      g_array_set_size(stop_times, stop_times->len + 1);
+      stop_time = &g_array_index(stop_times,
+                                 gtfs_stored_record_t,
+                                 stop_times->len - 1);
+      stop_time->fields_present =
+        read_stored_record(select_stmt,
+                           &stop_times_file_spec,
+                           strings,
+                           stop_time->field_values);
+    }
+  } while(sqlite_result == SQLITE_ROW);
+  if(sqlite_result != SQLITE_DONE) {
+    fprintf(stderr,
+            "add_frequent_trip_runs: "
+            "Error reading table \"stop_times\": %s\n",
+            sqlite3_errmsg(db));
+    result = false;
+  }
+
+  g_string_chunk_free(strings);
+  g_array_free(stop_times, TRUE);
+  sqlite3_finalize(select_stmt);
+  sqlite3_finalize(trip_select_stmt);
+
+  return result;
+}
+
+/* Expands each trip in the frequencies table into a trip and stop
+   times for each of its runs, inserted into the trips and stop_times
+   tables through their batched INSERT statements alongside the records
+   loaded from the bundle; the trip itself is left as it was loaded */
+static void expand_frequent_trips(sqlite3 *db) {
+  gtfs_load_job_t trips_job, stop_times_job;
+  gtfs_record_batch_t *trips_batch, *stop_times_batch;
+  gtfs_frequencies_t *frequencies;
+  char *errmsg;
+  GTimer *frequencies_timer;
+  bool result;
+
+  /* A bundle without "frequencies.txt" has no trips to expand */
+  if(!gtfs_sqlite_table_exists(db, "frequencies")) {
+    return;
+  }
+
+  printf("Expanding frequencies: ");
+  fflush(stdout);
+  frequencies_timer = g_timer_new();
+
+  memset(&trips_job, 0, sizeof(trips_job));
+  trips_job.gtfs_file_spec = &trips_file_spec;
+  memset(&stop_times_job, 0, sizeof(stop_times_job));
+  stop_times_job.gtfs_file_spec = &stop_times_file_spec;
+  if(prepare_insert_stmts(db, &trips_job) != SQLITE_OK ||
+     prepare_insert_stmts(db, &stop_times_job) != SQLITE_OK) {
+    puts("");
+    fprintf(stderr,
+            "expand_frequent_trips: "
+            "Error preparing INSERT statement: %s\n",
+            sqlite3_errmsg(db));
+    finalize_insert_stmts(&trips_job);
+    finalize_insert_stmts(&stop_times_job);
+    g_timer_destroy(frequencies_timer);
+    return;
+  }
+  trips_batch = new_record_batch(&trips_job);
+  stop_times_batch = new_record_batch(&stop_times_job);
+
+  if((frequencies = gtfs_frequencies_read(db, &errmsg)) == NULL) {
+    fprintf(stderr,
+            "expand_frequent_trips: "
+            "Error reading table \"frequencies\": %s\n",
+            errmsg);
+    g_free(errmsg);
+    result = false;
+  }
+  else {
+    if(compact_ids) {
+      name_frequent_trips(frequencies);
+    }
+    result = add_frequent_trip_runs(db,
+                                    frequencies,
+                                    trips_batch,
+                                    stop_times_batch);
+    gtfs_frequencies_free(frequencies);
+  }
+
+  /* Insert the records remaining in each batch */
+  if(trips_batch->num_records > 0) {
+    insert_records(trips_batch);
+  }
+  if(stop_times_batch->num_records > 0) {
+    insert_records(stop_times_batch);
+  }
+  g_free(stop_times_batch);
+  g_free(trips_batch);
+
+  if(transaction_open) {
+    end_transaction();
+  }
+  if(finalize_insert_stmts(&trips_job) != SQLITE_OK ||
+     finalize_insert_stmts(&stop_times_job) != SQLITE_OK) {
+    fprintf(stderr,
+            "expand_frequent_trips: "
+            "Error finalizing INSERT statement: %s\n",
+            sqlite3_errmsg(db));
+  }
+
+  g_timer_stop(frequencies_timer);
+  record_derived_table_stats("frequencies",
+                             g_timer_elapsed(frequencies_timer, NULL));
+
+  if(result) {
+    printf("%lu trips and %lu stop times added in %.2f seconds\n",
+           trips_job.objects_loaded,
+           stop_times_job.objects_loaded,
+           g_timer_elapsed(frequencies_timer, NULL));
+  }
+  else {
+    puts("");
+    fprintf(stderr,
+            "expand_frequent_trips: "
+            "Error expanding frequencies\n");
+  }
+  g_timer_destroy(frequencies_timer);
+}
+
+/* Expands the service calendars into the days each service runs,
+   storing these in the service_days table if it was requested; returns
+   NULL on error */
+static gtfs_service_days_t *expand_service_days(sqlite3 *db) {
+  gtfs_service_days_t *service_days;
+  char *errmsg;
+  GTimer *service_days_timer;
+
+  printf("Expanding service calendars: ");
+  fflush(stdout);
+  service_days_timer = g_timer_new();
+
+  if((service_days = gtfs_service_days_expand(db, &errmsg)) == NULL ||
+     (store_service_days &&
+      !gtfs_service_days_write(service_days, db, &errmsg))) {
+    puts("");
+    fprintf(stderr,
+            "expand_service_days: "
+            "Error expanding service calendars: %s\n",
+            errmsg);
+    g_free(errmsg);
+    if(service_days) {
+      gtfs_service_days_free(service_days);
+      service_days = NULL;
+    }
+  }
+  else {
+    printf("%u services expanded in %.2f seconds\n",
+           gtfs_service_days_num_services(service_days),
+           g_timer_elapsed(service_days_timer, NULL));
+    record_derived_table_stats("service_days",
+                               g_timer_elapsed(service_days_timer, NULL));
+  }
+  g_timer_destroy(service_days_timer);
+
+  return service_days;
+}
+
+/* Builds the spatial index over the stops in the stops_rtree table */
+static void build_stop_index(sqlite3 *db) {
+  unsigned int num_stops;
+  char *errmsg;
+  GTimer *stop_index_timer;
+
+  printf("Indexing stops: ");
+  fflush(stdout);
+  stop_index_timer = g_timer_new();
+
+  if(!gtfs_stop_index_build(db, &num_stops, &errmsg)) {
+    puts("");
+    fprintf(stderr,
+            "build_stop_index: "
+            "Error indexing stops: %s\n",
+            errmsg);
+    g_free(errmsg);
+  }
+  else {
+    printf("%u stops indexed in %.2f seconds\n",
+           num_stops,
+           g_timer_elapsed(stop_index_timer, NULL));
+    record_derived_table_stats("stops_rtree",
+                               g_timer_elapsed(stop_index_timer, NULL));
+  }
+  g_timer_destroy(stop_index_timer);
+}
+
+/* Adds a transfer on foot between two stops to the sorter of the
+   walking_transfers table */
+static void add_walking_transfer(const gtfs_field_value_t *from_stop_id,
+                                 const gtfs_field_value_t *to_stop_id,
+                                 double distance,
+                                 void *data) {
+  gtfs_load_job_t *job = data;
+  gtfs_field_value_t field_values[MAX_COLUMNS];
+
+  field_values[WALKING_TRANSFER_FROM_STOP_ID] = *from_stop_id;
+  field_values[WALKING_TRANSFER_TO_STOP_ID] = *to_stop_id;
+  field_values[WALKING_TRANSFER_DISTANCE].double_value = distance;
+  field_values[WALKING_TRANSFER_MIN_TRANSFER_TIME].integer_value =
+    (int)ceil(distance / WALKING_SPEED);
+  gtfs_sorter_add(job->sorter,
+                  (1 << walking_transfers_file_spec.num_fields) - 1,
+                  field_values);
+}
+
+/* Builds the walking_transfers table, replacing any built before:
+   finds each pair of stops in the database within walking distance of
+   each other, then sorts the transfers by key and inserts them in that
+   order */
+static void build_walking_transfers(sqlite3 *db) {
+  const gtfs_file_spec_t *gtfs_file_spec = &walking_transfers_file_spec;
+  gtfs_load_job_t job;
+  char *errmsg;
+  GTimer *walking_transfers_timer;
+  bool result;
+
+  printf("Finding walking transfers: ");
+  fflush(stdout);
+  walking_transfers_timer = g_timer_new();
+
+  memset(&job, 0, sizeof(job));
+  job.gtfs_file_spec = gtfs_file_spec;
+
+  if(sqlite3_exec(db,
+                  "DROP TABLE IF EXISTS walking_transfers",
+                  NULL,
+                  NULL,
+                  &errmsg) != SQLITE_OK ||
+     create_table(db, gtfs_file_spec, &errmsg) != SQLITE_OK) {
+    puts("");
+    fprintf(stderr,
+            "build_walking_transfers: "
+            "Error creating database table: %s\n",
+            errmsg);
+    sqlite3_free(errmsg);
+    g_timer_destroy(walking_transfers_timer);
+    return;
+  }
+  if(prepare_insert_stmts(db, &job) != SQLITE_OK) {
+    puts("");
+    fprintf(stderr,
+            "build_walking_transfers: "
+            "Error preparing INSERT statement: %s\n",
+            sqlite3_errmsg(db));
+    g_timer_destroy(walking_transfers_timer);
+    return;
+  }
+  job.sorter = new_key_sorter(gtfs_file_spec);
+
+  result = gtfs_find_walking_transfers(db,
+                                       walking_transfer_distance,
+                                       compact_ids,
+                                       add_walking_transfer,
+                                       &job,
+                                       &errmsg);
+  if(!result) {
+    fprintf(stderr,
+            "build_walking_transfers: "
+            "Error finding walking transfers: %s\n",
+            errmsg);
+    g_free(errmsg);
+  }
+
+  if(result) {
+    insert_sorted_records(&job);
+  }
+  if(!gtfs_sorter_free(job.sorter)) {
+    result = false;
+  }
+
+  if(transaction_open) {
+    end_transaction();
+  }
+  if(finalize_insert_stmts(&job) != SQLITE_OK) {
+    fprintf(stderr,
+            "build_walking_transfers: "
+            "Error finalizing INSERT statement: %s\n",
+            sqlite3_errmsg(db));
+  }
+
+  g_timer_stop(walking_transfers_timer);
+  record_derived_table_stats("walking_transfers",
+                             g_timer_elapsed(walking_transfers_timer, NULL));
+
+  if(result) {
+    report_objects_loaded(gtfs_file_spec,
+                          job.objects_loaded,
+                          g_timer_elapsed(walking_transfers_timer, NULL));
+    puts("");
+  }
+  else {
+    puts("");
+    fprintf(stderr,
+            "build_walking_transfers: "
+            "Error building walking_transfers table\n");
+  }
+  g_timer_destroy(walking_transfers_timer);
+}
+
+/* Writes the timetable, laid out for RAPTOR routers, to the file named
+   with "--raptor" */
+static void write_raptor_timetable(sqlite3 *db,
+                                   const gtfs_service_days_t *service_days) {
+  gtfs_raptor_counts_t counts;
+  char *errmsg;
+  GTimer *raptor_timer;
+
+  printf("Writing RAPTOR timetable: ");
+  fflush(stdout);
+  raptor_timer = g_timer_new();
+
+  /* Once trips run at regular intervals are expanded, their runs take
+     their place */
+  if(!gtfs_raptor_write(db,
+                        service_days,
+                        expand_frequencies &&
+                        gtfs_sqlite_table_exists(db, "frequencies"),
+                        raptor_path,
+                        &counts,
+                        &errmsg)) {
+    puts("");
+    fprintf(stderr,
+            "write_raptor_timetable: "
+            "Error writing \"%s\": %s\n",
+            raptor_path,
+            errmsg);
+    g_free(errmsg);
+  }
+  else {
+    printf("%u trips in %u patterns written in %.2f seconds\n",
+           counts.num_trips,
+           counts.num_patterns,
+           g_timer_elapsed(raptor_timer, NULL));
+    if(counts.num_skipped_trips > 0) {
+      fprintf(stderr,
+              "Warning: %u trips without usable stop times were left out "
+              "of the RAPTOR timetable\n",
+              counts.num_skipped_trips);
+    }
+    record_derived_table_stats("raptor",
+                               g_timer_elapsed(raptor_timer, NULL));
+  }
+  g_timer_destroy(raptor_timer);
+}
+
+/* Completes the database once every table is loaded: expands the
+   trips run at regular intervals, if this was requested, before
+   creating the indices deferred until then (which then cover the
+   trips' runs), then builds the spatial index over the stops, the
+   walking_transfers table and the service_days and departures tables
+   and writes the RAPTOR timetable, if these were requested */
+static void sqlite_sink_finish(unsigned int num_threads) {
+  gtfs_service_days_t *service_days;
+
+  if(expand_frequencies) {
+    expand_frequent_trips(output_db);
+  }
+
+  create_deferred_indices(output_db, num_threads);
+
+  if(index_stops) {
+    build_stop_index(output_db);
+  }
+
+  if(walking_transfer_distance > 0) {
+    build_walking_transfers(output_db);
+  }
+
+  if(store_service_days || departure_days > 0 || raptor_path) {
+    if(service_days = expand_service_days(output_db)) {
+      if(departure_days > 0) {
+        build_departures(output_db, service_days);
+      }
+      if(raptor_path) {
+        write_raptor_timetable(output_db, service_days);
+      }
+      gtfs_service_days_free(service_days);
+    }
+  }
+}
+
+/* Closes the database, first restoring SQLite's usual settings after a
+   bulk load so the database is used safely from here on */
+static bool sqlite_sink_close(void) {
+  char *errmsg;
+
+  /* Add the identifiers interned during the load to their lookup
+     tables */
+  if(compact_ids) {
+    write_id_dictionaries(output_db);
+    free_id_dictionaries();
+  }
+
+  if(transaction_open) {
+    end_transaction();
+  }
+
+  /* Free our "BEGIN TRANSACTION" and "END TRANSACTION" statements */
+  assert(sqlite3_finalize(begin_transaction_stmt) == SQLITE_OK);
+  assert(sqlite3_finalize(end_transaction_stmt) == SQLITE_OK);
+  g_timer_destroy(transaction_timer);
+  g_ptr_array_free(deferred_indices, TRUE);
+
+  if(bulk_load_database &&
+     configure_database(output_db,
+                        durable_pragma_strs,
+                        &errmsg) != SQLITE_OK) {
+    fprintf(stderr,
+            "Error restoring database settings: %s\n",
+            errmsg);
+    sqlite3_free(errmsg);
+  }
+
+  assert(sqlite3_close(output_db) == SQLITE_OK);
+
+  return true;
+}
+
+/* Creates the directory at "path" to hold the Arrow files, if it does
+   not already exist */
+static bool arrow_sink_open(const char *path) {
+  if(g_mkdir_with_parents(path, 0777) != 0) {
+    fprintf(stderr,
+            "Error creating directory \"%s\": %s\n",
+            path,
+            g_strerror(errno));
+    return false;
+  }
+
+  output_path = path;
+  return true;
+}
+
+/* Creates the columnar file to which a job's records are written, in
+   the output directory and named after the file's table */
+static bool arrow_sink_begin_table(gtfs_load_job_t *job) {
+  char *name, *filename, *path, *errmsg;
+  gchar **column_names;
+
+  name = table_name(job->gtfs_file_spec);
+  filename = g_strconcat(name, ARROW_FILE_EXTENSION, NULL);
+  path = g_build_filename(output_path, filename, NULL);
+  column_names = table_column_names(job->gtfs_file_spec);
+
+  job->arrow_writer = gtfs_arrow_writer_open(path,
+                                             job->gtfs_file_spec,
+                                             column_names,
+                                             &errmsg);
+  if(job->arrow_writer == NULL) {
+    fprintf(stderr,
+            "Error creating Arrow file \"%s\": %s\n",
+            path,
+            errmsg);
+    g_free(errmsg);
+  }
+
+  g_strfreev(column_names);
+  g_free(path);
+  g_free(filename);
+  g_free(name);
+
+  return job->arrow_writer != NULL;
+}
+
+/* Adds the records in a batch to a job's columnar file, which takes
+   every record, in order, with no transaction, index or existing
+   record to consider */
+static void arrow_sink_write_batch(gtfs_record_batch_t *batch) {
+  gtfs_load_job_t *job = batch->job;
+
+  for(unsigned int record = 0; record < batch->num_records; record++) {
+    gtfs_arrow_writer_append(job->arrow_writer,
+                             batch->fields_present[record],
+                             batch->field_values[record]);
+  }
+  job->objects_loaded += batch->num_records;
+}
+
+/* Completes and closes a job's columnar file, if it has one; returns
+   FALSE if the file could not be written */
+static bool arrow_sink_end_table(gtfs_load_job_t *job, bool load_error) {
+  bool result = true;
+
+  if(job->arrow_writer) {
+    result = gtfs_arrow_writer_close(job->arrow_writer);
+    job->arrow_writer = NULL;
+  }
+
+  return result;
+}
+
+/* Closes the Arrow sink, which has nothing left to do once each of
+   its files has been closed */
+static bool arrow_sink_close(void) {
+  return true;
+}
+
+/* The null sink discards every record, counting them as loaded, so
+   the time spent reading and parsing a bundle can be measured on its
+   own */
+static bool null_sink_open(const char *path) {
+  return true;
+}
+
+static bool null_sink_begin_table(gtfs_load_job_t *job) {
+  return true;
+}
+
+static void null_sink_write_batch(gtfs_record_batch_t *batch) {
+  batch->job->objects_loaded += batch->num_records;
+}
+
+static bool null_sink_end_table(gtfs_load_job_t *job, bool load_error) {
+  return true;
+}
+
+static bool null_sink_close(void) {
+  return true;
+}
+
+/* The output sinks, selected by name with "--output-format" */
+const gtfs_output_sink_t sqlite_sink = {
+  "sqlite",
+  true,
+  sqlite_sink_open,
+  sqlite_sink_begin_table,
+  sqlite_sink_write_batch,
+  sqlite_sink_end_table,
+  sqlite_sink_finish,
+  sqlite_sink_close
+};
+
+const gtfs_output_sink_t arrow_sink = {
+  "arrow",
+  true,
+  arrow_sink_open,
+  arrow_sink_begin_table,
+  arrow_sink_write_batch,
+  arrow_sink_end_table,
+  NULL,
+  arrow_sink_close
+};
+
+const gtfs_output_sink_t null_sink = {
+  "null",
+  false,
+  null_sink_open,
+  null_sink_begin_table,
+  null_sink_write_batch,
+  null_sink_end_table,
+  NULL,
+  null_sink_close
+};
+
+const gtfs_output_sink_t *output_sinks[] = {
+  &sqlite_sink,
+  &arrow_sink,
+  &null_sink,
+  NULL
+};
+
+/* Returns the output sink with the given name, or NULL if there is
+   none */
+static const gtfs_output_sink_t *find_output_sink(const char *name) {
+  for(unsigned int index = 0; output_sinks[index]; index++) {
+    if(strcmp(output_sinks[index]->name, name) == 0) {
+      return output_sinks[index];
+    }
+  }
+
+  return NULL;
+}
+
+/* Writes the records in a batch to the output sink, collecting the
+   statistics the parsing thread sent with it */
+static void write_record_batch(gtfs_record_batch_t *batch) {
+  gtfs_load_job_t *job = batch->job;
+  gint64 start_time = g_get_monotonic_time();
+
+  move_load_stats(&job->stats, &batch->stats);
+
+  output_sink->write_batch(batch);
+
+  job->stats.write_time += seconds_since(start_time);
+  report_progress(job);
+}
+
+/* Returns the record batch currently being filled by a parsing
+   thread, first waiting for an empty batch from the database writer
+   if necessary (or allocating one, if we are its only user) */
+static gtfs_record_batch_t *
+current_record_batch(gtfs_parsing_state_t *parsing_state) {
+  gtfs_record_batch_t *batch = parsing_state->batch;
+
+  if(batch == NULL) {
+    if(parsing_state->file_chunk) {
+      /* A chunk's batches are held until the whole chunk is parsed,
+         and the number of chunks in flight is already bounded, so
+         allocate a new batch rather than wait for one */
+      batch = g_async_queue_try_pop(parsing_state->free_batches);
+      if(batch == NULL) {
+        batch = g_new(gtfs_record_batch_t, 1);
+      }
+      batch->chunk = parsing_state->file_chunk->chunk;
+    }
+    else if(parsing_state->free_batches) {
+      batch = g_async_queue_pop(parsing_state->free_batches);
+      batch->chunk = parsing_state->next_chunk;
+    }
+    else {
+      /* We're loading serially, and will reuse this batch for every
+         record in the file */
+      batch = g_new(gtfs_record_batch_t, 1);
+      batch->chunk = 0;
+    }
+
+    batch->job = parsing_state->job;
+    batch->file_chunk = NULL;
+    batch->next = parsing_state->chunk_batches;
+    batch->end_of_file = false;
+    batch->load_error = false;
+    batch->num_records = 0;
+    memset(&batch->stats, 0, sizeof(batch->stats));
+    batch->strings.data = batch->string_data;
+    batch->strings.size = sizeof(batch->string_data);
+    batch->strings.used = 0;
+
+    parsing_state->batch = batch;
+  }
+
+  return batch;
+}
+
+/* Hands the record batch currently being filled by a parsing thread
+   to the database writer or, if a chunk is being parsed, adds it to
+   the chunk's chain of batches; when loading serially, the batch is
+   instead written immediately and emptied for reuse */
+static void queue_record_batch(gtfs_parsing_state_t *parsing_state) {
+  gtfs_record_batch_t *batch = parsing_state->batch;
+
+  /* Send the statistics gathered since the last batch along with this
+     one */
+  move_load_stats(&batch->stats, &parsing_state->stats);
+
+  if(parsing_state->file_chunk) {
+    parsing_state->chunk_batches = batch;
+    parsing_state->batch = NULL;
+  }
+  else if(parsing_state->filled_batches) {
+    g_async_queue_push(parsing_state->filled_batches, batch);
+    parsing_state->next_chunk++;
+    parsing_state->batch = NULL;
+  }
+  else {
+    write_record_batch(batch);
+    batch->num_records = 0;
+    batch->strings.used = 0;
+  }
+}
+
+/* Prepares to parse the fields of a new record straight into the
+   current record batch, first making sure it has room for the
+   record's strings */
+static void begin_record(gtfs_parsing_state_t *parsing_state) {
+  gtfs_record_batch_t *batch;
+
+  batch = current_record_batch(parsing_state);
+  if(batch->strings.size - batch->strings.used <
+     parsing_state->max_record_strings_size) {
+    queue_record_batch(parsing_state);
+    batch = current_record_batch(parsing_state);
+  }
+
+  parsing_state->record_values = batch->field_values[batch->num_records];
+  parsing_state->strings = &batch->strings;
+}
+
+/* Invoked by the CSV parser each time a field has been parsed */
+static void field_parsed(void *val, size_t len, void *data) {
+  gtfs_parsing_state_t *parsing_state = (gtfs_parsing_state_t *)data;
+  const gtfs_file_spec_t *gtfs_file_spec =
+    parsing_state->gtfs_file_spec;
+
+  if(parsing_state->header_parsed) {
+    /* We've parsed the header already; this field contains real data */
+
+    unsigned int field_number;
+    gtfs_field_spec_t *field_spec;
+    gtfs_field_value_t *field_value;
+    bool value_valid = true;
+
+    if(parsing_state->fields_parsed == 0) {
+      begin_record(parsing_state);
+    }
+
+    field_number =
+      parsing_state->field_for_column[parsing_state->fields_parsed];
     field_spec =
       parsing_state->gtfs_file_spec->field_specs[field_number];
 
-    /* Save this value using our pool of field-value objects */
-    field_value = &parsing_state->field_values[field_number];
+    /* Save this value in the current record */
+    field_value = &parsing_state->record_values[field_number];
+
+    switch(field_spec->type) {
+    case TYPE_BOOLEAN:
+      field_value->boolean_value = (*((char *)val) == '1');
+      break;
+
+    case TYPE_INTEGER:
+      value_valid = parse_integer(val, len, &field_value->integer_value);
+      break;
+
+    case TYPE_DOUBLE:
+      value_valid = parse_double(val, len, &field_value->double_value);
+      break;
+
+    case TYPE_STRING:
+      assert(len <= field_spec->length);
+      assert(*(char *)(val + len) == 0);
+
+      /* For an optional field, we insert a NULL value instead of an
+         empty string to indicate it is not present */
+      if(len == 0 && !field_spec->required) {
+        field_value = NULL;
+      }
+      else {
+        /* Copy the string into our arena, truncated as it would be on
+           insertion */
+        field_value->string_value =
+          copy_string(parsing_state->strings,
+                      (const char *)val,
+                      len > field_spec->length? field_spec->length: len);
+      }
+      break;
+
+    case TYPE_DATE:
+      value_valid = parse_date(val, len, field_value->date_value);
+      break;
+
+    case TYPE_TIME:
+      /* TODO: This may not correctly handle the shift to or from
+         daylight saving time */
+      value_valid = parse_time(val, len, &field_value->time_value);
+      break;
+
+    default:
+      /* Unrecognized field type; this should never be reached */
+      assert(false);
+    }
+
+    if(len == 0 && field_spec->type != TYPE_STRING &&
+       field_spec->type != TYPE_BOOLEAN) {
+      /* An empty value is inserted as NULL (for instance, the arrival
+         and departure times of untimed stop times) */
+      field_value = NULL;
+    }
+    else if(!value_valid) {
+      fprintf(stderr,
+              "field_parsed: "
+              "Invalid value \"%s\" for field \"%s\"\n",
+              (char *)val,
+              field_spec->name);
+      field_value = NULL;
+    }
+
+    /* Mark this field as present, unless it was found to be empty */
+    if(field_value) {
+      parsing_state->fields_present |= 1 << field_number;
+    }
+  }
+  else {
+    /* We're still parsing the header; use this header field to update
+       our column-number-to-field-number mapping */
+
+    unsigned int field_number = 0;
+    bool field_name_matched = false;
+
+    assert(parsing_state->fields_parsed < MAX_COLUMNS);
+
+    /* Search for this field's number by name */
+    while(!field_name_matched &&
+          field_number < gtfs_file_spec->num_fields) {
+      field_name_matched =
+        (strncmp(gtfs_file_spec->field_specs[field_number++]->name,
+                 val,
+                 len) == 0);
+    }
+
+    /* TODO: Better error-handling. Add fields to the
+       gtfs_parsing_state_t structure to indicate whether an error has
+       occurred, and a description of the error? */
+    assert(field_name_matched);
+
+    /* Add the mapping */
+    parsing_state->field_for_column[parsing_state->fields_parsed] =
+      field_number - 1;
+  }
+
+  /* Another field parsed from the current record */
+  parsing_state->fields_parsed++;
+}
+
+/* Completes the record just parsed into the current record batch,
+   for insertion once the batch is written */
+static void queue_record(gtfs_parsing_state_t *parsing_state) {
+  const gtfs_file_spec_t *gtfs_file_spec = parsing_state->gtfs_file_spec;
+  gtfs_record_batch_t *batch = parsing_state->batch;
+
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    if(!(parsing_state->fields_present & (1 << field_number)) &&
+       gtfs_file_spec->field_specs[field_number]->required) {
+      fprintf(stderr,
+              "record_parsed: "
+              "Field \"%s\" is required but missing\n",
+              gtfs_file_spec->field_specs[field_number]->name);
+    }
+  }
+
+  batch->fields_present[batch->num_records] =
+    parsing_state->fields_present;
+  if(++batch->num_records == RECORDS_PER_BATCH) {
+    queue_record_batch(parsing_state);
+  }
+}
+
+/* Invoked by the CSV parser each time a row has been parsed */
+static void record_parsed(int eor, void *data) {
+  gtfs_parsing_state_t *parsing_state = (gtfs_parsing_state_t *)data;
+
+  if(parsing_state->header_parsed) {
+    /* Add the record to the current batch, to be written with the
+       records around it */
+    queue_record(parsing_state);
+
+    /* Another record parsed */
+    parsing_state->stats.rows_parsed++;
+  }
+  else {
+    /* We've now finished parsing the header---our
+       column-number-to-field-number mapping should be complete */
+    parsing_state->header_parsed = true;
+  }
+
+  /* Reset our parsing state */
+  parsing_state->fields_parsed = 0;
+  parsing_state->fields_present = 0;
+}
+
+/* Returns the most arena storage, in bytes, the string fields of a
+   single record of a GTFS file can occupy */
+static size_t max_record_strings_size(const gtfs_file_spec_t *gtfs_file_spec) {
+  size_t result = 0;
+
+  for(unsigned int field_number = 0;
+      field_number < gtfs_file_spec->num_fields;
+      field_number += 1) {
+    if(gtfs_file_spec->field_specs[field_number]->type == TYPE_STRING) {
+      result += gtfs_file_spec->field_specs[field_number]->length + 1;
+    }
+  }
+
+  return result;
+}
+
+/* Reads data from a GTFS file in the bundle, counting the bytes read
+   and the time taken towards a parsing thread's statistics */
+static ssize_t read_gtfs_member(gtfs_member_t *gtfs_member,
+                                char *buf,
+                                size_t size,
+                                gtfs_load_stats_t *stats) {
+  gint64 start_time = g_get_monotonic_time();
+  ssize_t bytes_read;
+
+  bytes_read = gtfs_member_read(gtfs_member, buf, size);
+  stats->inflate_time += seconds_since(start_time);
+  if(bytes_read > 0) {
+    stats->bytes_inflated += bytes_read;
+  }
+
+  return bytes_read;
+}
+
+/* Returns the next block of data from a GTFS file in the bundle,
+   parsed in place where the file is mapped into memory, counting the
+   bytes and the time taken towards a parsing thread's statistics */
+static ssize_t next_gtfs_member_block(gtfs_member_t *gtfs_member,
+                                      const char **data,
+                                      gtfs_load_stats_t *stats) {
+  gint64 start_time = g_get_monotonic_time();
+  ssize_t bytes_read;
+
+  bytes_read = gtfs_member_next_block(gtfs_member, data);
+  stats->inflate_time += seconds_since(start_time);
+  if(bytes_read > 0) {
+    stats->bytes_inflated += bytes_read;
+  }
+
+  return bytes_read;
+}
+
+/* Reads and parses a GTFS file from the bundle, invoking our callback
+   functions for each field and record; returns TRUE on success */
+static bool parse_gtfs_member(gtfs_member_t *gtfs_member,
+                              gtfs_csv_parser_t *csv,
+                              gtfs_parsing_state_t *parsing_state) {
+  gtfs_load_job_t *job = parsing_state->job;
+  const char *buf;
+  ssize_t bytes_read;
+  bool parsing_error = false;
+  bool serial = parsing_state->filled_batches == NULL;
+  gint64 start_time;
+  double write_time = 0;
+
+  /* When loading serially, records are written from within the CSV
+     parser's callbacks; that time is counted as writing, not
+     parsing */
+  if(serial) {
+    write_time = job->stats.write_time;
+  }
+
+  bytes_read = next_gtfs_member_block(gtfs_member,
+                                      &buf,
+                                      &parsing_state->stats);
+  start_time = g_get_monotonic_time();
+  while(bytes_read > 0 && !parsing_error) {
+    /* Parse this data, invoking our callback functions as each field
+       or record is parsed */
+    parsing_error =
+      gtfs_csv_parse(csv,
+                     buf,
+                     bytes_read,
+                     field_parsed,
+                     record_parsed,
+                     parsing_state)
+      != bytes_read;
+    parsing_state->stats.bytes_tokenized += bytes_read;
+
+    if(parsing_error) {
+      fprintf(stderr,
+              "load_gtfs_file: "
+              "Error parsing CSV data: %s\n",
+              gtfs_csv_strerror(csv));
+    }
+    else {
+      parsing_state->stats.parse_time += seconds_since(start_time);
+      bytes_read = next_gtfs_member_block(gtfs_member,
+                                          &buf,
+                                          &parsing_state->stats);
+      start_time = g_get_monotonic_time();
+    }
+  }
+
+  if(bytes_read < 0) {
+    fprintf(stderr,
+            "load_gtfs_file: "
+            "Error reading bundle file \"%s\"\n",
+            job->gtfs_file_spec->filename);
+    parsing_error = true;
+  }
+
+  /* Finalize the CSV parser, which passes on any final record not
+     terminated by a newline */
+  if(gtfs_csv_fini(csv,
+                   field_parsed,
+                   record_parsed,
+                   parsing_state) != 0) {
+    fprintf(stderr,
+            "load_gtfs_file: "
+            "Error parsing CSV data: %s\n",
+            gtfs_csv_strerror(csv));
+    parsing_error = true;
+  }
+  parsing_state->stats.parse_time += seconds_since(start_time);
+  if(serial) {
+    parsing_state->stats.parse_time -= job->stats.write_time - write_time;
+  }
+
+  return !parsing_error;
+}
+
+/* Loads a GTFS file (that is, a file contained within a GTFS bundle)
+   according to the provided GTFS-file specifier, leaving the counts
+   of objects written in "job" */
+long load_gtfs_file(const gtfs_file_spec_t *gtfs_file_spec,
+                    gtfs_bundle_t *gtfs_bundle,
+                    gtfs_csv_parser_t *csv,
+                    gtfs_load_job_t *job) {
+  long result = -1;
+  gtfs_member_t *gtfs_member;
+  char *errmsg;
+  gtfs_parsing_state_t parsing_state;
+  bool parsed;
+
+  /* Open the file within the GTFS bundle---note this should always
+     succeed as the main routine has validated the bundle contains the
+     needed files */
+  if(gtfs_member = gtfs_member_open(gtfs_bundle,
+                                    gtfs_file_spec->filename,
+                                    &errmsg)) {
+    /* Prepare the output sink for the file's records (creating, or
+       preparing to update, the corresponding table in the database) */
+    memset(job, 0, sizeof(*job));
+    job->gtfs_file_spec = gtfs_file_spec;
+    if(output_sink->begin_table(job)) {
+      /* We're just about ready to parse---reset our parsing state */
+      memset(&parsing_state, 0, sizeof(parsing_state));
+      parsing_state.gtfs_file_spec = gtfs_file_spec;
+      parsing_state.job = job;
+      parsing_state.max_record_strings_size =
+        max_record_strings_size(gtfs_file_spec);
+
+      /* Now parse the CSV file, then write the records remaining in
+         the final batch */
+      parsed = parse_gtfs_member(gtfs_member, csv, &parsing_state);
+      if(parsing_state.batch) {
+        queue_record_batch(&parsing_state);
+        g_free(parsing_state.batch);
+        parsing_state.batch = NULL;
+      }
+      move_load_stats(&job->stats, &parsing_state.stats);
+
+      /* Complete the file's table (removing the existing records the
+         file no longer contains, when updating the database) and
+         return the number of objects loaded to our caller */
+      if(output_sink->end_table(job, !parsed)) {
+        result = job->objects_loaded;
+      }
+    }
+    else {
+      output_sink->end_table(job, true);
+    }
+
+    /* All done---close the GTFS member file */
+    gtfs_member_close(gtfs_member);
+  }
+  else {
+    fprintf(stderr,
+            "Error opening bundle file \"%s\": %s\n",
+            gtfs_file_spec->filename,
+            errmsg);
+    g_free(errmsg);
+  }
+
+  /* Return the number of objects loaded, or -1 on error */
+  return result;
+}
+
+/* Prints the number of existing objects updated, deleted and left
+   unchanged by a job that updated its table */
+static void report_objects_updated(const gtfs_load_job_t *job) {
+  if(job->update) {
+    printf("; %lu updated, %lu deleted, %lu unchanged",
+           job->objects_updated,
+           job->objects_deleted,
+           job->objects_unchanged);
+  }
+}
+
+/* Initializes the parsing state for a file (or chunk of a file) to be
+   parsed as part of a parallel load */
+static void init_parallel_parsing_state(gtfs_parsing_state_t *parsing_state,
+                                        gtfs_load_job_t *job,
+                                        gtfs_parallel_load_t *parallel_load) {
+  memset(parsing_state, 0, sizeof(*parsing_state));
+  parsing_state->gtfs_file_spec = job->gtfs_file_spec;
+  parsing_state->job = job;
+  parsing_state->free_batches = parallel_load->free_batches;
+  parsing_state->filled_batches = parallel_load->filled_batches;
+  parsing_state->max_record_strings_size =
+    max_record_strings_size(job->gtfs_file_spec);
+}
+
+/* Entry point for the threads in the chunk-parser pool: parses one
+   chunk of a split file and hands its records to the database writer
+   as a single chain of batches */
+static void parse_gtfs_chunk(gpointer data, gpointer user_data) {
+  gtfs_file_chunk_t *file_chunk = (gtfs_file_chunk_t *)data;
+  gtfs_parallel_load_t *parallel_load = (gtfs_parallel_load_t *)user_data;
+  gtfs_parsing_state_t parsing_state;
+  gtfs_record_batch_t *batch, *next_batch, *chunk_batches;
+  gtfs_csv_parser_t csv;
+  gint64 start_time;
+
+  init_parallel_parsing_state(&parsing_state,
+                              file_chunk->job,
+                              parallel_load);
+  parsing_state.file_chunk = file_chunk;
+
+  /* The chunk starts at a record boundary past the file's header, so
+     reuse the mapping read from the header */
+  parsing_state.header_parsed = true;
+  memcpy(parsing_state.field_for_column,
+         file_chunk->job->field_for_column,
+         sizeof(parsing_state.field_for_column));
+
+  start_time = g_get_monotonic_time();
+  if(!gtfs_csv_init(&csv, csv_tokenizer)) {
+    fprintf(stderr,
+            "parse_gtfs_chunk: "
+            "Error initializing the %s tokenizer\n",
+            gtfs_csv_tokenizer_name(csv_tokenizer));
+    g_atomic_int_set(&file_chunk->job->chunk_failed, 1);
+  }
+  else {
+    if(gtfs_csv_parse(&csv,
+                      file_chunk->data,
+                      file_chunk->size,
+                      field_parsed,
+                      record_parsed,
+                      &parsing_state) != file_chunk->size) {
+      fprintf(stderr,
+              "parse_gtfs_chunk: "
+              "Error parsing CSV data: %s\n",
+              gtfs_csv_strerror(&csv));
+      g_atomic_int_set(&file_chunk->job->chunk_failed, 1);
+    }
+    if(gtfs_csv_fini(&csv,
+                     field_parsed,
+                     record_parsed,
+                     &parsing_state) != 0) {
+      fprintf(stderr,
+              "parse_gtfs_chunk: "
+              "Error parsing CSV data: %s\n",
+              gtfs_csv_strerror(&csv));
+      g_atomic_int_set(&file_chunk->job->chunk_failed, 1);
+    }
+    gtfs_csv_free(&csv);
+  }
+  parsing_state.stats.parse_time += seconds_since(start_time);
+  parsing_state.stats.bytes_tokenized += file_chunk->size;
+
+  /* Make sure the chain holds at least one batch, then put it back
+     into the order in which its records were parsed */
+  current_record_batch(&parsing_state);
+  queue_record_batch(&parsing_state);
+
+  chunk_batches = NULL;
+  batch = parsing_state.chunk_batches;
+  while(batch) {
+    next_batch = batch->next;
+    batch->next = chunk_batches;
+    chunk_batches = batch;
+    batch = next_batch;
+  }
+
+  /* Hand the chain to the database writer, which will return the
+     chunk once its records are written */
+  chunk_batches->file_chunk = file_chunk;
+  g_async_queue_push(parallel_load->filled_batches, chunk_batches);
+}
+
+/* Reads a large GTFS file from the bundle, parsing its header and
+   then splitting the rest of the file at record boundaries into
+   chunks that are parsed by the chunk-parser pool; returns TRUE on
+   success */
+static bool split_gtfs_member(gtfs_member_t *gtfs_member,
+                              gtfs_csv_parser_t *csv,
+                              gtfs_parsing_state_t *parsing_state,
+                              gtfs_parallel_load_t *parallel_load) {
+  gtfs_load_job_t *job = parsing_state->job;
+  gtfs_file_chunk_t *file_chunk, *next_file_chunk;
+  size_t scanned = 0, boundary = 0;
+  bool in_quotes = false, header_parsed = false, end_of_member = false;
+  bool result = true;
+  ssize_t bytes_read;
+  gint64 start_time;
+  char c;
+
+  file_chunk = g_async_queue_pop(parallel_load->free_chunks);
+  file_chunk->size = 0;
+
+  while(!end_of_member) {
+    /* Fill the chunk, enlarging it if it holds no complete record */
+    if(file_chunk->size == file_chunk->capacity) {
+      file_chunk->capacity *= 2;
+      file_chunk->data = g_realloc(file_chunk->data,
+                                   file_chunk->capacity);
+    }
+
+    bytes_read = read_gtfs_member(gtfs_member,
+                                  file_chunk->data + file_chunk->size,
+                                  file_chunk->capacity - file_chunk->size,
+                                  &parsing_state->stats);
+    if(bytes_read < 0) {
+      fprintf(stderr,
+              "split_gtfs_member: "
+              "Error reading bundle file \"%s\"\n",
+              job->gtfs_file_spec->filename);
+      result = false;
+    }
+    end_of_member = bytes_read <= 0;
+    if(bytes_read > 0) {
+      file_chunk->size += bytes_read;
+    }
+
+    /* Find the last record boundary---that is, the last newline not
+       within a quoted field---in the new data */
+    while(scanned < file_chunk->size) {
+      c = file_chunk->data[scanned++];
+      if(c == '"') {
+        in_quotes = !in_quotes;
+      }
+      else if((c == '\n' || c == '\r') && !in_quotes) {
+        boundary = scanned;
+        if(!header_parsed) {
+          break;
+        }
+      }
+    }
+
+    if(!header_parsed && (boundary > 0 || end_of_member)) {
+      /* Parse the header ourselves, so its column-number-to-field-
+         number mapping can be shared with the chunk parsers */
+      if(boundary == 0) {
+        boundary = file_chunk->size;
+      }
 
-    switch(field_spec->type) {
-    case TYPE_BOOLEAN:
-      field_value->boolean_value = (*((char *)val) == '1');
-      break;
+      start_time = g_get_monotonic_time();
+      if(gtfs_csv_parse(csv,
+                        file_chunk->data,
+                        boundary,
+                        field_parsed,
+                        record_parsed,
+                        parsing_state) != boundary) {
+        fprintf(stderr,
+                "split_gtfs_member: "
+                "Error parsing CSV data: %s\n",
+                gtfs_csv_strerror(csv));
+        result = false;
+      }
+      if(gtfs_csv_fini(csv,
+                       field_parsed,
+                       record_parsed,
+                       parsing_state) != 0) {
+        fprintf(stderr,
+                "split_gtfs_member: "
+                "Error parsing CSV data: %s\n",
+                gtfs_csv_strerror(csv));
+        result = false;
+      }
+      parsing_state->stats.parse_time += seconds_since(start_time);
+      parsing_state->stats.bytes_tokenized += boundary;
+      memcpy(job->field_for_column,
+             parsing_state->field_for_column,
+             sizeof(job->field_for_column));
+      header_parsed = true;
 
-    case TYPE_INTEGER:
-      field_value->integer_value = atoi((const char *)val);
-      break;
+      file_chunk->size -= boundary;
+      memmove(file_chunk->data,
+              file_chunk->data + boundary,
+              file_chunk->size);
+      scanned -= boundary;
+      boundary = 0;
 
-    case TYPE_DOUBLE:
-      field_value->double_value = atof((const char *)val);
-      break;
+      /* Continue scanning whatever follows the header */
+      end_of_member = false;
+      continue;
+    }
 
-    case TYPE_STRING:
-      assert(len <= field_spec->length);
-      assert(*(char *)(val + len) == 0);
+    if(end_of_member || (file_chunk->size == file_chunk->capacity &&
+                         boundary > 0)) {
+      if(!end_of_member) {
+        /* Move the partial record following the boundary into the
+           next chunk */
+        next_file_chunk = g_async_queue_pop(parallel_load->free_chunks);
+        next_file_chunk->size = file_chunk->size - boundary;
+        if(next_file_chunk->capacity < next_file_chunk->size) {
+          next_file_chunk->capacity = file_chunk->capacity;
+          next_file_chunk->data = g_realloc(next_file_chunk->data,
+                                            next_file_chunk->capacity);
+        }
+        memcpy(next_file_chunk->data,
+               file_chunk->data + boundary,
+               next_file_chunk->size);
 
-      /* For an optional field, we insert a NULL value instead of an
-         empty string to indicate it is not present */
-      if(len == 0 && !field_spec->required) {
-        field_value = NULL;
+        file_chunk->size = boundary;
+        scanned -= boundary;
+        boundary = 0;
       }
       else {
-        field_value->string_value = strdup((char *)val);
+        next_file_chunk = NULL;
       }
-      break;
-
-    case TYPE_DATE:
-      assert(strptime(val, "%Y%m%d", &(field_value->date_value)));
-      break;
 
-    case TYPE_TIME:
-      if(len == 0) {
-        /* We insert NULL values for missing arrival or departure
-           times in stop times  */
-        field_value = NULL;
+      if(file_chunk->size > 0) {
+        file_chunk->job = job;
+        file_chunk->chunk = parsing_state->next_chunk++;
+        g_thread_pool_push(parallel_load->chunk_parsers,
+                           file_chunk,
+                           NULL);
       }
       else {
-        char *hours, *minutes, *seconds;
+        g_async_queue_push(parallel_load->free_chunks, file_chunk);
+      }
+
+      file_chunk = next_file_chunk;
+    }
+  }
+
+  return result;
+}
+
+/* Entry point for each parsing thread in a parallel load: takes jobs
+   from the queue of pending jobs, parsing each file and passing its
+   records on to the database writer, until no jobs remain */
+static gpointer parse_gtfs_files(gpointer data) {
+  gtfs_parallel_load_t *parallel_load = (gtfs_parallel_load_t *)data;
+  gtfs_load_job_t *job;
+  gtfs_member_t *gtfs_member;
+  gtfs_csv_parser_t csv;
+  gtfs_parsing_state_t parsing_state;
+  char *errmsg;
+  bool csv_initialized, load_error;
 
-        /* Convert the "H:MM:SS" or "HH:MM:SS" format to a number of
-           seconds since midnight */
-        /* TODO: This may not correctly handle the shift to or from
-           daylight saving time */
-        hours = strtok(val, ":");
-        minutes = strtok(NULL, ":");
-        seconds = strtok(NULL, ":");
+  /* Without a parser, each job is still taken from the queue, so the
+     database writer hears of its failure */
+  if(!(csv_initialized = gtfs_csv_init(&csv, csv_tokenizer))) {
+    fprintf(stderr,
+            "parse_gtfs_files: "
+            "Error initializing the %s tokenizer\n",
+            gtfs_csv_tokenizer_name(csv_tokenizer));
+  }
 
-        assert(strtok(NULL, ":") == NULL);
+  while(job = g_async_queue_try_pop(parallel_load->pending_jobs)) {
+    g_timer_start(job->timer);
 
-        field_value->time_value =
-          atoi(hours) * 3600 +
-          atoi(minutes) * 60 +
-          atoi(seconds);
+    init_parallel_parsing_state(&parsing_state, job, parallel_load);
+
+    load_error = true;
+    if(!csv_initialized) {
+      /* Fail the job without reading it */
+    }
+    else if(gtfs_member = gtfs_member_open(parallel_load->gtfs_bundle,
+                                           job->gtfs_file_spec->filename,
+                                           &errmsg)) {
+      if(parallel_load->chunk_parsers &&
+         job->size >= SPLIT_FILE_MIN_SIZE) {
+        load_error = !split_gtfs_member(gtfs_member,
+                                        &csv,
+                                        &parsing_state,
+                                        parallel_load);
+      }
+      else {
+        load_error = !parse_gtfs_member(gtfs_member, &csv, &parsing_state);
       }
-      break;
 
-    default:
-      /* Unrecognized field type; this should never be reached */
-      assert(false);
+      gtfs_member_close(gtfs_member);
+    }
+    else {
+      fprintf(stderr,
+              "Error opening bundle file \"%s\": %s\n",
+              job->gtfs_file_spec->filename,
+              errmsg);
+      g_free(errmsg);
     }
 
-    /* Add this field value to our hash table of parsed fields */
-    g_hash_table_insert(parsing_state->fields,
-                        (gpointer)field_spec->name,
-                        field_value);
+    /* Mark the last batch for this file and hand it to the database
+       writer */
+    current_record_batch(&parsing_state)->end_of_file = true;
+    parsing_state.batch->load_error = load_error;
+    queue_record_batch(&parsing_state);
   }
-  else {
-    /* We're still parsing the header; use this header field to update
-       our column-number-to-field-number mapping */
 
-    unsigned int field_number = 0;
-    bool field_name_matched = false;
+  if(csv_initialized) {
+    gtfs_csv_free(&csv);
+  }
 
-    assert(parsing_state->fields_parsed < MAX_COLUMNS);
+  return NULL;
+}
 
-    /* Search for this field's number by name */
-    while(!field_name_matched &&
-          field_number < gtfs_file_spec->num_fields) {
-      field_name_matched =
-        (strncmp(gtfs_file_spec->field_specs[field_number++]->name,
-                 val,
-                 len) == 0);
-    }
+/* Completes a job once its last record has been written, having the
+   output sink complete its table, and reports the number of objects
+   loaded; returns FALSE if the file could not be read (or its records
+   written) */
+static bool finish_load_job(gtfs_load_job_t *job, bool load_error) {
+  const gtfs_file_spec_t *gtfs_file_spec = job->gtfs_file_spec;
 
-    /* TODO: Better error-handling. Add fields to the
-       gtfs_parsing_state_t structure to indicate whether an error has
-       occurred, and a description of the error? */
-    assert(field_name_matched);
+  if(!output_sink->end_table(job, load_error)) {
+    load_error = true;
+  }
 
-    /* Add the mapping */
-    parsing_state->field_for_column[parsing_state->fields_parsed] =
-      field_number - 1;
+  if(load_error) {
+    return false;
   }
 
-  /* Another field parsed from the current record */
-  parsing_state->fields_parsed++;
+  g_timer_stop(job->timer);
+  record_file_stats(job, g_timer_elapsed(job->timer, NULL));
+  printf("Processing \"%s\": ", gtfs_file_spec->filename);
+  report_objects_loaded(gtfs_file_spec,
+                        job->objects_loaded,
+                        g_timer_elapsed(job->timer, NULL));
+  report_objects_updated(job);
+  puts("");
+
+  return true;
 }
 
-/* Invoked by the CSV parser each time a row has been parsed */
-static void record_parsed(int eor, void *data) {
-  gtfs_parsing_state_t *parsing_state = (gtfs_parsing_state_t *)data;
+/* Writes the records in each batch handed over by the parsing threads
+   to the output sink, in their original order within each file, until
+   the last batch of every job has been written; returns TRUE if every
+   file was loaded */
+static bool write_record_batches(gtfs_parallel_load_t *parallel_load) {
+  bool result = true;
+  unsigned int jobs_remaining = parallel_load->num_jobs;
+  gtfs_record_batch_t *batch, *next_batch;
+  gtfs_load_job_t *job;
 
-  if(parsing_state->header_parsed) {
-    /* End and start a new transaction if we've reached our limit on
-       the number of objects in this one */
-    if(parsing_state->objects_loaded % RECORDS_PER_TRANSACTION == 0) {
-        assert(sqlite3_step(end_transaction_stmt) == SQLITE_DONE);
-        assert(sqlite3_reset(end_transaction_stmt) == SQLITE_OK);
+  while(jobs_remaining > 0) {
+    batch = g_async_queue_pop(parallel_load->filled_batches);
+    job = batch->job;
 
-        assert(sqlite3_step(begin_transaction_stmt) == SQLITE_DONE);
-        assert(sqlite3_reset(begin_transaction_stmt) == SQLITE_OK);
+    /* Hold on to batches that arrive ahead of their turn, which
+       happens when the chunks of a split file are parsed out of
+       order */
+    if(batch->chunk != job->next_chunk) {
+      if(job->pending_chunks == NULL) {
+        job->pending_chunks = g_hash_table_new(g_direct_hash,
+                                               g_direct_equal);
+      }
+      g_hash_table_insert(job->pending_chunks,
+                          GUINT_TO_POINTER(batch->chunk),
+                          batch);
+      continue;
     }
 
-    /* Bind each field value to our INSERT statement */
-    for(unsigned int field_number = 0;
-        field_number < parsing_state->gtfs_file_spec->num_fields;
-        field_number += 1) {
-      gtfs_field_spec_t *field_spec;
-      gtfs_field_value_t *field_value;
-      int sqlite_result;
-
-      field_spec =
-        parsing_state->gtfs_file_spec->field_specs[field_number];
-
-      /* Get the parsed field value, if present */
-      field_value =
-        g_hash_table_lookup(parsing_state->fields,
-                            (gconstpointer)field_spec->name);
-
-      if(field_value == NULL) {
-        if(!field_spec->required) {
-          /* Optional but missing values are bound as NULL */
-          sqlite_result = sqlite3_bind_null(parsing_state->insert_stmt,
-                                            field_number + 1);
-        }
-        else {
-          /* Required but missing values are an error */
-          fprintf(stderr,
-                  "record_parsed: "
-                  "Field \"%s\" is required but missing\n",
-                  field_spec->name);
-        }
+    while(batch) {
+      /* Write this batch (or chain of batches), then any held batch
+         that follows it */
+      if(batch->file_chunk) {
+        g_async_queue_push(parallel_load->free_chunks, batch->file_chunk);
       }
-      else {
-        /* Bind this value to our INSERT statement */
-        switch(field_spec->type) {
-          static const char *true_char = "t";
-          static const char *false_char = "f";
-
-          unsigned int len, max_len;
-          char iso8601_date_str[24];
-
-        case TYPE_BOOLEAN:
-          /* Map boolean values to "t" and "f" to match Active
-             Record's behaviour */
-          sqlite_result =
-            sqlite3_bind_text(parsing_state->insert_stmt,
-                              field_number + 1,
-                              field_value->boolean_value ?
-                              true_char : false_char,
-                              1,
-                              SQLITE_TRANSIENT);
-          break;
 
-        case TYPE_INTEGER:
-          sqlite_result =
-            sqlite3_bind_int(parsing_state->insert_stmt,
-                             field_number + 1,
-                             field_value->integer_value);
-          break;
+      while(batch) {
+        write_record_batch(batch);
 
-        case TYPE_DOUBLE:
-          sqlite_result =
-            sqlite3_bind_double(parsing_state->insert_stmt,
-                                field_number + 1,
-                                field_value->double_value);
-          break;
+        /* The file's last batch follows every batch of its chunks,
+           so by now any chunk that failed to parse has said so */
+        if(batch->end_of_file) {
+          result = finish_load_job(job,
+                                   batch->load_error ||
+                                   g_atomic_int_get(&job->chunk_failed)) &&
+            result;
+          jobs_remaining--;
+        }
 
-        case TYPE_STRING:
-          len = strlen(field_value->string_value);
-          max_len = len > field_spec->length? field_spec->length: len;
+        /* Return the batch to the parsing threads for reuse */
+        next_batch = batch->next;
+        g_async_queue_push(parallel_load->free_batches, batch);
+        batch = next_batch;
+      }
 
-          sqlite_result =
-            sqlite3_bind_text(parsing_state->insert_stmt,
-                              field_number + 1,
-                              field_value->string_value,
-                              max_len,
-                              SQLITE_TRANSIENT);
+      job->next_chunk++;
+      if(job->pending_chunks) {
+        batch = g_hash_table_lookup(job->pending_chunks,
+                                    GUINT_TO_POINTER(job->next_chunk));
+        g_hash_table_remove(job->pending_chunks,
+                            GUINT_TO_POINTER(job->next_chunk));
+      }
+    }
+  }
 
-          /* Free the memory allocated for the string immediately */
-          free(field_value->string_value);
-          field_value->string_value = NULL;
-          break;
+  return result;
+}
 
-        case TYPE_DATE:
-          assert(len = strftime(iso8601_date_str,
-                                sizeof(iso8601_date_str),
-                                "%F",
-                                &field_value->date_value));
-          sqlite_result =
-            sqlite3_bind_text(parsing_state->insert_stmt,
-                              field_number + 1,
-                              iso8601_date_str,
-                              len,
-                              SQLITE_TRANSIENT);
-          break;
+/* Orders load jobs by descending file size */
+static int compare_load_jobs(const void *a, const void *b) {
+  const gtfs_load_job_t *job_a = a, *job_b = b;
 
-        case TYPE_TIME:
-          sqlite_result =
-            sqlite3_bind_int(parsing_state->insert_stmt,
-                             field_number + 1,
-                             field_value->time_value);
-          break;
+  return (job_a->size < job_b->size) - (job_a->size > job_b->size);
+}
 
-        default:
-          /* Unrecognized field type; this should never be reached */
-          assert(false);
-        }
+/* Loads the files of a GTFS bundle in parallel, parsing up to
+   "num_threads" files at once while this thread writes the parsed
+   records to the output sink; if "split_files" is TRUE, large files are
+   also split into chunks parsed by a further "num_threads" threads.
+   Returns TRUE on success */
+bool load_gtfs_bundle_parallel(gtfs_bundle_t *gtfs_bundle,
+                               unsigned int num_threads,
+                               bool split_files) {
+  bool result = true;
+  gtfs_parallel_load_t parallel_load;
+  const gtfs_file_spec_t *gtfs_file_spec;
+  gtfs_load_job_t *job;
+  gtfs_record_batch_t *batch;
+  gtfs_file_chunk_t *file_chunk;
+  GThread **threads;
+  unsigned int num_file_threads, index;
 
-        if(sqlite_result != SQLITE_OK) {
-          fprintf(stderr,
-                  "record_parsed: "
-                  "Error binding value for field \"%s\": %s\n",
-                  field_spec->name,
-                  sqlite3_errmsg(parsing_state->db));
-        }
-      }
-    }
+  memset(&parallel_load, 0, sizeof(parallel_load));
+  parallel_load.gtfs_bundle = gtfs_bundle;
+  parallel_load.jobs = g_new0(gtfs_load_job_t,
+                              G_N_ELEMENTS(gtfs_file_specs));
 
-    /* Insert the parsed record into the database */
-    if(sqlite3_step(parsing_state->insert_stmt) == SQLITE_DONE) {
-      /* Another object loaded to the database */
-      parsing_state->objects_loaded++;
-    }
-    else {
-      fprintf(stderr,
-              "record_parsed: "
-              "Error inserting record: %s\n",
-              sqlite3_errmsg(parsing_state->db));
-    }
+  /* Create a job for each file that is either required or optional
+     but present, preparing the output sink for its records */
+  index = 0;
+  while((gtfs_file_spec = gtfs_file_specs[index++]) && result) {
+    if(gtfs_file_spec->required ||
+       gtfs_bundle_locate(gtfs_bundle, gtfs_file_spec->filename, NULL)) {
+      job = &parallel_load.jobs[parallel_load.num_jobs];
+      job->gtfs_file_spec = gtfs_file_spec;
+      gtfs_bundle_locate(gtfs_bundle, gtfs_file_spec->filename, &job->size);
 
-    /* Unbind the values from the INSERT statement and reset it */
-    sqlite3_clear_bindings(parsing_state->insert_stmt);
-    if(sqlite3_reset(parsing_state->insert_stmt) != SQLITE_OK) {
-      fprintf(stderr,
-              "record_parsed: "
-              "Error resetting INSERT statement: %s\n",
-              sqlite3_errmsg(parsing_state->db));
+      if(output_sink->begin_table(job)) {
+        job->timer = g_timer_new();
+        parallel_load.num_jobs++;
+      }
+      else {
+        output_sink->end_table(job, true);
+        result = false;
+      }
     }
-
-    /* Another record parsed */
-    parsing_state->records_parsed++;
-  }
-  else {
-    /* We've now finished parsing the header---our
-       column-number-to-field-number mapping should be complete */
-    parsing_state->header_parsed = true;
   }
 
-  /* Reset our parsing state */
-  parsing_state->fields_parsed = 0;
-  g_hash_table_remove_all(parsing_state->fields);
-  memset(parsing_state->field_values,
-         0,
-         sizeof(parsing_state->field_values));
-}
+  if(result) {
+    /* Start on the largest files first, so the smaller ones are
+       loaded alongside them */
+    qsort(parallel_load.jobs,
+          parallel_load.num_jobs,
+          sizeof(gtfs_load_job_t),
+          compare_load_jobs);
 
-/* Loads a GTFS file (that is, a file contained within a GTFS bundle)
-   according to the provided GTFS-file specifier */
-long load_gtfs_file(const gtfs_file_spec_t *gtfs_file_spec,
-                    struct zip *gtfs_zip,
-                    sqlite3 *db,
-                    struct csv_parser *csv) {
-  long result = -1;
-  struct zip_file *gtfs_zip_member;
-  char *errmsg;
-  sqlite3_stmt *insert_stmt;
-  char buf[BUFFER_SIZE];
-  int bytes_read;
-  gtfs_parsing_state_t parsing_state;
-  bool parsing_error;
+    parallel_load.pending_jobs = g_async_queue_new();
+    for(index = 0; index < parallel_load.num_jobs; index++) {
+      g_async_queue_push(parallel_load.pending_jobs,
+                         &parallel_load.jobs[index]);
+    }
 
-  /* Open the file within the GTFS bundle---note this should always
-     succeed as the main routine has validated the bundle contains the
-     needed files */
-  if(gtfs_zip_member = zip_fopen(gtfs_zip,
-                                 gtfs_file_spec->filename,
-                                 0)) {
-    /* Create the corresponding table in the database */
-    if(create_table(db, gtfs_file_spec, &errmsg) == SQLITE_OK) {
-      /* Prepare the INSERT statement */
-      if(prepare_insert_stmt(db,
-                             gtfs_file_spec,
-                             &insert_stmt) == SQLITE_OK) {
-        /* We're just about ready to parse---reset our parsing state */
-        memset(&parsing_state, 0, sizeof(parsing_state));
-        parsing_state.db = db;
-        parsing_state.gtfs_file_spec = gtfs_file_spec;
-        parsing_state.fields = g_hash_table_new(g_str_hash,
-                                                g_str_equal);
-        parsing_state.insert_stmt = insert_stmt;
-
-        /* Start a new transaction in the database */
-        assert(sqlite3_step(begin_transaction_stmt) == SQLITE_DONE);
-        assert(sqlite3_reset(begin_transaction_stmt) == SQLITE_OK);
-
-        /* Now parse the CSV file */
-        bytes_read = zip_fread(gtfs_zip_member,
-                               buf,
-                               BUFFER_SIZE);
-        while(bytes_read > 0 && !parsing_error) {
-          /* Parse this data, invoking our callback functions as
-             each field or record is parsed */
-          parsing_error =
-            csv_parse(csv,
-                      buf,
-                      bytes_read,
-                      field_parsed,
-                      record_parsed,
-                      &parsing_state)
-            != bytes_read;
-
-          if(parsing_error) {
-            fprintf(stderr,
-                    "load_gtfs_file: "
-                    "Error parsing CSV data: %s\n",
-                    csv_strerror(csv_error(csv)));
-          }
-          else {
-            bytes_read = zip_fread(gtfs_zip_member,
-                                   buf,
-                                   BUFFER_SIZE);
-          }
-        }
+    num_file_threads = MIN(num_threads, parallel_load.num_jobs);
+
+    /* Allocate the pool of record batches shared between the parsing
+       threads and the database writer */
+    parallel_load.free_batches = g_async_queue_new();
+    parallel_load.filled_batches = g_async_queue_new();
+    for(index = 0; index < num_file_threads * BATCHES_PER_THREAD; index++) {
+      g_async_queue_push(parallel_load.free_batches,
+                         g_new(gtfs_record_batch_t, 1));
+    }
 
-        /* End this final database transaction */
-        assert(sqlite3_step(end_transaction_stmt) == SQLITE_DONE);
-        assert(sqlite3_reset(end_transaction_stmt) == SQLITE_OK);
+    /* If large files are to be split, allocate the pool of chunks and
+       start the threads that parse them */
+    if(split_files) {
+      parallel_load.free_chunks = g_async_queue_new();
+      for(index = 0; index < num_threads * CHUNKS_PER_THREAD; index++) {
+        file_chunk = g_new0(gtfs_file_chunk_t, 1);
+        file_chunk->capacity = CHUNK_SIZE;
+        file_chunk->data = g_malloc(file_chunk->capacity);
+        g_async_queue_push(parallel_load.free_chunks, file_chunk);
+      }
 
-        /* Finalize the CSV parser */
-        assert(csv_fini(csv,
-                        field_parsed,
-                        record_parsed,
-                        &parsing_state) == 0);
+      parallel_load.chunk_parsers = g_thread_pool_new(parse_gtfs_chunk,
+                                                      &parallel_load,
+                                                      num_threads,
+                                                      FALSE,
+                                                      NULL);
+    }
 
-        /* Free our prepared INSERT statement */
-        if(sqlite3_finalize(insert_stmt) != SQLITE_OK) {
-          fprintf(stderr,
-                  "load_gtfs_file: "
-                  "Error finalizing INSERT statement: %s\n",
-                  sqlite3_errmsg(db));
-        }
+    /* Start the parsing threads, then write their records to the
+       output sink as they arrive */
+    threads = g_new(GThread *, num_file_threads);
+    for(index = 0; index < num_file_threads; index++) {
+      threads[index] = g_thread_new("parser",
+                                    parse_gtfs_files,
+                                    &parallel_load);
+    }
 
-        /* Uninitialize our parsing state */
-        parsing_state.insert_stmt = NULL;
-        g_hash_table_destroy(parsing_state.fields);
-        parsing_state.fields = NULL;
+    result = write_record_batches(&parallel_load);
 
-        /* Define indices on the table, if any CREATE INDEX commands
-           have been given */
-        if(create_indices(db, gtfs_file_spec, &errmsg) != SQLITE_OK) {
-          fprintf(stderr,
-                  "load_gtfs_file: "
-                  "Error creating index on table: %s\n",
-                  errmsg);
-        }
+    for(index = 0; index < num_file_threads; index++) {
+      g_thread_join(threads[index]);
+    }
+    g_free(threads);
 
-        /* Return the number of objects loaded to our caller */
-        result = parsing_state.objects_loaded;
-      }
-      else {
-        fprintf(stderr,
-                "Error preparing INSERT statement: %s\n",
-                sqlite3_errmsg(db));
+    if(split_files) {
+      g_thread_pool_free(parallel_load.chunk_parsers, FALSE, TRUE);
+      while(file_chunk = g_async_queue_try_pop(parallel_load.free_chunks)) {
+        g_free(file_chunk->data);
+        g_free(file_chunk);
       }
-    }
-    else {
-      fprintf(stderr,
-              "Error creating database table: %s\n",
-              errmsg);
+      g_async_queue_unref(parallel_load.free_chunks);
     }
 
-    /* All done---close the GTFS member file */
-    assert(zip_fclose(gtfs_zip_member) == 0);
+    /* Every batch has been returned to the pool by now */
+    while(batch = g_async_queue_try_pop(parallel_load.free_batches)) {
+      g_free(batch);
+    }
+    g_async_queue_unref(parallel_load.filled_batches);
+    g_async_queue_unref(parallel_load.free_batches);
+    g_async_queue_unref(parallel_load.pending_jobs);
   }
-  else {
-    fprintf(stderr,
-            "Error opening ZIP member \"%s\": %s\n",
-            gtfs_file_spec->filename,
-            zip_strerror(gtfs_zip));
+
+  /* Free the jobs' resources, including those the output sink holds
+     for any job left incomplete */
+  for(index = 0; index < parallel_load.num_jobs; index++) {
+    job = &parallel_load.jobs[index];
+    output_sink->end_table(job, true);
+    if(job->timer) {
+      g_timer_destroy(job->timer);
+    }
+    if(job->pending_chunks) {
+      g_hash_table_destroy(job->pending_chunks);
+    }
   }
+  g_free(parallel_load.jobs);
 
-  /* Return the number of objects loaded into the database, or -1 on
-     error */
   return result;
 }
 
 /* Validates a GTFS bundle before it is loaded---at the moment, this
    simply checks to make sure the bundle contains the files we expect
    to load */
-bool validate_gtfs_bundle(struct zip *gtfs_zip) {
+bool validate_gtfs_bundle(const gtfs_bundle_t *gtfs_bundle) {
   const gtfs_file_spec_t *gtfs_file_spec;
   bool result = true;
   int index;
@@ -602,7 +4804,7 @@ bool validate_gtfs_bundle(struct zip *gtfs_zip) {
   while(gtfs_file_spec = gtfs_file_specs[index++]) {
     filename = gtfs_file_spec->filename;
     if(gtfs_file_spec->required &&
-       zip_name_locate(gtfs_zip, filename, 0) == -1) {
+       !gtfs_bundle_locate(gtfs_bundle, filename, NULL)) {
       fprintf(stderr,
               "Error: Bundle is missing required file \"%s\".\n",
               filename);
@@ -620,156 +4822,432 @@ int main(int argc, char *argv[]) {
   char *gtfs_path;
   char *db_path;
 
-  struct zip *gtfs_zip;
-  struct zip_file *gtfs_zip_member;
-  const char *zip_member_name;
-  int zip_error, system_error;
-  int zip_member_count, zip_member_index;
-  char zip_error_str[256];
+  static gint num_jobs = 1;
+  static gboolean split_files = FALSE;
+  static gboolean bulk_load = FALSE;
+  static gint transaction_size = -1;
+  static gboolean update = FALSE;
+  static gboolean compact = FALSE;
+  static gboolean clustered = FALSE;
+  static gint sort_memory_size = DEFAULT_SORT_MEMORY;
+  static gboolean service_days = FALSE;
+  static gint num_departure_days = 0;
+  static gchar *departures_start_str = NULL;
+  static gboolean stop_index = FALSE;
+  static gboolean expand_frequency_trips = FALSE;
+  static gint walking_distance = 0;
+  static gchar *raptor_file_path = NULL;
+  static gchar *stats_json_path = NULL;
+  static gint buffer_size = DEFAULT_READ_BUFFER_SIZE / 1024;
+  static gboolean no_mmap = FALSE;
+  static gint inflate_buffers = -1;
+  static gchar *tokenizer_name = NULL;
+  static gchar *output_format_name = NULL;
+  static const GOptionEntry option_entries[] = {
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &num_jobs,
+      "Parse up to N bundle files in parallel", "N" },
+    { "split-files", 's', 0, G_OPTION_ARG_NONE, &split_files,
+      "Split large files into chunks parsed by N further threads",
+      NULL },
+    { "bulk", 'b', 0, G_OPTION_ARG_NONE, &bulk_load,
+      "Load quickly at the risk of a corrupt database if interrupted",
+      NULL },
+    { "transaction-size", 't', 0, G_OPTION_ARG_INT, &transaction_size,
+      "Commit every N records (0 to adapt N to the commit rate)", "N" },
+    { "update", 'u', 0, G_OPTION_ARG_NONE, &update,
+      "Update an existing database, writing only records that have "
+      "changed", NULL },
+    { "compact-ids", 0, 0, G_OPTION_ARG_NONE, &compact,
+      "Store trip, stop, route and service IDs as integers, keeping the "
+      "IDs themselves in lookup tables", NULL },
+    { "clustered", 0, 0, G_OPTION_ARG_NONE, &clustered,
+      "Create the stop_times, trips and calendar_dates tables clustered "
+      "on their keys, inserting their records in key order", NULL },
+    { "sort-memory", 0, 0, G_OPTION_ARG_INT, &sort_memory_size,
+      "Sort each clustered table's records in up to N megabytes of "
+      "memory before spilling them to disk", "N" },
+    { "service-days", 0, 0, G_OPTION_ARG_NONE, &service_days,
+      "Store the days each service runs as a bitset in the service_days "
+      "table", NULL },
+    { "departures", 0, 0, G_OPTION_ARG_INT, &num_departure_days,
+      "Build a table of the departures from each stop over N days of "
+      "service", "N" },
+    { "departures-start", 0, 0, G_OPTION_ARG_STRING, &departures_start_str,
+      "Start the departures table on DATE (YYYYMMDD; by default, today)",
+      "DATE" },
+    { "stop-index", 0, 0, G_OPTION_ARG_NONE, &stop_index,
+      "Build a spatial index over the stops in the stops_rtree table",
+      NULL },
+    { "expand-frequencies", 0, 0, G_OPTION_ARG_NONE,
+      &expand_frequency_trips,
+      "Add a trip with its stop times for each run of a trip listed in "
+      "frequencies.txt", NULL },
+    { "walking-transfers", 0, 0, G_OPTION_ARG_INT, &walking_distance,
+      "Add a transfer on foot between each pair of stops up to M metres "
+      "apart to the walking_transfers table", "M" },
+    { "raptor", 0, 0, G_OPTION_ARG_FILENAME, &raptor_file_path,
+      "Write the timetable to PATH laid out for RAPTOR routers", "PATH" },
+    { "stats-json", 0, 0, G_OPTION_ARG_FILENAME, &stats_json_path,
+      "Write statistics on where time was spent to PATH as JSON", "PATH" },
+    { "progress", 'p', 0, G_OPTION_ARG_INT, &progress_interval,
+      "Report progress every N seconds", "N" },
+    { "buffer-size", 0, 0, G_OPTION_ARG_INT, &buffer_size,
+      "Read compressed files through buffers of N kilobytes", "N" },
+    { "no-mmap", 0, 0, G_OPTION_ARG_NONE, &no_mmap,
+      "Read a ZIP bundle through libzip rather than mapping it into "
+      "memory", NULL },
+    { "inflate-buffers", 0, 0, G_OPTION_ARG_INT, &inflate_buffers,
+      "Inflate each compressed file on a thread of its own into a ring "
+      "of N buffers as it is parsed (0 to inflate it on the parsing "
+      "thread; by default, 2 on a multiprocessor)", "N" },
+    { "tokenizer", 0, 0, G_OPTION_ARG_STRING, &tokenizer_name,
+      "Parse CSV data with NAME: auto (the default), avx2, sse2, scalar "
+      "or libcsv", "NAME" },
+    { "output-format", 'f', 0, G_OPTION_ARG_STRING, &output_format_name,
+      "Write FORMAT: sqlite, a database (the default); arrow, a "
+      "directory of Arrow IPC files, one per table; or null, nothing "
+      "at all, to time parsing alone", "FORMAT" },
+    { NULL }
+  };
+  GOptionContext *option_context;
+  GError *option_error = NULL;
+
+  gtfs_bundle_t *gtfs_bundle;
+  unsigned int gtfs_member_index;
 
-  sqlite3 *db;
+  char *errmsg;
 
   const gtfs_file_spec_t *gtfs_file_spec;
   int gtfs_file_specs_index;
 
-  struct csv_parser csv;
-  bool parsing_error;
+  gtfs_csv_parser_t csv;
+  bool csv_initialized, parsing_error;
 
-  GTimer *parsing_timer;
+  GTimer *parsing_timer, *bundle_timer;
   gdouble parsing_time_elapsed;
   long objects_loaded;
-  const char *object_name;
+  gtfs_load_job_t load_job;
+
+  char departures_start_date[11];
+  time_t now;
+
+  /* Parse our command-line options, writing to a SQLite database
+     unless another output format is chosen */
+  output_sink = &sqlite_sink;
+  option_context = g_option_context_new("gtfs-file [db-file]");
+  g_option_context_add_main_entries(option_context,
+                                    option_entries,
+                                    NULL);
+  if(!g_option_context_parse(option_context, &argc, &argv, &option_error)) {
+    fprintf(stderr, "Error: %s\n", option_error->message);
+    g_error_free(option_error);
+    argc = 0;
+  }
+  else if(num_jobs < 1) {
+    fprintf(stderr, "Error: The number of jobs must be at least 1\n");
+    argc = 0;
+  }
+  else if(buffer_size < 1) {
+    fprintf(stderr, "Error: The buffer size must be at least 1\n");
+    argc = 0;
+  }
+  else if(inflate_buffers < -1) {
+    fprintf(stderr,
+            "Error: The number of inflate buffers must not be negative\n");
+    argc = 0;
+  }
+  else if(tokenizer_name &&
+          !gtfs_csv_tokenizer_from_name(tokenizer_name, &csv_tokenizer)) {
+    fprintf(stderr, "Error: Unknown tokenizer \"%s\"\n", tokenizer_name);
+    argc = 0;
+  }
+  else if(!gtfs_csv_tokenizer_supported(csv_tokenizer)) {
+    fprintf(stderr,
+            "Error: The %s tokenizer is not supported by this processor\n",
+            tokenizer_name);
+    argc = 0;
+  }
+  else if(output_format_name &&
+          !(output_sink = find_output_sink(output_format_name))) {
+    fprintf(stderr,
+            "Error: Unknown output format \"%s\"\n",
+            output_format_name);
+    argc = 0;
+  }
+  else if(update && output_sink != &sqlite_sink) {
+    fprintf(stderr, "Error: Only a SQLite database can be updated\n");
+    argc = 0;
+  }
+  else if(compact && output_sink != &sqlite_sink) {
+    fprintf(stderr,
+            "Error: Only a SQLite database can have compact IDs\n");
+    argc = 0;
+  }
+  else if(clustered && output_sink != &sqlite_sink) {
+    fprintf(stderr,
+            "Error: Only a SQLite database can have clustered tables\n");
+    argc = 0;
+  }
+  else if(clustered && update) {
+    fprintf(stderr,
+            "Error: A database with clustered tables cannot be updated\n");
+    argc = 0;
+  }
+  else if(sort_memory_size < 1) {
+    fprintf(stderr, "Error: The sort memory must be at least 1\n");
+    argc = 0;
+  }
+  else if(service_days && output_sink != &sqlite_sink) {
+    fprintf(stderr,
+            "Error: Only a SQLite database can have a service_days table\n");
+    argc = 0;
+  }
+  else if(num_departure_days < 0) {
+    fprintf(stderr,
+            "Error: The number of departure days must not be negative\n");
+    argc = 0;
+  }
+  else if(num_departure_days > 0 && output_sink != &sqlite_sink) {
+    fprintf(stderr,
+            "Error: Only a SQLite database can have a departures table\n");
+    argc = 0;
+  }
+  else if(departures_start_str &&
+          !parse_date(departures_start_str,
+                      strlen(departures_start_str),
+                      departures_start_date)) {
+    fprintf(stderr,
+            "Error: Invalid departures start date \"%s\"\n",
+            departures_start_str);
+    argc = 0;
+  }
+  else if(stop_index && output_sink != &sqlite_sink) {
+    fprintf(stderr,
+            "Error: Only a SQLite database can have a stop index\n");
+    argc = 0;
+  }
+  else if(expand_frequency_trips && output_sink != &sqlite_sink) {
+    fprintf(stderr,
+            "Error: Only a SQLite database can have its frequencies "
+            "expanded\n");
+    argc = 0;
+  }
+  else if(walking_distance < 0) {
+    fprintf(stderr,
+            "Error: The walking transfer distance must not be negative\n");
+    argc = 0;
+  }
+  else if(walking_distance > 0 && output_sink != &sqlite_sink) {
+    fprintf(stderr,
+            "Error: Only a SQLite database can have a walking_transfers "
+            "table\n");
+    argc = 0;
+  }
+  else if(raptor_file_path && output_sink != &sqlite_sink) {
+    fprintf(stderr,
+            "Error: Only a SQLite database can be written as a RAPTOR "
+            "timetable\n");
+    argc = 0;
+  }
+  else if(progress_interval < 0) {
+    fprintf(stderr,
+            "Error: The progress interval must not be negative\n");
+    argc = 0;
+  }
+  else if(transaction_size == 0 ||
+          (transaction_size == -1 && bulk_load)) {
+    /* Adapt the number of records per transaction as we go; a bulk
+       load does this unless told otherwise */
+    adapt_records_per_transaction = true;
+  }
+  else if(transaction_size > 0) {
+    records_per_transaction = transaction_size;
+  }
+  else if(transaction_size != -1) {
+    fprintf(stderr,
+            "Error: The transaction size must not be negative\n");
+    argc = 0;
+  }
+  g_option_context_free(option_context);
+  update_database = update;
+  compact_ids = compact;
+  clustered_tables = clustered;
+  sort_memory = (size_t)sort_memory_size * 1024 * 1024;
+  bulk_load_database = bulk_load;
+
+  /* The departures table starts today unless another day was given */
+  if(departures_start_str == NULL) {
+    now = time(NULL);
+    strftime(departures_start_date,
+             sizeof(departures_start_date),
+             "%Y-%m-%d",
+             localtime(&now));
+  }
+  store_service_days = service_days;
+  departure_days = num_departure_days;
+  departures_first_day = gtfs_day_from_date(departures_start_date);
+  index_stops = stop_index;
+  expand_frequencies = expand_frequency_trips;
+  walking_transfer_distance = walking_distance;
+  raptor_path = raptor_file_path;
 
-  if(argc > 2) {
+  /* Inflating each file on a thread of its own only gains anything
+     when that thread can run alongside the parser */
+  if(inflate_buffers == -1) {
+    inflate_buffers =
+      sysconf(_SC_NPROCESSORS_ONLN) > 1? DEFAULT_INFLATE_BUFFERS: 0;
+  }
+
+  if(argc > 2 || (argc == 2 && !output_sink->path_required)) {
     /* Get our parameters */
     gtfs_path = argv[1];
-    db_path = argv[2];
+    db_path = argc > 2? argv[2]: NULL;
 
-    /* Open and process the GTFS bundle (ZIP file) */
-    gtfs_zip = zip_open(gtfs_path, ZIP_CHECKCONS, &zip_error);
-    if(gtfs_zip) {
+    /* Open and process the GTFS bundle (ZIP file or directory of
+       extracted files) */
+    gtfs_bundle = gtfs_bundle_open(gtfs_path,
+                                   !no_mmap,
+                                   (size_t)buffer_size * 1024,
+                                   inflate_buffers,
+                                   &errmsg);
+    if(gtfs_bundle) {
       /* List the bundle's contents */
       puts("Bundle contents:");
-      zip_member_count = zip_get_num_files(gtfs_zip);
-      for(zip_member_index = 0;
-          zip_member_index < zip_member_count;
-          zip_member_index++) {
-        zip_member_name = zip_get_name(gtfs_zip, zip_member_index, 0);
-        if(zip_member_name) {
-          printf("  %s\n", zip_member_name);
-        }
+      for(gtfs_member_index = 0;
+          gtfs_member_index < gtfs_bundle_num_members(gtfs_bundle);
+          gtfs_member_index++) {
+        printf("  %s\n",
+               gtfs_bundle_member_name(gtfs_bundle, gtfs_member_index));
       }
 
       /* Validate the GTFS bundle before continuing */
-      if(validate_gtfs_bundle(gtfs_zip)) {
-        /* Create and open the database */
-        if(sqlite3_open(db_path, &db) == SQLITE_OK) {
-          /* Precompile our "BEGIN TRANSACTION" and "END TRANSACTION"
-             statements */
-          assert(sqlite3_prepare_v2(db,
-                                    "BEGIN TRANSACTION",
-                                    strlen("BEGIN TRANSACTION"),
-                                    &begin_transaction_stmt,
-                                    NULL) == SQLITE_OK);
-          assert(sqlite3_prepare_v2(db,
-                                    "END TRANSACTION",
-                                    strlen("END TRANSACTION"),
-                                    &end_transaction_stmt,
-                                    NULL) == SQLITE_OK);
-
-          /* Initialize our CSV parser */
-          assert(csv_init(&csv, CSV_STRICT | CSV_APPEND_NULL) == 0);
-
-          /* Now step through our data structure that specifies files
-             to parse and how they should be parsed, parsing each
-             file */
-          parsing_error = false;
-          gtfs_file_specs_index = 0;
-          while((gtfs_file_spec = gtfs_file_specs[gtfs_file_specs_index++]) &&
-                !parsing_error) {
-            /* Process the file if it is either required or optional
-               but present */
-            if(gtfs_file_spec->required ||
-               zip_name_locate(gtfs_zip,
-                               gtfs_file_spec->filename,
-                               0) != -1) {
-              printf("Processing \"%s\": ",
-                     gtfs_file_spec->filename);
-              fflush(stdout);
-
-              parsing_timer = g_timer_new();
-              objects_loaded = load_gtfs_file(gtfs_file_spec,
-                                              gtfs_zip,
-                                              db,
-                                              &csv);
-              g_timer_stop(parsing_timer);
-              parsing_time_elapsed = g_timer_elapsed(parsing_timer,
-                                                     NULL);
+      if(validate_gtfs_bundle(gtfs_bundle)) {
+        /* Open the output sink, creating the database (or output
+           directory) */
+        if(output_sink->open(db_path)) {
+          file_stats_json = g_ptr_array_new_with_free_func(g_free);
+          index_stats_json = g_ptr_array_new_with_free_func(g_free);
+          derived_stats_json = g_ptr_array_new_with_free_func(g_free);
+          last_progress_time = g_get_monotonic_time();
+          bundle_timer = g_timer_new();
 
-              /* If parsing was successful, output the number of
-                 objects loaded and the time it took */
-              if(objects_loaded > -1) {
-                object_name = objects_loaded == 1?
-                  gtfs_file_spec->name.singular:
-                  gtfs_file_spec->name.plural;
-                printf("%lu %s added in %.2f seconds",
-                       objects_loaded,
-                       object_name,
-                       parsing_time_elapsed);
-                if(parsing_time_elapsed > 0) {
-                  printf(" (%.2fms/%s)",
-                         (parsing_time_elapsed * 1000) / objects_loaded,
-                         gtfs_file_spec->name.singular);
+          if(num_jobs > 1 || split_files) {
+            /* Parse the bundle's files in parallel, writing their
+               records to the output sink from this thread */
+            parsing_error = !load_gtfs_bundle_parallel(gtfs_bundle,
+                                                       num_jobs,
+                                                       split_files);
+          }
+          else {
+            /* Initialize our CSV parser */
+            if(!(csv_initialized = gtfs_csv_init(&csv, csv_tokenizer))) {
+              fprintf(stderr,
+                      "Error initializing the %s tokenizer\n",
+                      gtfs_csv_tokenizer_name(csv_tokenizer));
+            }
+            parsing_error = !csv_initialized;
+
+            /* Now step through our data structure that specifies
+               files to parse and how they should be parsed, parsing
+               each file */
+            gtfs_file_specs_index = 0;
+            while((gtfs_file_spec =
+                   gtfs_file_specs[gtfs_file_specs_index++]) &&
+                  !parsing_error) {
+              /* Process the file if it is either required or optional
+                 but present */
+              if(gtfs_file_spec->required ||
+                 gtfs_bundle_locate(gtfs_bundle,
+                                    gtfs_file_spec->filename,
+                                    NULL)) {
+                printf("Processing \"%s\": ",
+                       gtfs_file_spec->filename);
+                fflush(stdout);
+
+                parsing_timer = g_timer_new();
+                objects_loaded = load_gtfs_file(gtfs_file_spec,
+                                                gtfs_bundle,
+                                                &csv,
+                                                &load_job);
+                g_timer_stop(parsing_timer);
+                parsing_time_elapsed = g_timer_elapsed(parsing_timer,
+                                                       NULL);
+                g_timer_destroy(parsing_timer);
+
+                /* If parsing was successful, output the number of
+                   objects loaded and the time it took */
+                if(objects_loaded > -1) {
+                  report_objects_loaded(gtfs_file_spec,
+                                        objects_loaded,
+                                        parsing_time_elapsed);
+                  report_objects_updated(&load_job);
+                  record_file_stats(&load_job, parsing_time_elapsed);
                 }
+                else {
+                  parsing_error = TRUE;
+                }
+
+                puts("");
               }
-              else {
-                parsing_error = TRUE;
-              }
+            }
 
-              puts("");
+            /* Free our CSV parser */
+            if(csv_initialized) {
+              gtfs_csv_free(&csv);
             }
           }
 
-          /* Free our CSV parser */
-          csv_free(&csv);
+          /* With every table loaded, complete the output, creating
+             the indices that could not be built as records were
+             inserted and any tables derived from those loaded */
+          if(!parsing_error && output_sink->finish) {
+            output_sink->finish(num_jobs);
+          }
+
+          g_timer_stop(bundle_timer);
 
-          /* Free our "BEGIN TRANSACTION" and "END TRANSACTION"
-             statements */
-          assert(sqlite3_finalize(begin_transaction_stmt) ==
-                 SQLITE_OK);
-          assert(sqlite3_finalize(end_transaction_stmt) ==
-                 SQLITE_OK);
+          /* Close the output sink */
+          output_sink->close();
 
-          /* Close the database */
-          puts("GTFS bundle loaded.");
-          assert(sqlite3_close(db) == SQLITE_OK);
+          printf("GTFS bundle loaded in %.2f seconds.\n",
+                 g_timer_elapsed(bundle_timer, NULL));
+          if(stats_json_path) {
+            write_stats_json(stats_json_path,
+                             g_timer_elapsed(bundle_timer, NULL));
+          }
+          g_ptr_array_free(file_stats_json, TRUE);
+          g_ptr_array_free(index_stats_json, TRUE);
+          g_ptr_array_free(derived_stats_json, TRUE);
+          g_timer_destroy(bundle_timer);
 
           /* Success! */
           result = 0;
         }
-        else {
-          fprintf(stderr,
-                  "Error creating database \"%s\": %s",
-                  db_path,
-                  sqlite3_errmsg(db));
-        }
       }
 
-      /* All done; close the GTFS ZIP file and exit */
-      assert(zip_close(gtfs_zip) == 0);
+      /* All done; close the GTFS bundle and exit */
+      gtfs_bundle_close(gtfs_bundle);
     }
     else {
       /* Couldn't open the GTFS bundle; print an error message and
          exit */
-      zip_error_to_str(zip_error_str, 256, zip_error, errno);
       fprintf(stderr,
-              "Error opening ZIP file: %s\n",
-              zip_error_str);
+              "Error opening GTFS bundle: %s\n",
+              errmsg);
+      g_free(errmsg);
     }
   }
   else {
     /* Print out our usage and exit */
-    puts("Usage: gtfs2db gtfs-file db-file");
+    puts("Usage: gtfs2db [--jobs N] [--split-files] [--bulk] "
+         "[--transaction-size N] [--update] [--compact-ids] "
+         "[--clustered] [--sort-memory N] [--service-days] [--departures N] "
+         "[--departures-start DATE] [--stop-index] "
+         "[--expand-frequencies] [--walking-transfers M] "
+         "[--raptor PATH] [--stats-json PATH] "
+         "[--progress N] [--buffer-size N] [--no-mmap] "
+         "[--inflate-buffers N] [--tokenizer NAME] "
+         "[--output-format FORMAT] gtfs-file [db-file]");
   }
 
   return result;
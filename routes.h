@@ -37,7 +37,8 @@ const gtfs_file_spec_t routes_file_spec = {
   /* Field definitions */
   9,
   (gtfs_field_spec_t *[9]) {
-    &(gtfs_field_spec_t) {"route_id",         TYPE_STRING,   255, true },
+    &(gtfs_field_spec_t) {"route_id",         TYPE_STRING,   255, true,
+                          ID_SPACE_ROUTE },
     &(gtfs_field_spec_t) {"agency_id",        TYPE_STRING,   255, false },
     &(gtfs_field_spec_t) {"route_short_name", TYPE_STRING,   255, true },
     &(gtfs_field_spec_t) {"route_long_name",  TYPE_STRING,   255, true },
@@ -48,6 +49,10 @@ const gtfs_file_spec_t routes_file_spec = {
     &(gtfs_field_spec_t) {"route_text_color", TYPE_STRING,     6, false }
   },
 
+  /* The fields identifying each object: its route ID */
+  1,
+  (unsigned int [1]) { 0 },
+
   /* SQL statements */
 
   /* Create the corresponding table in the database */
@@ -71,6 +76,10 @@ const gtfs_file_spec_t routes_file_spec = {
   (const char *[]) {
     NULL
   },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  false,
 };
 
 #endif
@@ -0,0 +1,91 @@
+/* Specifies how the file "shapes.txt" within a GTFS bundle is to be
+   parsed. Each record is a single point along the path of a shape; an
+   Arrow file (or any sink writing records as they are) stores them as
+   they are, one row per point, but the SQLite sink instead encodes
+   each shape's points together as a single row of the "shapes" table
+   (see encoded_shapes.h).
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __SHAPES_H__
+#define __SHAPES_H__
+
+#include "gtfs_file.h"
+
+/* The numbers of the file's fields, by which each point is read */
+enum {
+  SHAPE_ID,
+  SHAPE_PT_LAT,
+  SHAPE_PT_LON,
+  SHAPE_PT_SEQUENCE,
+  SHAPE_DIST_TRAVELED
+};
+
+const gtfs_file_spec_t shapes_file_spec = {
+  /* The name of this GTFS object, both singular and plural forms */
+  { "shape", "shapes" },
+
+  /* The filename within the GTFS bundle to load from */
+  "shapes.txt",
+
+  /* Whether the file is required to be present in a GTFS bundle or
+     not */
+  false,
+
+  /* Field definitions */
+  5,
+  (gtfs_field_spec_t *[5]) {
+    &(gtfs_field_spec_t) {"shape_id",            TYPE_STRING, 255, true },
+    &(gtfs_field_spec_t) {"shape_pt_lat",        TYPE_DOUBLE,   0, true },
+    &(gtfs_field_spec_t) {"shape_pt_lon",        TYPE_DOUBLE,   0, true },
+    &(gtfs_field_spec_t) {"shape_pt_sequence",   TYPE_INTEGER,  0, true },
+    &(gtfs_field_spec_t) {"shape_dist_traveled", TYPE_DOUBLE,   0, false }
+  },
+
+  /* The fields identifying each object: its shape ID and point
+     sequence */
+  2,
+  (unsigned int [2]) { 0, 3 },
+
+  /* SQL statements */
+
+  /* Create the table holding a row for each point---used only by
+     sinks that write records as they are parsed */
+  "CREATE TABLE shape_points("
+    "shape_id VARCHAR(255) NOT NULL, "
+    "lat DECIMAL(8,6) NOT NULL, "
+    "lon DECIMAL(9,6) NOT NULL, "
+    "sequence INTEGER NOT NULL, "
+    "dist_traveled DECIMAL);",
+
+  /* Insert a new record into the table */
+  "INSERT INTO shape_points(shape_id, lat, lon, sequence, "
+    "dist_traveled) "
+    "VALUES (?, ?, ?, ?, ?);",
+
+  /* Define indices on the table for quick lookups---none */
+  (const char *[]) {
+    NULL
+  },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  false,
+};
+
+#endif
@@ -23,6 +23,13 @@
 
 #include "gtfs_file.h"
 
+/* The numbers of the file's fields that are referred to by name */
+enum {
+  STOP_TIME_TRIP_ID,
+  STOP_TIME_ARRIVAL_TIME,
+  STOP_TIME_DEPARTURE_TIME
+};
+
 const gtfs_file_spec_t stop_times_file_spec = {
   /* The name of this GTFS object, both singular and plural forms */
   { "stop time", "stop times" },
@@ -37,10 +44,12 @@ const gtfs_file_spec_t stop_times_file_spec = {
   /* Field definitions */
   9,
   (gtfs_field_spec_t *[9]) {
-    &(gtfs_field_spec_t) {"trip_id",             TYPE_STRING,  255, true },
+    &(gtfs_field_spec_t) {"trip_id",             TYPE_STRING,  255, true,
+                          ID_SPACE_TRIP },
     &(gtfs_field_spec_t) {"arrival_time",        TYPE_TIME,      8, true },
     &(gtfs_field_spec_t) {"departure_time",      TYPE_TIME,      8, true },
-    &(gtfs_field_spec_t) {"stop_id",             TYPE_STRING,  255, true },
+    &(gtfs_field_spec_t) {"stop_id",             TYPE_STRING,  255, true,
+                          ID_SPACE_STOP },
     &(gtfs_field_spec_t) {"stop_sequence",       TYPE_INTEGER,   0, true },
     &(gtfs_field_spec_t) {"stop_headsign",       TYPE_STRING,  255, false },
     &(gtfs_field_spec_t) {"pickup_type",         TYPE_INTEGER,   0, false },
@@ -48,6 +57,10 @@ const gtfs_file_spec_t stop_times_file_spec = {
     &(gtfs_field_spec_t) {"shape_dist_traveled", TYPE_DOUBLE,    0, false }
   },
 
+  /* The fields identifying each object: its trip ID and stop sequence */
+  2,
+  (unsigned int [2]) { 0, 4 },
+
   /* SQL statements */
 
   /* Create the corresponding table in the database */
@@ -70,11 +83,19 @@ const gtfs_file_spec_t stop_times_file_spec = {
 
   /* Define indices on the table for quick lookups */
   (const char *[]) {
+    /* Allow fast look-ups by trip ID, in stop sequence */
+    "CREATE INDEX stop_times_trip_id_index "
+      "ON stop_times(trip_id, stop_sequence);",
+
     /* Allow fast look-ups by stop ID */
     "CREATE INDEX stop_times_stop_id_index "
       "ON stop_times(stop_id);",
     NULL
   },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  true,
 };
 
 #endif
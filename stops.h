@@ -37,7 +37,8 @@ const gtfs_file_spec_t stops_file_spec = {
   /* Field definitions */
   12,
   (gtfs_field_spec_t *[12]) {
-    &(gtfs_field_spec_t) {"stop_id",             TYPE_STRING,  255, true },
+    &(gtfs_field_spec_t) {"stop_id",             TYPE_STRING,  255, true,
+                          ID_SPACE_STOP },
     &(gtfs_field_spec_t) {"stop_code",           TYPE_STRING,   16, false },
     &(gtfs_field_spec_t) {"stop_name",           TYPE_STRING,  255, true },
     &(gtfs_field_spec_t) {"stop_desc",           TYPE_STRING,  255, false },
@@ -46,12 +47,17 @@ const gtfs_file_spec_t stops_file_spec = {
     &(gtfs_field_spec_t) {"zone_id",             TYPE_STRING,   16, false },
     &(gtfs_field_spec_t) {"stop_url",            TYPE_STRING,  255, false },
     &(gtfs_field_spec_t) {"location_type",       TYPE_INTEGER,   0, false },
-    &(gtfs_field_spec_t) {"parent_station",      TYPE_STRING,  255, false },
+    &(gtfs_field_spec_t) {"parent_station",      TYPE_STRING,  255, false,
+                          ID_SPACE_STOP },
     &(gtfs_field_spec_t) {"stop_timezone",       TYPE_STRING,   64, false },
     &(gtfs_field_spec_t) {"wheelchair_boarding", TYPE_INTEGER,   0, false },
     
   },
 
+  /* The fields identifying each object: its stop ID */
+  1,
+  (unsigned int [1]) { 0 },
+
   /* SQL statements */
 
   /* Create the corresponding table in the database */
@@ -81,6 +87,10 @@ const gtfs_file_spec_t stops_file_spec = {
       "ON stops(code, id)",
     NULL
   },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  false,
 };
 
 #endif
@@ -0,0 +1,93 @@
+/* Specifies how the file "transfers.txt" within a GTFS bundle is to be
+   parsed and loaded into the database.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __TRANSFERS_H__
+#define __TRANSFERS_H__
+
+#include "gtfs_file.h"
+
+const gtfs_file_spec_t transfers_file_spec = {
+  /* The name of this GTFS object, both singular and plural forms */
+  { "transfer", "transfers" },
+
+  /* The filename within the GTFS bundle to load from */
+  "transfers.txt",
+
+  /* Whether the file is required to be present in a GTFS bundle or
+     not */
+  false,
+
+  /* Field definitions */
+  8,
+  (gtfs_field_spec_t *[8]) {
+    &(gtfs_field_spec_t) {"from_stop_id",      TYPE_STRING,  255, true,
+                          ID_SPACE_STOP },
+    &(gtfs_field_spec_t) {"to_stop_id",        TYPE_STRING,  255, true,
+                          ID_SPACE_STOP },
+    &(gtfs_field_spec_t) {"transfer_type",     TYPE_INTEGER,   0, false },
+    &(gtfs_field_spec_t) {"min_transfer_time", TYPE_INTEGER,   0, false },
+    &(gtfs_field_spec_t) {"from_route_id",     TYPE_STRING,  255, false,
+                          ID_SPACE_ROUTE },
+    &(gtfs_field_spec_t) {"to_route_id",       TYPE_STRING,  255, false,
+                          ID_SPACE_ROUTE },
+    &(gtfs_field_spec_t) {"from_trip_id",      TYPE_STRING,  255, false,
+                          ID_SPACE_TRIP },
+    &(gtfs_field_spec_t) {"to_trip_id",        TYPE_STRING,  255, false,
+                          ID_SPACE_TRIP }
+  },
+
+  /* The fields identifying each object: the stops, routes and trips it
+     connects */
+  6,
+  (unsigned int [6]) { 0, 1, 4, 5, 6, 7 },
+
+  /* SQL statements */
+
+  /* Create the corresponding table in the database */
+  "CREATE TABLE transfers("
+    "from_stop_id VARCHAR(255) NOT NULL REFERENCES stops(id), "
+    "to_stop_id VARCHAR(255) NOT NULL REFERENCES stops(id), "
+    "transfer_type TINYINT, "
+    "min_transfer_time INTEGER, "
+    "from_route_id VARCHAR(255) REFERENCES routes(id), "
+    "to_route_id VARCHAR(255) REFERENCES routes(id), "
+    "from_trip_id VARCHAR(255) REFERENCES trips(id), "
+    "to_trip_id VARCHAR(255) REFERENCES trips(id));",
+
+  /* Insert a new record into the database */
+  "INSERT INTO transfers(from_stop_id, to_stop_id, transfer_type, "
+    "min_transfer_time, from_route_id, to_route_id, from_trip_id, "
+    "to_trip_id) "
+    "VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
+
+  /* Define indices on the table for quick lookups */
+  (const char *[]) {
+    /* Allow fast look-ups by the stop transferred from */
+    "CREATE INDEX transfers_from_stop_id_index "
+      "ON transfers(from_stop_id, to_stop_id);",
+    NULL
+  },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  false,
+};
+
+#endif
@@ -23,6 +23,11 @@
 
 #include "gtfs_file.h"
 
+/* The numbers of the file's fields that are referred to by name */
+enum {
+  TRIP_ID
+};
+
 const gtfs_file_spec_t trips_file_spec = {
   /* The name of this GTFS object, both singular and plural forms */
   { "trip", "trips" },
@@ -37,9 +42,12 @@ const gtfs_file_spec_t trips_file_spec = {
   /* Field definitions */
   10,
   (gtfs_field_spec_t *[10]) {
-    &(gtfs_field_spec_t) {"trip_id",               TYPE_STRING,  255, true },
-    &(gtfs_field_spec_t) {"route_id",              TYPE_STRING,  255, true },
-    &(gtfs_field_spec_t) {"service_id",            TYPE_STRING,  255, true },
+    &(gtfs_field_spec_t) {"trip_id",               TYPE_STRING,  255, true,
+                          ID_SPACE_TRIP },
+    &(gtfs_field_spec_t) {"route_id",              TYPE_STRING,  255, true,
+                          ID_SPACE_ROUTE },
+    &(gtfs_field_spec_t) {"service_id",            TYPE_STRING,  255, true,
+                          ID_SPACE_SERVICE },
     &(gtfs_field_spec_t) {"trip_headsign",         TYPE_STRING,  255, false },
     &(gtfs_field_spec_t) {"trip_short_name",       TYPE_STRING,  255, false },
     &(gtfs_field_spec_t) {"direction_id",          TYPE_INTEGER,   0, false },
@@ -49,6 +57,10 @@ const gtfs_file_spec_t trips_file_spec = {
     &(gtfs_field_spec_t) {"bikes_allowed",         TYPE_INTEGER,   0, false }
   },
 
+  /* The fields identifying each object: its trip ID */
+  1,
+  (unsigned int [1]) { 0 },
+
   /* SQL statements */
 
   /* Create the corresponding table in the database */
@@ -74,6 +86,10 @@ const gtfs_file_spec_t trips_file_spec = {
   (const char *[]) {
     NULL
   },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered */
+  true,
 };
 
 #endif
@@ -0,0 +1,96 @@
+/* Specifies the walking_transfers table, which is not loaded from a
+   file within a GTFS bundle but derived from the stops once these are
+   loaded: each record is a transfer on foot from one stop to another
+   within a given distance of it, with the distance between them and
+   the time taken to walk it, so a journey planner reads the transfers
+   from a stop with a single range scan of the table's primary key
+   rather than searching for the stops nearby.
+
+   Copyright (c) 2012 Simon South <ssouth@simonsouth.com>.
+
+   This file is part of gtfs2db.
+
+   gtfs2db is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   gtfs2db is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with gtfs2db.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef __WALKING_TRANSFERS_H__
+#define __WALKING_TRANSFERS_H__
+
+#include "gtfs_file.h"
+
+/* The numbers of the table's fields, by which each transfer is built
+   up */
+enum {
+  WALKING_TRANSFER_FROM_STOP_ID,
+  WALKING_TRANSFER_TO_STOP_ID,
+  WALKING_TRANSFER_DISTANCE,
+  WALKING_TRANSFER_MIN_TRANSFER_TIME
+};
+
+const gtfs_file_spec_t walking_transfers_file_spec = {
+  /* The name of this GTFS object, both singular and plural forms */
+  { "walking transfer", "walking transfers" },
+
+  /* The filename within the GTFS bundle to load from---none, as the
+     table is derived from others */
+  NULL,
+
+  /* Whether the file is required to be present in a GTFS bundle or
+     not */
+  false,
+
+  /* Field definitions */
+  4,
+  (gtfs_field_spec_t *[4]) {
+    &(gtfs_field_spec_t) {"from_stop_id",      TYPE_STRING, 255, true,
+                          ID_SPACE_STOP },
+    &(gtfs_field_spec_t) {"to_stop_id",        TYPE_STRING, 255, true,
+                          ID_SPACE_STOP },
+    &(gtfs_field_spec_t) {"distance",          TYPE_DOUBLE,   0, true },
+    &(gtfs_field_spec_t) {"min_transfer_time", TYPE_INTEGER,  0, true }
+  },
+
+  /* The fields identifying each object: the stops it connects */
+  2,
+  (unsigned int [2]) { 0, 1 },
+
+  /* SQL statements */
+
+  /* Create the corresponding table in the database, always clustered
+     on the fields identifying each object */
+  "CREATE TABLE walking_transfers("
+    "from_stop_id VARCHAR(255) NOT NULL, "
+    "to_stop_id VARCHAR(255) NOT NULL, "
+    "distance DECIMAL NOT NULL, "
+    "min_transfer_time INTEGER NOT NULL, "
+    "PRIMARY KEY (from_stop_id, to_stop_id)) "
+    "WITHOUT ROWID;",
+
+  /* Insert a new record into the database */
+  "INSERT INTO walking_transfers(from_stop_id, to_stop_id, distance, "
+    "min_transfer_time) "
+    "VALUES (?, ?, ?, ?);",
+
+  /* Define indices on the table for quick lookups---none beyond its
+     primary key */
+  (const char *[]) {
+    NULL
+  },
+
+  /* Whether the table is clustered on the fields identifying each
+     object, when tables are clustered---it is regardless, by its own
+     CREATE statement */
+  false,
+};
+
+#endif